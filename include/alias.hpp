@@ -0,0 +1,25 @@
+#ifndef ALIAS_HPP_
+#define ALIAS_HPP_
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Lifetime of a resource that is never used; it may share memory with
+// anything.
+#define ALIAS_UNUSED UINT32_MAX
+
+// A resource to be placed in a shared memory block. first_use and
+// last_use are inclusive pass indices within a frame.
+struct alias_resource {
+  VkMemoryRequirements mem_reqs;
+  uint32_t first_use;
+  uint32_t last_use;
+  VkDeviceSize offset;
+};
+
+// Assigns an offset to every resource so that resources whose lifetimes
+// overlap never overlap in memory. Returns the size of the block needed.
+VkDeviceSize plan_aliasing(std::vector<alias_resource>& resources);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef COMMAND_RECORDER_HPP_
+#define COMMAND_RECORDER_HPP_
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Records binds and dynamic state into one command buffer, dropping the
+// calls that would set what is already bound. It shadows, per bind point,
+// the pipeline and each descriptor set with its dynamic offsets; and the
+// vertex and index buffers, push constants, viewports and scissors.
+//
+// Vertex buffer binds are only recorded by the next draw, so adjacent
+// bindings set one by one go down as a single vkCmdBindVertexBuffers.
+//
+// Every command that changes shadowed state must go through the recorder
+// between reset() and the end of the command buffer; anything recorded
+// around it calls invalidate(). Not thread safe, like the command buffer.
+class command_recorder {
+public:
+  command_recorder();
+
+  // After vkBeginCommandBuffer: nothing is bound
+  void reset(VkCommandBuffer command_buffer);
+  void invalidate();
+  VkCommandBuffer command_buffer() const;
+
+  void bind_pipeline(VkPipelineBindPoint bind_point, VkPipeline pipeline);
+  void bind_descriptor_sets(VkPipelineBindPoint bind_point,
+			    VkPipelineLayout layout,
+			    uint32_t first_set,
+			    uint32_t set_count,
+			    const VkDescriptorSet* sets,
+			    uint32_t dynamic_offset_count = 0,
+			    const uint32_t* dynamic_offsets = nullptr);
+  void bind_vertex_buffers(uint32_t first_binding,
+			   uint32_t binding_count,
+			   const VkBuffer* buffers,
+			   const VkDeviceSize* offsets);
+  void bind_index_buffer(VkBuffer buffer,
+			 VkDeviceSize offset,
+			 VkIndexType type);
+  void push_constants(VkPipelineLayout layout,
+		      VkShaderStageFlags stages,
+		      uint32_t offset,
+		      uint32_t size,
+		      const void* values);
+  void set_viewport(uint32_t first_viewport,
+		    uint32_t viewport_count,
+		    const VkViewport* new_viewports);
+  void set_scissor(uint32_t first_scissor,
+		   uint32_t scissor_count,
+		   const VkRect2D* new_scissors);
+
+  void draw(uint32_t vertex_count,
+	    uint32_t instance_count,
+	    uint32_t first_vertex,
+	    uint32_t first_instance);
+  void draw_indexed(uint32_t index_count,
+		    uint32_t instance_count,
+		    uint32_t first_index,
+		    int32_t vertex_offset,
+		    uint32_t first_instance);
+  void draw_indexed_indirect(VkBuffer buffer,
+			     VkDeviceSize offset,
+			     uint32_t draw_count,
+			     uint32_t stride);
+  void dispatch(uint32_t x, uint32_t y, uint32_t z);
+
+  // Binds and state changes asked for, and the calls that recorded them,
+  // since construction
+  uint64_t requested_count() const;
+  uint64_t recorded_count() const;
+
+private:
+  // VK_PIPELINE_BIND_POINT_GRAPHICS and _COMPUTE
+  static const uint32_t BIND_POINT_COUNT = 2;
+  // Bytes of push constants shadowed. The spec only guarantees 128, and
+  // some devices report more than this; pushes reaching past it are
+  // always recorded.
+  static const uint32_t MAX_PUSH_CONSTANTS = 256;
+
+  // Dynamic offsets cannot be split by set without the set layouts, so a
+  // set keeps the range and offsets of the call that bound it
+  struct bound_set {
+    VkPipelineLayout layout;
+    VkDescriptorSet set;
+    uint32_t first_set;
+    uint32_t set_count;
+    std::vector<uint32_t> dynamic_offsets;
+  };
+
+  struct bind_point_state {
+    VkPipeline pipeline;
+    std::vector<bound_set> sets;
+  };
+
+  // What was asked for, and what the command buffer has been given
+  struct vertex_binding {
+    bool set;
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    bool recorded;
+    VkBuffer recorded_buffer;
+    VkDeviceSize recorded_offset;
+  };
+
+  bool vertex_binding_dirty(const vertex_binding& b) const;
+
+  void flush_vertex_buffers();
+
+  VkCommandBuffer cmd;
+  bind_point_state bind_points[BIND_POINT_COUNT];
+  std::vector<vertex_binding> vertex_bindings;
+  bool index_bound;
+  VkBuffer index_buffer;
+  VkDeviceSize index_offset;
+  VkIndexType index_type;
+  VkPipelineLayout push_layout;
+  unsigned char push_data[MAX_PUSH_CONSTANTS];
+  // Stages each byte was last pushed for, 0 if unknown
+  VkShaderStageFlags push_stages[MAX_PUSH_CONSTANTS];
+  std::vector<VkViewport> viewports;
+  std::vector<bool> viewports_set;
+  std::vector<VkRect2D> scissors;
+  std::vector<bool> scissors_set;
+
+  // Scratch for flush_vertex_buffers()
+  std::vector<VkBuffer> run_buffers;
+  std::vector<VkDeviceSize> run_offsets;
+
+  uint64_t requested;
+  uint64_t recorded;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef COMPUTE_ENGINE_HPP_
+#define COMPUTE_ENGINE_HPP_
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <string>
+
+#include <vulkan/vulkan.h>
+
+// Kernels see storage buffers at set 0, bindings 0..buffer_count-1, and a
+// push constant block starting with this header:
+//
+//   uvec4 offset;  // element offset of this dispatch (xyz)
+//   uvec4 size;    // problem size (xyz); invocations past it must return
+//
+// followed by the kernel's own constants. A problem needing more
+// workgroups than the device allows in one dispatch is split, the offset
+// telling each part where it starts.
+#define COMPUTE_HEADER_SIZE        32
+
+#define COMPUTE_MAX_BINDINGS       16
+#define COMPUTE_MAX_SETS           256
+#define COMPUTE_BATCHES            2
+
+#define COMPUTE_NO_KERNEL          UINT32_MAX
+#define COMPUTE_NO_BUFFER          UINT32_MAX
+
+// Reads the LocalSize execution mode; kernels using LocalSizeId (spec
+// constants) are not supported
+bool spirv_local_size(const std::vector<uint32_t>& spirv, uint32_t size[3]);
+
+// Typed handle to an engine buffer of count elements of T
+template <typename T>
+struct compute_buffer {
+  uint32_t idx;
+  VkDeviceSize count;
+
+  VkDeviceSize size() const { return count * sizeof(T); }
+};
+
+// Records dispatches into a command buffer and submits them in batches:
+// nothing reaches the queue until submit(), which sends every dispatch
+// since the last one in a single vkQueueSubmit. While one batch runs the
+// next can be recorded.
+//
+// Dispatches and copies run in order; a barrier is only recorded before
+// one that uses a buffer an earlier one used since the last barrier, in
+// its own batch or the batch submitted before it.
+class compute_engine {
+public:
+  compute_engine(VkPhysicalDevice physical_device,
+		 VkDevice device,
+		 uint32_t queue_family_idx,
+		 VkQueue queue,
+		 std::mutex& queue_mutex,
+		 const VkAllocationCallbacks* alloc_callbacks);
+  ~compute_engine();
+
+  // The local size is read from the SPIR-V (LocalSize execution mode).
+  // push_constant_size excludes the header.
+  uint32_t add_kernel(const std::vector<uint32_t>& spirv,
+		      uint32_t buffer_count,
+		      uint32_t push_constant_size,
+		      const char* entry_point = "main");
+  uint32_t load_kernel(const std::string& filename,
+		       uint32_t buffer_count,
+		       uint32_t push_constant_size);
+  void local_size(uint32_t kernel, uint32_t size[3]) const;
+
+  // Host visible buffers stay mapped; others live in device local memory
+  uint32_t add_buffer(VkDeviceSize size, bool host_visible);
+  template <typename T>
+  compute_buffer<T> add_buffer(VkDeviceSize count, bool host_visible)
+  {
+    compute_buffer<T> buf = {add_buffer(count * sizeof(T), host_visible),
+			     count};
+    return buf;
+  }
+
+  VkBuffer buffer(uint32_t buf) const;
+  void* data(uint32_t buf) const;
+  template <typename T>
+  T* data(const compute_buffer<T>& buf) const
+  {
+    return static_cast<T*>(data(buf.idx));
+  }
+
+  // Records the kernel over a problem of x*y*z invocations
+  bool dispatch(uint32_t kernel,
+		const std::vector<uint32_t>& buffers,
+		const void* push_constants,
+		uint32_t x,
+		uint32_t y = 1,
+		uint32_t z = 1);
+
+  // Records a buffer to buffer copy, ordered like a dispatch
+  bool copy(uint32_t src, uint32_t dst, VkDeviceSize size);
+
+  void submit();
+  // Waits for every submitted batch
+  void wait();
+
+  uint64_t dispatch_count() const;
+  uint64_t submit_count() const;
+
+private:
+  struct kernel {
+    VkShaderModule module;
+    VkDescriptorSetLayout set_layout;
+    VkPipelineLayout layout;
+    VkPipeline pipeline;
+    uint32_t buffer_count;
+    uint32_t push_constant_size;
+    uint32_t local_size[3];
+  };
+
+  struct storage {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    void* data;
+  };
+
+  struct batch {
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    bool recording;
+    bool pending;
+    std::vector<bool> used;
+  };
+
+  uint32_t find_memory_type(uint32_t type_bits,
+			    VkMemoryPropertyFlags flags) const;
+  VkDescriptorSet descriptor_set(uint32_t kernel_idx,
+				 const std::vector<uint32_t>& buffers);
+  batch& begin_batch();
+  void order_after_batch(batch& b, const std::vector<uint32_t>& bufs);
+
+  VkDevice device;
+  VkQueue queue;
+  std::mutex& queue_mutex;
+  const VkAllocationCallbacks* alloc_callbacks;
+  VkPhysicalDeviceMemoryProperties mem_props;
+  VkPhysicalDeviceLimits limits;
+
+  VkCommandPool command_pool;
+  VkDescriptorPool descriptor_pool;
+  std::map<std::vector<uint32_t>, VkDescriptorSet> descriptor_sets;
+
+  std::vector<kernel> kernels;
+  std::vector<storage> buffers;
+  std::vector<batch> batches;
+  uint32_t cur_batch;
+
+  uint64_t dispatches;
+  uint64_t submits;
+};
+
+#endif
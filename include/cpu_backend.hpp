@@ -0,0 +1,126 @@
+#ifndef CPU_BACKEND_HPP_
+#define CPU_BACKEND_HPP_
+
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "compute_engine.hpp"
+#include "job_system.hpp"
+
+// What a host kernel sees of a dispatch: the compute_engine header, the
+// bound buffers and the kernel's own push constants
+struct cpu_dispatch {
+  uint32_t offset[4];
+  uint32_t size[4];
+  void* const* buffers;
+  const VkDeviceSize* buffer_sizes;
+  const void* push_constants;
+};
+
+// Runs invocations [begin, end), numbered x fastest, then y, then z
+typedef void (*cpu_kernel_fn)(const cpu_dispatch& d,
+			      uint64_t begin,
+			      uint64_t end);
+
+// Host counterparts of the kernels in src/shader, by name
+cpu_kernel_fn find_cpu_kernel(const std::string& name);
+
+// Stand-in for compute_engine without a GPU: the same calls, with kernels
+// replaced by host functions run across the job system. Kernels loaded by
+// file name get the built-in counterpart of that shader, so code written
+// against compute_engine runs unchanged.
+//
+// Like compute_engine nothing runs before submit(); dispatches and copies
+// then run in order. Integer kernels match the GPU bit for bit; float
+// kernels do too as long as the device does not fuse multiply-adds.
+class cpu_engine {
+public:
+  explicit cpu_engine(job_system& jobs);
+
+  // grain is the number of invocations per job
+  uint32_t add_kernel(cpu_kernel_fn fn,
+		      uint32_t buffer_count,
+		      uint32_t push_constant_size,
+		      uint32_t grain);
+  // Looks up the shader's name (the file name up to its first '.')
+  uint32_t load_kernel(const std::string& filename,
+		       uint32_t buffer_count,
+		       uint32_t push_constant_size);
+
+  // Every buffer is host memory; host_visible is accepted for symmetry
+  uint32_t add_buffer(VkDeviceSize size, bool host_visible);
+  template <typename T>
+  compute_buffer<T> add_buffer(VkDeviceSize count, bool host_visible)
+  {
+    compute_buffer<T> buf = {add_buffer(count * sizeof(T), host_visible),
+			     count};
+    return buf;
+  }
+
+  void* data(uint32_t buf) const;
+  template <typename T>
+  T* data(const compute_buffer<T>& buf) const
+  {
+    return static_cast<T*>(data(buf.idx));
+  }
+
+  bool dispatch(uint32_t kernel,
+		const std::vector<uint32_t>& buffers,
+		const void* push_constants,
+		uint32_t x,
+		uint32_t y = 1,
+		uint32_t z = 1);
+  // Passes first in the header's w words (offset.w the low word, size.w
+  // the high one) the way stream_compute passes a chunk's first element
+  bool dispatch_at(uint64_t first,
+		   uint32_t kernel,
+		   const std::vector<uint32_t>& buffers,
+		   const void* push_constants,
+		   uint32_t x,
+		   uint32_t y = 1,
+		   uint32_t z = 1);
+  bool copy(uint32_t src, uint32_t dst, VkDeviceSize size);
+
+  void submit();
+  void wait();
+
+  uint64_t dispatch_count() const;
+  uint64_t submit_count() const;
+
+private:
+  struct kernel {
+    cpu_kernel_fn fn;
+    uint32_t buffer_count;
+    uint32_t push_constant_size;
+    uint32_t grain;
+  };
+
+  // A recorded dispatch, or a copy when kernel is COMPUTE_NO_KERNEL
+  struct command {
+    uint32_t kernel;
+    std::vector<uint32_t> buffers;
+    std::vector<char> push_constants;
+    uint32_t size[3];
+    uint64_t first;
+    VkDeviceSize copy_size;
+  };
+
+  // 64 byte aligned so vector loads never split a cache line needlessly
+  struct storage {
+    std::vector<char> bytes;
+    char* data;
+    VkDeviceSize size;
+  };
+
+  job_system& jobs;
+  std::vector<kernel> kernels;
+  std::vector<storage> buffers;
+  std::vector<command> commands;
+
+  uint64_t dispatches;
+  uint64_t submits;
+};
+
+#endif
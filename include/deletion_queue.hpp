@@ -0,0 +1,76 @@
+#ifndef DELETION_QUEUE_HPP_
+#define DELETION_QUEUE_HPP_
+
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include <vulkan/vulkan.h>
+
+// Destroys objects once the GPU is done with them instead of idling the
+// device first. Each release is tagged with the value of the last
+// submission that may use the object: a frame number, or a timeline
+// semaphore value. retire() is then called with the highest value known
+// to have completed and destroys everything tagged at or below it, in
+// release order.
+//
+// Values only need to increase across retire() calls; releases may arrive
+// out of order and are kept sorted.
+class deletion_queue {
+public:
+  deletion_queue(VkDevice device,
+		 const VkAllocationCallbacks* alloc_callbacks);
+  // Destroys whatever is still queued, so the device must be idle
+  ~deletion_queue();
+
+  void destroy_buffer(VkBuffer buffer, uint64_t last_use);
+  void destroy_buffer_view(VkBufferView view, uint64_t last_use);
+  void destroy_image(VkImage image, uint64_t last_use);
+  void destroy_image_view(VkImageView view, uint64_t last_use);
+  void destroy_sampler(VkSampler sampler, uint64_t last_use);
+  void destroy_framebuffer(VkFramebuffer framebuffer, uint64_t last_use);
+  void destroy_pipeline(VkPipeline pipeline, uint64_t last_use);
+  void free_memory(VkDeviceMemory memory, uint64_t last_use);
+  // For anything else, e.g. returning a suballocation
+  void defer(std::function<void()> release, uint64_t last_use);
+
+  // Returns how many objects were destroyed
+  size_t retire(uint64_t completed);
+  size_t flush();
+
+  size_t pending() const;
+  uint64_t retired() const;
+
+private:
+  enum kind {
+    DELETE_BUFFER,
+    DELETE_BUFFER_VIEW,
+    DELETE_IMAGE,
+    DELETE_IMAGE_VIEW,
+    DELETE_SAMPLER,
+    DELETE_FRAMEBUFFER,
+    DELETE_PIPELINE,
+    DELETE_MEMORY,
+    DELETE_CALLBACK
+  };
+
+  // Non-dispatchable handles are 64 bits on every platform
+  struct entry {
+    uint64_t last_use;
+    kind type;
+    uint64_t handle;
+    std::function<void()> release;
+  };
+
+  void push(entry e);
+  void destroy(const entry& e);
+
+  VkDevice device;
+  const VkAllocationCallbacks* alloc_callbacks;
+
+  mutable std::mutex mutex;
+  std::deque<entry> entries;
+  uint64_t completed;
+};
+
+#endif
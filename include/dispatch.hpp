@@ -0,0 +1,76 @@
+#ifndef DISPATCH_HPP_
+#define DISPATCH_HPP_
+
+#include <vulkan/vulkan.h>
+
+// Entry points called while recording and submitting. Through vkd they go
+// straight to the driver instead of the loader's exported trampolines.
+#define DISPATCH_DEVICE_FUNCTIONS(X)		\
+  X(vkQueueSubmit)				\
+  X(vkQueueWaitIdle)				\
+  X(vkWaitForFences)				\
+  X(vkResetFences)				\
+  X(vkGetFenceStatus)				\
+  X(vkFlushMappedMemoryRanges)			\
+  X(vkInvalidateMappedMemoryRanges)		\
+  X(vkGetQueryPoolResults)			\
+  X(vkGetEventStatus)				\
+  X(vkResetEvent)				\
+  X(vkAllocateDescriptorSets)			\
+  X(vkUpdateDescriptorSets)			\
+  X(vkBeginCommandBuffer)			\
+  X(vkEndCommandBuffer)				\
+  X(vkResetCommandBuffer)			\
+  X(vkCmdBindPipeline)				\
+  X(vkCmdSetViewport)				\
+  X(vkCmdSetScissor)				\
+  X(vkCmdBindDescriptorSets)			\
+  X(vkCmdBindIndexBuffer)			\
+  X(vkCmdBindVertexBuffers)			\
+  X(vkCmdDraw)					\
+  X(vkCmdDrawIndexed)				\
+  X(vkCmdDrawIndexedIndirect)			\
+  X(vkCmdDispatch)				\
+  X(vkCmdCopyBuffer)				\
+  X(vkCmdCopyImage)				\
+  X(vkCmdCopyBufferToImage)			\
+  X(vkCmdCopyImageToBuffer)			\
+  X(vkCmdFillBuffer)				\
+  X(vkCmdClearColorImage)			\
+  X(vkCmdPipelineBarrier)			\
+  X(vkCmdResetQueryPool)			\
+  X(vkCmdWriteTimestamp)			\
+  X(vkCmdSetEvent)				\
+  X(vkCmdPushConstants)				\
+  X(vkCmdBeginRenderPass)			\
+  X(vkCmdEndRenderPass)				\
+  X(vkAcquireNextImageKHR)			\
+  X(vkQueuePresentKHR)
+
+#define DISPATCH_INSTANCE_FUNCTIONS(X)		\
+  X(vkGetDeviceProcAddr)
+
+#define DISPATCH_MEMBER(name) PFN_##name name;
+
+struct device_dispatch {
+  DISPATCH_DEVICE_FUNCTIONS(DISPATCH_MEMBER)
+};
+
+struct instance_dispatch {
+  DISPATCH_INSTANCE_FUNCTIONS(DISPATCH_MEMBER)
+};
+
+// Both start out pointing at the loader's exports, so calls through them
+// work before anything is loaded, and a function the driver does not
+// return (such as one from an extension that is not enabled) keeps its
+// export. The tables are process wide: load them for the one device the
+// program records on.
+extern instance_dispatch vki;
+extern device_dispatch vkd;
+
+// After vkCreateInstance
+void load_instance_dispatch(VkInstance instance);
+// After vkCreateDevice; returns how many functions kept the export
+unsigned int load_device_dispatch(VkDevice device);
+
+#endif
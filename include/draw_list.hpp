@@ -0,0 +1,78 @@
+#ifndef DRAW_LIST_HPP_
+#define DRAW_LIST_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "command_recorder.hpp"
+#include "job_system.hpp"
+
+// Fields of a draw's sort key, most significant first, so a sorted list
+// changes pass least often and depth most often
+#define DRAW_KEY_PASS_BITS      4
+#define DRAW_KEY_PIPELINE_BITS  10
+#define DRAW_KEY_MATERIAL_BITS  16
+#define DRAW_KEY_MESH_BITS      10
+#define DRAW_KEY_DEPTH_BITS     24
+
+// Fields wider than their bits are truncated
+uint64_t draw_key(uint32_t pass,
+		  uint32_t pipeline,
+		  uint32_t material,
+		  uint32_t mesh,
+		  uint32_t depth);
+uint32_t draw_key_pass(uint64_t key);
+uint32_t draw_key_pipeline(uint64_t key);
+uint32_t draw_key_material(uint64_t key);
+uint32_t draw_key_mesh(uint64_t key);
+// View depth in [near_z, far_z] as a key depth; near first unless
+// back_to_front, for blending. Depths outside the range are clamped to it,
+// and NaN or an empty range gives the near end.
+uint32_t draw_depth(float depth, float near_z, float far_z,
+		    bool back_to_front = false);
+
+// The payload is the caller's, e.g. an index into its own draw data
+struct draw_command {
+  uint64_t key;
+  uint32_t payload;
+};
+
+// Draws collected in any order, then radix sorted by key and replayed
+// through a command recorder, so draws sharing a pipeline, material or
+// mesh run back to back and their binds are dropped. Draws with equal
+// keys keep the order they were added in.
+class draw_list {
+public:
+  typedef std::function<void(uint64_t begin,
+			     uint64_t end,
+			     std::vector<draw_command>& draws)> build_fn;
+  typedef std::function<void(command_recorder& recorder,
+			     const draw_command& draw)> replay_fn;
+
+  void clear();
+  void add(uint64_t key, uint32_t payload);
+  // Calls fn over [0, count) in ranges of at most grain indices, on the
+  // job system's threads if given. Each range appends to a list of its
+  // own; the lists are added in range order.
+  void build(job_system* jobs,
+	     uint64_t count,
+	     uint64_t grain,
+	     const build_fn& fn);
+
+  void sort();
+  // fn records the binds and the draw of each command, in key order
+  void replay(command_recorder& recorder, const replay_fn& fn) const;
+
+  size_t size() const;
+  const std::vector<draw_command>& commands() const;
+
+private:
+  std::vector<draw_command> draws;
+
+  // Scratch, kept to avoid reallocating each frame
+  std::vector<std::vector<draw_command>> ranges;
+  std::vector<draw_command> sorted;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef GPU_PROFILER_HPP_
+#define GPU_PROFILER_HPP_
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <string>
+#include <ostream>
+
+#include <vulkan/vulkan.h>
+
+#define GPU_PROFILER_MAX_SCOPES  64
+#define GPU_PROFILER_HISTORY     128
+#define GPU_PROFILER_MAX_EVENTS  100000
+
+#define GPU_PROFILER_NO_SCOPE    UINT32_MAX
+
+struct gpu_scope_stats {
+  double last_ms;
+  double avg_ms;
+  double min_ms;
+  double max_ms;
+  uint32_t samples;
+};
+
+// Times command buffer regions with vkCmdWriteTimestamp. Each frame in
+// flight owns a query pool; begin_frame() reads back the pool it is about
+// to reuse without waiting, and skips profiling that frame if the GPU has
+// not finished with it yet. The pool is reset on the GPU, so a frame is
+// only read once an event recorded after the reset has been set; until
+// then the availability bits still belong to the pool's previous use.
+//
+// Scopes are also forwarded to the CPU tracer. The GPU clock is not
+// calibrated against the CPU one, so each frame's GPU work is placed at
+// the time its recording began (or after the previous frame's GPU work,
+// if later); spacing within a frame is exact.
+class gpu_profiler {
+public:
+  gpu_profiler(VkPhysicalDevice physical_device,
+	       VkDevice device,
+	       uint32_t queue_family_idx,
+	       uint32_t frames_in_flight,
+	       const VkAllocationCallbacks* alloc_callbacks);
+  ~gpu_profiler();
+
+  bool supported() const;
+
+  // Must be recorded outside a render pass, before any scope of the frame
+  void begin_frame(VkCommandBuffer command_buffer);
+  // Leaves the frame being recorded untimed, e.g. one recorded once into a
+  // command buffer that is then resubmitted
+  void skip_frame();
+  uint32_t begin_scope(VkCommandBuffer command_buffer,
+		       const std::string& name);
+  void end_scope(VkCommandBuffer command_buffer, uint32_t scope);
+
+  // Picks up every finished frame without blocking. Call between frames,
+  // not while recording one.
+  void collect();
+
+  bool stats(const std::string& name, gpu_scope_stats& out) const;
+  void print_stats(std::ostream& out) const;
+  uint32_t dropped_frames() const;
+
+  // Chrome trace event format, viewable in chrome://tracing or Perfetto
+  bool write_trace(const std::string& filename) const;
+
+private:
+  struct frame {
+    VkQueryPool pool;
+    VkEvent reset;
+    std::vector<std::string> names;
+    uint64_t index;
+    uint64_t cpu_begin_ns;
+    bool pending;
+  };
+
+  struct history {
+    std::deque<double> samples;
+    double last_ms;
+  };
+
+  struct trace_event {
+    std::string name;
+    uint64_t frame;
+    double start_us;
+    double duration_us;
+  };
+
+  bool read_back(frame& f);
+
+  VkDevice device;
+  const VkAllocationCallbacks* alloc_callbacks;
+  double timestamp_period;
+  uint64_t timestamp_mask;
+  bool timestamps;
+
+  std::vector<frame> frames;
+  uint64_t frame_count;
+  frame* recording;
+  uint32_t dropped;
+
+  bool have_origin;
+  uint64_t origin;
+  uint64_t last_cpu_end_ns;
+  std::map<std::string, history> histories;
+  std::vector<trace_event> events;
+};
+
+// Times the commands recorded during its lifetime
+class gpu_scope {
+public:
+  gpu_scope(gpu_profiler& profiler,
+	    VkCommandBuffer command_buffer,
+	    const std::string& name);
+  ~gpu_scope();
+
+private:
+  gpu_profiler& profiler;
+  VkCommandBuffer command_buffer;
+  uint32_t scope;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef JOB_SYSTEM_HPP_
+#define JOB_SYSTEM_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Splits loops into ranges run on a fixed set of worker threads. The
+// calling thread takes ranges too, and parallel_for() returns once the
+// whole loop is done. One loop runs at a time; concurrent callers queue.
+class job_system {
+public:
+  typedef std::function<void(uint64_t begin, uint64_t end)> range_fn;
+
+  // 0 workers means one per hardware thread besides the caller
+  explicit job_system(unsigned int workers = 0);
+  ~job_system();
+
+  // Calls fn over [0, count) in ranges of at most grain indices
+  void parallel_for(uint64_t count, uint64_t grain, const range_fn& fn);
+
+  // Workers plus the calling thread
+  unsigned int thread_count() const;
+
+private:
+  void run();
+  void work();
+
+  std::vector<std::thread> threads;
+  std::mutex loop_mutex;
+
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable finished;
+  uint64_t generation;
+  unsigned int busy;
+  bool stopping;
+
+  const range_fn* fn;
+  uint64_t count;
+  uint64_t grain;
+  std::atomic<uint64_t> next;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef LOG_HPP_
+#define LOG_HPP_
+
+#include <string>
+#include <sstream>
+#include <streambuf>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE  4
+
+// Messages below this level are removed by the preprocessor
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Messages per thread waiting for the writer; when full, new messages are
+// dropped (and counted) rather than blocking the caller
+#define LOG_QUEUE_SIZE  4096
+#define LOG_FLUSH_MS    50
+
+bool log_start(const std::string& filename);
+// Writes everything still queued and closes the file
+void log_stop();
+
+void log_write(int level, std::string&& message);
+
+// Turns each line written through it into an info message. Installed as
+// std::cout's buffer so existing output goes through the writer thread.
+std::streambuf* log_stream_buffer();
+
+class log_line {
+public:
+  explicit log_line(int level) : level(level) {}
+  ~log_line() { log_write(level, stream.str()); }
+
+  std::ostringstream stream;
+
+private:
+  int level;
+};
+
+#define LOG_AT(LEVEL, MESSAGE)			\
+  do {						\
+    log_line log_line_(LEVEL);			\
+    log_line_.stream << MESSAGE;		\
+  } while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(MESSAGE) LOG_AT(LOG_LEVEL_DEBUG, MESSAGE)
+#else
+#define LOG_DEBUG(MESSAGE) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(MESSAGE) LOG_AT(LOG_LEVEL_INFO, MESSAGE)
+#else
+#define LOG_INFO(MESSAGE) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(MESSAGE) LOG_AT(LOG_LEVEL_WARN, MESSAGE)
+#else
+#define LOG_WARN(MESSAGE) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(MESSAGE) LOG_AT(LOG_LEVEL_ERROR, MESSAGE)
+#else
+#define LOG_ERROR(MESSAGE) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef MAPPED_MEMORY_HPP_
+#define MAPPED_MEMORY_HPP_
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// A persistently mapped, host visible allocation that remembers which
+// bytes the host wrote. flush() hands only those to
+// vkFlushMappedMemoryRanges, each range widened to whole
+// nonCoherentAtomSize atoms and overlapping or touching ranges merged, so
+// memory types without HOST_COHERENT cost one call per submission.
+// Coherent memory keeps no ranges and never flushes.
+//
+// Not thread safe; callers serialise access as they do for the memory.
+class mapped_memory {
+public:
+  // Maps the whole allocation, which must be size bytes of memory_type
+  mapped_memory(VkPhysicalDevice physical_device,
+		VkDevice device,
+		VkDeviceMemory memory,
+		uint32_t memory_type,
+		VkDeviceSize size);
+  // Unmaps; anything not flushed is lost
+  ~mapped_memory();
+
+  bool valid() const;
+  bool coherent() const;
+
+  // Writes through it must be passed to mark_dirty()
+  char* data();
+  void write(VkDeviceSize offset, const void* src, VkDeviceSize length);
+  void mark_dirty(VkDeviceSize offset, VkDeviceSize length);
+  VkResult flush();
+
+  // Invalidates the range, so device writes that have completed are seen.
+  // Flushes first, as invalidation would drop host writes not yet flushed.
+  const char* read(VkDeviceSize offset, VkDeviceSize length);
+
+  // Bytes handed to vkFlushMappedMemoryRanges so far, after rounding
+  VkDeviceSize flushed_bytes() const;
+  uint64_t flush_count() const;
+
+private:
+  // In whole atoms, [begin, end)
+  struct range {
+    VkDeviceSize begin;
+    VkDeviceSize end;
+  };
+
+  VkMappedMemoryRange mapped_range(const range& r) const;
+
+  VkDevice device;
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  VkDeviceSize atom_size;
+  bool is_coherent;
+  char* mapped;
+
+  // Sorted and disjoint
+  std::vector<range> dirty;
+  std::vector<VkMappedMemoryRange> ranges;
+  VkDeviceSize flushed;
+  uint64_t flushes;
+};
+
+#endif
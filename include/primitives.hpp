@@ -0,0 +1,72 @@
+#ifndef PRIMITIVES_HPP_
+#define PRIMITIVES_HPP_
+
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "compute_engine.hpp"
+
+// Matches WG_SIZE and ITEMS in src/shader/primitives.glsl
+#define PRIMITIVES_WG_SIZE  256
+#define PRIMITIVES_BLOCK    (PRIMITIVES_WG_SIZE * 4)
+#define PRIMITIVES_RADIX    16
+
+// Parallel scan, reduce, compaction and radix sort over uint32 data in
+// compute_engine buffers. Each call only records dispatches into the
+// engine's current batch; results are there after submit() and wait().
+//
+// Kernels using subgroup operations are picked when the instance and
+// device are Vulkan 1.1 and the device supports basic and arithmetic
+// subgroup operations in compute shaders.
+class gpu_primitives {
+public:
+  // Scratch space is sized for max_elements
+  gpu_primitives(compute_engine& engine,
+		 VkPhysicalDevice physical_device,
+		 uint32_t instance_api_version,
+		 const std::string& shader_dir,
+		 uint32_t max_elements);
+
+  bool valid() const;
+  bool subgroups() const;
+
+  // out[0] = sum of in[0..n)
+  void reduce(uint32_t in, uint32_t n, uint32_t out);
+  // in and out may be the same buffer
+  void scan(uint32_t in, uint32_t out, uint32_t n, bool inclusive);
+  // Keeps values[i] where flags[i] != 0, in order; count[0] = kept
+  void compact(uint32_t values, uint32_t flags, uint32_t n,
+	       uint32_t out, uint32_t count);
+  // Stable sort by 32 or 64 bit keys (64 bit keys as low, high words),
+  // values carried along. Sorted in place.
+  void sort(uint32_t keys, uint32_t values, uint32_t n, uint32_t key_bits);
+
+private:
+  void scan_level(uint32_t in, uint32_t out, uint32_t n,
+		  bool inclusive, bool flags, uint32_t level);
+  void dispatch(uint32_t kernel, const std::vector<uint32_t>& buffers,
+		uint32_t invocations, uint32_t n,
+		uint32_t a = 0, uint32_t b = 0);
+
+  compute_engine& engine;
+  bool use_subgroups;
+  uint32_t max_elements;
+
+  uint32_t reduce_kernel;
+  uint32_t scan_kernel;
+  uint32_t scan_add_kernel;
+  uint32_t compact_kernel;
+  uint32_t radix_count_kernel;
+  uint32_t radix_scatter_kernel;
+
+  // Block totals, one buffer per level of the scan and reduce trees
+  std::vector<uint32_t> block_sums;
+  uint32_t positions;
+  uint32_t sort_keys;
+  uint32_t sort_values;
+  uint32_t digit_counts;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef QUEUE_SCHEDULER_HPP_
+#define QUEUE_SCHEDULER_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "submit_batch.hpp"
+
+enum queue_class {
+  QUEUE_CLASS_MAIN,      // the family the application chose (presents)
+  QUEUE_CLASS_COMPUTE,   // async compute
+  QUEUE_CLASS_TRANSFER,  // copies
+  QUEUE_CLASS_COUNT
+};
+
+// The family serving each class, and every family to create queues on
+struct queue_plan {
+  uint32_t family[QUEUE_CLASS_COUNT];
+  std::vector<uint32_t> families;
+};
+
+// Compute prefers a family with compute but no graphics, transfer one with
+// neither; a class without such a family shares the main one. Families
+// are created with all their queues.
+queue_plan plan_queues(const std::vector<VkQueueFamilyProperties>& families,
+		       uint32_t main_family);
+void queue_create_infos(const queue_plan& plan,
+			const std::vector<VkQueueFamilyProperties>& families,
+			std::vector<float>& priorities,
+			std::vector<VkDeviceQueueCreateInfo>& infos);
+
+struct scheduled_queue {
+  uint32_t family;
+  VkQueue queue;
+  std::mutex* mutex;
+  submit_batch* batch;
+};
+
+// Returned by submit(). If it was asked to signal, exactly one later
+// submission must wait on it before end_frame().
+struct queue_ticket {
+  submit_batch* batch;
+  VkSemaphore semaphore;
+};
+
+// Spreads independent submissions over the queues of each class. The
+// first queue of the main family is kept for the main class alone, so
+// presentation and frame waits see one queue; compute and transfer take
+// the queues of their families, or the main family's other queues when
+// they share it, round-robin.
+//
+// Work on different queues is ordered with binary semaphores: a
+// submission waiting on a ticket from another queue first flushes that
+// queue's batch, so the signal is always submitted before the wait.
+class queue_scheduler {
+public:
+  queue_scheduler(VkDevice device,
+		  const queue_plan& plan,
+		  const std::vector<scheduled_queue>& queues,
+		  const VkAllocationCallbacks* alloc_callbacks);
+  ~queue_scheduler();
+
+  uint32_t family(queue_class c) const;
+  uint32_t queue_count(queue_class c) const;
+  // Queues of the class distinct from the main queue, i.e. work on them
+  // can overlap the main queue's
+  bool concurrent(queue_class c) const;
+
+  // The next queue of the class, for components that submit on their own
+  const scheduled_queue& pick(queue_class c);
+
+  queue_ticket submit(queue_class c,
+		      const VkCommandBuffer* command_buffers,
+		      uint32_t command_buffer_count,
+		      const queue_ticket* waits,
+		      const VkPipelineStageFlags* wait_stages,
+		      uint32_t wait_count,
+		      bool signal,
+		      VkFence fence = VK_NULL_HANDLE);
+
+  VkResult flush();
+  VkResult wait_idle();
+  // Every submission so far has completed; recycles the semaphores
+  void end_frame();
+
+private:
+  struct lane_set {
+    std::vector<uint32_t> lanes;
+    std::atomic<uint32_t> next;
+  };
+
+  VkSemaphore acquire_semaphore();
+
+  VkDevice device;
+  const VkAllocationCallbacks* alloc_callbacks;
+  queue_plan plan;
+  std::vector<scheduled_queue> lanes;
+  lane_set classes[QUEUE_CLASS_COUNT];
+
+  std::mutex semaphore_mutex;
+  std::vector<VkSemaphore> free_semaphores;
+  std::vector<VkSemaphore> used_semaphores;
+};
+
+#endif
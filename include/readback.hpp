@@ -0,0 +1,112 @@
+#ifndef READBACK_HPP_
+#define READBACK_HPP_
+
+#include <deque>
+#include <vector>
+#include <future>
+#include <functional>
+
+#include <vulkan/vulkan.h>
+
+// Data is only valid for the duration of the call
+typedef std::function<void(const char* data, VkDeviceSize size)>
+readback_callback;
+
+// Copies buffer and image regions into a persistently mapped host buffer
+// used as a ring. Reads are queued, recorded into the caller's command
+// buffer by record(), and delivered once the fence returned by record()
+// has signalled; poll() never blocks, so results of frame N are picked up
+// while frame N+1 runs.
+//
+// Requests that do not fit in the ring this frame stay queued for the next
+// one. A request larger than the whole ring is refused.
+class readback_ring {
+public:
+  readback_ring(VkPhysicalDevice physical_device,
+		VkDevice device,
+		VkDeviceSize size,
+		uint32_t frames_in_flight,
+		const VkAllocationCallbacks* alloc_callbacks);
+  ~readback_ring();
+
+  bool valid() const;
+
+  bool read_buffer(VkBuffer buffer,
+		   VkDeviceSize offset,
+		   VkDeviceSize size,
+		   readback_callback callback);
+  std::future<std::vector<char>> read_buffer(VkBuffer buffer,
+					     VkDeviceSize offset,
+					     VkDeviceSize size);
+
+  // The image must be in layout (TRANSFER_SRC_OPTIMAL or GENERAL) when the
+  // copies execute. region.bufferOffset is ignored and rows are tightly
+  // packed, so size is the extent times the texel size.
+  bool read_image(VkImage image,
+		  VkImageLayout layout,
+		  const VkBufferImageCopy& region,
+		  VkDeviceSize size,
+		  readback_callback callback);
+  std::future<std::vector<char>> read_image(VkImage image,
+					    VkImageLayout layout,
+					    const VkBufferImageCopy& region,
+					    VkDeviceSize size);
+
+  // Records the queued copies (outside a render pass) and returns the fence
+  // the submission of command_buffer must signal, or VK_NULL_HANDLE if
+  // nothing was recorded
+  VkFence record(VkCommandBuffer command_buffer);
+
+  // Delivers every finished frame without blocking
+  void poll();
+  // Waits for every recorded frame, then delivers it
+  void flush();
+
+  uint32_t queued() const;
+  uint32_t in_flight() const;
+
+private:
+  struct request {
+    VkBuffer buffer;
+    VkImage image;
+    VkImageLayout layout;
+    VkBufferCopy buffer_copy;
+    VkBufferImageCopy image_copy;
+    VkDeviceSize size;
+    VkDeviceSize ring_offset;
+    readback_callback callback;
+  };
+
+  struct frame {
+    VkFence fence;
+    uint64_t end;
+    std::vector<request> requests;
+    bool pending;
+  };
+
+  uint32_t find_memory_type(uint32_t type_bits,
+			    VkMemoryPropertyFlags flags) const;
+  bool allocate(VkDeviceSize size, VkDeviceSize& ring_offset);
+  void deliver(frame& f);
+
+  VkDevice device;
+  const VkAllocationCallbacks* alloc_callbacks;
+  VkPhysicalDeviceMemoryProperties mem_props;
+  VkDeviceSize atom_size;
+
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  char* data;
+  bool coherent;
+
+  // Monotonic byte positions; the ring offset is position % size
+  uint64_t head;
+  uint64_t tail;
+
+  std::deque<request> requests;
+  std::vector<frame> frames;
+  uint32_t next_frame;
+};
+
+#endif
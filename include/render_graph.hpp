@@ -0,0 +1,201 @@
+#ifndef RENDER_GRAPH_HPP_
+#define RENDER_GRAPH_HPP_
+
+#include <vector>
+#include <string>
+#include <functional>
+
+#include <vulkan/vulkan.h>
+
+// How a pass uses a resource. Each maps to the exact stages, access mask
+// and (for images) layout used when building barriers.
+enum rg_access {
+  RG_TRANSFER_READ,
+  RG_TRANSFER_WRITE,
+  RG_COLOR_ATTACHMENT_WRITE,
+  RG_DEPTH_STENCIL_ATTACHMENT_WRITE,
+  RG_FRAGMENT_SHADER_READ,
+  RG_COMPUTE_SHADER_READ,
+  RG_COMPUTE_SHADER_WRITE,
+  RG_VERTEX_BUFFER_READ,
+  RG_INDEX_BUFFER_READ,
+  RG_INDIRECT_BUFFER_READ,
+  RG_UNIFORM_BUFFER_READ,
+  RG_COMPUTE_UNIFORM_BUFFER_READ,
+  RG_HOST_READ,
+  RG_HOST_WRITE
+};
+
+struct rg_access_info {
+  VkPipelineStageFlags stages;
+  VkAccessFlags access;
+  VkImageLayout layout;
+  bool write;
+};
+
+const rg_access_info& get_access_info(rg_access access);
+
+// How a frame split over two queues has to be submitted. The prologue and
+// main command buffers go to the main queue, the async one to the async
+// queue, in the order prologue, async, main.
+struct rg_async_split {
+  // The prologue releases resources to the async family; if it is used,
+  // the async submission waits on it at async_wait_stages
+  bool prologue;
+  VkPipelineStageFlags async_wait_stages;
+  // If the async command buffer is used, the main submission waits on it
+  // at main_wait_stages
+  bool async;
+  VkPipelineStageFlags main_wait_stages;
+};
+
+// A frame graph. Resources are registered once and keep their
+// synchronization state across frames; passes are added every frame,
+// then compile() culls passes whose results are never consumed and
+// execute() records the survivors with one batched barrier per pass.
+// Passes may also be moved to a second queue, with queue family ownership
+// of their resources transferred there and back.
+class render_graph {
+public:
+  render_graph();
+
+  uint32_t add_image(VkImage image,
+		     VkImageAspectFlags aspect,
+		     VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED,
+		     VkPipelineStageFlags initial_stages =
+		     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+  uint32_t add_buffer(VkBuffer buffer);
+
+  // Hands the resource to something outside the graph (e.g. presentation)
+  // at the end of every frame. Its state then reverts to the initial one.
+  void export_image(uint32_t resource,
+		    VkImageLayout layout,
+		    VkPipelineStageFlags stages,
+		    VkAccessFlags access);
+
+  uint32_t add_pass(const std::string& name,
+		    std::function<void(VkCommandBuffer)> record);
+  void read(uint32_t pass, uint32_t resource, rg_access access);
+  void write(uint32_t pass, uint32_t resource, rg_access access);
+  void set_side_effect(uint32_t pass);
+
+  // Lets passes marked async run on a queue of async_family, which may be
+  // the main family if it has a second queue. compile() moves such a pass
+  // there when timing reports it takes at least min_ms on the GPU; until
+  // it has been measured, or if it is too short to be worth the
+  // semaphores, it stays on the main queue.
+  void set_async_queue(uint32_t main_family,
+		       uint32_t async_family,
+		       double min_ms,
+		       std::function<bool(const std::string&, double&)> timing);
+  void set_async(uint32_t pass);
+
+  void compile();
+  void execute(VkCommandBuffer command_buffer);
+  // Once an async queue is set, frames have to be recorded with this one,
+  // as resources may still belong to the async family from earlier frames.
+  // Ordering against the previous frame is left to the caller.
+  void execute(VkCommandBuffer prologue_command_buffer,
+	       VkCommandBuffer command_buffer,
+	       VkCommandBuffer async_command_buffer,
+	       rg_async_split& split);
+  void clear_passes();
+
+  uint32_t pass_count() const;
+  uint32_t culled_pass_count() const;
+  uint32_t async_pass_count() const;
+  uint32_t barrier_count() const;
+
+private:
+  struct resource_state {
+    bool is_image;
+    VkImage image;
+    VkBuffer buffer;
+    VkImageAspectFlags aspect;
+    VkImageLayout initial_layout;
+    VkPipelineStageFlags initial_stages;
+
+    VkImageLayout layout;
+    VkPipelineStageFlags write_stages;
+    VkAccessFlags write_access;
+    VkPipelineStageFlags read_stages;
+    VkPipelineStageFlags visible_stages;
+    VkAccessFlags visible_access;
+    bool used;
+    bool async_owned;
+
+    bool exported;
+    VkImageLayout export_layout;
+    VkPipelineStageFlags export_stages;
+    VkAccessFlags export_access;
+  };
+
+  struct resource_use {
+    uint32_t resource;
+    rg_access_info info;
+    bool read;
+  };
+
+  struct pass {
+    std::string name;
+    std::function<void(VkCommandBuffer)> record;
+    std::vector<resource_use> uses;
+    bool side_effect;
+    bool culled;
+    bool async;
+    bool on_async;
+  };
+
+  struct barrier_batch {
+    VkPipelineStageFlags src_stages;
+    VkPipelineStageFlags dst_stages;
+    VkAccessFlags src_memory_access;
+    VkAccessFlags dst_memory_access;
+    std::vector<VkBufferMemoryBarrier> buffer_barriers;
+    std::vector<VkImageMemoryBarrier> image_barriers;
+  };
+
+  void add_use(pass& p,
+	       uint32_t resource,
+	       const rg_access_info& info,
+	       bool is_read);
+  void reset_state(resource_state& res);
+  void transition(resource_state& res,
+		  const rg_access_info& info,
+		  barrier_batch& batch);
+  bool hand_over(resource_state& res,
+		 const resource_use& use,
+		 uint32_t src_family,
+		 uint32_t dst_family,
+		 barrier_batch& releases,
+		 barrier_batch& acquires);
+  void add_image_barrier(resource_state& res,
+			 VkAccessFlags src_access,
+			 VkAccessFlags dst_access,
+			 VkImageLayout new_layout,
+			 barrier_batch& batch,
+			 uint32_t src_family = VK_QUEUE_FAMILY_IGNORED,
+			 uint32_t dst_family = VK_QUEUE_FAMILY_IGNORED);
+  void add_buffer_barrier(resource_state& res,
+			  VkAccessFlags src_access,
+			  VkAccessFlags dst_access,
+			  uint32_t src_family,
+			  uint32_t dst_family,
+			  barrier_batch& batch);
+  void export_resources(VkCommandBuffer command_buffer);
+  void flush(VkCommandBuffer command_buffer, barrier_batch& batch);
+
+  std::vector<resource_state> resources;
+  std::vector<pass> passes;
+  uint32_t culled;
+  uint32_t barriers;
+
+  bool async_enabled;
+  uint32_t main_family;
+  uint32_t async_family;
+  double async_min_ms;
+  std::function<bool(const std::string&, double&)> async_timing;
+  uint32_t async_passes;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef RESOURCE_POOL_HPP_
+#define RESOURCE_POOL_HPP_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+
+// Refers to one slot of a resource_pool. The generation is odd while the
+// slot is live and bumped on destroy, so a handle outliving its resource
+// no longer matches and lookups through it fail instead of reading
+// whatever took the slot next. The all-zero handle is never live.
+template <typename Tag>
+struct pool_handle {
+  uint32_t index;
+  uint32_t generation;
+
+  bool null() const { return generation == 0; }
+  bool operator==(const pool_handle& other) const
+  {
+    return index == other.index && generation == other.generation;
+  }
+  bool operator!=(const pool_handle& other) const
+  {
+    return !(*this == other);
+  }
+};
+
+#define POOL_NO_SLOT UINT32_MAX
+
+// Fixed capacity pool of resources stored as one array per field, so a
+// loop over e.g. memory requirements touches only those. Creation and
+// destruction pop and push a lock-free free list; lookups are a
+// generation compare. Fields of a slot are not synchronized: a resource
+// is written by whoever created it before its handle is shared.
+template <typename Tag, typename... Fields>
+class resource_pool {
+public:
+  typedef pool_handle<Tag> handle;
+
+  template <size_t I>
+  using field = typename std::tuple_element<I, std::tuple<Fields...>>::type;
+
+  explicit resource_pool(uint32_t capacity)
+    : slots(capacity),
+      generations(new std::atomic<uint32_t>[capacity]),
+      next(new std::atomic<uint32_t>[capacity]),
+      columns(std::unique_ptr<Fields[]>(new Fields[capacity]())...),
+      live(0)
+  {
+    // Slots are handed out lowest index first
+    for (uint32_t i = 0; i != capacity; i++) {
+      generations[i].store(0, std::memory_order_relaxed);
+      next[i].store(i + 1 == capacity ? POOL_NO_SLOT : i + 1,
+		    std::memory_order_relaxed);
+    }
+    head.store(capacity == 0 ? POOL_NO_SLOT : 0, std::memory_order_release);
+  }
+
+  // Returns a null handle when the pool is full
+  handle create(const Fields&... values)
+  {
+    handle h = {};
+    uint32_t idx = pop();
+    if (idx == POOL_NO_SLOT)
+      return h;
+    assign<0>(idx, values...);
+    h.index = idx;
+    h.generation = generations[idx].load(std::memory_order_relaxed) + 1;
+    generations[idx].store(h.generation, std::memory_order_release);
+    live.fetch_add(1, std::memory_order_relaxed);
+    return h;
+  }
+
+  // False if the handle was already destroyed (or never created here)
+  bool destroy(handle h)
+  {
+    if (h.index >= slots)
+      return false;
+    uint32_t expected = h.generation;
+    if (h.null() || !generations[h.index].compare_exchange_strong(
+	  expected, h.generation + 1, std::memory_order_acq_rel))
+      return false;
+    push(h.index);
+    live.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool alive(handle h) const
+  {
+    return h.index < slots && !h.null()
+      && generations[h.index].load(std::memory_order_acquire) == h.generation;
+  }
+
+  // Unchecked in release builds; for loops over handles known to be live
+  template <size_t I>
+  field<I>& get(handle h)
+  {
+    assert(alive(h));
+    return std::get<I>(columns)[h.index];
+  }
+
+  template <size_t I>
+  const field<I>& get(handle h) const
+  {
+    assert(alive(h));
+    return std::get<I>(columns)[h.index];
+  }
+
+  // Null if the handle is stale
+  template <size_t I>
+  field<I>* find(handle h)
+  {
+    return alive(h) ? &std::get<I>(columns)[h.index] : nullptr;
+  }
+
+  // Calls fn(handle) for every live slot, in index order
+  template <typename Fn>
+  void for_each(Fn fn) const
+  {
+    for (uint32_t i = 0; i != slots; i++) {
+      uint32_t gen = generations[i].load(std::memory_order_acquire);
+      if (gen % 2 == 1) {
+	handle h = {i, gen};
+	fn(h);
+      }
+    }
+  }
+
+  uint32_t size() const
+  {
+    return live.load(std::memory_order_relaxed);
+  }
+
+  uint32_t capacity() const
+  {
+    return slots;
+  }
+
+private:
+  // The free list head carries a tag in its top half so a slot popped and
+  // pushed back between another thread's load and CAS is not mistaken
+  // for an unchanged list
+  uint32_t pop()
+  {
+    uint64_t old_head = head.load(std::memory_order_acquire);
+    for (;;) {
+      uint32_t idx = static_cast<uint32_t>(old_head);
+      if (idx == POOL_NO_SLOT)
+	return POOL_NO_SLOT;
+      uint64_t tag = (old_head >> 32) + 1;
+      uint64_t new_head = tag << 32
+	| next[idx].load(std::memory_order_relaxed);
+      if (head.compare_exchange_weak(old_head, new_head,
+				     std::memory_order_acq_rel))
+	return idx;
+    }
+  }
+
+  void push(uint32_t idx)
+  {
+    uint64_t old_head = head.load(std::memory_order_relaxed);
+    for (;;) {
+      next[idx].store(static_cast<uint32_t>(old_head),
+		      std::memory_order_relaxed);
+      uint64_t new_head = ((old_head >> 32) + 1) << 32 | idx;
+      if (head.compare_exchange_weak(old_head, new_head,
+				     std::memory_order_acq_rel))
+	return;
+    }
+  }
+
+  template <size_t I>
+  void assign(uint32_t)
+  {
+  }
+
+  template <size_t I, typename F, typename... Rest>
+  void assign(uint32_t idx, const F& value, const Rest&... rest)
+  {
+    std::get<I>(columns)[idx] = value;
+    assign<I + 1>(idx, rest...);
+  }
+
+  uint32_t slots;
+  std::unique_ptr<std::atomic<uint32_t>[]> generations;
+  std::unique_ptr<std::atomic<uint32_t>[]> next;
+  std::tuple<std::unique_ptr<Fields[]>...> columns;
+  std::atomic<uint64_t> head;
+  std::atomic<uint32_t> live;
+};
+
+#endif
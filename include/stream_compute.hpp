@@ -0,0 +1,148 @@
+#ifndef STREAM_COMPUTE_HPP_
+#define STREAM_COMPUTE_HPP_
+
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#define STREAM_MAX_DEPTH  3
+
+struct stream_queue {
+  uint32_t family;
+  VkQueue queue;
+  std::mutex* mutex;
+};
+
+// Runs one kernel over an input of any size, a chunk at a time. Each
+// chunk is uploaded on the upload queue, processed on the compute queue
+// and read back on the download queue, the three chained by semaphores.
+// With depth 2 or 3 chunks in flight the copies of one chunk overlap the
+// kernel of another, so a run takes about as long as the slower of the
+// two rather than their sum; a depth outside that range is clamped to
+// it. The queues may be the same. A run that fails leaves the stream
+// invalid.
+//
+// The kernel binds the chunk's input at binding 0 and its output at
+// binding 1 and gets the compute_engine push constant header:
+//
+//   uvec4 offset;  // xyz: element offset of this dispatch in the chunk
+//                  // w:   low word of the chunk's first element
+//   uvec4 size;    // x:   elements in the chunk
+//                  // w:   high word of the chunk's first element
+//
+// followed by the kernel's own constants. Every input element of
+// in_element_size bytes gives out_element_size bytes of output; a short
+// last element is padded with zeros.
+class stream_compute {
+public:
+  stream_compute(VkPhysicalDevice physical_device,
+		 VkDevice device,
+		 const stream_queue& upload,
+		 const stream_queue& compute,
+		 const stream_queue& download,
+		 VkDeviceSize chunk_size,
+		 uint32_t depth,
+		 const VkAllocationCallbacks* alloc_callbacks);
+  ~stream_compute();
+
+  bool load_kernel(const std::string& filename,
+		   uint32_t in_element_size,
+		   uint32_t out_element_size,
+		   const void* push_constants,
+		   uint32_t push_constant_size);
+  bool valid() const;
+
+  // Results are written to out in input order
+  bool run(const void* data, size_t size, std::ostream& out);
+  bool run(std::istream& in, std::ostream& out);
+  // Maps the file where possible, otherwise reads it as a stream
+  bool run_file(const std::string& filename, std::ostream& out);
+
+  uint64_t chunk_count() const;
+  uint64_t bytes_in() const;
+  uint64_t bytes_out() const;
+
+private:
+  // Fills dst with up to max bytes and returns how many
+  typedef std::function<size_t(void* dst, size_t max)> reader;
+
+  struct slot {
+    VkBuffer in_staging;
+    VkDeviceMemory in_staging_memory;
+    void* in_data;
+    VkBuffer in;
+    VkDeviceMemory in_memory;
+    VkBuffer out;
+    VkDeviceMemory out_memory;
+    VkBuffer out_staging;
+    VkDeviceMemory out_staging_memory;
+    void* out_data;
+
+    VkDescriptorSet set;
+    VkCommandBuffer upload_cmd;
+    VkCommandBuffer compute_cmd;
+    VkCommandBuffer download_cmd;
+    VkSemaphore uploaded;
+    VkSemaphore computed;
+    VkFence done;
+
+    uint32_t elements;
+    bool pending;
+  };
+
+  uint32_t find_memory_type(uint32_t type_bits,
+			    VkMemoryPropertyFlags flags) const;
+  bool create_buffer(VkDeviceSize size,
+		     VkBufferUsageFlags usage,
+		     VkMemoryPropertyFlags flags,
+		     const std::vector<uint32_t>& families,
+		     VkBuffer& buffer,
+		     VkDeviceMemory& memory,
+		     void** data);
+  VkCommandBuffer begin(VkCommandBuffer cmd);
+  bool submit(const stream_queue& q, VkCommandBuffer cmd,
+	      VkSemaphore wait, VkPipelineStageFlags wait_stage,
+	      VkSemaphore signal, VkFence fence);
+  bool start_chunk(slot& s, uint32_t elements, uint64_t first);
+  bool download_chunk(slot& s);
+  bool finish_chunk(slot& s, std::ostream& out);
+  void wait_idle();
+  bool stream(const reader& read, std::ostream& out);
+
+  VkDevice device;
+  stream_queue upload_queue;
+  stream_queue compute_queue;
+  stream_queue download_queue;
+  const VkAllocationCallbacks* alloc_callbacks;
+  VkPhysicalDeviceMemoryProperties mem_props;
+  VkPhysicalDeviceLimits limits;
+  VkDeviceSize chunk_size;
+  bool ready;
+
+  VkCommandPool upload_pool;
+  VkCommandPool compute_pool;
+  VkCommandPool download_pool;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSetLayout set_layout;
+
+  VkShaderModule module;
+  VkPipelineLayout layout;
+  VkPipeline pipeline;
+  uint32_t local_size[3];
+  uint32_t in_element_size;
+  uint32_t out_element_size;
+  std::vector<char> constants;
+
+  std::vector<slot> slots;
+
+  uint64_t chunks;
+  uint64_t in_bytes;
+  uint64_t out_bytes;
+};
+
+#endif
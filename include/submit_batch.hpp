@@ -0,0 +1,101 @@
+#ifndef SUBMIT_BATCH_HPP_
+#define SUBMIT_BATCH_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Collects submissions for one queue so they reach it in a single
+// vkQueueSubmit. Any thread may enqueue; an enqueue is a push onto a
+// lock-free list and takes no lock. flush() takes the whole list and
+// submits it with one VkSubmitInfo per enqueue, in enqueue order for each
+// thread.
+//
+// Entries are recycled rather than freed: flush() returns them to a free
+// list in one push, and an enqueuing thread takes the whole list into a
+// cache of its own when its cache runs dry, so only a single entry is
+// ever popped, and that without contention. Once every thread has warmed
+// up, an enqueue allocates nothing.
+//
+// A fence signals once everything submitted with it has completed. Since
+// a vkQueueSubmit takes one fence, flush() splits the batch after each
+// entry carrying a fence, so normally it is still a single call.
+class submit_batch {
+public:
+  submit_batch(VkQueue queue, std::mutex& queue_mutex);
+  // Drops anything not flushed
+  ~submit_batch();
+
+  void enqueue(VkCommandBuffer command_buffer,
+	       VkFence fence = VK_NULL_HANDLE);
+  void enqueue(const VkCommandBuffer* command_buffers,
+	       uint32_t command_buffer_count,
+	       const VkSemaphore* wait_semaphores,
+	       const VkPipelineStageFlags* wait_stages,
+	       uint32_t wait_count,
+	       const VkSemaphore* signal_semaphores,
+	       uint32_t signal_count,
+	       VkFence fence = VK_NULL_HANDLE);
+  // For timeline semaphores: one value per wait and per signal semaphore,
+  // ignored for binary ones. Either array may be null.
+  void enqueue(const VkCommandBuffer* command_buffers,
+	       uint32_t command_buffer_count,
+	       const VkSemaphore* wait_semaphores,
+	       const uint64_t* wait_values,
+	       const VkPipelineStageFlags* wait_stages,
+	       uint32_t wait_count,
+	       const VkSemaphore* signal_semaphores,
+	       const uint64_t* signal_values,
+	       uint32_t signal_count,
+	       VkFence fence = VK_NULL_HANDLE);
+
+  // Submits everything enqueued so far. Returns the first failure, in
+  // which case later parts of the batch are not submitted.
+  VkResult flush();
+
+  bool empty() const;
+  uint64_t submit_count() const;
+  uint64_t entry_count() const;
+
+private:
+  struct entry {
+    entry* next;
+    std::vector<VkCommandBuffer> command_buffers;
+    std::vector<VkSemaphore> wait_semaphores;
+    std::vector<VkPipelineStageFlags> wait_stages;
+    std::vector<VkSemaphore> signal_semaphores;
+    std::vector<uint64_t> wait_values;
+    std::vector<uint64_t> signal_values;
+    VkFence fence;
+  };
+
+  // Entries taken from any batch's free list; freed when the thread exits
+  struct entry_cache {
+    entry* free;
+    ~entry_cache();
+  };
+
+  static void delete_entries(entry* e);
+  entry* allocate();
+  void push(entry* e);
+
+  static thread_local entry_cache cache;
+
+  VkQueue queue;
+  std::mutex& queue_mutex;
+  std::atomic<entry*> head;
+  std::atomic<entry*> free_head;
+
+  // Only touched by flush(), under queue_mutex
+  std::vector<entry*> pending;
+  std::vector<VkSubmitInfo> infos;
+#ifdef VK_KHR_timeline_semaphore
+  std::vector<VkTimelineSemaphoreSubmitInfoKHR> timeline_infos;
+#endif
+  uint64_t submits;
+  uint64_t entries;
+};
+
+#endif
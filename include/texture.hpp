@@ -0,0 +1,147 @@
+#ifndef TEXTURE_HPP_
+#define TEXTURE_HPP_
+
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <condition_variable>
+
+#include <vulkan/vulkan.h>
+
+#include "deletion_queue.hpp"
+
+#define TEXTURE_FORMAT          VK_FORMAT_R8G8B8A8_UNORM
+#define TEXTURE_TEXEL_SIZE      4
+
+// Levels at or below this edge length are always uploaded together as the
+// mip tail and are never evicted, so every texture stays sampleable.
+#define TEXTURE_MIP_TAIL_EXTENT 64
+
+#define TEXTURE_NOT_RESIDENT    UINT32_MAX
+
+struct texture_mip {
+  uint32_t width;
+  uint32_t height;
+  std::vector<unsigned char> texels;
+};
+
+// CPU side copy of a texture. mips[0] is the full resolution level.
+struct texture_data {
+  std::string name;
+  std::vector<texture_mip> mips;
+};
+
+bool load_ppm(const std::string& filename, texture_data& tex);
+
+// Box filters mips[0] down to 1x1, replacing any existing smaller levels.
+void generate_mips(texture_data& tex);
+
+// Decodes textures and builds their mip chains on a worker thread.
+class texture_loader {
+public:
+  texture_loader();
+  ~texture_loader();
+
+  void request(const std::string& filename);
+  bool poll(texture_data& tex);
+  bool idle();
+
+private:
+  void run();
+
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<std::string> pending;
+  std::deque<texture_data> finished;
+  unsigned int in_flight;
+  bool stopping;
+};
+
+// Streams texture mips into device local images through a host visible
+// staging buffer. A texture first becomes resident with only its mip tail,
+// then gains one higher level per update while the per-update staging
+// budget allows. When resident memory exceeds the VRAM budget the least
+// recently used textures lose their highest level.
+//
+// Changing the resident levels means recreating the image (the old levels
+// are copied across on the device), so callers should re-fetch view() and
+// rewrite descriptors whenever version() changes.
+class texture_streamer {
+public:
+  texture_streamer(VkPhysicalDevice physical_device,
+		   VkDevice device,
+		   uint32_t queue_family_idx,
+		   VkQueue queue,
+		   std::mutex& queue_mutex,
+		   VkDeviceSize vram_budget,
+		   VkDeviceSize staging_size,
+		   deletion_queue& deletions,
+		   const VkAllocationCallbacks* alloc_callbacks);
+  ~texture_streamer();
+
+  uint32_t add(texture_data& tex);
+  void touch(uint32_t tex_idx, uint64_t frame);
+  void update(uint64_t frame);
+
+  VkImageView view(uint32_t tex_idx) const;
+  uint32_t version(uint32_t tex_idx) const;
+  uint32_t resident_level(uint32_t tex_idx) const;
+  uint32_t level_count(uint32_t tex_idx) const;
+  VkDeviceSize resident_bytes() const;
+
+private:
+  struct entry {
+    texture_data data;
+    uint32_t tail_level;
+    uint32_t top_level;
+    uint64_t last_used;
+    uint32_t version;
+    VkImage image;
+    VkImageView view;
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+  };
+
+  bool create_staging();
+  uint32_t find_memory_type(uint32_t type_bits,
+			    VkMemoryPropertyFlags flags) const;
+  bool create_image(entry& tex, uint32_t top_level,
+		    VkImage& image, VkImageView& view,
+		    VkDeviceMemory& memory, VkDeviceSize& size);
+  bool stage_levels(const entry& tex, uint32_t first, uint32_t last,
+		    std::vector<VkBufferImageCopy>& copies);
+  bool restream(entry& tex, uint32_t top_level, bool upload);
+  void retire(entry& tex);
+
+  VkPhysicalDevice physical_device;
+  VkDevice device;
+  uint32_t queue_family_idx;
+  VkQueue queue;
+  std::mutex& queue_mutex;
+  deletion_queue& deletions;
+  const VkAllocationCallbacks* alloc_callbacks;
+  VkPhysicalDeviceMemoryProperties mem_props;
+
+  VkDeviceSize vram_budget;
+  VkDeviceSize resident;
+
+  VkBuffer staging_buffer;
+  VkDeviceMemory staging_memory;
+  VkDeviceSize staging_size;
+  VkDeviceSize staging_used;
+  unsigned char* staging_data;
+
+  VkCommandPool command_pool;
+  VkCommandBuffer command_buffer;
+  VkFence fence;
+  bool recording;
+  bool submitted;
+
+  std::vector<entry> textures;
+  uint64_t current_frame;
+};
+
+#endif
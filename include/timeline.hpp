@@ -0,0 +1,126 @@
+#ifndef TIMELINE_HPP_
+#define TIMELINE_HPP_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "submit_batch.hpp"
+
+// A point on a queue's timeline: reached once the submission that
+// signalled value has completed. Value 0 is reached from the start.
+struct gpu_point {
+  uint32_t queue;
+  uint64_t value;
+};
+
+// One timeline semaphore per queue (VK_KHR_timeline_semaphore). Every
+// submit() signals the next value of its queue's semaphore, so work on
+// one queue completes in value order and anything, on the GPU or the
+// CPU, can wait for an exact submission instead of a whole queue.
+//
+// Submissions go through the queues' submit batches. As with the queue
+// scheduler, a wait on another queue's point first flushes that queue's
+// batch, so the signal is always submitted before the wait.
+class gpu_timeline {
+public:
+  // batches[i] submits to queue i
+  gpu_timeline(VkDevice device,
+	       const std::vector<submit_batch*>& batches,
+	       const VkAllocationCallbacks* alloc_callbacks);
+  ~gpu_timeline();
+
+  // False if the extension is missing or not enabled on the device; the
+  // timeline must not be used then
+  bool supported() const;
+  uint32_t queue_count() const;
+
+  gpu_point submit(uint32_t queue,
+		   const VkCommandBuffer* command_buffers,
+		   uint32_t command_buffer_count,
+		   const gpu_point* waits,
+		   const VkPipelineStageFlags* wait_stages,
+		   uint32_t wait_count,
+		   VkFence fence = VK_NULL_HANDLE);
+
+  // The last point submitted on the queue
+  gpu_point last(uint32_t queue) const;
+  // The highest value the queue's submissions have reached
+  uint64_t completed(uint32_t queue) const;
+  bool reached(gpu_point point) const;
+  // Flushes the point's queue and waits for it on the CPU
+  VkResult wait(gpu_point point, uint64_t timeout = UINT64_MAX);
+  // Waits for several points at once, or for any of them
+  VkResult wait(const gpu_point* points,
+		uint32_t point_count,
+		bool any,
+		uint64_t timeout = UINT64_MAX);
+
+private:
+  struct lane {
+    submit_batch* batch;
+    VkSemaphore semaphore;
+    // Values are taken and enqueued under it, so the batch sees them in
+    // increasing order
+    std::mutex mutex;
+    uint64_t value;
+  };
+
+  VkDevice device;
+  const VkAllocationCallbacks* alloc_callbacks;
+  std::vector<std::unique_ptr<lane>> lanes;
+  bool ready;
+
+#ifdef VK_KHR_timeline_semaphore
+  PFN_vkWaitSemaphoresKHR wait_semaphores;
+  PFN_vkGetSemaphoreCounterValueKHR get_counter_value;
+#endif
+};
+
+// GPU work as a graph of tasks, each a submission to one queue that may
+// depend on earlier tasks or on points already submitted. submit() sends
+// the tasks in the order they were added, which must be a topological
+// order, i.e. a task depends only on tasks added before it.
+class gpu_task_graph {
+public:
+  typedef uint32_t task;
+
+  task add_task(uint32_t queue,
+		const VkCommandBuffer* command_buffers,
+		uint32_t command_buffer_count,
+		VkFence fence = VK_NULL_HANDLE);
+  // The dependent task waits at stages for the other to complete
+  void depend(task t, task on, VkPipelineStageFlags stages);
+  void depend(task t, gpu_point on, VkPipelineStageFlags stages);
+
+  void submit(gpu_timeline& timeline);
+  // Valid after submit()
+  gpu_point point(task t) const;
+  // Drops all tasks
+  void clear();
+
+  size_t size() const;
+
+private:
+  static const task EXTERNAL = UINT32_MAX;
+
+  struct dependency {
+    task on;
+    gpu_point point;
+    VkPipelineStageFlags stages;
+  };
+
+  struct node {
+    uint32_t queue;
+    std::vector<VkCommandBuffer> command_buffers;
+    VkFence fence;
+    std::vector<dependency> dependencies;
+    gpu_point point;
+  };
+
+  std::vector<node> nodes;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+
+#include <string>
+#include <cstdint>
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Records per thread, oldest are kept and newer ones dropped when full
+#define TRACE_RING_SIZE  16384
+#define TRACE_FLUSH_MS   10
+
+// Starts the writer thread; zones are only recorded while it runs
+bool trace_start(const std::string& filename);
+// Drains everything still buffered and finishes the file
+void trace_stop();
+
+// Nanoseconds on the clock used for every zone
+uint64_t trace_now_ns();
+
+// Names the calling thread in the trace viewer
+void trace_thread_name(const char* name);
+
+// Zones measured elsewhere (e.g. GPU timestamps already converted to the
+// trace clock), shown on their own track
+void trace_gpu_zone(const std::string& name,
+		    uint64_t begin_ns,
+		    uint64_t end_ns);
+
+// Name must outlive the trace, a string literal in practice
+class trace_zone {
+public:
+  explicit trace_zone(const char* name);
+  ~trace_zone();
+
+private:
+  const char* name;
+  uint64_t begin;
+};
+
+#define TRACE_CONCAT_(A, B) A##B
+#define TRACE_CONCAT(A, B) TRACE_CONCAT_(A, B)
+
+#if TRACE_ENABLED
+#define TRACE_SCOPE(NAME) trace_zone TRACE_CONCAT(trace_zone_, __LINE__)(NAME)
+#else
+#define TRACE_SCOPE(NAME)
+#endif
+
+#endif
@@ -19,13 +19,15 @@ bool supported_surface_format(VkFormat format,
 void print_mem(VkDevice device, VkDeviceMemory memory,
 	       std::mutex& mutex, VkDeviceSize offset,
 	       VkDeviceSize size);
+// For memory that is already mapped
+void print_mem(const char* data, VkDeviceSize size);
 
 void print_all_buffers(VkDevice device,
 		       VkDeviceMemory memory,
 		       std::mutex& mem_mutex,
 		       VkDeviceSize offset,
 		       VkDeviceSize length,
-		       const std::vector<VkMemoryRequirements>& buf_mem_reqs);
+		       const std::vector<VkDeviceSize>& buf_offsets);
 
 bool supports_mem_reqs(unsigned int memory_type_idx,
 		       const std::vector<VkMemoryRequirements>& mem_reqs);
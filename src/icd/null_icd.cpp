@@ -0,0 +1,1331 @@
+// Vulkan driver without a GPU, for measuring the engine's own CPU cost.
+//
+// Every object is a small host allocation and device memory is host
+// memory, so mapping works. Recording only counts commands and
+// submissions complete immediately: fences are signaled by vkQueueSubmit
+// and nothing is executed, so buffer and image contents never change.
+//
+// Built as a shared library next to null_icd.json; run any executable
+// with VK_ICD_FILENAMES (or VK_DRIVER_FILES) pointing at that manifest.
+// Setting VULTURE_NULL_ICD_STATS prints command and submit counts when
+// the device is destroyed.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#if defined(_WIN32)
+#define NULL_ICD_EXPORT extern "C" __declspec(dllexport)
+#else
+#define NULL_ICD_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+// The loader replaces the first word of every dispatchable object with
+// its dispatch table, and checks it holds this value first
+#define ICD_LOADER_MAGIC          0x01CDC0DE
+#define ICD_INTERFACE_VERSION     2
+
+#define NULL_DEVICE_NAME          "Vulture null device"
+#define NULL_HEAP_SIZE            (4ull << 30)
+#define NULL_MEMORY_ALIGNMENT     256
+#define NULL_FAMILY_COUNT         2
+#define NULL_QUEUE_COUNT          4
+#define NULL_MAX_SWAPCHAIN_IMAGES 8
+
+#define NULL_STATS_ENV            "VULTURE_NULL_ICD_STATS"
+
+struct null_object {
+  void* loader_data;
+};
+
+struct null_physical_device : null_object {
+};
+
+struct null_instance : null_object {
+  null_physical_device physical_device;
+};
+
+struct null_queue : null_object {
+};
+
+struct null_device : null_object {
+  null_queue queues[NULL_FAMILY_COUNT][NULL_QUEUE_COUNT];
+  std::atomic<uint64_t> commands;
+  std::atomic<uint64_t> submits;
+  std::atomic<uint64_t> allocations;
+};
+
+struct null_command_pool;
+
+struct null_command_buffer : null_object {
+  null_device* device;
+  null_command_pool* pool;
+};
+
+struct null_command_pool {
+  std::mutex mutex;
+  std::vector<null_command_buffer*> buffers;
+};
+
+struct null_descriptor_set {
+};
+
+struct null_descriptor_pool {
+  std::mutex mutex;
+  std::vector<null_descriptor_set*> sets;
+};
+
+struct null_memory {
+  char* data;
+  VkDeviceSize size;
+};
+
+struct null_buffer {
+  VkDeviceSize size;
+};
+
+struct null_image {
+  VkDeviceSize size;
+};
+
+struct null_fence {
+  std::atomic<bool> signaled;
+};
+
+struct null_swapchain {
+  uint32_t image_count;
+  uint32_t next;
+  VkImage images[NULL_MAX_SWAPCHAIN_IMAGES];
+};
+
+// Everything else only has to exist
+struct null_handle {
+  uint64_t unused;
+};
+
+// Non-dispatchable handles are pointers on 64 bit and uint64_t on 32 bit
+template <typename H, typename T>
+static H to_handle(T* p)
+{
+  return (H)(uintptr_t)p;
+}
+
+template <typename T, typename H>
+static T* from_handle(H h)
+{
+  return (T*)(uintptr_t)h;
+}
+
+static void set_loader_magic(null_object* obj)
+{
+  obj->loader_data = reinterpret_cast<void*>(ICD_LOADER_MAGIC);
+}
+
+static null_device* device_of(VkCommandBuffer cmd)
+{
+  return reinterpret_cast<null_command_buffer*>(cmd)->device;
+}
+
+static void record(VkCommandBuffer cmd)
+{
+  device_of(cmd)->commands.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename P>
+static VkResult fill_array(const P* src, uint32_t count,
+			   uint32_t* out_count, P* out)
+{
+  if (out == nullptr) {
+    *out_count = count;
+    return VK_SUCCESS;
+  }
+  uint32_t n = *out_count < count ? *out_count : count;
+  for (uint32_t i = 0; i != n; i++)
+    out[i] = src[i];
+  *out_count = n;
+  return n < count ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
+static VkExtensionProperties extension(const char* name, uint32_t version)
+{
+  VkExtensionProperties ext = {};
+  std::strncpy(ext.extensionName, name, VK_MAX_EXTENSION_NAME_SIZE - 1);
+  ext.specVersion = version;
+  return ext;
+}
+
+// Instance
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_EnumerateInstanceExtensionProperties(const char* layer,
+					  uint32_t* count,
+					  VkExtensionProperties* props)
+{
+  if (layer != nullptr)
+    return VK_ERROR_LAYER_NOT_PRESENT;
+  // Surfaces are created by the loader at this interface version
+  const VkExtensionProperties exts[] = {
+    extension("VK_KHR_surface", 25),
+    extension("VK_KHR_xlib_surface", 6),
+    extension("VK_KHR_xcb_surface", 6),
+    extension("VK_KHR_win32_surface", 6)
+  };
+  return fill_array(exts, 4, count, props);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_EnumerateInstanceVersion(uint32_t* version)
+{
+  *version = VK_API_VERSION_1_0;
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_CreateInstance(const VkInstanceCreateInfo*,
+		    const VkAllocationCallbacks*,
+		    VkInstance* instance)
+{
+  null_instance* inst = new null_instance;
+  set_loader_magic(inst);
+  set_loader_magic(&inst->physical_device);
+  *instance = reinterpret_cast<VkInstance>(inst);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_DestroyInstance(VkInstance instance, const VkAllocationCallbacks*)
+{
+  delete reinterpret_cast<null_instance*>(instance);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_EnumeratePhysicalDevices(VkInstance instance,
+			      uint32_t* count,
+			      VkPhysicalDevice* devices)
+{
+  VkPhysicalDevice dev = reinterpret_cast<VkPhysicalDevice>(
+    &reinterpret_cast<null_instance*>(instance)->physical_device);
+  return fill_array(&dev, 1, count, devices);
+}
+
+// Physical device
+
+static VKAPI_ATTR void VKAPI_CALL
+null_GetPhysicalDeviceFeatures(VkPhysicalDevice,
+			       VkPhysicalDeviceFeatures* features)
+{
+  std::memset(features, 0, sizeof(*features));
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_GetPhysicalDeviceFormatProperties(VkPhysicalDevice,
+				       VkFormat,
+				       VkFormatProperties* props)
+{
+  // Claim everything so no format fallback path is taken
+  props->linearTilingFeatures = 0x7fffffff;
+  props->optimalTilingFeatures = 0x7fffffff;
+  props->bufferFeatures = 0x7fffffff;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_GetPhysicalDeviceProperties(VkPhysicalDevice,
+				 VkPhysicalDeviceProperties* props)
+{
+  std::memset(props, 0, sizeof(*props));
+  props->apiVersion = VK_API_VERSION_1_0;
+  props->driverVersion = 1;
+  props->vendorID = 0x10000;
+  props->deviceID = 1;
+  props->deviceType = VK_PHYSICAL_DEVICE_TYPE_OTHER;
+  std::strncpy(props->deviceName, NULL_DEVICE_NAME,
+	       VK_MAX_PHYSICAL_DEVICE_NAME_SIZE - 1);
+
+  VkPhysicalDeviceLimits& l = props->limits;
+  l.maxImageDimension1D = 16384;
+  l.maxImageDimension2D = 16384;
+  l.maxImageDimension3D = 2048;
+  l.maxImageDimensionCube = 16384;
+  l.maxImageArrayLayers = 2048;
+  l.maxTexelBufferElements = 1u << 27;
+  l.maxUniformBufferRange = 1u << 16;
+  l.maxStorageBufferRange = 1u << 30;
+  l.maxPushConstantsSize = 256;
+  l.maxMemoryAllocationCount = 1u << 20;
+  l.maxSamplerAllocationCount = 1u << 12;
+  l.bufferImageGranularity = 1;
+  l.maxBoundDescriptorSets = 8;
+  l.maxPerStageDescriptorStorageBuffers = 1u << 20;
+  l.maxDescriptorSetStorageBuffers = 1u << 20;
+  l.maxComputeSharedMemorySize = 1u << 15;
+  for (unsigned int i = 0; i != 3; i++)
+    l.maxComputeWorkGroupCount[i] = 65535;
+  l.maxComputeWorkGroupInvocations = 1024;
+  l.maxComputeWorkGroupSize[0] = 1024;
+  l.maxComputeWorkGroupSize[1] = 1024;
+  l.maxComputeWorkGroupSize[2] = 64;
+  l.timestampPeriod = 1.0f;
+  l.timestampComputeAndGraphics = VK_TRUE;
+  l.minMemoryMapAlignment = 64;
+  l.minTexelBufferOffsetAlignment = 16;
+  l.minUniformBufferOffsetAlignment = 16;
+  l.minStorageBufferOffsetAlignment = 16;
+  l.optimalBufferCopyOffsetAlignment = 16;
+  l.optimalBufferCopyRowPitchAlignment = 16;
+  l.nonCoherentAtomSize = 64;
+  l.maxSamplerLodBias = 16.0f;
+  l.maxSamplerAnisotropy = 16.0f;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_GetPhysicalDeviceQueueFamilyProperties(VkPhysicalDevice,
+					    uint32_t* count,
+					    VkQueueFamilyProperties* props)
+{
+  VkQueueFamilyProperties families[NULL_FAMILY_COUNT] = {};
+  families[0].queueFlags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT
+    | VK_QUEUE_TRANSFER_BIT;
+  families[1].queueFlags = VK_QUEUE_TRANSFER_BIT;
+  for (auto& f : families) {
+    f.queueCount = NULL_QUEUE_COUNT;
+    f.timestampValidBits = 64;
+    f.minImageTransferGranularity.width = 1;
+    f.minImageTransferGranularity.height = 1;
+    f.minImageTransferGranularity.depth = 1;
+  }
+  fill_array(families, NULL_FAMILY_COUNT, count, props);
+}
+
+// Heap 0 is "device local", heap 1 system memory; both are host RAM
+static VKAPI_ATTR void VKAPI_CALL
+null_GetPhysicalDeviceMemoryProperties(VkPhysicalDevice,
+				       VkPhysicalDeviceMemoryProperties* props)
+{
+  std::memset(props, 0, sizeof(*props));
+  props->memoryHeapCount = 2;
+  props->memoryHeaps[0].size = NULL_HEAP_SIZE;
+  props->memoryHeaps[0].flags = VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+  props->memoryHeaps[1].size = NULL_HEAP_SIZE;
+  props->memoryHeaps[1].flags = 0;
+
+  props->memoryTypeCount = 4;
+  props->memoryTypes[0].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  props->memoryTypes[0].heapIndex = 0;
+  props->memoryTypes[1].propertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+    | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  props->memoryTypes[1].heapIndex = 1;
+  props->memoryTypes[2].propertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+    | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+    | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+  props->memoryTypes[2].heapIndex = 1;
+  props->memoryTypes[3].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+    | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  props->memoryTypes[3].heapIndex = 0;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_EnumerateDeviceExtensionProperties(VkPhysicalDevice,
+					const char* layer,
+					uint32_t* count,
+					VkExtensionProperties* props)
+{
+  if (layer != nullptr)
+    return VK_ERROR_LAYER_NOT_PRESENT;
+  VkExtensionProperties swapchain = extension("VK_KHR_swapchain", 70);
+  return fill_array(&swapchain, 1, count, props);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_EnumerateDeviceLayerProperties(VkPhysicalDevice,
+				    uint32_t* count,
+				    VkLayerProperties*)
+{
+  *count = 0;
+  return VK_SUCCESS;
+}
+
+// Surfaces
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_GetPhysicalDeviceSurfaceSupportKHR(VkPhysicalDevice,
+					uint32_t family,
+					VkSurfaceKHR,
+					VkBool32* supported)
+{
+  *supported = family == 0 ? VK_TRUE : VK_FALSE;
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_GetPhysicalDeviceSurfaceCapabilitiesKHR(VkPhysicalDevice,
+					     VkSurfaceKHR,
+					     VkSurfaceCapabilitiesKHR* caps)
+{
+  std::memset(caps, 0, sizeof(*caps));
+  caps->minImageCount = 2;
+  caps->maxImageCount = NULL_MAX_SWAPCHAIN_IMAGES;
+  // No window to ask, so the application picks the extent
+  caps->currentExtent.width = UINT32_MAX;
+  caps->currentExtent.height = UINT32_MAX;
+  caps->minImageExtent.width = 1;
+  caps->minImageExtent.height = 1;
+  caps->maxImageExtent.width = 16384;
+  caps->maxImageExtent.height = 16384;
+  caps->maxImageArrayLayers = 1;
+  caps->supportedTransforms = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+  caps->currentTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+  caps->supportedCompositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+  caps->supportedUsageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+    | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_GetPhysicalDeviceSurfaceFormatsKHR(VkPhysicalDevice,
+					VkSurfaceKHR,
+					uint32_t* count,
+					VkSurfaceFormatKHR* formats)
+{
+  VkSurfaceFormatKHR formats_supported[2] = {
+    {VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR},
+    {VK_FORMAT_R8G8B8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR}
+  };
+  return fill_array(formats_supported, 2, count, formats);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_GetPhysicalDeviceSurfacePresentModesKHR(VkPhysicalDevice,
+					     VkSurfaceKHR,
+					     uint32_t* count,
+					     VkPresentModeKHR* modes)
+{
+  VkPresentModeKHR modes_supported[2] = {VK_PRESENT_MODE_FIFO_KHR,
+					 VK_PRESENT_MODE_IMMEDIATE_KHR};
+  return fill_array(modes_supported, 2, count, modes);
+}
+
+static VKAPI_ATTR VkBool32 VKAPI_CALL
+null_GetPhysicalDevicePresentationSupportKHR(VkPhysicalDevice,
+					     uint32_t family,
+					     void*,
+					     uint32_t)
+{
+  return family == 0 ? VK_TRUE : VK_FALSE;
+}
+
+static VKAPI_ATTR VkBool32 VKAPI_CALL
+null_GetPhysicalDeviceWin32PresentationSupportKHR(VkPhysicalDevice,
+						  uint32_t family)
+{
+  return family == 0 ? VK_TRUE : VK_FALSE;
+}
+
+// Device
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_CreateDevice(VkPhysicalDevice,
+		  const VkDeviceCreateInfo*,
+		  const VkAllocationCallbacks*,
+		  VkDevice* device)
+{
+  null_device* dev = new null_device;
+  set_loader_magic(dev);
+  for (auto& family : dev->queues)
+    for (auto& q : family)
+      set_loader_magic(&q);
+  dev->commands = 0;
+  dev->submits = 0;
+  dev->allocations = 0;
+  *device = reinterpret_cast<VkDevice>(dev);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_DestroyDevice(VkDevice device, const VkAllocationCallbacks*)
+{
+  null_device* dev = reinterpret_cast<null_device*>(device);
+  if (dev == nullptr)
+    return;
+  if (std::getenv(NULL_STATS_ENV) != nullptr)
+    std::fprintf(stderr, "null ICD: %llu commands, %llu submits, "
+		 "%llu memory allocations\n",
+		 static_cast<unsigned long long>(dev->commands.load()),
+		 static_cast<unsigned long long>(dev->submits.load()),
+		 static_cast<unsigned long long>(dev->allocations.load()));
+  delete dev;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_GetDeviceQueue(VkDevice device,
+		    uint32_t family,
+		    uint32_t index,
+		    VkQueue* queue)
+{
+  null_device* dev = reinterpret_cast<null_device*>(device);
+  *queue = family < NULL_FAMILY_COUNT && index < NULL_QUEUE_COUNT ?
+    reinterpret_cast<VkQueue>(&dev->queues[family][index]) : VK_NULL_HANDLE;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_DeviceWaitIdle(VkDevice)
+{
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_QueueWaitIdle(VkQueue)
+{
+  return VK_SUCCESS;
+}
+
+// Memory
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_AllocateMemory(VkDevice device,
+		    const VkMemoryAllocateInfo* info,
+		    const VkAllocationCallbacks*,
+		    VkDeviceMemory* memory)
+{
+  null_memory* mem = new null_memory;
+  mem->size = info->allocationSize;
+  mem->data = static_cast<char*>(std::calloc(
+    static_cast<size_t>(info->allocationSize), 1));
+  if (mem->data == nullptr) {
+    delete mem;
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  reinterpret_cast<null_device*>(device)->allocations++;
+  *memory = to_handle<VkDeviceMemory>(mem);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_FreeMemory(VkDevice, VkDeviceMemory memory,
+		const VkAllocationCallbacks*)
+{
+  null_memory* mem = from_handle<null_memory>(memory);
+  if (mem == nullptr)
+    return;
+  std::free(mem->data);
+  delete mem;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_MapMemory(VkDevice, VkDeviceMemory memory, VkDeviceSize offset,
+	       VkDeviceSize, VkMemoryMapFlags, void** data)
+{
+  *data = from_handle<null_memory>(memory)->data + offset;
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_UnmapMemory(VkDevice, VkDeviceMemory)
+{
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_MappedMemoryRanges(VkDevice, uint32_t, const VkMappedMemoryRange*)
+{
+  return VK_SUCCESS;
+}
+
+static VkMemoryRequirements requirements(VkDeviceSize size)
+{
+  VkMemoryRequirements reqs = {};
+  reqs.size = (size + NULL_MEMORY_ALIGNMENT - 1)
+    / NULL_MEMORY_ALIGNMENT * NULL_MEMORY_ALIGNMENT;
+  reqs.alignment = NULL_MEMORY_ALIGNMENT;
+  reqs.memoryTypeBits = 0xf;
+  return reqs;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_CreateBuffer(VkDevice, const VkBufferCreateInfo* info,
+		  const VkAllocationCallbacks*, VkBuffer* buffer)
+{
+  null_buffer* buf = new null_buffer;
+  buf->size = info->size;
+  *buffer = to_handle<VkBuffer>(buf);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_DestroyBuffer(VkDevice, VkBuffer buffer, const VkAllocationCallbacks*)
+{
+  delete from_handle<null_buffer>(buffer);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_GetBufferMemoryRequirements(VkDevice, VkBuffer buffer,
+				 VkMemoryRequirements* reqs)
+{
+  *reqs = requirements(from_handle<null_buffer>(buffer)->size);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_BindBufferMemory(VkDevice, VkBuffer, VkDeviceMemory, VkDeviceSize)
+{
+  return VK_SUCCESS;
+}
+
+// Bytes per texel, generous for formats not listed
+static VkDeviceSize texel_size(VkFormat format)
+{
+  switch (format) {
+  case VK_FORMAT_R8_UNORM:
+    return 1;
+  case VK_FORMAT_R32G32_SFLOAT:
+    return 8;
+  case VK_FORMAT_R32G32B32_SFLOAT:
+    return 12;
+  case VK_FORMAT_R32G32B32A32_SFLOAT:
+    return 16;
+  case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    return 8;
+  default:
+    return 4;
+  }
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_CreateImage(VkDevice, const VkImageCreateInfo* info,
+		 const VkAllocationCallbacks*, VkImage* image)
+{
+  // The whole mip chain fits in twice the base level
+  null_image* img = new null_image;
+  img->size = texel_size(info->format) * info->extent.width
+    * info->extent.height * info->extent.depth * info->arrayLayers
+    * info->samples * (info->mipLevels > 1 ? 2 : 1);
+  *image = to_handle<VkImage>(img);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_DestroyImage(VkDevice, VkImage image, const VkAllocationCallbacks*)
+{
+  delete from_handle<null_image>(image);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_GetImageMemoryRequirements(VkDevice, VkImage image,
+				VkMemoryRequirements* reqs)
+{
+  *reqs = requirements(from_handle<null_image>(image)->size);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_BindImageMemory(VkDevice, VkImage, VkDeviceMemory, VkDeviceSize)
+{
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_GetImageSubresourceLayout(VkDevice, VkImage image,
+			       const VkImageSubresource*,
+			       VkSubresourceLayout* layout)
+{
+  layout->offset = 0;
+  layout->size = from_handle<null_image>(image)->size;
+  layout->rowPitch = 0;
+  layout->arrayPitch = 0;
+  layout->depthPitch = 0;
+}
+
+// Objects that are only created and destroyed
+
+template <typename H>
+static VkResult create_plain(H* handle)
+{
+  *handle = to_handle<H>(new null_handle);
+  return VK_SUCCESS;
+}
+
+template <typename H>
+static void destroy_plain(H handle)
+{
+  delete from_handle<null_handle>(handle);
+}
+
+#define NULL_PLAIN_OBJECT(Name, Info)					\
+  static VKAPI_ATTR VkResult VKAPI_CALL					\
+  null_Create##Name(VkDevice, const Info*, const VkAllocationCallbacks*,	\
+		    Vk##Name* handle)					\
+  {									\
+    return create_plain(handle);					\
+  }									\
+  static VKAPI_ATTR void VKAPI_CALL					\
+  null_Destroy##Name(VkDevice, Vk##Name handle,				\
+		     const VkAllocationCallbacks*)			\
+  {									\
+    destroy_plain(handle);						\
+  }
+
+NULL_PLAIN_OBJECT(BufferView, VkBufferViewCreateInfo)
+NULL_PLAIN_OBJECT(ImageView, VkImageViewCreateInfo)
+NULL_PLAIN_OBJECT(Sampler, VkSamplerCreateInfo)
+NULL_PLAIN_OBJECT(ShaderModule, VkShaderModuleCreateInfo)
+NULL_PLAIN_OBJECT(PipelineLayout, VkPipelineLayoutCreateInfo)
+NULL_PLAIN_OBJECT(DescriptorSetLayout, VkDescriptorSetLayoutCreateInfo)
+NULL_PLAIN_OBJECT(RenderPass, VkRenderPassCreateInfo)
+NULL_PLAIN_OBJECT(Framebuffer, VkFramebufferCreateInfo)
+NULL_PLAIN_OBJECT(Semaphore, VkSemaphoreCreateInfo)
+NULL_PLAIN_OBJECT(QueryPool, VkQueryPoolCreateInfo)
+NULL_PLAIN_OBJECT(PipelineCache, VkPipelineCacheCreateInfo)
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_GetPipelineCacheData(VkDevice, VkPipelineCache,
+			  size_t* size, void* data)
+{
+  // Header only: length, version one, vendor, device, UUID
+  uint32_t header[8] = {32, 1, 0x10000, 1, 0, 0, 0, 0};
+  if (data == nullptr) {
+    *size = sizeof(header);
+    return VK_SUCCESS;
+  }
+  if (*size < sizeof(header)) {
+    *size = 0;
+    return VK_INCOMPLETE;
+  }
+  std::memcpy(data, header, sizeof(header));
+  *size = sizeof(header);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_MergePipelineCaches(VkDevice, VkPipelineCache, uint32_t,
+			 const VkPipelineCache*)
+{
+  return VK_SUCCESS;
+}
+
+template <typename Info>
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_CreatePipelines(VkDevice, VkPipelineCache, uint32_t count,
+		     const Info*, const VkAllocationCallbacks*,
+		     VkPipeline* pipelines)
+{
+  for (uint32_t i = 0; i != count; i++)
+    create_plain(&pipelines[i]);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_DestroyPipeline(VkDevice, VkPipeline pipeline,
+		     const VkAllocationCallbacks*)
+{
+  destroy_plain(pipeline);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_GetQueryPoolResults(VkDevice, VkQueryPool, uint32_t, uint32_t,
+			 size_t size, void* data, VkDeviceSize,
+			 VkQueryResultFlags)
+{
+  // Every query reads as zero: timestamps say no time passed
+  std::memset(data, 0, size);
+  return VK_SUCCESS;
+}
+
+// Descriptors
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_CreateDescriptorPool(VkDevice, const VkDescriptorPoolCreateInfo*,
+			  const VkAllocationCallbacks*,
+			  VkDescriptorPool* pool)
+{
+  *pool = to_handle<VkDescriptorPool>(new null_descriptor_pool);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_DestroyDescriptorPool(VkDevice, VkDescriptorPool pool,
+			   const VkAllocationCallbacks*)
+{
+  null_descriptor_pool* p = from_handle<null_descriptor_pool>(pool);
+  if (p == nullptr)
+    return;
+  for (auto set : p->sets)
+    delete set;
+  delete p;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_AllocateDescriptorSets(VkDevice,
+			    const VkDescriptorSetAllocateInfo* info,
+			    VkDescriptorSet* sets)
+{
+  null_descriptor_pool* p =
+    from_handle<null_descriptor_pool>(info->descriptorPool);
+  std::lock_guard<std::mutex> lock(p->mutex);
+  for (uint32_t i = 0; i != info->descriptorSetCount; i++) {
+    null_descriptor_set* set = new null_descriptor_set;
+    p->sets.push_back(set);
+    sets[i] = to_handle<VkDescriptorSet>(set);
+  }
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_FreeDescriptorSets(VkDevice, VkDescriptorPool pool, uint32_t count,
+			const VkDescriptorSet* sets)
+{
+  null_descriptor_pool* p = from_handle<null_descriptor_pool>(pool);
+  std::lock_guard<std::mutex> lock(p->mutex);
+  for (uint32_t i = 0; i != count; i++) {
+    null_descriptor_set* set = from_handle<null_descriptor_set>(sets[i]);
+    auto it = std::find(p->sets.begin(), p->sets.end(), set);
+    if (it != p->sets.end()) {
+      p->sets.erase(it);
+      delete set;
+    }
+  }
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_UpdateDescriptorSets(VkDevice, uint32_t, const VkWriteDescriptorSet*,
+			  uint32_t, const VkCopyDescriptorSet*)
+{
+}
+
+// Command buffers
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_CreateCommandPool(VkDevice, const VkCommandPoolCreateInfo*,
+		       const VkAllocationCallbacks*, VkCommandPool* pool)
+{
+  *pool = to_handle<VkCommandPool>(new null_command_pool);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_DestroyCommandPool(VkDevice, VkCommandPool pool,
+			const VkAllocationCallbacks*)
+{
+  null_command_pool* p = from_handle<null_command_pool>(pool);
+  if (p == nullptr)
+    return;
+  for (auto cmd : p->buffers)
+    delete cmd;
+  delete p;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_AllocateCommandBuffers(VkDevice device,
+			    const VkCommandBufferAllocateInfo* info,
+			    VkCommandBuffer* cmds)
+{
+  null_command_pool* p = from_handle<null_command_pool>(info->commandPool);
+  std::lock_guard<std::mutex> lock(p->mutex);
+  for (uint32_t i = 0; i != info->commandBufferCount; i++) {
+    null_command_buffer* cmd = new null_command_buffer;
+    set_loader_magic(cmd);
+    cmd->device = reinterpret_cast<null_device*>(device);
+    cmd->pool = p;
+    p->buffers.push_back(cmd);
+    cmds[i] = reinterpret_cast<VkCommandBuffer>(cmd);
+  }
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_FreeCommandBuffers(VkDevice, VkCommandPool pool, uint32_t count,
+			const VkCommandBuffer* cmds)
+{
+  null_command_pool* p = from_handle<null_command_pool>(pool);
+  std::lock_guard<std::mutex> lock(p->mutex);
+  for (uint32_t i = 0; i != count; i++) {
+    null_command_buffer* cmd =
+      reinterpret_cast<null_command_buffer*>(cmds[i]);
+    auto it = std::find(p->buffers.begin(), p->buffers.end(), cmd);
+    if (it != p->buffers.end()) {
+      p->buffers.erase(it);
+      delete cmd;
+    }
+  }
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_BeginCommandBuffer(VkCommandBuffer, const VkCommandBufferBeginInfo*)
+{
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_EndCommandBuffer(VkCommandBuffer)
+{
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_ResetCommandBuffer(VkCommandBuffer, VkCommandBufferResetFlags)
+{
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdBindPipeline(VkCommandBuffer cmd, VkPipelineBindPoint, VkPipeline)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdSetViewport(VkCommandBuffer cmd, uint32_t, uint32_t,
+		    const VkViewport*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdSetScissor(VkCommandBuffer cmd, uint32_t, uint32_t, const VkRect2D*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdBindDescriptorSets(VkCommandBuffer cmd, VkPipelineBindPoint,
+			   VkPipelineLayout, uint32_t, uint32_t,
+			   const VkDescriptorSet*, uint32_t, const uint32_t*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdBindIndexBuffer(VkCommandBuffer cmd, VkBuffer, VkDeviceSize,
+			VkIndexType)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdBindVertexBuffers(VkCommandBuffer cmd, uint32_t, uint32_t,
+			  const VkBuffer*, const VkDeviceSize*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdDraw(VkCommandBuffer cmd, uint32_t, uint32_t, uint32_t, uint32_t)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdDrawIndexed(VkCommandBuffer cmd, uint32_t, uint32_t, uint32_t,
+		    int32_t, uint32_t)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdDrawIndexedIndirect(VkCommandBuffer cmd, VkBuffer, VkDeviceSize,
+			    uint32_t, uint32_t)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdDispatch(VkCommandBuffer cmd, uint32_t, uint32_t, uint32_t)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdCopyBuffer(VkCommandBuffer cmd, VkBuffer, VkBuffer, uint32_t,
+		   const VkBufferCopy*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdCopyImage(VkCommandBuffer cmd, VkImage, VkImageLayout, VkImage,
+		  VkImageLayout, uint32_t, const VkImageCopy*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdCopyBufferToImage(VkCommandBuffer cmd, VkBuffer, VkImage,
+			  VkImageLayout, uint32_t, const VkBufferImageCopy*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdCopyImageToBuffer(VkCommandBuffer cmd, VkImage, VkImageLayout,
+			  VkBuffer, uint32_t, const VkBufferImageCopy*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdFillBuffer(VkCommandBuffer cmd, VkBuffer, VkDeviceSize,
+		   VkDeviceSize, uint32_t)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdClearColorImage(VkCommandBuffer cmd, VkImage, VkImageLayout,
+			const VkClearColorValue*, uint32_t,
+			const VkImageSubresourceRange*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdPipelineBarrier(VkCommandBuffer cmd, VkPipelineStageFlags,
+			VkPipelineStageFlags, VkDependencyFlags,
+			uint32_t, const VkMemoryBarrier*,
+			uint32_t, const VkBufferMemoryBarrier*,
+			uint32_t, const VkImageMemoryBarrier*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdResetQueryPool(VkCommandBuffer cmd, VkQueryPool, uint32_t, uint32_t)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdWriteTimestamp(VkCommandBuffer cmd, VkPipelineStageFlagBits,
+		       VkQueryPool, uint32_t)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdPushConstants(VkCommandBuffer cmd, VkPipelineLayout,
+		      VkShaderStageFlags, uint32_t, uint32_t, const void*)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdBeginRenderPass(VkCommandBuffer cmd, const VkRenderPassBeginInfo*,
+			VkSubpassContents)
+{
+  record(cmd);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_CmdEndRenderPass(VkCommandBuffer cmd)
+{
+  record(cmd);
+}
+
+// Synchronization and submission
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_CreateFence(VkDevice, const VkFenceCreateInfo* info,
+		 const VkAllocationCallbacks*, VkFence* fence)
+{
+  null_fence* f = new null_fence;
+  f->signaled = (info->flags & VK_FENCE_CREATE_SIGNALED_BIT) != 0;
+  *fence = to_handle<VkFence>(f);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_DestroyFence(VkDevice, VkFence fence, const VkAllocationCallbacks*)
+{
+  delete from_handle<null_fence>(fence);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_ResetFences(VkDevice, uint32_t count, const VkFence* fences)
+{
+  for (uint32_t i = 0; i != count; i++)
+    from_handle<null_fence>(fences[i])->signaled = false;
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_GetFenceStatus(VkDevice, VkFence fence)
+{
+  return from_handle<null_fence>(fence)->signaled ? VK_SUCCESS
+    : VK_NOT_READY;
+}
+
+// Work completes on submission, so a fence still unsignaled here was
+// never submitted and would never signal: report a timeout, not a hang
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_WaitForFences(VkDevice, uint32_t count, const VkFence* fences,
+		   VkBool32 wait_all, uint64_t)
+{
+  uint32_t signaled = 0;
+  for (uint32_t i = 0; i != count; i++)
+    if (from_handle<null_fence>(fences[i])->signaled)
+      signaled++;
+  return (wait_all ? signaled == count : signaled != 0) ? VK_SUCCESS
+    : VK_TIMEOUT;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_QueueSubmit(VkQueue, uint32_t count, const VkSubmitInfo* submits,
+		 VkFence fence)
+{
+  for (uint32_t i = 0; i != count; i++)
+    if (submits[i].commandBufferCount != 0) {
+      null_command_buffer* cmd = reinterpret_cast<null_command_buffer*>(
+	submits[i].pCommandBuffers[0]);
+      cmd->device->submits.fetch_add(1, std::memory_order_relaxed);
+    }
+  if (fence != VK_NULL_HANDLE)
+    from_handle<null_fence>(fence)->signaled = true;
+  return VK_SUCCESS;
+}
+
+// Swapchain
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_CreateSwapchainKHR(VkDevice device,
+			const VkSwapchainCreateInfoKHR* info,
+			const VkAllocationCallbacks*,
+			VkSwapchainKHR* swapchain)
+{
+  null_swapchain* sc = new null_swapchain;
+  sc->image_count = info->minImageCount < NULL_MAX_SWAPCHAIN_IMAGES ?
+    info->minImageCount : NULL_MAX_SWAPCHAIN_IMAGES;
+  sc->next = 0;
+
+  VkImageCreateInfo image_info = {};
+  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_info.format = info->imageFormat;
+  image_info.extent.width = info->imageExtent.width;
+  image_info.extent.height = info->imageExtent.height;
+  image_info.extent.depth = 1;
+  image_info.mipLevels = 1;
+  image_info.arrayLayers = info->imageArrayLayers;
+  image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  for (uint32_t i = 0; i != sc->image_count; i++)
+    null_CreateImage(device, &image_info, nullptr, &sc->images[i]);
+
+  *swapchain = to_handle<VkSwapchainKHR>(sc);
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+null_DestroySwapchainKHR(VkDevice device, VkSwapchainKHR swapchain,
+			 const VkAllocationCallbacks*)
+{
+  null_swapchain* sc = from_handle<null_swapchain>(swapchain);
+  if (sc == nullptr)
+    return;
+  for (uint32_t i = 0; i != sc->image_count; i++)
+    null_DestroyImage(device, sc->images[i], nullptr);
+  delete sc;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_GetSwapchainImagesKHR(VkDevice, VkSwapchainKHR swapchain,
+			   uint32_t* count, VkImage* images)
+{
+  null_swapchain* sc = from_handle<null_swapchain>(swapchain);
+  return fill_array(sc->images, sc->image_count, count, images);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_AcquireNextImageKHR(VkDevice, VkSwapchainKHR swapchain, uint64_t,
+			 VkSemaphore, VkFence fence, uint32_t* index)
+{
+  null_swapchain* sc = from_handle<null_swapchain>(swapchain);
+  *index = sc->next;
+  sc->next = (sc->next + 1) % sc->image_count;
+  if (fence != VK_NULL_HANDLE)
+    from_handle<null_fence>(fence)->signaled = true;
+  return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+null_QueuePresentKHR(VkQueue, const VkPresentInfoKHR*)
+{
+  return VK_SUCCESS;
+}
+
+// Entry points
+
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+null_GetDeviceProcAddr(VkDevice, const char* name);
+
+struct null_entry_point {
+  const char* name;
+  PFN_vkVoidFunction fn;
+};
+
+#define NULL_ENTRY(name, fn) \
+  {name, reinterpret_cast<PFN_vkVoidFunction>(fn)}
+
+static const null_entry_point entry_points[] = {
+  NULL_ENTRY("vkCreateInstance", null_CreateInstance),
+  NULL_ENTRY("vkDestroyInstance", null_DestroyInstance),
+  NULL_ENTRY("vkEnumerateInstanceExtensionProperties",
+	     null_EnumerateInstanceExtensionProperties),
+  NULL_ENTRY("vkEnumerateInstanceVersion", null_EnumerateInstanceVersion),
+  NULL_ENTRY("vkEnumeratePhysicalDevices", null_EnumeratePhysicalDevices),
+  NULL_ENTRY("vkGetPhysicalDeviceFeatures", null_GetPhysicalDeviceFeatures),
+  NULL_ENTRY("vkGetPhysicalDeviceFormatProperties",
+	     null_GetPhysicalDeviceFormatProperties),
+  NULL_ENTRY("vkGetPhysicalDeviceProperties",
+	     null_GetPhysicalDeviceProperties),
+  NULL_ENTRY("vkGetPhysicalDeviceQueueFamilyProperties",
+	     null_GetPhysicalDeviceQueueFamilyProperties),
+  NULL_ENTRY("vkGetPhysicalDeviceMemoryProperties",
+	     null_GetPhysicalDeviceMemoryProperties),
+  NULL_ENTRY("vkEnumerateDeviceExtensionProperties",
+	     null_EnumerateDeviceExtensionProperties),
+  NULL_ENTRY("vkEnumerateDeviceLayerProperties",
+	     null_EnumerateDeviceLayerProperties),
+  NULL_ENTRY("vkGetPhysicalDeviceSurfaceSupportKHR",
+	     null_GetPhysicalDeviceSurfaceSupportKHR),
+  NULL_ENTRY("vkGetPhysicalDeviceSurfaceCapabilitiesKHR",
+	     null_GetPhysicalDeviceSurfaceCapabilitiesKHR),
+  NULL_ENTRY("vkGetPhysicalDeviceSurfaceFormatsKHR",
+	     null_GetPhysicalDeviceSurfaceFormatsKHR),
+  NULL_ENTRY("vkGetPhysicalDeviceSurfacePresentModesKHR",
+	     null_GetPhysicalDeviceSurfacePresentModesKHR),
+  NULL_ENTRY("vkGetPhysicalDeviceXlibPresentationSupportKHR",
+	     null_GetPhysicalDevicePresentationSupportKHR),
+  NULL_ENTRY("vkGetPhysicalDeviceXcbPresentationSupportKHR",
+	     null_GetPhysicalDevicePresentationSupportKHR),
+  NULL_ENTRY("vkGetPhysicalDeviceWin32PresentationSupportKHR",
+	     null_GetPhysicalDeviceWin32PresentationSupportKHR),
+  NULL_ENTRY("vkCreateDevice", null_CreateDevice),
+  NULL_ENTRY("vkGetDeviceProcAddr", null_GetDeviceProcAddr),
+  NULL_ENTRY("vkDestroyDevice", null_DestroyDevice),
+  NULL_ENTRY("vkGetDeviceQueue", null_GetDeviceQueue),
+  NULL_ENTRY("vkDeviceWaitIdle", null_DeviceWaitIdle),
+  NULL_ENTRY("vkQueueWaitIdle", null_QueueWaitIdle),
+  NULL_ENTRY("vkAllocateMemory", null_AllocateMemory),
+  NULL_ENTRY("vkFreeMemory", null_FreeMemory),
+  NULL_ENTRY("vkMapMemory", null_MapMemory),
+  NULL_ENTRY("vkUnmapMemory", null_UnmapMemory),
+  NULL_ENTRY("vkFlushMappedMemoryRanges", null_MappedMemoryRanges),
+  NULL_ENTRY("vkInvalidateMappedMemoryRanges", null_MappedMemoryRanges),
+  NULL_ENTRY("vkCreateBuffer", null_CreateBuffer),
+  NULL_ENTRY("vkDestroyBuffer", null_DestroyBuffer),
+  NULL_ENTRY("vkGetBufferMemoryRequirements",
+	     null_GetBufferMemoryRequirements),
+  NULL_ENTRY("vkBindBufferMemory", null_BindBufferMemory),
+  NULL_ENTRY("vkCreateImage", null_CreateImage),
+  NULL_ENTRY("vkDestroyImage", null_DestroyImage),
+  NULL_ENTRY("vkGetImageMemoryRequirements",
+	     null_GetImageMemoryRequirements),
+  NULL_ENTRY("vkBindImageMemory", null_BindImageMemory),
+  NULL_ENTRY("vkGetImageSubresourceLayout", null_GetImageSubresourceLayout),
+  NULL_ENTRY("vkCreateBufferView", null_CreateBufferView),
+  NULL_ENTRY("vkDestroyBufferView", null_DestroyBufferView),
+  NULL_ENTRY("vkCreateImageView", null_CreateImageView),
+  NULL_ENTRY("vkDestroyImageView", null_DestroyImageView),
+  NULL_ENTRY("vkCreateSampler", null_CreateSampler),
+  NULL_ENTRY("vkDestroySampler", null_DestroySampler),
+  NULL_ENTRY("vkCreateShaderModule", null_CreateShaderModule),
+  NULL_ENTRY("vkDestroyShaderModule", null_DestroyShaderModule),
+  NULL_ENTRY("vkCreatePipelineLayout", null_CreatePipelineLayout),
+  NULL_ENTRY("vkDestroyPipelineLayout", null_DestroyPipelineLayout),
+  NULL_ENTRY("vkCreateDescriptorSetLayout", null_CreateDescriptorSetLayout),
+  NULL_ENTRY("vkDestroyDescriptorSetLayout",
+	     null_DestroyDescriptorSetLayout),
+  NULL_ENTRY("vkCreateRenderPass", null_CreateRenderPass),
+  NULL_ENTRY("vkDestroyRenderPass", null_DestroyRenderPass),
+  NULL_ENTRY("vkCreateFramebuffer", null_CreateFramebuffer),
+  NULL_ENTRY("vkDestroyFramebuffer", null_DestroyFramebuffer),
+  NULL_ENTRY("vkCreateSemaphore", null_CreateSemaphore),
+  NULL_ENTRY("vkDestroySemaphore", null_DestroySemaphore),
+  NULL_ENTRY("vkCreateQueryPool", null_CreateQueryPool),
+  NULL_ENTRY("vkDestroyQueryPool", null_DestroyQueryPool),
+  NULL_ENTRY("vkGetQueryPoolResults", null_GetQueryPoolResults),
+  NULL_ENTRY("vkCreatePipelineCache", null_CreatePipelineCache),
+  NULL_ENTRY("vkDestroyPipelineCache", null_DestroyPipelineCache),
+  NULL_ENTRY("vkGetPipelineCacheData", null_GetPipelineCacheData),
+  NULL_ENTRY("vkMergePipelineCaches", null_MergePipelineCaches),
+  NULL_ENTRY("vkCreateComputePipelines",
+	     null_CreatePipelines<VkComputePipelineCreateInfo>),
+  NULL_ENTRY("vkCreateGraphicsPipelines",
+	     null_CreatePipelines<VkGraphicsPipelineCreateInfo>),
+  NULL_ENTRY("vkDestroyPipeline", null_DestroyPipeline),
+  NULL_ENTRY("vkCreateDescriptorPool", null_CreateDescriptorPool),
+  NULL_ENTRY("vkDestroyDescriptorPool", null_DestroyDescriptorPool),
+  NULL_ENTRY("vkAllocateDescriptorSets", null_AllocateDescriptorSets),
+  NULL_ENTRY("vkFreeDescriptorSets", null_FreeDescriptorSets),
+  NULL_ENTRY("vkUpdateDescriptorSets", null_UpdateDescriptorSets),
+  NULL_ENTRY("vkCreateCommandPool", null_CreateCommandPool),
+  NULL_ENTRY("vkDestroyCommandPool", null_DestroyCommandPool),
+  NULL_ENTRY("vkAllocateCommandBuffers", null_AllocateCommandBuffers),
+  NULL_ENTRY("vkFreeCommandBuffers", null_FreeCommandBuffers),
+  NULL_ENTRY("vkBeginCommandBuffer", null_BeginCommandBuffer),
+  NULL_ENTRY("vkEndCommandBuffer", null_EndCommandBuffer),
+  NULL_ENTRY("vkResetCommandBuffer", null_ResetCommandBuffer),
+  NULL_ENTRY("vkCmdBindPipeline", null_CmdBindPipeline),
+  NULL_ENTRY("vkCmdSetViewport", null_CmdSetViewport),
+  NULL_ENTRY("vkCmdSetScissor", null_CmdSetScissor),
+  NULL_ENTRY("vkCmdBindDescriptorSets", null_CmdBindDescriptorSets),
+  NULL_ENTRY("vkCmdBindIndexBuffer", null_CmdBindIndexBuffer),
+  NULL_ENTRY("vkCmdBindVertexBuffers", null_CmdBindVertexBuffers),
+  NULL_ENTRY("vkCmdDraw", null_CmdDraw),
+  NULL_ENTRY("vkCmdDrawIndexed", null_CmdDrawIndexed),
+  NULL_ENTRY("vkCmdDrawIndexedIndirect", null_CmdDrawIndexedIndirect),
+  NULL_ENTRY("vkCmdDispatch", null_CmdDispatch),
+  NULL_ENTRY("vkCmdCopyBuffer", null_CmdCopyBuffer),
+  NULL_ENTRY("vkCmdCopyImage", null_CmdCopyImage),
+  NULL_ENTRY("vkCmdCopyBufferToImage", null_CmdCopyBufferToImage),
+  NULL_ENTRY("vkCmdCopyImageToBuffer", null_CmdCopyImageToBuffer),
+  NULL_ENTRY("vkCmdFillBuffer", null_CmdFillBuffer),
+  NULL_ENTRY("vkCmdClearColorImage", null_CmdClearColorImage),
+  NULL_ENTRY("vkCmdPipelineBarrier", null_CmdPipelineBarrier),
+  NULL_ENTRY("vkCmdResetQueryPool", null_CmdResetQueryPool),
+  NULL_ENTRY("vkCmdWriteTimestamp", null_CmdWriteTimestamp),
+  NULL_ENTRY("vkCmdPushConstants", null_CmdPushConstants),
+  NULL_ENTRY("vkCmdBeginRenderPass", null_CmdBeginRenderPass),
+  NULL_ENTRY("vkCmdEndRenderPass", null_CmdEndRenderPass),
+  NULL_ENTRY("vkCreateFence", null_CreateFence),
+  NULL_ENTRY("vkDestroyFence", null_DestroyFence),
+  NULL_ENTRY("vkResetFences", null_ResetFences),
+  NULL_ENTRY("vkGetFenceStatus", null_GetFenceStatus),
+  NULL_ENTRY("vkWaitForFences", null_WaitForFences),
+  NULL_ENTRY("vkQueueSubmit", null_QueueSubmit),
+  NULL_ENTRY("vkCreateSwapchainKHR", null_CreateSwapchainKHR),
+  NULL_ENTRY("vkDestroySwapchainKHR", null_DestroySwapchainKHR),
+  NULL_ENTRY("vkGetSwapchainImagesKHR", null_GetSwapchainImagesKHR),
+  NULL_ENTRY("vkAcquireNextImageKHR", null_AcquireNextImageKHR),
+  NULL_ENTRY("vkQueuePresentKHR", null_QueuePresentKHR)
+};
+
+static PFN_vkVoidFunction find_entry_point(const char* name)
+{
+  if (name == nullptr)
+    return nullptr;
+  for (const auto& entry : entry_points)
+    if (std::strcmp(entry.name, name) == 0)
+      return entry.fn;
+  return nullptr;
+}
+
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+null_GetDeviceProcAddr(VkDevice, const char* name)
+{
+  return find_entry_point(name);
+}
+
+NULL_ICD_EXPORT VKAPI_ATTR VkResult VKAPI_CALL
+vk_icdNegotiateLoaderICDInterfaceVersion(uint32_t* version)
+{
+  if (*version > ICD_INTERFACE_VERSION)
+    *version = ICD_INTERFACE_VERSION;
+  return VK_SUCCESS;
+}
+
+NULL_ICD_EXPORT VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+vk_icdGetInstanceProcAddr(VkInstance, const char* name)
+{
+  return find_entry_point(name);
+}
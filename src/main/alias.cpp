@@ -0,0 +1,65 @@
+#include "alias.hpp"
+
+#include <algorithm>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+  if (alignment == 0)
+    return value;
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool lifetimes_overlap(const alias_resource& a,
+			      const alias_resource& b)
+{
+  return a.first_use <= b.last_use && b.first_use <= a.last_use;
+}
+
+VkDeviceSize plan_aliasing(std::vector<alias_resource>& resources)
+{
+  // Largest first, each at the lowest offset that does not collide with
+  // an already placed resource that is alive at the same time.
+  std::vector<size_t> order;
+  for (size_t i = 0; i != resources.size(); i++)
+    if (resources[i].first_use != ALIAS_UNUSED)
+      order.push_back(i);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return resources[a].mem_reqs.size > resources[b].mem_reqs.size;
+    });
+
+  VkDeviceSize total = 0;
+  std::vector<size_t> placed;
+  for (auto idx : order) {
+    alias_resource& res = resources[idx];
+
+    std::vector<std::pair<VkDeviceSize, VkDeviceSize>> taken;
+    for (auto other : placed)
+      if (lifetimes_overlap(res, resources[other]))
+	taken.emplace_back(resources[other].offset,
+			   resources[other].offset
+			   + resources[other].mem_reqs.size);
+    std::sort(taken.begin(), taken.end());
+
+    VkDeviceSize offset = 0;
+    for (auto& range : taken) {
+      if (offset + res.mem_reqs.size <= range.first)
+	break;
+      offset = std::max(offset,
+			align_up(range.second, res.mem_reqs.alignment));
+    }
+
+    res.offset = offset;
+    total = std::max(total, offset + res.mem_reqs.size);
+    placed.push_back(idx);
+  }
+
+  // Unused resources hold nothing worth keeping, so they all sit at the
+  // start of the block
+  for (auto& res : resources)
+    if (res.first_use == ALIAS_UNUSED) {
+      res.offset = 0;
+      total = std::max(total, res.mem_reqs.size);
+    }
+
+  return total;
+}
@@ -0,0 +1,309 @@
+#include "command_recorder.hpp"
+#include "dispatch.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+command_recorder::command_recorder()
+  : cmd(VK_NULL_HANDLE),
+    requested(0),
+    recorded(0)
+{
+  invalidate();
+}
+
+void command_recorder::reset(VkCommandBuffer command_buffer)
+{
+  cmd = command_buffer;
+  invalidate();
+}
+
+void command_recorder::invalidate()
+{
+  for (auto& point : bind_points) {
+    point.pipeline = VK_NULL_HANDLE;
+    point.sets.clear();
+  }
+  vertex_bindings.clear();
+  index_bound = false;
+  index_buffer = VK_NULL_HANDLE;
+  index_offset = 0;
+  index_type = VK_INDEX_TYPE_UINT32;
+  push_layout = VK_NULL_HANDLE;
+  memset(push_data, 0, sizeof(push_data));
+  memset(push_stages, 0, sizeof(push_stages));
+  viewports.clear();
+  viewports_set.clear();
+  scissors.clear();
+  scissors_set.clear();
+}
+
+VkCommandBuffer command_recorder::command_buffer() const
+{
+  return cmd;
+}
+
+void command_recorder::bind_pipeline(VkPipelineBindPoint bind_point,
+				     VkPipeline pipeline)
+{
+  requested++;
+  if (static_cast<uint32_t>(bind_point) < BIND_POINT_COUNT) {
+    bind_point_state& point = bind_points[bind_point];
+    if (point.pipeline == pipeline)
+      return;
+    point.pipeline = pipeline;
+    // Dynamic state a pipeline has as static is overwritten by it
+    if (bind_point == VK_PIPELINE_BIND_POINT_GRAPHICS) {
+      viewports_set.clear();
+      scissors_set.clear();
+    }
+  }
+  vkd.vkCmdBindPipeline(cmd, bind_point, pipeline);
+  recorded++;
+}
+
+void command_recorder::bind_descriptor_sets(VkPipelineBindPoint bind_point,
+					    VkPipelineLayout layout,
+					    uint32_t first_set,
+					    uint32_t set_count,
+					    const VkDescriptorSet* sets,
+					    uint32_t dynamic_offset_count,
+					    const uint32_t* dynamic_offsets)
+{
+  requested++;
+  if (static_cast<uint32_t>(bind_point) < BIND_POINT_COUNT) {
+    std::vector<bound_set>& bound = bind_points[bind_point].sets;
+    bool same = bound.size() >= first_set + set_count;
+    for (uint32_t i = 0; same && i != set_count; i++) {
+      const bound_set& b = bound[first_set + i];
+      same = b.layout == layout
+	&& b.set == sets[i]
+	&& b.first_set == first_set
+	&& b.set_count == set_count
+	&& b.dynamic_offsets.size() == dynamic_offset_count
+	&& std::equal(b.dynamic_offsets.begin(), b.dynamic_offsets.end(),
+		      dynamic_offsets);
+    }
+    if (same)
+      return;
+
+    // Sets bound with another layout may be disturbed; forget them
+    for (auto& b : bound)
+      if (b.layout != layout)
+	b.set = VK_NULL_HANDLE;
+    if (bound.size() < first_set + set_count)
+      bound.resize(first_set + set_count,
+		   {VK_NULL_HANDLE, VK_NULL_HANDLE, 0, 0, {}});
+    for (uint32_t i = 0; i != set_count; i++) {
+      bound_set& b = bound[first_set + i];
+      b.layout = layout;
+      b.set = sets[i];
+      b.first_set = first_set;
+      b.set_count = set_count;
+      b.dynamic_offsets.assign(dynamic_offsets,
+			       dynamic_offsets + dynamic_offset_count);
+    }
+  }
+  vkd.vkCmdBindDescriptorSets(cmd, bind_point, layout,
+			      first_set, set_count, sets,
+			      dynamic_offset_count, dynamic_offsets);
+  recorded++;
+}
+
+void command_recorder::bind_vertex_buffers(uint32_t first_binding,
+					   uint32_t binding_count,
+					   const VkBuffer* buffers,
+					   const VkDeviceSize* offsets)
+{
+  requested++;
+  if (vertex_bindings.size() < first_binding + binding_count)
+    vertex_bindings.resize(first_binding + binding_count,
+			   {false, VK_NULL_HANDLE, 0,
+			    false, VK_NULL_HANDLE, 0});
+  for (uint32_t i = 0; i != binding_count; i++) {
+    vertex_binding& b = vertex_bindings[first_binding + i];
+    b.set = true;
+    b.buffer = buffers[i];
+    b.offset = offsets[i];
+  }
+}
+
+bool command_recorder::vertex_binding_dirty(const vertex_binding& b) const
+{
+  return b.set && (!b.recorded
+		   || b.recorded_buffer != b.buffer
+		   || b.recorded_offset != b.offset);
+}
+
+// Records each run of set bindings from its first to its last dirty one;
+// clean bindings in between are rebound rather than splitting the call
+void command_recorder::flush_vertex_buffers()
+{
+  uint32_t count = static_cast<uint32_t>(vertex_bindings.size());
+  uint32_t i = 0;
+  while (i != count) {
+    if (!vertex_binding_dirty(vertex_bindings[i])) {
+      i++;
+      continue;
+    }
+    uint32_t first = i;
+    uint32_t last = i;
+    for (; i != count && vertex_bindings[i].set; i++)
+      if (vertex_binding_dirty(vertex_bindings[i]))
+	last = i;
+
+    run_buffers.clear();
+    run_offsets.clear();
+    for (uint32_t j = first; j <= last; j++) {
+      vertex_binding& b = vertex_bindings[j];
+      run_buffers.push_back(b.buffer);
+      run_offsets.push_back(b.offset);
+      b.recorded = true;
+      b.recorded_buffer = b.buffer;
+      b.recorded_offset = b.offset;
+    }
+    vkd.vkCmdBindVertexBuffers(cmd, first, last - first + 1,
+			       run_buffers.data(), run_offsets.data());
+    recorded++;
+    i = last + 1;
+  }
+}
+
+void command_recorder::bind_index_buffer(VkBuffer buffer,
+					 VkDeviceSize offset,
+					 VkIndexType type)
+{
+  requested++;
+  if (index_bound && index_buffer == buffer && index_offset == offset
+      && index_type == type)
+    return;
+  index_bound = true;
+  index_buffer = buffer;
+  index_offset = offset;
+  index_type = type;
+  vkd.vkCmdBindIndexBuffer(cmd, buffer, offset, type);
+  recorded++;
+}
+
+void command_recorder::push_constants(VkPipelineLayout layout,
+				      VkShaderStageFlags stages,
+				      uint32_t offset,
+				      uint32_t size,
+				      const void* values)
+{
+  requested++;
+  if (offset + size <= MAX_PUSH_CONSTANTS) {
+    bool same = layout == push_layout
+      && memcmp(push_data + offset, values, size) == 0;
+    for (uint32_t i = offset; same && i != offset + size; i++)
+      same = push_stages[i] == stages;
+    if (same)
+      return;
+
+    // Constants pushed with another layout are not kept
+    if (layout != push_layout) {
+      memset(push_stages, 0, sizeof(push_stages));
+      push_layout = layout;
+    }
+    memcpy(push_data + offset, values, size);
+    for (uint32_t i = offset; i != offset + size; i++)
+      push_stages[i] = stages;
+  }
+  vkd.vkCmdPushConstants(cmd, layout, stages, offset, size, values);
+  recorded++;
+}
+
+void command_recorder::set_viewport(uint32_t first_viewport,
+				    uint32_t viewport_count,
+				    const VkViewport* new_viewports)
+{
+  requested++;
+  bool same = viewports_set.size() >= first_viewport + viewport_count;
+  for (uint32_t i = 0; same && i != viewport_count; i++)
+    same = viewports_set[first_viewport + i]
+      && memcmp(&viewports[first_viewport + i], &new_viewports[i],
+		sizeof(VkViewport)) == 0;
+  if (same)
+    return;
+
+  if (viewports_set.size() < first_viewport + viewport_count) {
+    viewports.resize(first_viewport + viewport_count);
+    viewports_set.resize(first_viewport + viewport_count, false);
+  }
+  for (uint32_t i = 0; i != viewport_count; i++) {
+    viewports[first_viewport + i] = new_viewports[i];
+    viewports_set[first_viewport + i] = true;
+  }
+  vkd.vkCmdSetViewport(cmd, first_viewport, viewport_count, new_viewports);
+  recorded++;
+}
+
+void command_recorder::set_scissor(uint32_t first_scissor,
+				   uint32_t scissor_count,
+				   const VkRect2D* new_scissors)
+{
+  requested++;
+  bool same = scissors_set.size() >= first_scissor + scissor_count;
+  for (uint32_t i = 0; same && i != scissor_count; i++)
+    same = scissors_set[first_scissor + i]
+      && memcmp(&scissors[first_scissor + i], &new_scissors[i],
+		sizeof(VkRect2D)) == 0;
+  if (same)
+    return;
+
+  if (scissors_set.size() < first_scissor + scissor_count) {
+    scissors.resize(first_scissor + scissor_count);
+    scissors_set.resize(first_scissor + scissor_count, false);
+  }
+  for (uint32_t i = 0; i != scissor_count; i++) {
+    scissors[first_scissor + i] = new_scissors[i];
+    scissors_set[first_scissor + i] = true;
+  }
+  vkd.vkCmdSetScissor(cmd, first_scissor, scissor_count, new_scissors);
+  recorded++;
+}
+
+void command_recorder::draw(uint32_t vertex_count,
+			    uint32_t instance_count,
+			    uint32_t first_vertex,
+			    uint32_t first_instance)
+{
+  flush_vertex_buffers();
+  vkd.vkCmdDraw(cmd, vertex_count, instance_count,
+		first_vertex, first_instance);
+}
+
+void command_recorder::draw_indexed(uint32_t index_count,
+				    uint32_t instance_count,
+				    uint32_t first_index,
+				    int32_t vertex_offset,
+				    uint32_t first_instance)
+{
+  flush_vertex_buffers();
+  vkd.vkCmdDrawIndexed(cmd, index_count, instance_count,
+		       first_index, vertex_offset, first_instance);
+}
+
+void command_recorder::draw_indexed_indirect(VkBuffer buffer,
+					     VkDeviceSize offset,
+					     uint32_t draw_count,
+					     uint32_t stride)
+{
+  flush_vertex_buffers();
+  vkd.vkCmdDrawIndexedIndirect(cmd, buffer, offset, draw_count, stride);
+}
+
+void command_recorder::dispatch(uint32_t x, uint32_t y, uint32_t z)
+{
+  vkd.vkCmdDispatch(cmd, x, y, z);
+}
+
+uint64_t command_recorder::requested_count() const
+{
+  return requested;
+}
+
+uint64_t command_recorder::recorded_count() const
+{
+  return recorded;
+}
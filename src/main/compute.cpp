@@ -7,10 +7,24 @@
 #include <iomanip>
 #include <thread>
 #include <cassert>
+#include <memory>
+#include <chrono>
+#include <cmath>
 
 #include <vulkan/vulkan.h>
 
 #include "allocator.hpp"
+#include "compute_engine.hpp"
+#include "cpu_backend.hpp"
+#include "dispatch.hpp"
+#include "gpu_profiler.hpp"
+#include "log.hpp"
+#include "queue_scheduler.hpp"
+#include "readback.hpp"
+#include "resource_pool.hpp"
+#include "submit_batch.hpp"
+#include "stream_compute.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 
 #define APP_SHORT_NAME     "VultureTest"
@@ -40,6 +54,15 @@
 
 #define MAX_QUEUES                      64
 
+// Pool capacity; BUFFER_COUNT are created up front
+#define MAX_BUFFERS                     1024
+
+// Fields of the buffer pool
+#define BUFFER_HANDLE                   0
+#define BUFFER_MEM_REQS                 1
+#define BUFFER_OFFSET                   2
+#define BUFFER_VIEW                     3
+
 #define READ_OFFSET                     0
 #define READ_LENGTH                     64
 
@@ -48,13 +71,41 @@
 
 #define BUFFER_FORMAT        VK_FORMAT_R8G8B8A8_UNORM
 
+#define PROFILER_FRAMES_IN_FLIGHT 1
+#define PROFILER_TRACE_FILE       "compute.trace.json"
+
+#define READBACK_RING_SIZE        (1 << 20)
+#define READBACK_FRAMES_IN_FLIGHT 2
+
+// saxpy through the compute engine: every dispatch adds a*x to y once.
+// None of the values are integers, so a fused multiply-add on either side
+// changes the rounding and shows up in the CPU comparison.
+#define ENGINE_ELEMENTS           (1 << 20)
+#define ENGINE_DISPATCHES         16
+#define SAXPY_A                   0.3f
+#define SAXPY_X(i)                (static_cast<float>((i) % 1024) * 0.37f)
+#define SAXPY_Y(i)                (static_cast<float>((i) % 777) * 0.11f)
+
+// Out-of-core streaming: the file named on the command line, or
+// STREAM_ELEMENTS generated words, pass through stream.comp in chunks
+#define STREAM_CHUNK_SIZE         (4 << 20)
+#define STREAM_DEPTH              3
+#define STREAM_ELEMENTS           (1 << 24)
+#define STREAM_SEED               0x9e3779b9
+#define STREAM_OUTPUT_FILE        "compute.stream.out"
+
+// Host reference run of simple.comp, saxpy.comp and stream.comp; 0
+// workers means one per hardware thread. The stream run starts at a
+// position whose low word wraps partway through.
+#define CPU_WORKERS               0
+#define CPU_STREAM_FIRST          ((5ull << 32) + 0xfffff000u)
+
+// CPU zones merged with the GPU timings
+#define TRACE_FILE                "compute.timeline.json"
+
 std::mutex device_mutex;
 std::mutex instance_mutex;
 std::mutex debug_report_callback_mutex;
-std::vector<std::mutex> resource_mutex[1] =
-  {std::vector<std::mutex>(BUFFER_COUNT)};
-std::vector<std::mutex> view_mutex[1] =
-  {std::vector<std::mutex>(BUFFER_COUNT)};
 std::mutex memory_mutex[2];
 std::mutex command_pool_mutex;
 std::vector<std::mutex> command_buffer_mutex(COMMAND_BUFFER_COUNT);
@@ -85,12 +136,21 @@ VkPhysicalDeviceMemoryProperties physical_device_mem_props;
 std::vector<VkQueueFamilyProperties> queue_family_properties;
 VkDevice device;
 VkDebugReportCallbackEXT debug_report_callback;
-std::vector<VkBuffer> buffers;
-std::vector<VkMemoryRequirements> buf_mem_requirements;
+typedef resource_pool<struct buffer_tag,
+		      VkBuffer,
+		      VkMemoryRequirements,
+		      VkDeviceSize,
+		      VkBufferView> buffer_pool_t;
+buffer_pool_t buffer_pool(MAX_BUFFERS);
+// Creation order; the shaders bind buffer i at binding i
+std::vector<buffer_pool_t::handle> buffers;
 VkDeviceSize mem_size[2];
 VkDeviceMemory memory[2];
-std::vector<VkBufferView> buffer_views;
 std::vector<VkQueue> queues;
+std::vector<std::unique_ptr<submit_batch>> submit_batches;
+std::vector<uint32_t> queue_families;
+queue_plan planned_queues;
+std::unique_ptr<queue_scheduler> scheduler;
 VkCommandPool command_pool;
 std::vector<VkCommandBuffer> command_buffers;
 VkSemaphore semaphore;
@@ -102,6 +162,33 @@ VkPipelineLayout compute_pipeline_layout;
 std::vector<VkDescriptorSetLayout> descriptor_set_layouts;
 VkDescriptorPool descriptor_pool;
 std::vector<VkDescriptorSet> descriptor_sets;
+std::unique_ptr<gpu_profiler> profiler;
+std::unique_ptr<readback_ring> readback;
+std::unique_ptr<compute_engine> engine;
+compute_buffer<float> saxpy_y = {COMPUTE_NO_BUFFER, 0};
+double saxpy_ms = 0.0;
+std::unique_ptr<job_system> jobs;
+std::unique_ptr<cpu_engine> cpu;
+std::unique_ptr<stream_compute> streamer;
+
+VkBuffer buffer_at(uint32_t buf_idx)
+{
+  return buffer_pool.get<BUFFER_HANDLE>(buffers[buf_idx]);
+}
+
+VkDeviceSize buffer_offset(uint32_t buf_idx)
+{
+  return buffer_pool.get<BUFFER_OFFSET>(buffers[buf_idx]);
+}
+
+std::vector<VkDeviceSize> buffer_offsets()
+{
+  std::vector<VkDeviceSize> offsets;
+  buffer_pool.for_each([&](buffer_pool_t::handle h) {
+      offsets.push_back(buffer_pool.get<BUFFER_OFFSET>(h));
+    });
+  return offsets;
+}
 
 const std::string logfile = "compute.log";
 const std::string errfile = "compute.err";
@@ -165,9 +252,10 @@ void create_instance()
   res = vkCreateInstance(&inst_info,
 			 CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
 			 &inst);
-  if (res == VK_SUCCESS)
+  if (res == VK_SUCCESS) {
     std::cout << "Instance created successfully!" << std::endl;
-  else
+    load_instance_dispatch(inst);
+  } else
     std::cout << "Instance creation failed..." << std::endl;
 }
 
@@ -256,24 +344,20 @@ void create_device()
   VkPhysicalDeviceFeatures supported_features;
   vkGetPhysicalDeviceFeatures(physical_devices[phys_device_idx], &supported_features);
 
-  std::vector<float> queue_priorities(queue_family_queue_count, 0.0);
-  VkDeviceQueueCreateInfo device_queue_create_info = {};
-  device_queue_create_info.sType = 
-    VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-  device_queue_create_info.pNext = nullptr;
-  device_queue_create_info.flags = 0;
-  device_queue_create_info.queueFamilyIndex = queue_family_idx;
-  device_queue_create_info.queueCount = queue_family_queue_count;
-  device_queue_create_info.pQueuePriorities = queue_priorities.data();
-  VkDeviceQueueCreateInfo device_queue_create_infos[1] = 
-    {device_queue_create_info};
+  std::vector<float> queue_priorities;
+  std::vector<VkDeviceQueueCreateInfo> device_queue_create_infos;
+  queue_create_infos(planned_queues,
+		     queue_family_properties,
+		     queue_priorities,
+		     device_queue_create_infos);
 
   VkDeviceCreateInfo device_create_info = {};
   device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
   device_create_info.pNext = nullptr;
   device_create_info.flags = 0;
-  device_create_info.queueCreateInfoCount = 1;
-  device_create_info.pQueueCreateInfos = device_queue_create_infos;
+  device_create_info.queueCreateInfoCount =
+    static_cast<uint32_t>(device_queue_create_infos.size());
+  device_create_info.pQueueCreateInfos = device_queue_create_infos.data();
 #if ENABLE_STANDARD_VALIDATION
   device_create_info.enabledLayerCount = 1;
   const char* enabled_layer_names[] = { "VK_LAYER_LUNARG_standard_validation" };
@@ -295,9 +379,13 @@ void create_device()
    		       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
    		       &device);
 
-  if (res == VK_SUCCESS)
+  if (res == VK_SUCCESS) {
     std::cout << "Device created successfully!" << std::endl;
-  else
+    unsigned int missing = load_device_dispatch(device);
+    if (missing != 0)
+      std::cout << missing << " device functions go through the loader"
+		<< std::endl;
+  } else
     std::cout << "Failed to create device..." << std::endl;
 }
 
@@ -350,36 +438,56 @@ void create_buffers()
     buf_create_infos[i].pQueueFamilyIndices = nullptr;
   }
   
-  buffers.resize(BUFFER_COUNT);
   std::cout << "Creating buffers (" << BUFFER_COUNT << ")..." << std::endl;
   for (int i = 0; i != BUFFER_COUNT; i++) {
+    // A failed buffer keeps its index with a null handle
+    VkBuffer buf = VK_NULL_HANDLE;
+    buffer_pool_t::handle h = {};
     res = vkCreateBuffer(device,
 			 &buf_create_infos[i],
 			 CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
-			 &buffers[i]);
+			 &buf);
     if (res == VK_SUCCESS)
+      h = buffer_pool.create(buf, VkMemoryRequirements(), 0, VK_NULL_HANDLE);
+    if (res == VK_SUCCESS && !h.null())
       std::cout << "Buffer " << i << " created successfully!" << std::endl;
+    else if (res == VK_SUCCESS)
+      std::cout << "Failed to create buffer " << i << ": pool is full"
+		<< std::endl;
     else
       std::cout << "Failed to create buffer " << i << "..." << std::endl;
+    buffers.push_back(h);
   }
 }
 
+// Buffers are placed back to back in one allocation, each at its
+// required alignment
 void get_buffer_memory_requirements()
 {
-  buf_mem_requirements.resize(BUFFER_COUNT);
   mem_size[RESOURCE_BUFFER] = 0;
-  for (unsigned int i = 0; i != BUFFER_COUNT; i++) {
-    std::cout << "Fetching memory requirements for buffer "
-	      << i << "..." << std::endl;
-    vkGetBufferMemoryRequirements(device,
-				  buffers[i],
-				  &buf_mem_requirements[i]);
-    mem_size[RESOURCE_BUFFER] += buf_mem_requirements[i].size;
-  }
+  buffer_pool.for_each([](buffer_pool_t::handle h) {
+      std::cout << "Fetching memory requirements for buffer "
+		<< h.index << "..." << std::endl;
+      VkMemoryRequirements& mem_reqs =
+	buffer_pool.get<BUFFER_MEM_REQS>(h);
+      vkGetBufferMemoryRequirements(device,
+				    buffer_pool.get<BUFFER_HANDLE>(h),
+				    &mem_reqs);
+      VkDeviceSize offset =
+	(mem_size[RESOURCE_BUFFER] + mem_reqs.alignment - 1)
+	/ mem_reqs.alignment * mem_reqs.alignment;
+      buffer_pool.get<BUFFER_OFFSET>(h) = offset;
+      mem_size[RESOURCE_BUFFER] = offset + mem_reqs.size;
+    });
 }
 
 void find_memory_types()
 {  
+  std::vector<VkMemoryRequirements> buf_mem_requirements;
+  buffer_pool.for_each([&](buffer_pool_t::handle h) {
+      buf_mem_requirements.push_back(buffer_pool.get<BUFFER_MEM_REQS>(h));
+    });
+
   for (uint32_t cur = 0;
        mem_types[RESOURCE_BUFFER] == UINT32_MAX
 	 && cur < physical_device_mem_props.memoryTypeCount;
@@ -439,13 +547,10 @@ void write_buffer_memory()
     std::cout << "Failed to map buffer memory..." << std::endl;
  
   char* str = new char[mem_size[RESOURCE_BUFFER]];
-  unsigned int k = 0;
-  for (unsigned int i = 0; i != BUFFER_COUNT; i++) {
-    for (unsigned int j = 0; j != buf_mem_requirements[i].size; j++) {
-      int off = rand() % 26;
-      unsigned char c = 'A' + off;
-      str[k++] = c;
-    }
+  for (unsigned int k = 0; k != mem_size[RESOURCE_BUFFER]; k++) {
+    int off = rand() % 26;
+    unsigned char c = 'A' + off;
+    str[k] = c;
   }
   str[mem_size[RESOURCE_BUFFER]-1] = '\0';
   memcpy(buf_data, str, mem_size[RESOURCE_BUFFER]);
@@ -458,38 +563,32 @@ void write_buffer_memory()
 
 void bind_buffer_memory()
 {
-  std::vector<std::unique_lock<std::mutex>> locks;
-  for (auto& mut : resource_mutex[RESOURCE_BUFFER])
-    locks.emplace_back(mut, std::defer_lock);
-  VkDeviceSize offset = 0;
-  for (unsigned int i = 0; i != BUFFER_COUNT; i++) {
-    locks[i].lock();
-    std::cout << "Binding buffer memory to buffer " << i
-	      << "..." << std::endl;
-    res = vkBindBufferMemory(device,
-			     buffers[i],
-			     memory[RESOURCE_BUFFER],
-			     offset);
-    offset += buf_mem_requirements[i].size;
-    if (res == VK_SUCCESS)
-      std::cout << "Buffer memory bound to buffer " << i
-		<< " successfully!" << std::endl;
-    else
-      std::cout << "Failed to bind buffer memory to buffer " << i
+  buffer_pool.for_each([](buffer_pool_t::handle h) {
+      std::cout << "Binding buffer memory to buffer " << h.index
 		<< "..." << std::endl;
-    locks[i].unlock();
-  }
+      res = vkBindBufferMemory(device,
+			       buffer_pool.get<BUFFER_HANDLE>(h),
+			       memory[RESOURCE_BUFFER],
+			       buffer_pool.get<BUFFER_OFFSET>(h));
+      if (res == VK_SUCCESS)
+	std::cout << "Buffer memory bound to buffer " << h.index
+		  << " successfully!" << std::endl;
+      else
+	std::cout << "Failed to bind buffer memory to buffer " << h.index
+		  << "..." << std::endl;
+    });
 }
 
 void create_buffer_views()
 {
-  buffer_views.resize(BUFFER_COUNT);
   for (unsigned int i = 0; i != BUFFER_COUNT; i++) {
+    if (!buffer_pool.alive(buffers[i]))
+      continue;
     VkBufferViewCreateInfo buf_view_create_info = {};
     buf_view_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO;
     buf_view_create_info.pNext = nullptr;
     buf_view_create_info.flags = 0;
-    buf_view_create_info.buffer = buffers[i];
+    buf_view_create_info.buffer = buffer_at(i);
     buf_view_create_info.format = BUFFER_FORMAT;
     buf_view_create_info.offset = 0;
     buf_view_create_info.range = VK_WHOLE_SIZE;
@@ -498,7 +597,7 @@ void create_buffer_views()
     res = vkCreateBufferView(device,
 			     &buf_view_create_info,
 			     CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
-			     &buffer_views[i]);
+			     &buffer_pool.get<BUFFER_VIEW>(buffers[i]));
     if (res == VK_SUCCESS)
       std::cout << "Buffer view " << i << " created successfully!"
 		<< std::endl;
@@ -508,18 +607,37 @@ void create_buffer_views()
   }
 }
 
+void plan_device_queues()
+{
+  planned_queues = plan_queues(queue_family_properties, queue_family_idx);
+  std::cout << "Queue families: main "
+	    << planned_queues.family[QUEUE_CLASS_MAIN]
+	    << ", compute " << planned_queues.family[QUEUE_CLASS_COMPUTE]
+	    << ", transfer " << planned_queues.family[QUEUE_CLASS_TRANSFER]
+	    << std::endl;
+}
+
+// The main family comes first, so its queues keep indices
+// 0..queue_family_queue_count-1
 void get_queues()
 {
-  queues.resize(queue_family_queue_count);
-  for (unsigned int queue_idx = 0;
-       queue_idx != queue_family_queue_count;
-       queue_idx++) {
-    std::cout << "Obtaining device queue " << (queue_idx+1)
-	      << "/" << queue_family_queue_count << "..." << std::endl;
-    vkGetDeviceQueue(device,
-		     queue_family_idx,
-		     queue_idx,
-		     &queues[queue_idx]);
+  queues.clear();
+  queue_families.clear();
+  for (auto family : planned_queues.families) {
+    uint32_t count = queue_family_properties[family].queueCount;
+    for (unsigned int i = 0; i != count; i++) {
+      if (queues.size() == MAX_QUEUES) {
+	std::cout << "Not using more than " << MAX_QUEUES << " queues..."
+		  << std::endl;
+	return;
+      }
+      std::cout << "Obtaining device queue " << (i+1) << "/" << count
+		<< " of family " << family << "..." << std::endl;
+      VkQueue queue;
+      vkGetDeviceQueue(device, family, i, &queue);
+      queues.push_back(queue);
+      queue_families.push_back(family);
+    }
   }
 }
 
@@ -572,22 +690,20 @@ void begin_recording()
   cmd_buf_begin_info.pNext = nullptr;
   cmd_buf_begin_info.flags = 0;
   cmd_buf_begin_info.pInheritanceInfo = nullptr;
-  std::cout << "Beginning command buffers (" << COMMAND_BUFFER_COUNT
-	    << ")..." << std::endl;
+  LOG_DEBUG("Beginning command buffers (" << COMMAND_BUFFER_COUNT
+	    << ")...");
   std::lock_guard<std::mutex> lock(command_pool_mutex);
   std::vector<std::unique_lock<std::mutex>> locks;
   for (auto& mut : command_buffer_mutex)
     locks.emplace_back(mut, std::defer_lock);
   for (unsigned int i = 0; i != COMMAND_BUFFER_COUNT; i++) {
     locks[i].lock();
-    res = vkBeginCommandBuffer(command_buffers[i],
-			       &cmd_buf_begin_info);
+    res = vkd.vkBeginCommandBuffer(command_buffers[i],
+				   &cmd_buf_begin_info);
     if (res == VK_SUCCESS)
-      std::cout << "Command buffer " << i << " is now recording."
-		<< std::endl;
+      LOG_DEBUG("Command buffer " << i << " is now recording.");
     else
-      std::cout << "Failed to begin command buffer " << i << "..."
-		<< std::endl;      
+      LOG_ERROR("Failed to begin command buffer " << i << "...");      
     locks[i].unlock();
   }
 }
@@ -599,19 +715,18 @@ void begin_recording(uint32_t command_buf_idx)
   cmd_buf_begin_info.pNext = nullptr;
   cmd_buf_begin_info.flags = 0;
   cmd_buf_begin_info.pInheritanceInfo = nullptr;
-  std::cout << "Beginning command buffer "
-	    << command_buf_idx << "..." << std::endl;
+  LOG_DEBUG("Beginning command buffer "
+	    << command_buf_idx << "...");
   std::lock_guard<std::mutex> pool_lock(command_pool_mutex);
   std::lock_guard<std::mutex> buf_lock(command_buffer_mutex[command_buf_idx]);
-  res = vkBeginCommandBuffer(command_buffers[command_buf_idx],
-			     &cmd_buf_begin_info);
+  res = vkd.vkBeginCommandBuffer(command_buffers[command_buf_idx],
+				 &cmd_buf_begin_info);
   if (res == VK_SUCCESS)
-    std::cout << "Command buffer " << command_buf_idx
-	      << " is now recording." << std::endl;
+    LOG_DEBUG("Command buffer " << command_buf_idx
+	      << " is now recording.");
   else
-    std::cout << "Failed to begin command buffer "
-	      << command_buf_idx << "..."
-	      << std::endl;   
+    LOG_ERROR("Failed to begin command buffer "
+	      << command_buf_idx << "...");   
 }
 
 void record_copy_buffer_commands()
@@ -621,21 +736,21 @@ void record_copy_buffer_commands()
   for (auto& mut : command_buffer_mutex)
     locks.emplace_back(mut, std::defer_lock);
   for (unsigned int i = 0; i != COMMAND_BUFFER_COUNT; i++) {
-    std::cout << "Adding vkCmdCopyBuffer from buffer " << 2*i
+    LOG_DEBUG("Adding vkCmdCopyBuffer from buffer " << 2*i
 	      << " to buffer " << 2*i+1 << " to command buffer " << i
-	      << "..." << std::endl;
+	      << "...");
     locks[i].lock();
-    VkBuffer src_buf = buffers[2*i];
-    VkBuffer dst_buf = buffers[2*i+1];
+    VkBuffer src_buf = buffer_at(2*i);
+    VkBuffer dst_buf = buffer_at(2*i+1);
     std::vector<VkBufferCopy> copies(1);
     copies[0].srcOffset = 0;
     copies[0].dstOffset = 0;
     copies[0].size = 128;
-    vkCmdCopyBuffer(command_buffers[i],
-		    src_buf,
-		    dst_buf,
-		    static_cast<uint32_t>(copies.size()),
-		    copies.data());
+    vkd.vkCmdCopyBuffer(command_buffers[i],
+			src_buf,
+			dst_buf,
+			static_cast<uint32_t>(copies.size()),
+			copies.data());
     locks[i].unlock();
   }
 }
@@ -648,129 +763,154 @@ void record_fill_buffer_commands()
     locks.emplace_back(mut, std::defer_lock);
   uint32_t data = make_data("ABCD");
   if (data == VT_BAD_DATA) {
-    std::cout << "Failed record_fill_buffer_commands(): bad data"
-	      << std::endl;
+    LOG_ERROR("Failed record_fill_buffer_commands(): bad data");
     return;
   }
   
   for (unsigned int i = 0; i != COMMAND_BUFFER_COUNT; i++) {
-    std::cout << "Adding vkCmdFillBuffer to buffer "
+    LOG_DEBUG("Adding vkCmdFillBuffer to buffer "
 	      << i << " to command buffer " << i
-	      << "..." << std::endl;
+	      << "...");
     locks[i].lock();
-    vkCmdFillBuffer(command_buffers[i],
-		    buffers[i],
-		    0,
-		    64,
-		    data);
+    vkd.vkCmdFillBuffer(command_buffers[i],
+			buffer_at(i),
+			0,
+			64,
+			data);
     locks[i].unlock();
   }
 }
 
 void end_recording()
 {
-  std::cout << "Ending command buffers (" << COMMAND_BUFFER_COUNT
-	    << ")..." << std::endl;
+  LOG_DEBUG("Ending command buffers (" << COMMAND_BUFFER_COUNT
+	    << ")...");
   std::lock_guard<std::mutex> lock(command_pool_mutex);
   std::vector<std::unique_lock<std::mutex>> locks;
   for (auto& mut : command_buffer_mutex)
     locks.emplace_back(mut, std::defer_lock);
   for (unsigned int i = 0; i != COMMAND_BUFFER_COUNT; i++) {
     locks[i].lock();
-    res = vkEndCommandBuffer(command_buffers[i]);
+    res = vkd.vkEndCommandBuffer(command_buffers[i]);
     if (res == VK_SUCCESS)
-      std::cout << "Command buffer " << i << " is no longer recording."
-		<< std::endl;
+      LOG_DEBUG("Command buffer " << i << " is no longer recording.");
     else
-      std::cout << "Failed to end command buffer " << i << "..."
-		<< std::endl;      
+      LOG_ERROR("Failed to end command buffer " << i << "...");      
     locks[i].unlock();
   }
 }
 
 void end_recording(uint32_t command_buf_idx)
 {
-  std::cout << "Ending command buffer " << command_buf_idx 
-	    << "..." << std::endl;
+  LOG_DEBUG("Ending command buffer " << command_buf_idx 
+	    << "...");
   std::lock_guard<std::mutex> pool_lock(command_pool_mutex);
   std::lock_guard<std::mutex> buf_lock(command_buffer_mutex[command_buf_idx]);
-  res = vkEndCommandBuffer(command_buffers[command_buf_idx]);
+  res = vkd.vkEndCommandBuffer(command_buffers[command_buf_idx]);
   if (res == VK_SUCCESS)
-    std::cout << "Command buffer " << command_buf_idx
-	      << " is no longer recording." << std::endl;
+    LOG_DEBUG("Command buffer " << command_buf_idx
+	      << " is no longer recording.");
   else
-    std::cout << "Failed to end command buffer " << command_buf_idx
-	      << "..." << std::endl;      
+    LOG_ERROR("Failed to end command buffer " << command_buf_idx
+	      << "...");      
 }
 
 void submit_all_to_queue(uint32_t queue_idx)
 {
-  std::vector<VkSubmitInfo> submit_infos(1);
-  submit_infos[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submit_infos[0].pNext = nullptr;
-  submit_infos[0].waitSemaphoreCount = 0;
-  submit_infos[0].pWaitSemaphores = nullptr;
-  submit_infos[0].pWaitDstStageMask = nullptr;
-  submit_infos[0].commandBufferCount =
-    static_cast<uint32_t>(command_buffers.size());
-  submit_infos[0].pCommandBuffers = command_buffers.data();
-  submit_infos[0].signalSemaphoreCount = 0;
-  submit_infos[0].pSignalSemaphores = nullptr;
-  std::cout << "Submitting command buffers to queue "
-	    << queue_idx << "..." << std::endl;
-  std::lock_guard<std::mutex> lock(queue_mutex[queue_idx]);
-  res = vkQueueSubmit(queues[queue_idx],
-		      static_cast<uint32_t>(submit_infos.size()),
-		      submit_infos.data(),
-		      VK_NULL_HANDLE);
-  if (res == VK_SUCCESS)
-    std::cout << "Command buffers submitted to queue " << queue_idx
-	      << " successfully!" << std::endl;
-  else
-    std::cout << "Failed to submit command buffers to queue "
-	      << queue_idx << "..." << std::endl;
-}
-
-void submit_to_queue(uint32_t command_buf_idx, uint32_t queue_idx)
-{
-  std::vector<VkSubmitInfo> submit_infos(1);
-  submit_infos[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submit_infos[0].pNext = nullptr;
-  submit_infos[0].waitSemaphoreCount = 0;
-  submit_infos[0].pWaitSemaphores = nullptr;
-  submit_infos[0].pWaitDstStageMask = nullptr;
-  submit_infos[0].commandBufferCount = 1;
-  submit_infos[0].pCommandBuffers = &command_buffers[command_buf_idx];
-  submit_infos[0].signalSemaphoreCount = 0;
-  submit_infos[0].pSignalSemaphores = nullptr;
-  std::cout << "Submitting command buffer " << command_buf_idx
-	    << " to queue " << queue_idx << "..." << std::endl;
-  std::lock_guard<std::mutex> lock(queue_mutex[queue_idx]);
-  res = vkQueueSubmit(queues[queue_idx],
-		      static_cast<uint32_t>(submit_infos.size()),
-		      submit_infos.data(),
-		      VK_NULL_HANDLE);
+  LOG_DEBUG("Queueing command buffers for queue "
+	    << queue_idx << "...");
+  submit_batches[queue_idx]->enqueue(command_buffers.data(),
+				     COMMAND_BUFFER_COUNT,
+				     nullptr, nullptr, 0,
+				     nullptr, 0);
+}
+
+void submit_to_queue(uint32_t command_buf_idx, uint32_t queue_idx,
+		     VkFence fence = VK_NULL_HANDLE)
+{
+  TRACE_SCOPE("submit");
+  LOG_DEBUG("Queueing command buffer " << command_buf_idx
+	    << " for queue " << queue_idx << "...");
+  submit_batches[queue_idx]->enqueue(command_buffers[command_buf_idx], fence);
+}
+
+void create_submit_batches()
+{
+  std::cout << "Creating submit batches (" << queues.size()
+	    << ")..." << std::endl;
+  for (unsigned int i = 0; i != queues.size(); i++)
+    submit_batches.emplace_back(new submit_batch(queues[i], queue_mutex[i]));
+}
+
+// Sends everything queued for the queue in as few vkQueueSubmit calls as
+// the fences allow, normally one
+void flush_queue(uint32_t queue_idx)
+{
+  if (submit_batches[queue_idx]->empty())
+    return;
+  LOG_DEBUG("Flushing submissions to queue " << queue_idx << "...");
+  res = submit_batches[queue_idx]->flush();
   if (res == VK_SUCCESS)
-    std::cout << "Command buffer " << command_buf_idx
-	      << " submitted to queue " << queue_idx
-	      << " successfully!" << std::endl;
+    LOG_DEBUG("Submissions flushed to queue " << queue_idx
+	      << " successfully!");
   else
-    std::cout << "Failed to submit command buffer "
-	      << command_buf_idx << " to queue "
-	      << queue_idx << "..." << std::endl;
+    LOG_ERROR("Failed to flush submissions to queue "
+	      << queue_idx << "...");
+}
+
+void create_queue_scheduler()
+{
+  std::vector<scheduled_queue> scheduled;
+  for (unsigned int i = 0; i != queues.size(); i++) {
+    scheduled_queue q = {queue_families[i], queues[i], &queue_mutex[i],
+			 submit_batches[i].get()};
+    scheduled.push_back(q);
+  }
+  scheduler.reset(new queue_scheduler(device,
+				      planned_queues,
+				      scheduled,
+				      CUSTOM_ALLOCATOR ? &alloc_callbacks
+				      : nullptr));
+  std::cout << "Created queue scheduler ("
+	    << scheduler->queue_count(QUEUE_CLASS_COMPUTE) << " compute, "
+	    << scheduler->queue_count(QUEUE_CLASS_TRANSFER)
+	    << " transfer queues"
+	    << (scheduler->concurrent(QUEUE_CLASS_COMPUTE) ?
+		", async compute" : "")
+	    << ")..." << std::endl;
+}
+
+void destroy_queue_scheduler()
+{
+  std::cout << "Destroying queue scheduler..." << std::endl;
+  scheduler.reset();
+}
+
+void destroy_submit_batches()
+{
+  uint64_t submits = 0;
+  uint64_t entries = 0;
+  for (auto& batch : submit_batches) {
+    submits += batch->submit_count();
+    entries += batch->entry_count();
+  }
+  std::cout << "Destroying submit batches (" << entries
+	    << " submissions in " << submits << " vkQueueSubmit calls)..."
+	    << std::endl;
+  submit_batches.clear();
 }
 
 void wait_for_queue(uint32_t queue_idx)
 {
-  std::cout << "Waiting for queue " << queue_idx
-	    << " to idle..." << std::endl;
-  res = vkQueueWaitIdle(queues[queue_idx]);
+  TRACE_SCOPE("wait for queue");
+  flush_queue(queue_idx);
+  LOG_DEBUG("Waiting for queue " << queue_idx
+	    << " to idle...");
+  res = vkd.vkQueueWaitIdle(queues[queue_idx]);
   if (res == VK_SUCCESS)
-    std::cout << "Queue " << queue_idx << " idled successfully!"
-	      << std::endl;
+    LOG_DEBUG("Queue " << queue_idx << " idled successfully!");
   else
-    std::cout << "Failed to wait for queue " << queue_idx
-	      << "...";
+    LOG_ERROR("Failed to wait for queue " << queue_idx << "...");
 }
 
 void reset_command_buffers()
@@ -779,15 +919,13 @@ void reset_command_buffers()
   for (auto& mut : command_buffer_mutex)
     locks.emplace_back(mut, std::defer_lock);
   for (unsigned int i = 0; i != COMMAND_BUFFER_COUNT; i++) {
-    std::cout << "Resetting command buffer " << i << "..." << std::endl;
+    LOG_DEBUG("Resetting command buffer " << i << "...");
     locks[i].lock();
-    res = vkResetCommandBuffer(command_buffers[i], 0);
+    res = vkd.vkResetCommandBuffer(command_buffers[i], 0);
     if (res == VK_SUCCESS)
-      std::cout << "Command buffer " << i << " reset successfully!"
-		<< std::endl;
+      LOG_DEBUG("Command buffer " << i << " reset successfully!");
     else
-      std::cout << "Failed to reset command buffer " << i << "..."
-		<< std::endl;
+      LOG_ERROR("Failed to reset command buffer " << i << "...");
     locks[i].unlock();
   }
 }
@@ -795,15 +933,14 @@ void reset_command_buffers()
 void reset_command_buffer(uint32_t command_buf_idx)
 {
   std::lock_guard<std::mutex> lock(command_buffer_mutex[command_buf_idx]);
-  std::cout << "Resetting command buffer " << command_buf_idx << "..."
-	    << std::endl;
-  res = vkResetCommandBuffer(command_buffers[command_buf_idx], 0);
+  LOG_DEBUG("Resetting command buffer " << command_buf_idx << "...");
+  res = vkd.vkResetCommandBuffer(command_buffers[command_buf_idx], 0);
   if (res == VK_SUCCESS)
-    std::cout << "Command buffer " << command_buf_idx
-	      << " reset successfully!" << std::endl;
+    LOG_DEBUG("Command buffer " << command_buf_idx
+	      << " reset successfully!");
   else
-    std::cout << "Failed to reset command buffer " << command_buf_idx
-	      << "..." << std::endl;
+    LOG_ERROR("Failed to reset command buffer " << command_buf_idx
+	      << "...");
 }
 
 void create_semaphore()
@@ -1095,9 +1232,9 @@ void allocate_descriptor_sets()
 	    << (DESCRIPTOR_SET_COUNT != 1 ? "s" : "") << "..."
 	    << std::endl;  
   descriptor_sets.resize(DESCRIPTOR_SET_COUNT);
-  res = vkAllocateDescriptorSets(device,
-				 &alloc_info,
-				 descriptor_sets.data());
+  res = vkd.vkAllocateDescriptorSets(device,
+				     &alloc_info,
+				     descriptor_sets.data());
   if (res == VK_SUCCESS)
     std::cout << "Allocated " << DESCRIPTOR_SET_COUNT << " descriptor set"
 	      << (DESCRIPTOR_SET_COUNT != 1 ? "s" : "") << " successfully!"
@@ -1118,7 +1255,7 @@ void update_descriptor_sets()
   
   std::vector<VkDescriptorBufferInfo> buffer_info(BUFFER_COUNT);
   for (unsigned int j = 0; j != BUFFER_COUNT; j++) {
-    buffer_info[j].buffer = buffers[j];
+    buffer_info[j].buffer = buffer_at(j);
     buffer_info[j].offset = 0;
     buffer_info[j].range = VK_WHOLE_SIZE;
   }
@@ -1137,14 +1274,13 @@ void update_descriptor_sets()
     writes[i].pTexelBufferView = nullptr;
   }
 
-  std::cout << "Updating " << DESCRIPTOR_SET_COUNT
+  LOG_DEBUG("Updating " << DESCRIPTOR_SET_COUNT
 	    << " descriptor set"
-	    << (DESCRIPTOR_SET_COUNT != 1 ? "s..." : "...")
-	    << std::endl;
-  vkUpdateDescriptorSets(device,
-			 static_cast<uint32_t>(writes.size()),
-			 writes.data(),
-			 0, nullptr);
+	    << (DESCRIPTOR_SET_COUNT != 1 ? "s..." : "..."));
+  vkd.vkUpdateDescriptorSets(device,
+			     static_cast<uint32_t>(writes.size()),
+			     writes.data(),
+			     0, nullptr);
 
   for (unsigned int i = 0; i != DESCRIPTOR_SET_COUNT; i++)
     locks[i].unlock();
@@ -1155,12 +1291,12 @@ void record_bind_compute_pipeline(uint32_t pipeline_idx,
 {
   std::lock_guard<std::mutex> buf_lock(command_buffer_mutex[command_buf_idx]);
   std::lock_guard<std::mutex> pool_lock(command_pool_mutex);
-  std::cout << "Recording bind compute pipeline " << pipeline_idx
+  LOG_DEBUG("Recording bind compute pipeline " << pipeline_idx
 	    << " to command buffer " << command_buf_idx
-	    << "..." << std::endl;
-  vkCmdBindPipeline(command_buffers[command_buf_idx],
-		    VK_PIPELINE_BIND_POINT_COMPUTE,
-		    compute_pipelines[pipeline_idx]);
+	    << "...");
+  vkd.vkCmdBindPipeline(command_buffers[command_buf_idx],
+			VK_PIPELINE_BIND_POINT_COMPUTE,
+			compute_pipelines[pipeline_idx]);
 }
 
 void record_bind_descriptor_set(uint32_t descriptor_set_idx,
@@ -1168,43 +1304,385 @@ void record_bind_descriptor_set(uint32_t descriptor_set_idx,
 {
   std::lock_guard<std::mutex> buf_lock(command_buffer_mutex[command_buf_idx]);
   std::lock_guard<std::mutex> pool_lock(command_pool_mutex);
-  std::cout << "Recording bind descriptor set " << descriptor_set_idx
-	    << " to command buffer " << command_buf_idx << "..."
-	    << std::endl;
-  vkCmdBindDescriptorSets(command_buffers[command_buf_idx],
-			  VK_PIPELINE_BIND_POINT_COMPUTE,
-			  compute_pipeline_layout,
-			  0,
-			  1,
-			  &descriptor_sets[descriptor_set_idx],
-			  0,
-			  nullptr);
+  LOG_DEBUG("Recording bind descriptor set " << descriptor_set_idx
+	    << " to command buffer " << command_buf_idx << "...");
+  vkd.vkCmdBindDescriptorSets(command_buffers[command_buf_idx],
+			      VK_PIPELINE_BIND_POINT_COMPUTE,
+			      compute_pipeline_layout,
+			      0,
+			      1,
+			      &descriptor_sets[descriptor_set_idx],
+			      0,
+			      nullptr);
 }
 
 void record_push_constants(uint32_t command_buf_idx)
 {
   std::lock_guard<std::mutex> buf_lock(command_buffer_mutex[command_buf_idx]);
   std::lock_guard<std::mutex> pool_lock(command_pool_mutex);
-  std::cout << "Recording push constants to command buffer "
-	    << command_buf_idx << "..." << std::endl;
-  vkCmdPushConstants(command_buffers[command_buf_idx],
-		     compute_pipeline_layout,
-		     VK_SHADER_STAGE_ALL,
-		     0,
-		     sizeof(push_constants),
-		     push_constants);
+  LOG_DEBUG("Recording push constants to command buffer "
+	    << command_buf_idx << "...");
+  vkd.vkCmdPushConstants(command_buffers[command_buf_idx],
+			 compute_pipeline_layout,
+			 VK_SHADER_STAGE_ALL,
+			 0,
+			 sizeof(push_constants),
+			 push_constants);
 }
 
 void record_dispatch_compute_pipeline(uint32_t command_buf_idx)
 {
+  TRACE_SCOPE("record dispatch");
   std::lock_guard<std::mutex> buf_lock(command_buffer_mutex[command_buf_idx]);
   std::lock_guard<std::mutex> pool_lock(command_pool_mutex);
-  std::cout << "Recording dispatch compute pipeline to command buffer "
-	    << command_buf_idx << "..." << std::endl;
-  vkCmdDispatch(command_buffers[command_buf_idx],
-		4,
-		5,
-		6);
+  LOG_DEBUG("Recording dispatch compute pipeline to command buffer "
+	    << command_buf_idx << "...");
+  gpu_scope scope(*profiler, command_buffers[command_buf_idx], "dispatch");
+  vkd.vkCmdDispatch(command_buffers[command_buf_idx],
+		    4,
+		    5,
+		    6);
+}
+
+void create_gpu_profiler()
+{
+  std::cout << "Creating GPU profiler..." << std::endl;
+  profiler.reset(new gpu_profiler(physical_devices[phys_device_idx],
+				  device,
+				  queue_family_idx,
+				  PROFILER_FRAMES_IN_FLIGHT,
+				  CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr));
+  if (!profiler->supported())
+    std::cout << "GPU timestamps are not supported, "
+	      << "dispatch timings will be unavailable" << std::endl;
+}
+
+void create_readback_ring()
+{
+  std::cout << "Creating readback ring (" << READBACK_RING_SIZE
+	    << " bytes)..." << std::endl;
+  readback.reset(new readback_ring(physical_devices[phys_device_idx],
+				   device,
+				   READBACK_RING_SIZE,
+				   READBACK_FRAMES_IN_FLIGHT,
+				   CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr));
+  if (!readback->valid())
+    std::cout << "Failed to create readback ring..." << std::endl;
+}
+
+// Queues the read range of every buffer; each is printed once the
+// submission that copies it has finished
+void read_back_all_buffers()
+{
+  for (unsigned int i = 0; i != BUFFER_COUNT; i++)
+    readback->read_buffer(buffer_at(i),
+			  READ_OFFSET,
+			  READ_LENGTH,
+			  [i](const char* data, VkDeviceSize size) {
+			    std::cout << "Buffer " << i << " (offset="
+				      << READ_OFFSET << ", len="
+				      << READ_LENGTH << "): "
+				      << std::string(data, strnlen(data, size))
+				      << std::endl;
+			  });
+}
+
+VkFence record_readback(uint32_t command_buf_idx)
+{
+  std::lock_guard<std::mutex> buf_lock(command_buffer_mutex[command_buf_idx]);
+  LOG_DEBUG("Recording " << readback->queued()
+	    << " readbacks to command buffer " << command_buf_idx << "...");
+  return readback->record(command_buffers[command_buf_idx]);
+}
+
+// Runs on an async compute queue when the device has one
+void create_compute_engine()
+{
+  const scheduled_queue& q = scheduler->pick(QUEUE_CLASS_COMPUTE);
+  std::cout << "Creating compute engine (queue family " << q.family
+	    << ")..." << std::endl;
+  engine.reset(new compute_engine(physical_devices[phys_device_idx],
+				  device,
+				  q.family,
+				  q.queue,
+				  *q.mutex,
+				  CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr));
+}
+
+void run_compute_engine(const std::string& filename)
+{
+  float a = SAXPY_A;
+  uint32_t saxpy = engine->load_kernel(filename, 2, sizeof(a));
+  if (saxpy == COMPUTE_NO_KERNEL)
+    return;
+
+  compute_buffer<float> x = engine->add_buffer<float>(ENGINE_ELEMENTS, true);
+  compute_buffer<float> y = engine->add_buffer<float>(ENGINE_ELEMENTS, true);
+  if (x.idx == COMPUTE_NO_BUFFER || y.idx == COMPUTE_NO_BUFFER)
+    return;
+  saxpy_y = y;
+  for (unsigned int i = 0; i != ENGINE_ELEMENTS; i++) {
+    engine->data(x)[i] = SAXPY_X(i);
+    engine->data(y)[i] = SAXPY_Y(i);
+  }
+
+  uint32_t local[3];
+  engine->local_size(saxpy, local);
+  std::cout << "Running saxpy over " << ENGINE_ELEMENTS << " elements "
+	    << ENGINE_DISPATCHES << " times (local size " << local[0]
+	    << "x" << local[1] << "x" << local[2] << ")..." << std::endl;
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i != ENGINE_DISPATCHES; i++)
+    engine->dispatch(saxpy, {x.idx, y.idx}, &a, ENGINE_ELEMENTS);
+  engine->submit();
+  engine->wait();
+  std::chrono::duration<double, std::milli> time =
+    std::chrono::steady_clock::now() - start;
+  saxpy_ms = time.count();
+
+  // Exact results are the CPU backend's to check; this only catches
+  // dispatches that were lost or ran twice
+  unsigned int errors = 0;
+  for (unsigned int i = 0; i != ENGINE_ELEMENTS; i++) {
+    float expected = SAXPY_Y(i) + ENGINE_DISPATCHES * a * SAXPY_X(i);
+    if (std::fabs(engine->data(y)[i] - expected) > 1e-3f * (1.0f + expected))
+      errors++;
+  }
+  std::cout << "saxpy finished in " << time.count() << " ms ("
+	    << engine->dispatch_count() << " dispatches, "
+	    << engine->submit_count() << " submits, " << errors
+	    << " wrong elements)" << std::endl;
+}
+
+// Upload and readback go to transfer queues and the kernel to a compute
+// queue, each a different one where the device has enough
+void create_stream_compute()
+{
+  const scheduled_queue& up = scheduler->pick(QUEUE_CLASS_TRANSFER);
+  const scheduled_queue& comp = scheduler->pick(QUEUE_CLASS_COMPUTE);
+  const scheduled_queue& down = scheduler->pick(QUEUE_CLASS_TRANSFER);
+  std::cout << "Creating stream compute (upload family " << up.family
+	    << ", compute family " << comp.family << ", download family "
+	    << down.family << ")..." << std::endl;
+
+  stream_queue upload = {up.family, up.queue, up.mutex};
+  stream_queue compute = {comp.family, comp.queue, comp.mutex};
+  stream_queue download = {down.family, down.queue, down.mutex};
+  streamer.reset(new stream_compute(physical_devices[phys_device_idx],
+				    device,
+				    upload,
+				    compute,
+				    download,
+				    STREAM_CHUNK_SIZE,
+				    STREAM_DEPTH,
+				    CUSTOM_ALLOCATOR ? &alloc_callbacks
+				    : nullptr));
+}
+
+// Host copy of stream.comp
+uint32_t stream_hash(uint32_t x, uint32_t i)
+{
+  uint32_t h = x ^ i ^ STREAM_SEED;
+  h = (h ^ (h >> 16)) * 0x45d9f3bu;
+  h = (h ^ (h >> 16)) * 0x45d9f3bu;
+  return h ^ (h >> 16);
+}
+
+void run_stream_compute(const std::string& filename, const char* input)
+{
+  uint32_t seed = STREAM_SEED;
+  if (!streamer->load_kernel(filename, sizeof(uint32_t), sizeof(uint32_t),
+			     &seed, sizeof(seed))) {
+    std::cout << "Failed to set up stream compute..." << std::endl;
+    return;
+  }
+
+  std::ofstream out(STREAM_OUTPUT_FILE, std::ios::binary);
+  std::vector<uint32_t> generated;
+  auto start = std::chrono::steady_clock::now();
+  bool ok;
+  if (input != nullptr) {
+    std::cout << "Streaming " << input << " to " << STREAM_OUTPUT_FILE
+	      << "..." << std::endl;
+    ok = streamer->run_file(input, out);
+  } else {
+    generated.resize(STREAM_ELEMENTS);
+    for (uint32_t i = 0; i != STREAM_ELEMENTS; i++)
+      generated[i] = i * 2654435761u;
+    std::cout << "Streaming " << STREAM_ELEMENTS << " generated words to "
+	      << STREAM_OUTPUT_FILE << "..." << std::endl;
+    ok = streamer->run(generated.data(),
+		       generated.size() * sizeof(uint32_t), out);
+  }
+  out.close();
+  std::chrono::duration<double> time =
+    std::chrono::steady_clock::now() - start;
+
+  std::cout << "Stream " << (ok ? "finished" : "failed") << " in "
+	    << time.count() * 1e3 << " ms (" << streamer->chunk_count()
+	    << " chunks, " << streamer->bytes_in() / time.count() / 1e6
+	    << " MB/s in)" << std::endl;
+  if (!ok || generated.empty())
+    return;
+
+  std::ifstream result(STREAM_OUTPUT_FILE, std::ios::binary);
+  unsigned int errors = 0;
+  for (uint32_t i = 0; i != STREAM_ELEMENTS; i++) {
+    uint32_t y = 0;
+    result.read(reinterpret_cast<char*>(&y), sizeof(y));
+    if (!result || y != stream_hash(generated[i], i))
+      errors++;
+  }
+  std::cout << "Stream output has " << errors << " wrong words" << std::endl;
+}
+
+void destroy_stream_compute()
+{
+  std::cout << "Destroying stream compute..." << std::endl;
+  streamer.reset();
+}
+
+void create_cpu_backend()
+{
+  jobs.reset(new job_system(CPU_WORKERS));
+  cpu.reset(new cpu_engine(*jobs));
+  std::cout << "Created CPU backend (" << jobs->thread_count()
+	    << " threads)..." << std::endl;
+}
+
+// simple.comp on the host against the first word of every GPU buffer
+void run_cpu_simple(const std::string& filename)
+{
+  uint32_t simple = cpu->load_kernel(filename, BUFFER_COUNT,
+				     sizeof(push_constants));
+  if (simple == COMPUTE_NO_KERNEL)
+    return;
+  std::vector<uint32_t> bufs(BUFFER_COUNT);
+  for (unsigned int i = 0; i != BUFFER_COUNT; i++)
+    bufs[i] = cpu->add_buffer(
+      buffer_pool.get<BUFFER_MEM_REQS>(buffers[i]).size, true);
+  cpu->dispatch(simple, bufs, push_constants, 4, 5, 6);
+  cpu->submit();
+
+  void* mapped;
+  std::lock_guard<std::mutex> lock(memory_mutex[RESOURCE_BUFFER]);
+  if (vkMapMemory(device, memory[RESOURCE_BUFFER], 0, VK_WHOLE_SIZE, 0,
+		  &mapped) != VK_SUCCESS) {
+    std::cout << "Failed to map buffer memory..." << std::endl;
+    return;
+  }
+  unsigned int errors = 0;
+  for (unsigned int i = 0; i != BUFFER_COUNT; i++) {
+    uint32_t gpu;
+    std::memcpy(&gpu, static_cast<char*>(mapped) + buffer_offset(i),
+		sizeof(gpu));
+    if (gpu != *static_cast<uint32_t*>(cpu->data(bufs[i])))
+      errors++;
+  }
+  vkUnmapMemory(device, memory[RESOURCE_BUFFER]);
+  std::cout << "CPU simple: " << errors << " buffers differ from the GPU"
+	    << std::endl;
+}
+
+// saxpy.comp on the host, compared bit for bit with the engine's run
+void run_cpu_saxpy(const std::string& filename)
+{
+  float a = SAXPY_A;
+  uint32_t saxpy = cpu->load_kernel(filename, 2, sizeof(a));
+  if (saxpy == COMPUTE_NO_KERNEL)
+    return;
+  compute_buffer<float> x = cpu->add_buffer<float>(ENGINE_ELEMENTS, true);
+  compute_buffer<float> y = cpu->add_buffer<float>(ENGINE_ELEMENTS, true);
+  for (unsigned int i = 0; i != ENGINE_ELEMENTS; i++) {
+    cpu->data(x)[i] = SAXPY_X(i);
+    cpu->data(y)[i] = SAXPY_Y(i);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i != ENGINE_DISPATCHES; i++)
+    cpu->dispatch(saxpy, {x.idx, y.idx}, &a, ENGINE_ELEMENTS);
+  cpu->submit();
+  cpu->wait();
+  std::chrono::duration<double, std::milli> time =
+    std::chrono::steady_clock::now() - start;
+
+  std::cout << "CPU saxpy finished in " << time.count() << " ms (GPU "
+	    << saxpy_ms << " ms)" << std::endl;
+  if (saxpy_y.idx == COMPUTE_NO_BUFFER)
+    return;
+
+  unsigned int errors = 0;
+  for (unsigned int i = 0; i != ENGINE_ELEMENTS; i++)
+    if (std::memcmp(cpu->data(y) + i, engine->data(saxpy_y) + i,
+		    sizeof(float)) != 0)
+      errors++;
+  std::cout << "CPU saxpy: " << errors << " elements differ from the GPU"
+	    << std::endl;
+}
+
+// stream.comp on the host as one chunk from CPU_STREAM_FIRST, against the
+// host copy of the kernel
+void run_cpu_stream(const std::string& filename)
+{
+  uint32_t seed = STREAM_SEED;
+  uint32_t stream = cpu->load_kernel(filename, 2, sizeof(seed));
+  if (stream == COMPUTE_NO_KERNEL)
+    return;
+  compute_buffer<uint32_t> x = cpu->add_buffer<uint32_t>(ENGINE_ELEMENTS,
+							 true);
+  compute_buffer<uint32_t> y = cpu->add_buffer<uint32_t>(ENGINE_ELEMENTS,
+							 true);
+  for (uint32_t i = 0; i != ENGINE_ELEMENTS; i++)
+    cpu->data(x)[i] = i * 2654435761u;
+
+  cpu->dispatch_at(CPU_STREAM_FIRST, stream, {x.idx, y.idx}, &seed,
+		   ENGINE_ELEMENTS);
+  cpu->submit();
+  cpu->wait();
+
+  unsigned int errors = 0;
+  for (uint32_t i = 0; i != ENGINE_ELEMENTS; i++)
+    if (cpu->data(y)[i] != stream_hash(cpu->data(x)[i],
+				       static_cast<uint32_t>(CPU_STREAM_FIRST
+							     + i)))
+      errors++;
+  std::cout << "CPU stream: " << errors << " elements differ from the host "
+	    << "copy" << std::endl;
+}
+
+void destroy_cpu_backend()
+{
+  std::cout << "Destroying CPU backend..." << std::endl;
+  cpu.reset();
+  jobs.reset();
+}
+
+void destroy_compute_engine()
+{
+  std::cout << "Destroying compute engine..." << std::endl;
+  engine.reset();
+}
+
+void destroy_readback_ring()
+{
+  readback->flush();
+  std::cout << "Destroying readback ring..." << std::endl;
+  readback.reset();
+}
+
+void destroy_gpu_profiler()
+{
+  profiler->collect();
+  profiler->print_stats(std::cout);
+  if (profiler->write_trace(PROFILER_TRACE_FILE))
+    std::cout << "Wrote GPU trace to " << PROFILER_TRACE_FILE << "!"
+	      << std::endl;
+  else
+    std::cout << "Failed to write GPU trace..." << std::endl;
+
+  std::cout << "Destroying GPU profiler..." << std::endl;
+  profiler.reset();
 }
 
 void fetch_compute_pipeline_cache_data()
@@ -1379,17 +1857,14 @@ void destroy_command_pool()
 
 void destroy_buffer_views()
 {
-  std::vector<std::unique_lock<std::mutex>> locks;
-  for (auto& mut : view_mutex[RESOURCE_BUFFER])
-    locks.emplace_back(mut, std::defer_lock);
-  for (unsigned i = 0; i != BUFFER_COUNT; i++) {
-    locks[i].lock();
-    std::cout << "Destroying buffer view " << i << "..." << std::endl;
-    vkDestroyBufferView(device,
-			buffer_views[i],
-			CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
-    locks[i].unlock();
-  }
+  buffer_pool.for_each([](buffer_pool_t::handle h) {
+      std::cout << "Destroying buffer view " << h.index << "..." << std::endl;
+      VkBufferView& view = buffer_pool.get<BUFFER_VIEW>(h);
+      vkDestroyBufferView(device,
+			  view,
+			  CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+      view = VK_NULL_HANDLE;
+    });
 }
 
 void free_buffer_memory()
@@ -1403,17 +1878,16 @@ void free_buffer_memory()
 
 void destroy_buffers()
 {
-  std::vector<std::unique_lock<std::mutex>> locks;
-  for (auto& mut : resource_mutex[RESOURCE_BUFFER])
-    locks.emplace_back(mut, std::defer_lock);
-  for (int i = 0; i != BUFFER_COUNT; i++) {
-    locks[i].lock();
-    std::cout << "Destroying buffer " << i << "..." << std::endl;
+  for (auto h : buffers) {
+    if (!buffer_pool.alive(h))
+      continue;
+    std::cout << "Destroying buffer " << h.index << "..." << std::endl;
     vkDestroyBuffer(device,
-		    buffers[i],
+		    buffer_pool.get<BUFFER_HANDLE>(h),
 		    CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
-    locks[i].unlock();
+    buffer_pool.destroy(h);
   }
+  buffers.clear();
 }
 
 void wait_for_device()
@@ -1461,10 +1935,15 @@ void destroy_instance()
 
 int main(int argc, const char* argv[])
 {
-  std::ofstream lfile;
-  std::streambuf* lsbuf = std::cout.rdbuf();
-  lfile.open(logfile);
-  std::cout.rdbuf(lfile.rdbuf());
+  // Everything written to std::cout goes through the log writer thread
+  if (!log_start(logfile))
+    std::cerr << "Failed to open " << logfile << "..." << std::endl;
+  std::streambuf* lsbuf = std::cout.rdbuf(log_stream_buffer());
+
+  if (!trace_start(TRACE_FILE))
+    std::cout << "Failed to start tracing to " << TRACE_FILE << "..."
+	      << std::endl;
+  trace_thread_name("main");
 
 #if ENABLE_STANDARD_VALIDATION
   std::ofstream efile;
@@ -1563,6 +2042,7 @@ int main(int argc, const char* argv[])
   queue_family_queue_count =
     queue_family_properties[queue_family_idx].queueCount;
 
+  plan_device_queues();
   create_device();
 
   if (ENABLE_STANDARD_VALIDATION)
@@ -1593,6 +2073,8 @@ int main(int argc, const char* argv[])
   create_buffer_views();
 
   get_queues();
+  create_submit_batches();
+  create_queue_scheduler();
   
   create_command_pool();
 
@@ -1615,7 +2097,7 @@ int main(int argc, const char* argv[])
   print_mem(device,
 	    memory[RESOURCE_BUFFER],
 	    memory_mutex[RESOURCE_BUFFER],
-	    READ_OFFSET + buf_mem_requirements[0].size,
+	    READ_OFFSET + buffer_offset(1),
 	    READ_LENGTH);
 
   uint32_t submit_queue_idx = 0;
@@ -1635,7 +2117,7 @@ int main(int argc, const char* argv[])
   print_mem(device,
 	    memory[RESOURCE_BUFFER],
 	    memory_mutex[RESOURCE_BUFFER],
-	    READ_OFFSET + buf_mem_requirements[0].size,
+	    READ_OFFSET + buffer_offset(1),
 	    READ_LENGTH);
 
   reset_command_buffers();
@@ -1689,35 +2171,52 @@ int main(int argc, const char* argv[])
 		    memory_mutex[RESOURCE_BUFFER],
 		    READ_OFFSET,
 		    READ_LENGTH,
-		    buf_mem_requirements);
+		    buffer_offsets());
+
+  create_gpu_profiler();
+  create_readback_ring();
 
   uint32_t compute_pipeline_idx = 0;
   begin_recording(COMMAND_BUFFER_COMPUTE);
+  profiler->begin_frame(command_buffers[COMMAND_BUFFER_COMPUTE]);
   record_bind_compute_pipeline(compute_pipeline_idx,
 			       COMMAND_BUFFER_COMPUTE);
   record_bind_descriptor_set(DESCRIPTOR_SET_COMPUTE,
 			     COMMAND_BUFFER_COMPUTE);
   record_push_constants(COMMAND_BUFFER_COMPUTE);
   record_dispatch_compute_pipeline(COMMAND_BUFFER_COMPUTE);
+  read_back_all_buffers();
+  VkFence readback_fence = record_readback(COMMAND_BUFFER_COMPUTE);
   end_recording(COMMAND_BUFFER_COMPUTE);
 
-  submit_to_queue(COMMAND_BUFFER_COMPUTE, submit_queue_idx);
+  submit_to_queue(COMMAND_BUFFER_COMPUTE, submit_queue_idx, readback_fence);
   wait_for_queue(submit_queue_idx);
   reset_command_buffer(COMMAND_BUFFER_COMPUTE);
 
   std::cout << "After submit:" << std::endl;
-  print_all_buffers(device,
-		    memory[RESOURCE_BUFFER],
-		    memory_mutex[RESOURCE_BUFFER],
-		    READ_OFFSET,
-		    READ_LENGTH,
-		    buf_mem_requirements);
+  readback->poll();
+
+  create_compute_engine();
+  run_compute_engine("shaders/saxpy.comp.spv");
+
+  create_cpu_backend();
+  run_cpu_simple("shaders/simple.comp.spv");
+  run_cpu_saxpy("shaders/saxpy.comp.spv");
+  run_cpu_stream("shaders/stream.comp.spv");
+
+  create_stream_compute();
+  run_stream_compute("shaders/stream.comp.spv", argc > 1 ? argv[1] : nullptr);
 
   fetch_compute_pipeline_cache_data();
   delete_compute_pipeline_cache_data();
  
   // Cleanup
   wait_for_device();
+  destroy_stream_compute();
+  destroy_cpu_backend();
+  destroy_compute_engine();
+  destroy_readback_ring();
+  destroy_gpu_profiler();
 
   free_descriptor_sets();
 
@@ -1746,13 +2245,17 @@ int main(int argc, const char* argv[])
   if (ENABLE_STANDARD_VALIDATION)
     destroy_debug_report_callback();
 
+  destroy_queue_scheduler();
+  destroy_submit_batches();
   wait_for_device();
   destroy_device();
   
   destroy_instance();
 
+  trace_stop();
+
   std::cout.rdbuf(lsbuf);
-  lfile.close();
+  log_stop();
 
 #if ENABLE_STANDARD_VALIDATION
   std::cerr.rdbuf(esbuf);
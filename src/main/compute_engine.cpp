@@ -0,0 +1,613 @@
+#include "compute_engine.hpp"
+#include "dispatch.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#define SPIRV_MAGIC               0x07230203
+#define SPIRV_OP_EXECUTION_MODE   16
+#define SPIRV_MODE_LOCAL_SIZE     17
+
+bool spirv_local_size(const std::vector<uint32_t>& spirv, uint32_t size[3])
+{
+  if (spirv.size() < 5 || spirv[0] != SPIRV_MAGIC)
+    return false;
+
+  for (size_t i = 5; i < spirv.size();) {
+    uint32_t word_count = spirv[i] >> 16;
+    uint32_t opcode = spirv[i] & 0xffff;
+    if (word_count == 0 || i + word_count > spirv.size())
+      return false;
+    if (opcode == SPIRV_OP_EXECUTION_MODE && word_count == 6
+	&& spirv[i + 2] == SPIRV_MODE_LOCAL_SIZE) {
+      size[0] = spirv[i + 3];
+      size[1] = spirv[i + 4];
+      size[2] = spirv[i + 5];
+      return true;
+    }
+    i += word_count;
+  }
+  return false;
+}
+
+compute_engine::compute_engine(VkPhysicalDevice physical_device,
+			       VkDevice device,
+			       uint32_t queue_family_idx,
+			       VkQueue queue,
+			       std::mutex& queue_mutex,
+			       const VkAllocationCallbacks* alloc_callbacks)
+  : device(device),
+    queue(queue),
+    queue_mutex(queue_mutex),
+    alloc_callbacks(alloc_callbacks),
+    command_pool(VK_NULL_HANDLE),
+    descriptor_pool(VK_NULL_HANDLE),
+    cur_batch(0),
+    dispatches(0),
+    submits(0)
+{
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physical_device, &props);
+  limits = props.limits;
+
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  pool_info.queueFamilyIndex = queue_family_idx;
+  VkResult res = vkCreateCommandPool(device, &pool_info, alloc_callbacks,
+				     &command_pool);
+  if (res != VK_SUCCESS)
+    std::cout << "Failed to create compute engine command pool..."
+	      << std::endl;
+
+  VkDescriptorPoolSize pool_size = {};
+  pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_size.descriptorCount = COMPUTE_MAX_SETS * COMPUTE_MAX_BINDINGS;
+
+  VkDescriptorPoolCreateInfo desc_pool_info = {};
+  desc_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  desc_pool_info.pNext = nullptr;
+  desc_pool_info.flags = 0;
+  desc_pool_info.maxSets = COMPUTE_MAX_SETS;
+  desc_pool_info.poolSizeCount = 1;
+  desc_pool_info.pPoolSizes = &pool_size;
+  res = vkCreateDescriptorPool(device, &desc_pool_info, alloc_callbacks,
+			       &descriptor_pool);
+  if (res != VK_SUCCESS)
+    std::cout << "Failed to create compute engine descriptor pool..."
+	      << std::endl;
+
+  batches.resize(COMPUTE_BATCHES);
+  for (auto& b : batches) {
+    b.command_buffer = VK_NULL_HANDLE;
+    b.fence = VK_NULL_HANDLE;
+    b.recording = false;
+    b.pending = false;
+
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.pNext = nullptr;
+    alloc_info.commandPool = command_pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = 1;
+    res = vkAllocateCommandBuffers(device, &alloc_info, &b.command_buffer);
+    if (res != VK_SUCCESS)
+      std::cout << "Failed to allocate compute engine command buffer..."
+		<< std::endl;
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = 0;
+    res = vkCreateFence(device, &fence_info, alloc_callbacks, &b.fence);
+    if (res != VK_SUCCESS)
+      std::cout << "Failed to create compute engine fence..." << std::endl;
+  }
+}
+
+compute_engine::~compute_engine()
+{
+  wait();
+
+  for (auto& b : batches) {
+    if (b.recording)
+      vkd.vkEndCommandBuffer(b.command_buffer);
+    vkDestroyFence(device, b.fence, alloc_callbacks);
+    vkFreeCommandBuffers(device, command_pool, 1, &b.command_buffer);
+  }
+  vkDestroyCommandPool(device, command_pool, alloc_callbacks);
+
+  // Destroying the pool frees every set allocated from it
+  vkDestroyDescriptorPool(device, descriptor_pool, alloc_callbacks);
+
+  for (auto& k : kernels) {
+    vkDestroyPipeline(device, k.pipeline, alloc_callbacks);
+    vkDestroyPipelineLayout(device, k.layout, alloc_callbacks);
+    vkDestroyDescriptorSetLayout(device, k.set_layout, alloc_callbacks);
+    vkDestroyShaderModule(device, k.module, alloc_callbacks);
+  }
+
+  for (auto& buf : buffers) {
+    if (buf.data != nullptr)
+      vkUnmapMemory(device, buf.memory);
+    vkDestroyBuffer(device, buf.buffer, alloc_callbacks);
+    vkFreeMemory(device, buf.memory, alloc_callbacks);
+  }
+}
+
+uint32_t compute_engine::find_memory_type(uint32_t type_bits,
+					  VkMemoryPropertyFlags flags) const
+{
+  for (uint32_t i = 0; i != mem_props.memoryTypeCount; i++)
+    if ((type_bits & (1u << i)) != 0 &&
+	(mem_props.memoryTypes[i].propertyFlags & flags) == flags)
+      return i;
+  return UINT32_MAX;
+}
+
+uint32_t compute_engine::add_kernel(const std::vector<uint32_t>& spirv,
+				    uint32_t buffer_count,
+				    uint32_t push_constant_size,
+				    const char* entry_point)
+{
+  kernel k = {};
+  if (!spirv_local_size(spirv, k.local_size)) {
+    std::cout << "Failed to find compute kernel local size..." << std::endl;
+    return COMPUTE_NO_KERNEL;
+  }
+
+  uint64_t invocations = 1;
+  for (unsigned int i = 0; i != 3; i++) {
+    invocations *= k.local_size[i];
+    if (k.local_size[i] == 0
+	|| k.local_size[i] > limits.maxComputeWorkGroupSize[i]) {
+      std::cout << "Compute kernel local size exceeds the device limit..."
+		<< std::endl;
+      return COMPUTE_NO_KERNEL;
+    }
+  }
+  if (invocations > limits.maxComputeWorkGroupInvocations) {
+    std::cout << "Compute kernel has too many invocations per workgroup ("
+	      << invocations << ")..." << std::endl;
+    return COMPUTE_NO_KERNEL;
+  }
+  if (buffer_count > COMPUTE_MAX_BINDINGS
+      || COMPUTE_HEADER_SIZE + push_constant_size
+      > limits.maxPushConstantsSize) {
+    std::cout << "Compute kernel needs too many buffers or push constants..."
+	      << std::endl;
+    return COMPUTE_NO_KERNEL;
+  }
+  k.buffer_count = buffer_count;
+  k.push_constant_size = push_constant_size;
+
+  VkShaderModuleCreateInfo module_info = {};
+  module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  module_info.pNext = nullptr;
+  module_info.flags = 0;
+  module_info.codeSize = spirv.size() * sizeof(uint32_t);
+  module_info.pCode = spirv.data();
+  if (vkCreateShaderModule(device, &module_info, alloc_callbacks,
+			   &k.module) != VK_SUCCESS) {
+    std::cout << "Failed to create compute kernel module..." << std::endl;
+    return COMPUTE_NO_KERNEL;
+  }
+
+  std::vector<VkDescriptorSetLayoutBinding> bindings(buffer_count);
+  for (uint32_t i = 0; i != buffer_count; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[i].pImmutableSamplers = nullptr;
+  }
+
+  VkDescriptorSetLayoutCreateInfo set_layout_info = {};
+  set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_layout_info.pNext = nullptr;
+  set_layout_info.flags = 0;
+  set_layout_info.bindingCount = buffer_count;
+  set_layout_info.pBindings = bindings.data();
+  vkCreateDescriptorSetLayout(device, &set_layout_info, alloc_callbacks,
+			      &k.set_layout);
+
+  VkPushConstantRange range = {};
+  range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  range.offset = 0;
+  range.size = COMPUTE_HEADER_SIZE + push_constant_size;
+
+  VkPipelineLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_info.pNext = nullptr;
+  layout_info.flags = 0;
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &k.set_layout;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &range;
+  vkCreatePipelineLayout(device, &layout_info, alloc_callbacks, &k.layout);
+
+  VkComputePipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.pNext = nullptr;
+  pipeline_info.flags = 0;
+  pipeline_info.stage.sType =
+    VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipeline_info.stage.pNext = nullptr;
+  pipeline_info.stage.flags = 0;
+  pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipeline_info.stage.module = k.module;
+  pipeline_info.stage.pName = entry_point;
+  pipeline_info.stage.pSpecializationInfo = nullptr;
+  pipeline_info.layout = k.layout;
+  pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+  pipeline_info.basePipelineIndex = -1;
+  if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipeline_info,
+			       alloc_callbacks, &k.pipeline) != VK_SUCCESS) {
+    std::cout << "Failed to create compute kernel pipeline..." << std::endl;
+    vkDestroyPipelineLayout(device, k.layout, alloc_callbacks);
+    vkDestroyDescriptorSetLayout(device, k.set_layout, alloc_callbacks);
+    vkDestroyShaderModule(device, k.module, alloc_callbacks);
+    return COMPUTE_NO_KERNEL;
+  }
+
+  kernels.push_back(k);
+  return static_cast<uint32_t>(kernels.size() - 1);
+}
+
+uint32_t compute_engine::load_kernel(const std::string& filename,
+				     uint32_t buffer_count,
+				     uint32_t push_constant_size)
+{
+  std::ifstream is(filename,
+		   std::ios::binary | std::ios::in | std::ios::ate);
+  if (!is.is_open()) {
+    std::cout << "Failed to read compute kernel file: " << filename << "..."
+	      << std::endl;
+    return COMPUTE_NO_KERNEL;
+  }
+
+  auto size = is.tellg();
+  is.seekg(0, std::ios::beg);
+  std::vector<uint32_t> spirv(size / sizeof(uint32_t));
+  is.read(reinterpret_cast<char*>(spirv.data()),
+	  spirv.size() * sizeof(uint32_t));
+  return add_kernel(spirv, buffer_count, push_constant_size);
+}
+
+void compute_engine::local_size(uint32_t kernel, uint32_t size[3]) const
+{
+  for (unsigned int i = 0; i != 3; i++)
+    size[i] = kernels[kernel].local_size[i];
+}
+
+uint32_t compute_engine::add_buffer(VkDeviceSize size, bool host_visible)
+{
+  storage buf = {};
+
+  VkBufferCreateInfo buf_info = {};
+  buf_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buf_info.pNext = nullptr;
+  buf_info.flags = 0;
+  buf_info.size = size;
+  buf_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+    | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+    | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buf_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  buf_info.queueFamilyIndexCount = 0;
+  buf_info.pQueueFamilyIndices = nullptr;
+  if (vkCreateBuffer(device, &buf_info, alloc_callbacks, &buf.buffer)
+      != VK_SUCCESS) {
+    std::cout << "Failed to create compute buffer (" << size
+	      << " bytes)..." << std::endl;
+    return COMPUTE_NO_BUFFER;
+  }
+
+  VkMemoryRequirements reqs;
+  vkGetBufferMemoryRequirements(device, buf.buffer, &reqs);
+
+  VkMemoryAllocateInfo mem_info = {};
+  mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  mem_info.pNext = nullptr;
+  mem_info.allocationSize = reqs.size;
+  mem_info.memoryTypeIndex = host_visible ?
+    find_memory_type(reqs.memoryTypeBits,
+		     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) :
+    find_memory_type(reqs.memoryTypeBits,
+		     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  if (mem_info.memoryTypeIndex == UINT32_MAX && !host_visible)
+    mem_info.memoryTypeIndex = find_memory_type(reqs.memoryTypeBits, 0);
+  if (mem_info.memoryTypeIndex == UINT32_MAX
+      || vkAllocateMemory(device, &mem_info, alloc_callbacks, &buf.memory)
+      != VK_SUCCESS) {
+    std::cout << "Failed to allocate compute buffer memory (" << size
+	      << " bytes)..." << std::endl;
+    vkDestroyBuffer(device, buf.buffer, alloc_callbacks);
+    return COMPUTE_NO_BUFFER;
+  }
+  vkBindBufferMemory(device, buf.buffer, buf.memory, 0);
+
+  if (host_visible
+      && vkMapMemory(device, buf.memory, 0, VK_WHOLE_SIZE, 0, &buf.data)
+      != VK_SUCCESS)
+    buf.data = nullptr;
+  buf.size = size;
+
+  buffers.push_back(buf);
+  return static_cast<uint32_t>(buffers.size() - 1);
+}
+
+VkBuffer compute_engine::buffer(uint32_t buf) const
+{
+  return buffers[buf].buffer;
+}
+
+void* compute_engine::data(uint32_t buf) const
+{
+  return buffers[buf].data;
+}
+
+VkDescriptorSet compute_engine::descriptor_set(uint32_t kernel_idx,
+					       const std::vector<uint32_t>& bufs)
+{
+  std::vector<uint32_t> key(1, kernel_idx);
+  key.insert(key.end(), bufs.begin(), bufs.end());
+  auto it = descriptor_sets.find(key);
+  if (it != descriptor_sets.end())
+    return it->second;
+
+  const kernel& k = kernels[kernel_idx];
+  VkDescriptorSetAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.pNext = nullptr;
+  alloc_info.descriptorPool = descriptor_pool;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &k.set_layout;
+  VkDescriptorSet set;
+  if (vkd.vkAllocateDescriptorSets(device, &alloc_info, &set) != VK_SUCCESS) {
+    std::cout << "Failed to allocate compute descriptor set (limit "
+	      << COMPUTE_MAX_SETS << ")..." << std::endl;
+    return VK_NULL_HANDLE;
+  }
+
+  std::vector<VkDescriptorBufferInfo> infos(bufs.size());
+  std::vector<VkWriteDescriptorSet> writes(bufs.size());
+  for (unsigned int i = 0; i != bufs.size(); i++) {
+    infos[i].buffer = buffers[bufs[i]].buffer;
+    infos[i].offset = 0;
+    infos[i].range = VK_WHOLE_SIZE;
+
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].pNext = nullptr;
+    writes[i].dstSet = set;
+    writes[i].dstBinding = i;
+    writes[i].dstArrayElement = 0;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[i].pImageInfo = nullptr;
+    writes[i].pBufferInfo = &infos[i];
+    writes[i].pTexelBufferView = nullptr;
+  }
+  vkd.vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()),
+			     writes.data(), 0, nullptr);
+
+  descriptor_sets[key] = set;
+  return set;
+}
+
+compute_engine::batch& compute_engine::begin_batch()
+{
+  batch& b = batches[cur_batch];
+  if (b.recording)
+    return b;
+
+  // Reusing a batch that is still running is the only place this stalls
+  if (b.pending) {
+    vkd.vkWaitForFences(device, 1, &b.fence, VK_TRUE, UINT64_MAX);
+    b.pending = false;
+  }
+  vkd.vkResetFences(device, 1, &b.fence);
+  vkd.vkResetCommandBuffer(b.command_buffer, 0);
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  begin_info.pInheritanceInfo = nullptr;
+  vkd.vkBeginCommandBuffer(b.command_buffer, &begin_info);
+
+  // Batches run back to back on the queue, so a barrier here also orders
+  // this batch after the one before it; carry that batch's buffers over
+  // and the first dispatch touching one of them records it
+  const batch& prev = batches[(cur_batch + batches.size() - 1)
+			      % batches.size()];
+  if (&prev != &b)
+    b.used = prev.used;
+  b.used.resize(buffers.size(), false);
+  b.recording = true;
+  return b;
+}
+
+void compute_engine::order_after_batch(batch& b,
+					const std::vector<uint32_t>& bufs)
+{
+  b.used.resize(buffers.size(), false);
+  bool depends = false;
+  for (auto buf : bufs)
+    depends = depends || b.used[buf];
+
+  if (depends) {
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT
+      | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+      | VK_ACCESS_SHADER_WRITE_BIT
+      | VK_ACCESS_TRANSFER_READ_BIT
+      | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkd.vkCmdPipelineBarrier(b.command_buffer,
+			     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+			     | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+			     | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			     0,
+			     1, &barrier,
+			     0, nullptr,
+			     0, nullptr);
+    b.used.assign(buffers.size(), false);
+  }
+  for (auto buf : bufs)
+    b.used[buf] = true;
+}
+
+bool compute_engine::dispatch(uint32_t kernel_idx,
+			      const std::vector<uint32_t>& bufs,
+			      const void* push_constants,
+			      uint32_t x,
+			      uint32_t y,
+			      uint32_t z)
+{
+  if (kernel_idx >= kernels.size()
+      || bufs.size() != kernels[kernel_idx].buffer_count)
+    return false;
+  for (auto buf : bufs)
+    if (buf >= buffers.size())
+      return false;
+  if (x == 0 || y == 0 || z == 0)
+    return true;
+
+  VkDescriptorSet set = descriptor_set(kernel_idx, bufs);
+  if (set == VK_NULL_HANDLE)
+    return false;
+
+  const kernel& k = kernels[kernel_idx];
+  batch& b = begin_batch();
+  VkCommandBuffer cmd = b.command_buffer;
+
+  order_after_batch(b, bufs);
+
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, k.pipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, k.layout,
+			      0, 1, &set, 0, nullptr);
+  if (k.push_constant_size != 0 && push_constants != nullptr)
+    vkd.vkCmdPushConstants(cmd, k.layout, VK_SHADER_STAGE_COMPUTE_BIT,
+			   COMPUTE_HEADER_SIZE, k.push_constant_size,
+			   push_constants);
+
+  uint32_t problem[3] = {x, y, z};
+  uint32_t groups[3];
+  for (unsigned int i = 0; i != 3; i++)
+    groups[i] = static_cast<uint32_t>(
+      (static_cast<uint64_t>(problem[i]) + k.local_size[i] - 1)
+      / k.local_size[i]);
+
+  // Split into parts no larger than maxComputeWorkGroupCount
+  const uint32_t* max_groups = limits.maxComputeWorkGroupCount;
+  uint32_t header[8] = {0, 0, 0, 0, x, y, z, 0};
+  for (uint32_t gz = 0; gz < groups[2]; gz += max_groups[2])
+    for (uint32_t gy = 0; gy < groups[1]; gy += max_groups[1])
+      for (uint32_t gx = 0; gx < groups[0]; gx += max_groups[0]) {
+	header[0] = gx * k.local_size[0];
+	header[1] = gy * k.local_size[1];
+	header[2] = gz * k.local_size[2];
+	vkd.vkCmdPushConstants(cmd, k.layout, VK_SHADER_STAGE_COMPUTE_BIT,
+			       0, COMPUTE_HEADER_SIZE, header);
+	vkd.vkCmdDispatch(cmd,
+			  std::min(max_groups[0], groups[0] - gx),
+			  std::min(max_groups[1], groups[1] - gy),
+			  std::min(max_groups[2], groups[2] - gz));
+	dispatches++;
+      }
+  return true;
+}
+
+bool compute_engine::copy(uint32_t src, uint32_t dst, VkDeviceSize size)
+{
+  if (src >= buffers.size() || dst >= buffers.size()
+      || size > buffers[src].size || size > buffers[dst].size)
+    return false;
+
+  batch& b = begin_batch();
+  order_after_batch(b, {src, dst});
+
+  VkBufferCopy region = {};
+  region.srcOffset = 0;
+  region.dstOffset = 0;
+  region.size = size;
+  vkd.vkCmdCopyBuffer(b.command_buffer, buffers[src].buffer, buffers[dst].buffer,
+		      1, &region);
+  return true;
+}
+
+void compute_engine::submit()
+{
+  batch& b = batches[cur_batch];
+  if (!b.recording)
+    return;
+
+  // Results are read through mapped memory once the fence signals
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT
+    | VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkd.vkCmdPipelineBarrier(b.command_buffer,
+			   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+			   | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			   VK_PIPELINE_STAGE_HOST_BIT,
+			   0,
+			   1, &barrier,
+			   0, nullptr,
+			   0, nullptr);
+  vkd.vkEndCommandBuffer(b.command_buffer);
+  b.recording = false;
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = nullptr;
+  submit_info.waitSemaphoreCount = 0;
+  submit_info.pWaitSemaphores = nullptr;
+  submit_info.pWaitDstStageMask = nullptr;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &b.command_buffer;
+  submit_info.signalSemaphoreCount = 0;
+  submit_info.pSignalSemaphores = nullptr;
+
+  VkResult res;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    res = vkd.vkQueueSubmit(queue, 1, &submit_info, b.fence);
+  }
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to submit compute batch..." << std::endl;
+    return;
+  }
+
+  b.pending = true;
+  cur_batch = (cur_batch + 1) % batches.size();
+  submits++;
+}
+
+void compute_engine::wait()
+{
+  for (auto& b : batches)
+    if (b.pending) {
+      vkd.vkWaitForFences(device, 1, &b.fence, VK_TRUE, UINT64_MAX);
+      b.pending = false;
+    }
+}
+
+uint64_t compute_engine::dispatch_count() const
+{
+  return dispatches;
+}
+
+uint64_t compute_engine::submit_count() const
+{
+  return submits;
+}
@@ -0,0 +1,307 @@
+#include "cpu_backend.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#if defined(__AVX2__)
+#define CPU_USE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPU_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define CPU_BUFFER_ALIGNMENT  64
+#define CPU_DEFAULT_GRAIN     (1 << 16)
+
+// Matches the constant in src/shader/stream.comp
+#define STREAM_HASH_MULTIPLIER 0x45d9f3bu
+
+// simple.comp: every invocation stores the same two words, so one does
+static void simple_kernel(const cpu_dispatch& d, uint64_t begin, uint64_t)
+{
+  if (begin != 0)
+    return;
+  const uint32_t* pc = static_cast<const uint32_t*>(d.push_constants);
+  for (uint32_t i = 0; d.buffers[i] != nullptr; i++)
+    static_cast<uint32_t*>(d.buffers[i])[0] = i % 2 == 0 ? pc[0] : pc[1];
+}
+
+// saxpy.comp: y = a * x + y, kept as a separate multiply and add
+static void saxpy_kernel(const cpu_dispatch& d, uint64_t begin, uint64_t end)
+{
+  const float* x = static_cast<const float*>(d.buffers[0]);
+  float* y = static_cast<float*>(d.buffers[1]);
+  float a = *static_cast<const float*>(d.push_constants);
+  end = std::min<uint64_t>(end, d.size[0]);
+
+  uint64_t i = begin;
+#if defined(CPU_USE_AVX2)
+  __m256 va = _mm256_set1_ps(a);
+  for (; i + 8 <= end; i += 8)
+    _mm256_storeu_ps(y + i,
+		     _mm256_add_ps(_mm256_mul_ps(va, _mm256_loadu_ps(x + i)),
+				   _mm256_loadu_ps(y + i)));
+#elif defined(CPU_USE_SSE2)
+  __m128 va = _mm_set1_ps(a);
+  for (; i + 4 <= end; i += 4)
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_mul_ps(va, _mm_loadu_ps(x + i)),
+				    _mm_loadu_ps(y + i)));
+#endif
+  for (; i < end; i++)
+    y[i] = a * x[i] + y[i];
+}
+
+#if defined(CPU_USE_SSE2)
+// SSE2 has no 32 bit low multiply; do even and odd lanes separately
+static inline __m128i mullo_epi32(__m128i a, __m128i b)
+{
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			    _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#endif
+
+static inline uint32_t stream_hash(uint32_t h)
+{
+  h = (h ^ (h >> 16)) * STREAM_HASH_MULTIPLIER;
+  h = (h ^ (h >> 16)) * STREAM_HASH_MULTIPLIER;
+  return h ^ (h >> 16);
+}
+
+// stream.comp: mixes every word with its position in the whole stream
+static void stream_kernel(const cpu_dispatch& d, uint64_t begin, uint64_t end)
+{
+  const uint32_t* x = static_cast<const uint32_t*>(d.buffers[0]);
+  uint32_t* y = static_cast<uint32_t*>(d.buffers[1]);
+  uint32_t seed = *static_cast<const uint32_t*>(d.push_constants);
+  uint32_t first = d.offset[3];
+  end = std::min<uint64_t>(end, d.size[0]);
+
+  uint64_t i = begin;
+#if defined(CPU_USE_AVX2)
+  __m256i mul = _mm256_set1_epi32(static_cast<int>(STREAM_HASH_MULTIPLIER));
+  __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i vseed = _mm256_set1_epi32(static_cast<int>(seed));
+  for (; i + 8 <= end; i += 8) {
+    __m256i idx = _mm256_add_epi32(
+      _mm256_set1_epi32(static_cast<int>(first + static_cast<uint32_t>(i))),
+      lanes);
+    __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+    h = _mm256_xor_si256(_mm256_xor_si256(h, idx), vseed);
+    h = _mm256_mullo_epi32(_mm256_xor_si256(h, _mm256_srli_epi32(h, 16)),
+			   mul);
+    h = _mm256_mullo_epi32(_mm256_xor_si256(h, _mm256_srli_epi32(h, 16)),
+			   mul);
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), h);
+  }
+#elif defined(CPU_USE_SSE2)
+  __m128i mul = _mm_set1_epi32(static_cast<int>(STREAM_HASH_MULTIPLIER));
+  __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+  __m128i vseed = _mm_set1_epi32(static_cast<int>(seed));
+  for (; i + 4 <= end; i += 4) {
+    __m128i idx = _mm_add_epi32(
+      _mm_set1_epi32(static_cast<int>(first + static_cast<uint32_t>(i))),
+      lanes);
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    h = _mm_xor_si128(_mm_xor_si128(h, idx), vseed);
+    h = mullo_epi32(_mm_xor_si128(h, _mm_srli_epi32(h, 16)), mul);
+    h = mullo_epi32(_mm_xor_si128(h, _mm_srli_epi32(h, 16)), mul);
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), h);
+  }
+#endif
+  for (; i < end; i++)
+    y[i] = stream_hash(x[i] ^ (first + static_cast<uint32_t>(i)) ^ seed);
+}
+
+cpu_kernel_fn find_cpu_kernel(const std::string& name)
+{
+  if (name == "simple")
+    return simple_kernel;
+  if (name == "saxpy")
+    return saxpy_kernel;
+  if (name == "stream")
+    return stream_kernel;
+  return nullptr;
+}
+
+cpu_engine::cpu_engine(job_system& jobs)
+  : jobs(jobs),
+    dispatches(0),
+    submits(0)
+{
+}
+
+uint32_t cpu_engine::add_kernel(cpu_kernel_fn fn,
+				uint32_t buffer_count,
+				uint32_t push_constant_size,
+				uint32_t grain)
+{
+  if (fn == nullptr)
+    return COMPUTE_NO_KERNEL;
+  kernel k = {fn, buffer_count, push_constant_size, std::max(grain, 1u)};
+  kernels.push_back(k);
+  return static_cast<uint32_t>(kernels.size() - 1);
+}
+
+uint32_t cpu_engine::load_kernel(const std::string& filename,
+				 uint32_t buffer_count,
+				 uint32_t push_constant_size)
+{
+  size_t start = filename.find_last_of("/\\");
+  start = start == std::string::npos ? 0 : start + 1;
+  std::string name = filename.substr(start,
+				     filename.find('.', start) - start);
+
+  cpu_kernel_fn fn = find_cpu_kernel(name);
+  if (fn == nullptr) {
+    std::cout << "No CPU kernel for " << filename << "..." << std::endl;
+    return COMPUTE_NO_KERNEL;
+  }
+  return add_kernel(fn, buffer_count, push_constant_size,
+		    CPU_DEFAULT_GRAIN);
+}
+
+uint32_t cpu_engine::add_buffer(VkDeviceSize size, bool)
+{
+  storage buf;
+  buf.bytes.resize(static_cast<size_t>(size) + CPU_BUFFER_ALIGNMENT);
+  uintptr_t addr = reinterpret_cast<uintptr_t>(buf.bytes.data());
+  buf.data = buf.bytes.data()
+    + (CPU_BUFFER_ALIGNMENT - addr % CPU_BUFFER_ALIGNMENT)
+    % CPU_BUFFER_ALIGNMENT;
+  buf.size = size;
+
+  // The vector's storage survives the move, so data stays valid
+  buffers.push_back(std::move(buf));
+  return static_cast<uint32_t>(buffers.size() - 1);
+}
+
+void* cpu_engine::data(uint32_t buf) const
+{
+  return buffers[buf].data;
+}
+
+bool cpu_engine::dispatch(uint32_t kernel_idx,
+			  const std::vector<uint32_t>& bufs,
+			  const void* push_constants,
+			  uint32_t x,
+			  uint32_t y,
+			  uint32_t z)
+{
+  return dispatch_at(0, kernel_idx, bufs, push_constants, x, y, z);
+}
+
+bool cpu_engine::dispatch_at(uint64_t first,
+			     uint32_t kernel_idx,
+			     const std::vector<uint32_t>& bufs,
+			     const void* push_constants,
+			     uint32_t x,
+			     uint32_t y,
+			     uint32_t z)
+{
+  if (kernel_idx >= kernels.size()
+      || bufs.size() != kernels[kernel_idx].buffer_count)
+    return false;
+  for (auto buf : bufs)
+    if (buf >= buffers.size())
+      return false;
+  if (x == 0 || y == 0 || z == 0)
+    return true;
+
+  command c = {};
+  c.kernel = kernel_idx;
+  c.buffers = bufs;
+  if (push_constants != nullptr) {
+    const char* bytes = static_cast<const char*>(push_constants);
+    c.push_constants.assign(bytes,
+			    bytes + kernels[kernel_idx].push_constant_size);
+  }
+  c.size[0] = x;
+  c.size[1] = y;
+  c.size[2] = z;
+  c.first = first;
+  commands.push_back(std::move(c));
+  return true;
+}
+
+bool cpu_engine::copy(uint32_t src, uint32_t dst, VkDeviceSize size)
+{
+  if (src >= buffers.size() || dst >= buffers.size()
+      || size > buffers[src].size || size > buffers[dst].size)
+    return false;
+
+  command c = {};
+  c.kernel = COMPUTE_NO_KERNEL;
+  c.buffers = {src, dst};
+  c.copy_size = size;
+  commands.push_back(std::move(c));
+  return true;
+}
+
+void cpu_engine::submit()
+{
+  if (commands.empty())
+    return;
+
+  TRACE_SCOPE("cpu submit");
+  for (auto& c : commands) {
+    if (c.kernel == COMPUTE_NO_KERNEL) {
+      std::memmove(buffers[c.buffers[1]].data, buffers[c.buffers[0]].data,
+		   static_cast<size_t>(c.copy_size));
+      continue;
+    }
+
+    // Null terminated so kernels over a buffer array can find its end
+    const kernel& k = kernels[c.kernel];
+    std::vector<void*> data(c.buffers.size() + 1, nullptr);
+    std::vector<VkDeviceSize> sizes(c.buffers.size() + 1, 0);
+    for (size_t i = 0; i != c.buffers.size(); i++) {
+      data[i] = buffers[c.buffers[i]].data;
+      sizes[i] = buffers[c.buffers[i]].size;
+    }
+
+    // Never split, so the whole dispatch is the one part at offset zero
+    cpu_dispatch d = {};
+    d.offset[0] = 0;
+    d.offset[1] = 0;
+    d.offset[2] = 0;
+    d.offset[3] = static_cast<uint32_t>(c.first);
+    d.size[0] = c.size[0];
+    d.size[1] = c.size[1];
+    d.size[2] = c.size[2];
+    d.size[3] = static_cast<uint32_t>(c.first >> 32);
+    d.buffers = data.data();
+    d.buffer_sizes = sizes.data();
+    d.push_constants = c.push_constants.data();
+
+    uint64_t invocations = static_cast<uint64_t>(c.size[0]) * c.size[1]
+      * c.size[2];
+    jobs.parallel_for(invocations, k.grain,
+		      [&](uint64_t begin, uint64_t end) {
+			k.fn(d, begin, end);
+		      });
+    dispatches++;
+  }
+  commands.clear();
+  submits++;
+}
+
+void cpu_engine::wait()
+{
+}
+
+uint64_t cpu_engine::dispatch_count() const
+{
+  return dispatches;
+}
+
+uint64_t cpu_engine::submit_count() const
+{
+  return submits;
+}
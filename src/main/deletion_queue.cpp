@@ -0,0 +1,182 @@
+#include "deletion_queue.hpp"
+
+#include <algorithm>
+
+// Handles are pointers on 64 bit platforms and uint64_t elsewhere
+template <typename H>
+static uint64_t to_bits(H handle)
+{
+  return (uint64_t)handle;
+}
+
+template <typename H>
+static H from_bits(uint64_t bits)
+{
+  return (H)bits;
+}
+
+deletion_queue::deletion_queue(VkDevice device,
+			       const VkAllocationCallbacks* alloc_callbacks)
+  : device(device),
+    alloc_callbacks(alloc_callbacks),
+    completed(0)
+{
+}
+
+deletion_queue::~deletion_queue()
+{
+  flush();
+}
+
+void deletion_queue::destroy_buffer(VkBuffer buffer, uint64_t last_use)
+{
+  if (buffer != VK_NULL_HANDLE)
+    push({last_use, DELETE_BUFFER, to_bits(buffer), nullptr});
+}
+
+void deletion_queue::destroy_buffer_view(VkBufferView view,
+					 uint64_t last_use)
+{
+  if (view != VK_NULL_HANDLE)
+    push({last_use, DELETE_BUFFER_VIEW, to_bits(view), nullptr});
+}
+
+void deletion_queue::destroy_image(VkImage image, uint64_t last_use)
+{
+  if (image != VK_NULL_HANDLE)
+    push({last_use, DELETE_IMAGE, to_bits(image), nullptr});
+}
+
+void deletion_queue::destroy_image_view(VkImageView view,
+					uint64_t last_use)
+{
+  if (view != VK_NULL_HANDLE)
+    push({last_use, DELETE_IMAGE_VIEW, to_bits(view), nullptr});
+}
+
+void deletion_queue::destroy_sampler(VkSampler sampler, uint64_t last_use)
+{
+  if (sampler != VK_NULL_HANDLE)
+    push({last_use, DELETE_SAMPLER, to_bits(sampler), nullptr});
+}
+
+void deletion_queue::destroy_framebuffer(VkFramebuffer framebuffer,
+					 uint64_t last_use)
+{
+  if (framebuffer != VK_NULL_HANDLE)
+    push({last_use, DELETE_FRAMEBUFFER, to_bits(framebuffer), nullptr});
+}
+
+void deletion_queue::destroy_pipeline(VkPipeline pipeline, uint64_t last_use)
+{
+  if (pipeline != VK_NULL_HANDLE)
+    push({last_use, DELETE_PIPELINE, to_bits(pipeline), nullptr});
+}
+
+void deletion_queue::free_memory(VkDeviceMemory memory, uint64_t last_use)
+{
+  if (memory != VK_NULL_HANDLE)
+    push({last_use, DELETE_MEMORY, to_bits(memory), nullptr});
+}
+
+void deletion_queue::defer(std::function<void()> release, uint64_t last_use)
+{
+  if (release)
+    push({last_use, DELETE_CALLBACK, 0, std::move(release)});
+}
+
+// Already retired values are destroyed at the next retire() rather than
+// immediately, so a release never destroys anything under the caller
+void deletion_queue::push(entry e)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (entries.empty() || entries.back().last_use <= e.last_use) {
+    entries.push_back(std::move(e));
+    return;
+  }
+  auto pos = std::upper_bound(entries.begin(), entries.end(), e.last_use,
+			      [](uint64_t value, const entry& other) {
+				return value < other.last_use;
+			      });
+  entries.insert(pos, std::move(e));
+}
+
+void deletion_queue::destroy(const entry& e)
+{
+  switch (e.type) {
+  case DELETE_BUFFER:
+    vkDestroyBuffer(device, from_bits<VkBuffer>(e.handle), alloc_callbacks);
+    break;
+  case DELETE_BUFFER_VIEW:
+    vkDestroyBufferView(device, from_bits<VkBufferView>(e.handle),
+			alloc_callbacks);
+    break;
+  case DELETE_IMAGE:
+    vkDestroyImage(device, from_bits<VkImage>(e.handle), alloc_callbacks);
+    break;
+  case DELETE_IMAGE_VIEW:
+    vkDestroyImageView(device, from_bits<VkImageView>(e.handle),
+		       alloc_callbacks);
+    break;
+  case DELETE_SAMPLER:
+    vkDestroySampler(device, from_bits<VkSampler>(e.handle),
+		     alloc_callbacks);
+    break;
+  case DELETE_FRAMEBUFFER:
+    vkDestroyFramebuffer(device, from_bits<VkFramebuffer>(e.handle),
+			 alloc_callbacks);
+    break;
+  case DELETE_PIPELINE:
+    vkDestroyPipeline(device, from_bits<VkPipeline>(e.handle),
+		      alloc_callbacks);
+    break;
+  case DELETE_MEMORY:
+    vkFreeMemory(device, from_bits<VkDeviceMemory>(e.handle),
+		 alloc_callbacks);
+    break;
+  case DELETE_CALLBACK:
+    e.release();
+    break;
+  }
+}
+
+size_t deletion_queue::retire(uint64_t completed_value)
+{
+  // Destroy outside the lock so releases from callbacks do not deadlock
+  std::deque<entry> done;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    completed = std::max(completed, completed_value);
+    while (!entries.empty() && entries.front().last_use <= completed) {
+      done.push_back(std::move(entries.front()));
+      entries.pop_front();
+    }
+  }
+  for (auto& e : done)
+    destroy(e);
+  return done.size();
+}
+
+size_t deletion_queue::flush()
+{
+  std::deque<entry> done;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done.swap(entries);
+  }
+  for (auto& e : done)
+    destroy(e);
+  return done.size();
+}
+
+size_t deletion_queue::pending() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+uint64_t deletion_queue::retired() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return completed;
+}
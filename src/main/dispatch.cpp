@@ -0,0 +1,39 @@
+#include "dispatch.hpp"
+
+#define DISPATCH_EXPORT(name) name,
+
+instance_dispatch vki = {
+  DISPATCH_INSTANCE_FUNCTIONS(DISPATCH_EXPORT)
+};
+
+device_dispatch vkd = {
+  DISPATCH_DEVICE_FUNCTIONS(DISPATCH_EXPORT)
+};
+
+void load_instance_dispatch(VkInstance instance)
+{
+#define DISPATCH_LOAD_INSTANCE(name)					\
+  {									\
+    PFN_vkVoidFunction fn = vkGetInstanceProcAddr(instance, #name);	\
+    if (fn != nullptr)							\
+      vki.name = reinterpret_cast<PFN_##name>(fn);			\
+  }
+  DISPATCH_INSTANCE_FUNCTIONS(DISPATCH_LOAD_INSTANCE)
+#undef DISPATCH_LOAD_INSTANCE
+}
+
+unsigned int load_device_dispatch(VkDevice device)
+{
+  unsigned int missing = 0;
+#define DISPATCH_LOAD_DEVICE(name)					\
+  {									\
+    PFN_vkVoidFunction fn = vki.vkGetDeviceProcAddr(device, #name);	\
+    if (fn != nullptr)							\
+      vkd.name = reinterpret_cast<PFN_##name>(fn);			\
+    else								\
+      missing++;							\
+  }
+  DISPATCH_DEVICE_FUNCTIONS(DISPATCH_LOAD_DEVICE)
+#undef DISPATCH_LOAD_DEVICE
+  return missing;
+}
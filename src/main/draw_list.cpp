@@ -0,0 +1,161 @@
+#include "draw_list.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+
+#define DRAW_KEY_FIELD(value, bits) \
+  (static_cast<uint64_t>(value) & ((UINT64_C(1) << (bits)) - 1))
+
+uint64_t draw_key(uint32_t pass,
+		  uint32_t pipeline,
+		  uint32_t material,
+		  uint32_t mesh,
+		  uint32_t depth)
+{
+  uint64_t key = DRAW_KEY_FIELD(pass, DRAW_KEY_PASS_BITS);
+  key = key << DRAW_KEY_PIPELINE_BITS
+    | DRAW_KEY_FIELD(pipeline, DRAW_KEY_PIPELINE_BITS);
+  key = key << DRAW_KEY_MATERIAL_BITS
+    | DRAW_KEY_FIELD(material, DRAW_KEY_MATERIAL_BITS);
+  key = key << DRAW_KEY_MESH_BITS
+    | DRAW_KEY_FIELD(mesh, DRAW_KEY_MESH_BITS);
+  key = key << DRAW_KEY_DEPTH_BITS
+    | DRAW_KEY_FIELD(depth, DRAW_KEY_DEPTH_BITS);
+  return key;
+}
+
+#define DRAW_KEY_MESH_SHIFT     DRAW_KEY_DEPTH_BITS
+#define DRAW_KEY_MATERIAL_SHIFT (DRAW_KEY_MESH_SHIFT + DRAW_KEY_MESH_BITS)
+#define DRAW_KEY_PIPELINE_SHIFT (DRAW_KEY_MATERIAL_SHIFT		\
+				 + DRAW_KEY_MATERIAL_BITS)
+#define DRAW_KEY_PASS_SHIFT     (DRAW_KEY_PIPELINE_SHIFT		\
+				 + DRAW_KEY_PIPELINE_BITS)
+
+uint32_t draw_key_pass(uint64_t key)
+{
+  return static_cast<uint32_t>(DRAW_KEY_FIELD(key >> DRAW_KEY_PASS_SHIFT,
+					      DRAW_KEY_PASS_BITS));
+}
+
+uint32_t draw_key_pipeline(uint64_t key)
+{
+  return static_cast<uint32_t>(DRAW_KEY_FIELD(key >> DRAW_KEY_PIPELINE_SHIFT,
+					      DRAW_KEY_PIPELINE_BITS));
+}
+
+uint32_t draw_key_material(uint64_t key)
+{
+  return static_cast<uint32_t>(DRAW_KEY_FIELD(key >> DRAW_KEY_MATERIAL_SHIFT,
+					      DRAW_KEY_MATERIAL_BITS));
+}
+
+uint32_t draw_key_mesh(uint64_t key)
+{
+  return static_cast<uint32_t>(DRAW_KEY_FIELD(key >> DRAW_KEY_MESH_SHIFT,
+					      DRAW_KEY_MESH_BITS));
+}
+
+uint32_t draw_depth(float depth, float near_z, float far_z,
+		    bool back_to_front)
+{
+  const uint32_t max_depth = (1u << DRAW_KEY_DEPTH_BITS) - 1;
+  // An empty range puts everything at the near end. NaN fails every
+  // comparison, so it is caught before the clamp, whose min and max would
+  // pass it through to an undefined conversion.
+  float t = far_z > near_z ? (depth - near_z) / (far_z - near_z) : 0.0f;
+  if (!(t >= 0.0f))
+    t = 0.0f;
+  t = std::min(t, 1.0f);
+  uint32_t value = static_cast<uint32_t>(t * max_depth);
+  return back_to_front ? max_depth - value : value;
+}
+
+void draw_list::clear()
+{
+  draws.clear();
+}
+
+void draw_list::add(uint64_t key, uint32_t payload)
+{
+  draws.push_back({key, payload});
+}
+
+void draw_list::build(job_system* jobs,
+		      uint64_t count,
+		      uint64_t grain,
+		      const build_fn& fn)
+{
+  TRACE_SCOPE("build draws");
+  grain = std::max<uint64_t>(grain, 1);
+  size_t range_count = static_cast<size_t>((count + grain - 1) / grain);
+  if (ranges.size() < range_count)
+    ranges.resize(range_count);
+  for (size_t i = 0; i != range_count; i++)
+    ranges[i].clear();
+
+  // The job system splits the loop at multiples of grain, so each of its
+  // ranges is one of ours
+  auto run = [&](uint64_t begin, uint64_t end) {
+    for (; begin < end; begin += grain)
+      fn(begin, std::min(begin + grain, end), ranges[begin / grain]);
+  };
+  if (jobs != nullptr)
+    jobs->parallel_for(count, grain, run);
+  else
+    run(0, count);
+
+  for (size_t i = 0; i != range_count; i++)
+    draws.insert(draws.end(), ranges[i].begin(), ranges[i].end());
+}
+
+// Least significant byte first, each pass a stable counting sort. The
+// byte counts for every pass come from one read of the keys, and a pass
+// whose byte is the same in every key is skipped, which with few
+// pipelines and materials is most of the high ones.
+void draw_list::sort()
+{
+  TRACE_SCOPE("sort draws");
+  const size_t n = draws.size();
+  if (n < 2)
+    return;
+
+  uint32_t counts[8][256] = {};
+  for (auto& d : draws)
+    for (unsigned int pass = 0; pass != 8; pass++)
+      counts[pass][(d.key >> (pass * 8)) & 0xff]++;
+
+  sorted.resize(n);
+  for (unsigned int pass = 0; pass != 8; pass++) {
+    uint32_t* count = counts[pass];
+    unsigned int shift = pass * 8;
+    if (count[(draws[0].key >> shift) & 0xff] == n)
+      continue;
+
+    uint32_t offset = 0;
+    for (unsigned int digit = 0; digit != 256; digit++) {
+      uint32_t c = count[digit];
+      count[digit] = offset;
+      offset += c;
+    }
+    for (auto& d : draws)
+      sorted[count[(d.key >> shift) & 0xff]++] = d;
+    draws.swap(sorted);
+  }
+}
+
+void draw_list::replay(command_recorder& recorder,
+		       const replay_fn& fn) const
+{
+  for (auto& d : draws)
+    fn(recorder, d);
+}
+
+size_t draw_list::size() const
+{
+  return draws.size();
+}
+
+const std::vector<draw_command>& draw_list::commands() const
+{
+  return draws;
+}
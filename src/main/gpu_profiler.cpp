@@ -0,0 +1,327 @@
+#include "gpu_profiler.hpp"
+#include "dispatch.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+static std::string escape_json(const std::string& str)
+{
+  std::string out;
+  for (auto c : str) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+gpu_profiler::gpu_profiler(VkPhysicalDevice physical_device,
+			   VkDevice device,
+			   uint32_t queue_family_idx,
+			   uint32_t frames_in_flight,
+			   const VkAllocationCallbacks* alloc_callbacks)
+  : device(device),
+    alloc_callbacks(alloc_callbacks),
+    frame_count(0),
+    recording(nullptr),
+    dropped(0),
+    have_origin(false),
+    origin(0),
+    last_cpu_end_ns(0)
+{
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physical_device, &props);
+  timestamp_period = props.limits.timestampPeriod;
+
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
+					   &family_count,
+					   nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
+					   &family_count,
+					   families.data());
+
+  uint32_t valid_bits = queue_family_idx < family_count ?
+    families[queue_family_idx].timestampValidBits : 0;
+  timestamp_mask = valid_bits >= 64 ? UINT64_MAX
+    : ((uint64_t)1 << valid_bits) - 1;
+  timestamps = valid_bits != 0;
+  if (!timestamps)
+    return;
+
+  VkQueryPoolCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  info.pNext = nullptr;
+  info.flags = 0;
+  info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  info.queryCount = 2 * GPU_PROFILER_MAX_SCOPES;
+  info.pipelineStatistics = 0;
+
+  VkEventCreateInfo event_info = {};
+  event_info.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO;
+  event_info.pNext = nullptr;
+  event_info.flags = 0;
+
+  frames.resize(std::max(frames_in_flight, 1u));
+  for (auto& f : frames) {
+    f.pool = VK_NULL_HANDLE;
+    f.reset = VK_NULL_HANDLE;
+    f.index = 0;
+    f.cpu_begin_ns = 0;
+    f.pending = false;
+    if (vkCreateQueryPool(device, &info, alloc_callbacks, &f.pool)
+	!= VK_SUCCESS
+	|| vkCreateEvent(device, &event_info, alloc_callbacks, &f.reset)
+	!= VK_SUCCESS)
+      timestamps = false;
+  }
+}
+
+gpu_profiler::~gpu_profiler()
+{
+  for (auto& f : frames) {
+    if (f.pool != VK_NULL_HANDLE)
+      vkDestroyQueryPool(device, f.pool, alloc_callbacks);
+    if (f.reset != VK_NULL_HANDLE)
+      vkDestroyEvent(device, f.reset, alloc_callbacks);
+  }
+}
+
+bool gpu_profiler::supported() const
+{
+  return timestamps;
+}
+
+void gpu_profiler::begin_frame(VkCommandBuffer command_buffer)
+{
+  recording = nullptr;
+  if (!timestamps)
+    return;
+
+  frame& f = frames[frame_count % frames.size()];
+  frame_count++;
+
+  // Still in flight: leave this frame unprofiled rather than stall
+  if (f.pending && !read_back(f)) {
+    dropped++;
+    return;
+  }
+
+  // The previous frame's set has executed, or read_back would have failed
+  if (vkd.vkResetEvent(device, f.reset) != VK_SUCCESS) {
+    dropped++;
+    return;
+  }
+  vkd.vkCmdResetQueryPool(command_buffer, f.pool, 0, 2 * GPU_PROFILER_MAX_SCOPES);
+  vkd.vkCmdSetEvent(command_buffer,
+		    f.reset,
+		    VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+  f.names.clear();
+  f.index = frame_count - 1;
+  f.cpu_begin_ns = trace_now_ns();
+  f.pending = true;
+  recording = &f;
+}
+
+void gpu_profiler::skip_frame()
+{
+  recording = nullptr;
+}
+
+uint32_t gpu_profiler::begin_scope(VkCommandBuffer command_buffer,
+				   const std::string& name)
+{
+  if (recording == nullptr
+      || recording->names.size() == GPU_PROFILER_MAX_SCOPES)
+    return GPU_PROFILER_NO_SCOPE;
+
+  uint32_t scope = recording->names.size();
+  recording->names.push_back(name);
+  vkd.vkCmdWriteTimestamp(command_buffer,
+			  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			  recording->pool,
+			  2 * scope);
+  return scope;
+}
+
+void gpu_profiler::end_scope(VkCommandBuffer command_buffer, uint32_t scope)
+{
+  if (recording == nullptr || scope == GPU_PROFILER_NO_SCOPE)
+    return;
+
+  vkd.vkCmdWriteTimestamp(command_buffer,
+			  VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			  recording->pool,
+			  2 * scope + 1);
+}
+
+void gpu_profiler::collect()
+{
+  // Oldest first so the trace stays in frame order
+  recording = nullptr;
+  std::vector<frame*> pending;
+  for (auto& f : frames)
+    if (f.pending)
+      pending.push_back(&f);
+  std::sort(pending.begin(), pending.end(), [](frame* a, frame* b) {
+      return a->index < b->index;
+    });
+
+  for (auto f : pending)
+    if (!read_back(*f))
+      break;
+}
+
+bool gpu_profiler::read_back(frame& f)
+{
+  // Until the reset has run, availability is left over from the last use
+  if (vkd.vkGetEventStatus(device, f.reset) != VK_EVENT_SET)
+    return false;
+
+  if (f.names.empty()) {
+    f.pending = false;
+    return true;
+  }
+
+  // Each query yields its value followed by an availability word
+  uint32_t query_count = 2 * f.names.size();
+  std::vector<uint64_t> data(2 * query_count);
+  VkQueryResultFlags flags = VK_QUERY_RESULT_64_BIT
+    | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+  VkResult res = vkd.vkGetQueryPoolResults(device,
+					   f.pool,
+					   0,
+					   query_count,
+					   data.size() * sizeof(uint64_t),
+					   data.data(),
+					   2 * sizeof(uint64_t),
+					   flags);
+  if (res != VK_SUCCESS && res != VK_NOT_READY)
+    return false;
+  for (uint32_t i = 0; i != query_count; i++)
+    if (data[2 * i + 1] == 0)
+      return false;
+
+  if (!have_origin) {
+    origin = data[0] & timestamp_mask;
+    have_origin = true;
+  }
+
+  uint64_t frame_begin = data[0] & timestamp_mask;
+  uint64_t cpu_anchor = std::max(f.cpu_begin_ns, last_cpu_end_ns);
+
+  for (uint32_t i = 0; i != f.names.size(); i++) {
+    uint64_t begin = data[4 * i] & timestamp_mask;
+    uint64_t end = data[4 * i + 2] & timestamp_mask;
+    double duration_ns = ((end - begin) & timestamp_mask) * timestamp_period;
+
+    uint64_t cpu_begin = cpu_anchor
+      + ((begin - frame_begin) & timestamp_mask) * timestamp_period;
+    uint64_t cpu_end = cpu_begin + duration_ns;
+    trace_gpu_zone(f.names[i], cpu_begin, cpu_end);
+    last_cpu_end_ns = std::max(last_cpu_end_ns, cpu_end);
+
+    history& hist = histories[f.names[i]];
+    hist.last_ms = duration_ns / 1000000.0;
+    hist.samples.push_back(hist.last_ms);
+    if (hist.samples.size() > GPU_PROFILER_HISTORY)
+      hist.samples.pop_front();
+
+    if (events.size() < GPU_PROFILER_MAX_EVENTS) {
+      trace_event event;
+      event.name = f.names[i];
+      event.frame = f.index;
+      event.start_us = ((begin - origin) & timestamp_mask)
+	* timestamp_period / 1000.0;
+      event.duration_us = duration_ns / 1000.0;
+      events.push_back(event);
+    }
+  }
+
+  f.pending = false;
+  return true;
+}
+
+bool gpu_profiler::stats(const std::string& name, gpu_scope_stats& out) const
+{
+  auto it = histories.find(name);
+  if (it == histories.end() || it->second.samples.empty())
+    return false;
+
+  const history& hist = it->second;
+  out.last_ms = hist.last_ms;
+  out.min_ms = hist.samples.front();
+  out.max_ms = hist.samples.front();
+  double sum = 0.0;
+  for (auto sample : hist.samples) {
+    sum += sample;
+    out.min_ms = std::min(out.min_ms, sample);
+    out.max_ms = std::max(out.max_ms, sample);
+  }
+  out.samples = hist.samples.size();
+  out.avg_ms = sum / out.samples;
+  return true;
+}
+
+void gpu_profiler::print_stats(std::ostream& out) const
+{
+  if (!timestamps) {
+    out << "GPU timestamps not supported on this queue family" << std::endl;
+    return;
+  }
+
+  for (auto& entry : histories) {
+    gpu_scope_stats s;
+    if (!stats(entry.first, s))
+      continue;
+    out << "GPU " << entry.first << ": avg " << std::fixed
+	<< std::setprecision(3) << s.avg_ms << " ms (min " << s.min_ms
+	<< ", max " << s.max_ms << ", last " << s.last_ms << ") over "
+	<< s.samples << " frames" << std::endl;
+  }
+  out << "GPU profiler dropped " << dropped << " frame"
+      << (dropped != 1 ? "s" : "") << std::endl;
+}
+
+uint32_t gpu_profiler::dropped_frames() const
+{
+  return dropped;
+}
+
+bool gpu_profiler::write_trace(const std::string& filename) const
+{
+  std::ofstream file(filename);
+  if (!file.is_open())
+    return false;
+
+  file << "{\"traceEvents\":[" << std::endl;
+  for (size_t i = 0; i != events.size(); i++) {
+    const trace_event& event = events[i];
+    file << "{\"name\":\"" << escape_json(event.name)
+	 << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+	 << std::fixed << std::setprecision(3)
+	 << ",\"ts\":" << event.start_us
+	 << ",\"dur\":" << event.duration_us
+	 << ",\"args\":{\"frame\":" << event.frame << "}}"
+	 << (i + 1 != events.size() ? "," : "") << std::endl;
+  }
+  file << "]}" << std::endl;
+  return file.good();
+}
+
+gpu_scope::gpu_scope(gpu_profiler& profiler,
+		     VkCommandBuffer command_buffer,
+		     const std::string& name)
+  : profiler(profiler),
+    command_buffer(command_buffer),
+    scope(profiler.begin_scope(command_buffer, name))
+{
+}
+
+gpu_scope::~gpu_scope()
+{
+  profiler.end_scope(command_buffer, scope);
+}
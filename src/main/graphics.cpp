@@ -7,10 +7,13 @@
 #include <iomanip>
 #include <thread>
 #include <cassert>
+#include <memory>
 
 #define USE_XCB false
 
-#if defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
+#ifdef HEADLESS
+// Offscreen rendering only: no window system, surface or swapchain
+#elif defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
 #define VK_USE_PLATFORM_WIN32_KHR
 #include <windows.h>
 #include <tchar.h>
@@ -40,7 +43,23 @@ Window window;
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+#include "alias.hpp"
 #include "allocator.hpp"
+#include "deletion_queue.hpp"
+#include "dispatch.hpp"
+#include "gpu_profiler.hpp"
+#include "log.hpp"
+#include "queue_scheduler.hpp"
+#include "timeline.hpp"
+#include "mapped_memory.hpp"
+#include "command_recorder.hpp"
+#include "draw_list.hpp"
+#include "job_system.hpp"
+#include "render_graph.hpp"
+#include "resource_pool.hpp"
+#include "submit_batch.hpp"
+#include "texture.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 
 #define APP_SHORT_NAME     "VultureTest"
@@ -58,17 +77,53 @@ Window window;
 
 #define RESOURCE_BUFFER                 0
 #define RESOURCE_IMAGE                  1
+#define RESOURCE_TRANSIENT              2
 
 #define COMMAND_BUFFER_GRAPHICS         0
+// One per swapchain image, after the COMMAND_BUFFER_COUNT general ones
+#define COMMAND_BUFFER_STATIC           COMMAND_BUFFER_COUNT
+
+// Record the frame loop's draw once per swapchain image and resubmit it
+#define STATIC_COMMAND_BUFFERS          true
+
+// Cull instances in a compute pass and draw through an indirect buffer
+#define GPU_CULLING                     true
+// Compute passes at least this long (measured) move to a compute queue,
+// overlapped with the main one, if the device has a separate one
+#define ASYNC_COMPUTE_MIN_MS            0.05
+// Draws go through a list sorted by key. Without culling, each instance
+// is a draw of its own, built in ranges of this many on the job system;
+// with it, the list holds the indirect draw, marked by its payload.
+#define DRAW_BUILD_GRAIN                256
+#define DRAW_INDIRECT                   UINT32_MAX
+// Draws in the list sorted at startup to check build and sort, since
+// with culling the frame's own list only ever holds the one draw
+#define DRAW_CHECK_COUNT                10000
+
+// Order submissions with one timeline semaphore per queue and wait on the
+// CPU for exact submissions, if the device has VK_KHR_timeline_semaphore
+#define TIMELINE_SEMAPHORES             true
+
+// Let buffer memory be any host visible type, not only a coherent one;
+// host writes are then flushed by dirty range before each submission
+#define NON_COHERENT_BUFFERS            true
 
 #define GRAPHICS_PIPELINE_COUNT         1
 
 #define CLEAR_IMAGE                     0
 #define DEPTH_STENCIL_IMAGE             1
 
+// Passes within a frame, used to work out image lifetimes for aliasing
+#define PASS_CLEAR                      0
+#define PASS_RENDER                     1
+
 #define VERTEX_BUFFER                   0
 #define INDEX_BUFFER                    1
 #define UNIFORM_BUFFER                  2
+#define DRAW_BUFFER                     3
+
+#define Z_NEAR                          0.1f
+#define Z_FAR                           256.0f
 
 #define VERTEX_COUNT                    3
 #define INDEX_COUNT                     3
@@ -79,11 +134,33 @@ Window window;
 
 #define MAX_QUEUES                      64
 
+// Pool capacities; BUFFER_COUNT and IMAGE_COUNT are only created up front
+#define MAX_BUFFERS                     1024
+#define MAX_IMAGES                      1024
+
+// Fields of the buffer pool
+#define BUFFER_HANDLE                   0
+#define BUFFER_MEM_REQS                 1
+#define BUFFER_OFFSET                   2
+#define BUFFER_VIEW                     3
+
+// Fields of the image pool
+#define IMAGE_HANDLE                    0
+#define IMAGE_MEM_REQS                  1
+#define IMAGE_OFFSET                    2
+#define IMAGE_LAYOUT                    3
+#define IMAGE_VIEW                      4
+
 #define READ_OFFSET                     0
 #define READ_LENGTH                     64
 
 #define HOST_COHERENT(X) ((X & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0)
 #define HOST_VISIBLE(X)  ((X & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0)
+#define LAZILY_ALLOCATED(X) ((X & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0)
+
+// Images only ever used as render pass attachments; these get their own
+// (lazily allocated, if possible) memory instead of the aliased block
+#define TRANSIENT_IMAGE(X) ((X) == DEPTH_STENCIL_IMAGE)
 
 #define PREFERRED_WIDTH 800
 #define PREFERRED_HEIGHT 600
@@ -106,20 +183,31 @@ Window window;
 
 #define NEXT_IMAGE_TIMEOUT          1000 // nanoseconds
 
+// Offscreen images standing in for the swapchain in headless builds
+#define HEADLESS_IMAGE_COUNT        3
+
+#define TEXTURE_VRAM_BUDGET         (256*1024*1024)
+#define TEXTURE_STAGING_SIZE        (16*1024*1024)
+// The draw samples one loaded texture at a time, moving to the next this
+// often, so the others go idle and lose their top levels
+#define TEXTURE_SWITCH_FRAMES       100
+#define TEXTURE_NONE                UINT32_MAX
+
+#define PROFILER_FRAMES_IN_FLIGHT   2
+#define PROFILER_TRACE_FILE         "graphics.trace.json"
+
+// CPU zones merged with the GPU timings
+#define TRACE_FILE                  "graphics.timeline.json"
+
 std::string platform;
 
 std::mutex device_mutex;
 std::mutex instance_mutex;
 std::mutex debug_report_callback_mutex;
-std::vector<std::mutex> resource_mutex[2] =
-  {std::vector<std::mutex>(BUFFER_COUNT),
-   std::vector<std::mutex>(IMAGE_COUNT)};
-std::vector<std::mutex> view_mutex[2] =
-  {std::vector<std::mutex>(BUFFER_COUNT),
-   std::vector<std::mutex>(IMAGE_COUNT)};
-std::mutex memory_mutex[2];
+std::mutex memory_mutex[3];
 std::mutex command_pool_mutex;
-std::vector<std::mutex> command_buffer_mutex(COMMAND_BUFFER_COUNT);
+std::vector<std::mutex> command_buffer_mutex(COMMAND_BUFFER_COUNT
+					     + MAX_SWAPCHAIN_IMAGES);
 std::vector<std::mutex> queue_mutex(MAX_QUEUES);
 std::mutex surface_mutex;
 std::mutex swapchain_mutex;
@@ -141,7 +229,7 @@ allocator my_alloc = {};
 uint32_t phys_device_idx = 0;
 uint32_t queue_family_idx;
 uint32_t queue_family_queue_count;
-uint32_t mem_types[2] = {UINT32_MAX, UINT32_MAX};
+uint32_t mem_types[3] = {UINT32_MAX, UINT32_MAX, UINT32_MAX};
 uint32_t cur_swapchain_img;
 uint32_t push_constants[2] = {make_data("LMAO"), make_data("XDXD")};
 
@@ -153,18 +241,55 @@ VkPhysicalDeviceMemoryProperties physical_device_mem_props;
 std::vector<VkQueueFamilyProperties> queue_family_properties;
 VkDevice device;
 VkDebugReportCallbackEXT debug_report_callback;
-std::vector<VkBuffer> buffers;
-std::vector<VkImage> images;
-std::vector<VkSubresourceLayout> subresource_layouts;
-std::vector<VkMemoryRequirements> buf_mem_requirements;
-std::vector<VkMemoryRequirements> img_mem_requirements;
-VkDeviceSize mem_size[2];
-VkDeviceMemory memory[2];
-std::vector<VkBufferView> buffer_views;
-std::vector<VkImageView> image_views;
+typedef resource_pool<struct buffer_tag,
+		      VkBuffer,
+		      VkMemoryRequirements,
+		      VkDeviceSize,
+		      VkBufferView> buffer_pool_t;
+typedef resource_pool<struct image_tag,
+		      VkImage,
+		      VkMemoryRequirements,
+		      VkDeviceSize,
+		      VkSubresourceLayout,
+		      VkImageView> image_pool_t;
+buffer_pool_t buffer_pool(MAX_BUFFERS);
+image_pool_t image_pool(MAX_IMAGES);
+// Creation order, so VERTEX_BUFFER, CLEAR_IMAGE etc. index these
+std::vector<buffer_pool_t::handle> buffers;
+std::vector<image_pool_t::handle> images;
+VkDeviceSize mem_size[3];
+VkDeviceMemory memory[3];
+// Buffer memory stays mapped from write_buffer_memory() on
+std::unique_ptr<mapped_memory> buffer_mapping;
+// The uniform block has been written whole once
+bool uniforms_uploaded = false;
 std::vector<VkQueue> queues;
+std::vector<uint32_t> queue_families;
+queue_plan planned_queues;
+std::vector<std::unique_ptr<submit_batch>> submit_batches;
+std::unique_ptr<queue_scheduler> scheduler;
+// Instance and device both have VK_KHR_timeline_semaphore enabled
+bool timeline_semaphores = false;
+std::unique_ptr<gpu_timeline> timeline;
 VkCommandPool command_pool;
 std::vector<VkCommandBuffer> command_buffers;
+// Binds into command_buffers[i] go through recorders[i], which drops the
+// redundant ones
+std::vector<command_recorder> recorders(COMMAND_BUFFER_COUNT
+					+ MAX_SWAPCHAIN_IMAGES);
+VkCommandPool static_command_pool;
+struct static_draw {
+  bool valid;
+  uint32_t pipeline_idx;
+  uint32_t num_instances;
+};
+std::vector<static_draw> static_draws;
+bool async_compute = false;
+VkCommandPool async_command_pool;
+VkCommandBuffer async_command_buffer;
+command_recorder async_recorder;
+VkCommandBuffer prologue_command_buffer;
+rg_async_split frame_split = {};
 VkSurfaceKHR surface;
 VkSurfaceCapabilitiesKHR surface_capabilities;
 std::vector<VkSurfaceFormatKHR> surface_formats;
@@ -177,12 +302,59 @@ VkShaderModule vertex_shader;
 VkShaderModule fragment_shader;
 std::vector<VkPipeline> graphics_pipelines;
 VkPipelineLayout graphics_pipeline_layout;
+VkShaderModule cull_shader;
+VkDescriptorSetLayout cull_descriptor_set_layout;
+VkPipelineLayout cull_pipeline_layout;
+VkPipeline cull_pipeline;
 std::vector<VkDescriptorSetLayout> descriptor_set_layouts;
 VkDescriptorPool descriptor_pool;
 std::vector<VkDescriptorSet> descriptor_sets;
+VkDescriptorSet cull_descriptor_set;
 VkSampler image_sampler;
 VkRenderPass renderpass;
 std::vector<VkFramebuffer> framebuffers;
+render_graph frame_graph;
+std::vector<uint32_t> graph_images;
+std::vector<uint32_t> graph_buffers;
+std::vector<uint32_t> graph_swapchain_images;
+std::unique_ptr<texture_loader> tex_loader;
+std::unique_ptr<deletion_queue> deletions;
+uint64_t frames_submitted = 0;
+uint64_t frames_completed = 0;
+std::unique_ptr<texture_streamer> tex_streamer;
+std::vector<uint32_t> streamed_textures;
+// Sampled until a loaded texture is resident; white, so untextured
+// frames look as before
+uint32_t fallback_texture = TEXTURE_NONE;
+uint32_t sampled_texture = TEXTURE_NONE;
+// The texture and version the descriptor set was last written with
+uint32_t bound_texture = TEXTURE_NONE;
+uint32_t bound_texture_version = 0;
+std::unique_ptr<gpu_profiler> profiler;
+std::unique_ptr<job_system> draw_jobs;
+draw_list frame_draws;
+#ifdef HEADLESS
+VkDeviceMemory offscreen_memory;
+VkBuffer readback_buffer;
+VkDeviceMemory readback_memory;
+VkDeviceSize readback_size;
+bool readback_coherent;
+unsigned char* readback_data;
+uint32_t graph_readback_buffer;
+bool readback_pending = false;
+uint64_t frame_checksum = 0;
+#endif
+bool frame_uses_swapchain = false;
+
+VkBuffer buffer_at(uint32_t buf_idx)
+{
+  return buffer_pool.get<BUFFER_HANDLE>(buffers[buf_idx]);
+}
+
+VkImage image_at(uint32_t img_idx)
+{
+  return image_pool.get<IMAGE_HANDLE>(images[img_idx]);
+}
 
 const std::string logfile = "graphics.log";
 const std::string errfile = "graphics.err";
@@ -230,7 +402,9 @@ VKAPI_ATTR VkBool32 VKAPI_CALL MyDebugReportCallback(
 
 void get_platform()
 {
-  #ifdef VK_USE_PLATFORM_WIN32_KHR
+  #ifdef HEADLESS
+  platform = "Headless";
+  #elif defined(VK_USE_PLATFORM_WIN32_KHR)
   platform = "Win32";
   #elif USE_XCB
   platform = "Linux (XCB)";
@@ -239,6 +413,7 @@ void get_platform()
   #endif
 }
 
+#ifndef HEADLESS
 void create_window()
 {
   std::cout << "Creating " << platform << " window..." << std::endl;
@@ -311,6 +486,39 @@ void create_window()
   XSync(display, false);
 #endif
 }
+#endif
+
+bool instance_extension_available(const char* name)
+{
+  uint32_t ext_count = 0;
+  vkEnumerateInstanceExtensionProperties(nullptr, &ext_count, nullptr);
+  std::vector<VkExtensionProperties> ext_props(ext_count);
+  vkEnumerateInstanceExtensionProperties(nullptr,
+					 &ext_count,
+					 ext_props.data());
+  for (auto& extension : ext_props)
+    if (strcmp(extension.extensionName, name) == 0)
+      return true;
+  return false;
+}
+
+bool device_extension_available(const char* name)
+{
+  uint32_t ext_count = 0;
+  vkEnumerateDeviceExtensionProperties(physical_devices[phys_device_idx],
+				       nullptr,
+				       &ext_count,
+				       nullptr);
+  std::vector<VkExtensionProperties> ext_props(ext_count);
+  vkEnumerateDeviceExtensionProperties(physical_devices[phys_device_idx],
+				       nullptr,
+				       &ext_count,
+				       ext_props.data());
+  for (auto& extension : ext_props)
+    if (strcmp(extension.extensionName, name) == 0)
+      return true;
+  return false;
+}
 
 void create_instance()
 {
@@ -328,21 +536,29 @@ void create_instance()
   inst_info.pNext = nullptr;
   inst_info.flags = 0;
   inst_info.pApplicationInfo = &app_info;
-  inst_info.enabledExtensionCount = ENABLE_STANDARD_VALIDATION ? 3 : 2;
-  const char* enabled_extension_names[] = {
+  std::vector<const char*> enabled_extension_names;
 #if ENABLE_STANDARD_VALIDATION
-    "VK_EXT_debug_report",
+  enabled_extension_names.push_back("VK_EXT_debug_report");
 #endif
+#ifndef HEADLESS
 #ifdef VK_USE_PLATFORM_WIN32_KHR
-    "VK_KHR_win32_surface",
+  enabled_extension_names.push_back("VK_KHR_win32_surface");
 #elif USE_XCB
-    "VK_KHR_xcb_surface",
+  enabled_extension_names.push_back("VK_KHR_xcb_surface");
 #else
-    "VK_KHR_xlib_surface",
+  enabled_extension_names.push_back("VK_KHR_xlib_surface");
 #endif
-    "VK_KHR_surface"
-  };
-  inst_info.ppEnabledExtensionNames = enabled_extension_names;
+  enabled_extension_names.push_back("VK_KHR_surface");
+#endif
+#ifdef VK_KHR_timeline_semaphore
+  // Needed to query and enable the timeline feature on a 1.0 instance
+  bool properties2 = TIMELINE_SEMAPHORES
+    && instance_extension_available("VK_KHR_get_physical_device_properties2");
+  if (properties2)
+    enabled_extension_names.push_back("VK_KHR_get_physical_device_properties2");
+#endif
+  inst_info.enabledExtensionCount = enabled_extension_names.size();
+  inst_info.ppEnabledExtensionNames = enabled_extension_names.data();
   if (ENABLE_STANDARD_VALIDATION) {
     std::cout << "Enabling LunarG standard validation instance layer..." 
 
@@ -363,9 +579,13 @@ void create_instance()
   res = vkCreateInstance(&inst_info,
 			 CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
 			 &inst);
-  if (res == VK_SUCCESS)
+  if (res == VK_SUCCESS) {
     std::cout << "Instance created successfully!" << std::endl;
-  else
+    load_instance_dispatch(inst);
+#ifdef VK_KHR_timeline_semaphore
+    timeline_semaphores = properties2;
+#endif
+  } else
     std::cout << "Instance creation failed..." << std::endl;
 }
 
@@ -409,6 +629,7 @@ void get_physical_device_memory_properties()
   std::cout << std::setw(10) << "Type" << std::setw(10) << "Heap"
 	    << std::setw(20) << "Size" << std::setw(20) << "Host_Coherent"
 	    << std::setw(20) << "Host_Visible"
+	    << std::setw(20) << "Lazily_Allocated"
 	    << std::endl;
   for (uint32_t i = 0; i < physical_device_mem_props.memoryTypeCount; i++) {
     VkMemoryType& memType = physical_device_mem_props.memoryTypes[i];
@@ -419,6 +640,7 @@ void get_physical_device_memory_properties()
 	      << std::setw(20) << memHeap.size
 	      << std::setw(20) << (HOST_COHERENT(memType.propertyFlags) ? "Y" : "N")
 	      << std::setw(20) << (HOST_VISIBLE(memType.propertyFlags) ? "Y" : "N")
+	      << std::setw(20) << (LAZILY_ALLOCATED(memType.propertyFlags) ? "Y" : "N")
 	      << std::endl;
   }
   std::cout << std::right;
@@ -447,7 +669,11 @@ void get_queue_family_properties()
     if (queue_family_idx == UINT32_MAX) {
       VkBool32 supports;
 
-#ifdef VK_USE_PLATFORM_WIN32_KHR
+#ifdef HEADLESS
+      // Nothing is presented, any family that can draw and copy will do
+      supports = (queue_family_properties[i].queueFlags
+		  & VK_QUEUE_GRAPHICS_BIT) != 0 ? VK_TRUE : VK_FALSE;
+#elif defined(VK_USE_PLATFORM_WIN32_KHR)
       supports =
 	vkGetPhysicalDeviceWin32PresentationSupportKHR(physical_devices[phys_device_idx], static_cast<uint32_t>(i));
 #elif USE_XCB
@@ -463,35 +689,41 @@ void get_queue_family_properties()
   }
 
   if (queue_family_idx != UINT32_MAX)
-    std::cout << "Found surface supported queue family: " << queue_family_idx
+    std::cout << "Found supported queue family: " << queue_family_idx
 	      << std::endl;
   else
     std::cout << "Failed to find supported queue family..." << std::endl;
 }
 
+void plan_device_queues()
+{
+  planned_queues = plan_queues(queue_family_properties, queue_family_idx);
+  std::cout << "Queue families: main "
+	    << planned_queues.family[QUEUE_CLASS_MAIN]
+	    << ", compute " << planned_queues.family[QUEUE_CLASS_COMPUTE]
+	    << ", transfer " << planned_queues.family[QUEUE_CLASS_TRANSFER]
+	    << std::endl;
+}
+
 void create_device()
 {
   VkPhysicalDeviceFeatures supported_features;
   vkGetPhysicalDeviceFeatures(physical_devices[phys_device_idx], &supported_features);
 
-  std::vector<float> queue_priorities(queue_family_queue_count, 0.0);
-  VkDeviceQueueCreateInfo device_queue_create_info = {};
-  device_queue_create_info.sType = 
-    VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-  device_queue_create_info.pNext = nullptr;
-  device_queue_create_info.flags = 0;
-  device_queue_create_info.queueFamilyIndex = queue_family_idx;
-  device_queue_create_info.queueCount = queue_family_queue_count;
-  device_queue_create_info.pQueuePriorities = queue_priorities.data();
-  VkDeviceQueueCreateInfo device_queue_create_infos[1] = 
-    {device_queue_create_info};
+  std::vector<float> queue_priorities;
+  std::vector<VkDeviceQueueCreateInfo> device_queue_create_infos;
+  queue_create_infos(planned_queues,
+		     queue_family_properties,
+		     queue_priorities,
+		     device_queue_create_infos);
 
   VkDeviceCreateInfo device_create_info = {};
   device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
   device_create_info.pNext = nullptr;
   device_create_info.flags = 0;
-  device_create_info.queueCreateInfoCount = 1;
-  device_create_info.pQueueCreateInfos = device_queue_create_infos;
+  device_create_info.queueCreateInfoCount =
+    static_cast<uint32_t>(device_queue_create_infos.size());
+  device_create_info.pQueueCreateInfos = device_queue_create_infos.data();
 #if ENABLE_STANDARD_VALIDATION
   device_create_info.enabledLayerCount = 1;
   const char* enabled_layer_names[] = { "VK_LAYER_LUNARG_standard_validation" };
@@ -500,11 +732,41 @@ void create_device()
   device_create_info.enabledLayerCount = 0;
   device_create_info.ppEnabledLayerNames = nullptr;
 #endif
-  device_create_info.enabledExtensionCount = 1;
-  const char* enabled_extension_names[] = {
-    "VK_KHR_swapchain"
-  };
-  device_create_info.ppEnabledExtensionNames = enabled_extension_names;
+  std::vector<const char*> enabled_extension_names;
+#ifndef HEADLESS
+  enabled_extension_names.push_back("VK_KHR_swapchain");
+#endif
+#ifdef VK_KHR_timeline_semaphore
+  VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {};
+  timeline_features.sType =
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+  timeline_features.pNext = nullptr;
+  timeline_features.timelineSemaphore = VK_FALSE;
+  if (timeline_semaphores
+      && device_extension_available("VK_KHR_timeline_semaphore")) {
+    PFN_vkGetPhysicalDeviceFeatures2KHR vkGetPhysicalDeviceFeatures2KHR =
+      reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>
+      (vkGetInstanceProcAddr(inst, "vkGetPhysicalDeviceFeatures2KHR"));
+    VkPhysicalDeviceFeatures2KHR features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features2.pNext = &timeline_features;
+    if (vkGetPhysicalDeviceFeatures2KHR != nullptr)
+      vkGetPhysicalDeviceFeatures2KHR(physical_devices[phys_device_idx],
+				      &features2);
+  }
+  timeline_semaphores = timeline_features.timelineSemaphore == VK_TRUE;
+  if (timeline_semaphores) {
+    enabled_extension_names.push_back("VK_KHR_timeline_semaphore");
+    // Enables exactly the feature just reported
+    timeline_features.pNext = nullptr;
+    device_create_info.pNext = &timeline_features;
+  }
+#endif
+  device_create_info.enabledExtensionCount =
+    static_cast<uint32_t>(enabled_extension_names.size());
+  device_create_info.ppEnabledExtensionNames =
+    enabled_extension_names.empty() ? nullptr
+    : enabled_extension_names.data();
   device_create_info.pEnabledFeatures = &supported_features;
 
   std::cout << "Creating device..." << std::endl;
@@ -513,9 +775,13 @@ void create_device()
    		       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
    		       &device);
 
-  if (res == VK_SUCCESS)
+  if (res == VK_SUCCESS) {
     std::cout << "Device created successfully!" << std::endl;
-  else
+    unsigned int missing = load_device_dispatch(device);
+    if (missing != 0)
+      std::cout << missing << " device functions go through the loader"
+		<< std::endl;
+  } else
     std::cout << "Failed to create device..." << std::endl;
 }
 
@@ -565,22 +831,32 @@ void create_buffers()
       | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
     if (i == UNIFORM_BUFFER)
       buf_create_infos[i].usage |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    if (i == DRAW_BUFFER)
+      buf_create_infos[i].usage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
     buf_create_infos[i].sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     buf_create_infos[i].queueFamilyIndexCount = 0;
     buf_create_infos[i].pQueueFamilyIndices = nullptr;
   }
   
-  buffers.resize(BUFFER_COUNT);
   std::cout << "Creating buffers (" << BUFFER_COUNT << ")..." << std::endl;
   for (int i = 0; i != BUFFER_COUNT; i++) {
+    // A failed buffer keeps its index with a null handle
+    VkBuffer buf = VK_NULL_HANDLE;
+    buffer_pool_t::handle h = {};
     res = vkCreateBuffer(device,
 			 &buf_create_infos[i],
 			 CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
-			 &buffers[i]);
+			 &buf);
     if (res == VK_SUCCESS)
+      h = buffer_pool.create(buf, VkMemoryRequirements(), 0, VK_NULL_HANDLE);
+    if (res == VK_SUCCESS && !h.null())
       std::cout << "Buffer " << i << " created successfully!" << std::endl;
+    else if (res == VK_SUCCESS)
+      std::cout << "Failed to create buffer " << i << ": pool is full"
+		<< std::endl;
     else
       std::cout << "Failed to create buffer " << i << "..." << std::endl;
+    buffers.push_back(h);
   }
 }
 
@@ -605,27 +881,38 @@ void create_images()
     img_create_infos[i].arrayLayers = 1;
     img_create_infos[i].samples = VK_SAMPLE_COUNT_1_BIT;
     img_create_infos[i].tiling = VK_IMAGE_TILING_OPTIMAL;
-    img_create_infos[i].usage =
-      (i == DEPTH_STENCIL_IMAGE ?
-       VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT :
-       VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
-      | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
-      | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (TRANSIENT_IMAGE(i))
+      img_create_infos[i].usage =
+	VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+	| VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    else
+      img_create_infos[i].usage =
+	VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+	| VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+	| VK_IMAGE_USAGE_TRANSFER_DST_BIT;
     img_create_infos[i].sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     img_create_infos[i].queueFamilyIndexCount = 0;
     img_create_infos[i].pQueueFamilyIndices = nullptr;
     img_create_infos[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
   }
 
-  images.resize(IMAGE_COUNT);
   std::cout << "Creating images (" << IMAGE_COUNT << ")..." << std::endl;
   for (unsigned int i = 0; i != IMAGE_COUNT; i++) {
+    VkImage img = VK_NULL_HANDLE;
+    image_pool_t::handle h = {};
     res = vkCreateImage(device,
 			&img_create_infos[i],
 			CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
-			&images[i]);
+			&img);
     if (res == VK_SUCCESS)
+      h = image_pool.create(img, VkMemoryRequirements(), 0,
+			    VkSubresourceLayout(), VK_NULL_HANDLE);
+    images.push_back(h);
+    if (res == VK_SUCCESS && !h.null())
       std::cout << "Image " << i << " created successfully!" << std::endl;
+    else if (res == VK_SUCCESS)
+      std::cout << "Failed to create image " << i << ": pool is full"
+		<< std::endl;
     else if (res == VK_ERROR_OUT_OF_HOST_MEMORY)
       std::cout << "Failed to create image " << i
 		<< ": out of host memory" << std::endl;
@@ -643,9 +930,9 @@ void create_images()
 
 void get_subresource_layouts()
 {
-  subresource_layouts.resize(IMAGE_COUNT);
-  
   for (unsigned int i = 0; i != IMAGE_COUNT; i++) {
+    if (!image_pool.alive(images[i]))
+      continue;
     VkImageSubresource img_subresource = {};
     img_subresource.aspectMask =
       i == DEPTH_STENCIL_IMAGE ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
@@ -655,63 +942,143 @@ void get_subresource_layouts()
     std::cout << "Getting subresource layout for image " << i << "..."
 	      << std::endl;
     vkGetImageSubresourceLayout(device,
-				images[i],
+				image_at(i),
 				&img_subresource,
-				&subresource_layouts[i]);
+				&image_pool.get<IMAGE_LAYOUT>(images[i]));
   }
 }
 
+// Buffers are placed back to back in one allocation, each at its
+// required alignment
 void get_buffer_memory_requirements()
 {
-  buf_mem_requirements.resize(BUFFER_COUNT);
   mem_size[RESOURCE_BUFFER] = 0;
-  for (unsigned int i = 0; i != BUFFER_COUNT; i++) {
-    std::cout << "Fetching memory requirements for buffer "
-	      << i << "..." << std::endl;
-    vkGetBufferMemoryRequirements(device,
-				  buffers[i],
-				  &buf_mem_requirements[i]);
-    mem_size[RESOURCE_BUFFER] += buf_mem_requirements[i].size;
-  }
+  buffer_pool.for_each([](buffer_pool_t::handle h) {
+      std::cout << "Fetching memory requirements for buffer "
+		<< h.index << "..." << std::endl;
+      VkMemoryRequirements& mem_reqs =
+	buffer_pool.get<BUFFER_MEM_REQS>(h);
+      vkGetBufferMemoryRequirements(device,
+				    buffer_pool.get<BUFFER_HANDLE>(h),
+				    &mem_reqs);
+      VkDeviceSize offset =
+	(mem_size[RESOURCE_BUFFER] + mem_reqs.alignment - 1)
+	/ mem_reqs.alignment * mem_reqs.alignment;
+      buffer_pool.get<BUFFER_OFFSET>(h) = offset;
+      mem_size[RESOURCE_BUFFER] = offset + mem_reqs.size;
+    });
 }
 
 void get_image_memory_requirements()
 {
-  img_mem_requirements.resize(IMAGE_COUNT);
-  mem_size[RESOURCE_IMAGE] = 0;
-  for (unsigned int i = 0; i != IMAGE_COUNT; i++) {
-    std::cout << "Fetching memory requirements for image "
-	      << i << "..." << std::endl;
-    vkGetImageMemoryRequirements(device,
-				 images[i],
-				 &img_mem_requirements[i]);
-    mem_size[RESOURCE_IMAGE] += img_mem_requirements[i].size;
+  image_pool.for_each([](image_pool_t::handle h) {
+      std::cout << "Fetching memory requirements for image "
+		<< h.index << "..." << std::endl;
+      vkGetImageMemoryRequirements(device,
+				   image_pool.get<IMAGE_HANDLE>(h),
+				   &image_pool.get<IMAGE_MEM_REQS>(h));
+    });
+}
+
+void plan_image_memory()
+{
+  // Only the clear image is ever touched; the rest are never used and
+  // can all share its memory.
+  std::vector<alias_resource> aliased;
+  std::vector<uint32_t> aliased_imgs;
+  VkDeviceSize unaliased_size = 0;
+  mem_size[RESOURCE_TRANSIENT] = 0;
+  for (uint32_t i = 0; i != IMAGE_COUNT; i++) {
+    if (!image_pool.alive(images[i]))
+      continue;
+    const VkMemoryRequirements& mem_reqs =
+      image_pool.get<IMAGE_MEM_REQS>(images[i]);
+    if (TRANSIENT_IMAGE(i)) {
+      image_pool.get<IMAGE_OFFSET>(images[i]) = mem_size[RESOURCE_TRANSIENT];
+      mem_size[RESOURCE_TRANSIENT] += mem_reqs.size;
+      continue;
+    }
+
+    alias_resource resource = {};
+    resource.mem_reqs = mem_reqs;
+    if (i == CLEAR_IMAGE) {
+      resource.first_use = PASS_CLEAR;
+      resource.last_use = PASS_CLEAR;
+    } else {
+      resource.first_use = ALIAS_UNUSED;
+      resource.last_use = ALIAS_UNUSED;
+    }
+    aliased.push_back(resource);
+    aliased_imgs.push_back(i);
+    unaliased_size += mem_reqs.size;
   }
+
+  std::cout << "Planning aliased image memory..." << std::endl;
+  mem_size[RESOURCE_IMAGE] = plan_aliasing(aliased);
+  for (unsigned int i = 0; i != aliased.size(); i++)
+    image_pool.get<IMAGE_OFFSET>(images[aliased_imgs[i]]) =
+      aliased[i].offset;
+
+  std::cout << "Aliased image memory: " << mem_size[RESOURCE_IMAGE]
+	    << " bytes (" << unaliased_size << " without aliasing)"
+	    << std::endl;
 }
 
 void find_memory_types()
 {  
-  for (uint32_t cur = 0;
-       mem_types[RESOURCE_BUFFER] == UINT32_MAX
-	 && cur < physical_device_mem_props.memoryTypeCount;
-       cur++) {
-    VkMemoryType& mem_type = physical_device_mem_props.memoryTypes[cur];
-    VkMemoryHeap& mem_heap =
-      physical_device_mem_props.memoryHeaps[mem_type.heapIndex];
-
-    // Buffer memory should be coherent/visible so host application
-    // can write to buffers directly. Image memory need not be
-    // coherent/visible since images will be modified using shaders
-    // (and hence by the device).
-    if (mem_heap.size <= 0 ||
-	!HOST_COHERENT(mem_type.propertyFlags) ||
-	!HOST_VISIBLE(mem_type.propertyFlags))
+  std::vector<VkMemoryRequirements> buf_mem_requirements;
+  std::vector<VkMemoryRequirements> aliased_mem_requirements;
+  std::vector<VkMemoryRequirements> transient_mem_requirements;
+  buffer_pool.for_each([&](buffer_pool_t::handle h) {
+      buf_mem_requirements.push_back(buffer_pool.get<BUFFER_MEM_REQS>(h));
+    });
+  for (unsigned int i = 0; i != IMAGE_COUNT; i++) {
+    if (!image_pool.alive(images[i]))
       continue;
-    
-    if (mem_size[RESOURCE_BUFFER] <= mem_heap.size &&
-	supports_mem_reqs(cur, buf_mem_requirements))
-      mem_types[RESOURCE_BUFFER] = cur;
+    const VkMemoryRequirements& mem_reqs =
+      image_pool.get<IMAGE_MEM_REQS>(images[i]);
+    if (TRANSIENT_IMAGE(i))
+      transient_mem_requirements.push_back(mem_reqs);
+    else
+      aliased_mem_requirements.push_back(mem_reqs);
+  }
+
+  // Buffer memory should be visible so host application can write to
+  // buffers directly. Image memory need not be coherent/visible since
+  // images will be modified using shaders (and hence by the device).
+  //
+  // Device local visible memory is read fastest by the device, then
+  // cached memory; either is often only offered without coherence.
+  const VkMemoryPropertyFlags buf_mem_preferences[] = {
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+  };
+  for (auto flags : buf_mem_preferences) {
+    if (!NON_COHERENT_BUFFERS)
+      flags |= VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    for (uint32_t cur = 0;
+	 mem_types[RESOURCE_BUFFER] == UINT32_MAX
+	   && cur < physical_device_mem_props.memoryTypeCount;
+	 cur++) {
+      VkMemoryType& mem_type = physical_device_mem_props.memoryTypes[cur];
+      VkMemoryHeap& mem_heap =
+	physical_device_mem_props.memoryHeaps[mem_type.heapIndex];
+
+      if (mem_heap.size <= 0 ||
+	  (mem_type.propertyFlags & flags) != flags)
+	continue;
+
+      if (mem_size[RESOURCE_BUFFER] <= mem_heap.size &&
+	  supports_mem_reqs(cur, buf_mem_requirements))
+	mem_types[RESOURCE_BUFFER] = cur;
+    }
   }
+  if (mem_types[RESOURCE_BUFFER] != UINT32_MAX)
+    std::cout << "Buffer memory type " << mem_types[RESOURCE_BUFFER]
+	      << (HOST_COHERENT(physical_device_mem_props.memoryTypes
+				[mem_types[RESOURCE_BUFFER]].propertyFlags)
+		  ? " (coherent)" : " (flushed by range)") << std::endl;
 
   for (uint32_t cur = 0;
        mem_types[RESOURCE_IMAGE] == UINT32_MAX
@@ -722,7 +1089,7 @@ void find_memory_types()
       physical_device_mem_props.memoryHeaps[mem_type.heapIndex];
 
     if (mem_size[RESOURCE_IMAGE] <= mem_heap.size &&
-	supports_mem_reqs(cur, img_mem_requirements)) {
+	supports_mem_reqs(cur, aliased_mem_requirements)) {
       if (cur == mem_types[RESOURCE_BUFFER] &&
 	  mem_size[RESOURCE_BUFFER]+mem_size[RESOURCE_IMAGE] > mem_heap.size)
 	continue;
@@ -730,6 +1097,30 @@ void find_memory_types()
 	mem_types[RESOURCE_IMAGE] = cur;
     }
   }
+
+  // Transient attachments never need backing storage on tilers, so prefer
+  // lazily allocated memory and fall back to whatever the images accept.
+  for (uint32_t cur = 0;
+       mem_types[RESOURCE_TRANSIENT] == UINT32_MAX
+	 && cur < physical_device_mem_props.memoryTypeCount;
+       cur++) {
+    VkMemoryType& mem_type = physical_device_mem_props.memoryTypes[cur];
+    if (LAZILY_ALLOCATED(mem_type.propertyFlags) &&
+	supports_mem_reqs(cur, transient_mem_requirements))
+      mem_types[RESOURCE_TRANSIENT] = cur;
+  }
+
+  for (uint32_t cur = 0;
+       mem_types[RESOURCE_TRANSIENT] == UINT32_MAX
+	 && cur < physical_device_mem_props.memoryTypeCount;
+       cur++) {
+    VkMemoryType& mem_type = physical_device_mem_props.memoryTypes[cur];
+    VkMemoryHeap& mem_heap =
+      physical_device_mem_props.memoryHeaps[mem_type.heapIndex];
+    if (mem_size[RESOURCE_TRANSIENT] <= mem_heap.size &&
+	supports_mem_reqs(cur, transient_mem_requirements))
+      mem_types[RESOURCE_TRANSIENT] = cur;
+  }
 }
 
 void allocate_buffer_memory()
@@ -770,99 +1161,120 @@ void allocate_image_memory()
     std::cout << "Failed to allocate image memory..." << std::endl;
 }
 
+void allocate_transient_memory()
+{
+  VkMemoryAllocateInfo transient_mem_allocate_info = {};
+  transient_mem_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  transient_mem_allocate_info.pNext = nullptr;
+  transient_mem_allocate_info.allocationSize = mem_size[RESOURCE_TRANSIENT];
+  transient_mem_allocate_info.memoryTypeIndex = mem_types[RESOURCE_TRANSIENT];
+
+  std::cout << "Allocating transient attachment memory..." << std::endl;
+  res = vkAllocateMemory(device,
+			 &transient_mem_allocate_info,
+			 CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+			 &memory[RESOURCE_TRANSIENT]);
+  if (res == VK_SUCCESS)
+    std::cout << "Transient attachment memory allocated successfully!"
+	      << std::endl;
+  else
+    std::cout << "Failed to allocate transient attachment memory..."
+	      << std::endl;
+}
+
 void write_buffer_memory()
 {
-  void* buf_data;
   std::cout << "Mapping buffer memory..." << std::endl;
   std::lock_guard<std::mutex> lock(memory_mutex[RESOURCE_BUFFER]);
-  res = vkMapMemory(device,
-		    memory[RESOURCE_BUFFER],
-		    0,
-		    VK_WHOLE_SIZE,
-		    0,
-		    &buf_data);
-  if (res == VK_SUCCESS)
+  buffer_mapping.reset(new mapped_memory(physical_devices[phys_device_idx],
+					 device,
+					 memory[RESOURCE_BUFFER],
+					 mem_types[RESOURCE_BUFFER],
+					 mem_size[RESOURCE_BUFFER]));
+  if (buffer_mapping->valid())
     std::cout << "Buffer memory mapped successfully!" << std::endl;
-  else
+  else {
     std::cout << "Failed to map buffer memory..." << std::endl;
+    return;
+  }
  
   char* str = new char[mem_size[RESOURCE_BUFFER]];
-  unsigned int k = 0;
-  for (unsigned int i = 0; i != BUFFER_COUNT; i++) {
-    for (unsigned int j = 0; j != buf_mem_requirements[i].size; j++) {
-      int off = rand() % 26;
-      unsigned char c = 'A' + off;
-      str[k++] = c;
-    }
+  for (unsigned int k = 0; k != mem_size[RESOURCE_BUFFER]; k++) {
+    int off = rand() % 26;
+    unsigned char c = 'A' + off;
+    str[k] = c;
   }
   str[mem_size[RESOURCE_BUFFER]-1] = '\0';
-  memcpy(buf_data, str, mem_size[RESOURCE_BUFFER]);
+  buffer_mapping->write(0, str, mem_size[RESOURCE_BUFFER]);
   delete[](str);
+}
+
+// Host writes reach the device at the next submission
+void flush_buffer_memory()
+{
+  std::lock_guard<std::mutex> lock(memory_mutex[RESOURCE_BUFFER]);
+  if (!buffer_mapping)
+    return;
+  res = buffer_mapping->flush();
+  if (res != VK_SUCCESS)
+    LOG_ERROR("Failed to flush buffer memory...");
+}
 
-  std::cout << "Unmapping buffer memory..." << std::endl;
-  vkUnmapMemory(device,
-		memory[RESOURCE_BUFFER]);
+void print_buffer_memory(VkDeviceSize offset, VkDeviceSize length)
+{
+  std::lock_guard<std::mutex> lock(memory_mutex[RESOURCE_BUFFER]);
+  print_mem(buffer_mapping->read(offset, length), length);
 }
 
 void bind_buffer_memory()
 {
-  std::vector<std::unique_lock<std::mutex>> locks;
-  for (auto& mut : resource_mutex[RESOURCE_BUFFER])
-    locks.emplace_back(mut, std::defer_lock);
-  VkDeviceSize offset = 0;
-  for (unsigned int i = 0; i != BUFFER_COUNT; i++) {
-    locks[i].lock();
-    std::cout << "Binding buffer memory to buffer " << i
-	      << "..." << std::endl;
-    res = vkBindBufferMemory(device,
-			     buffers[i],
-			     memory[RESOURCE_BUFFER],
-			     offset);
-    offset += buf_mem_requirements[i].size;
-    if (res == VK_SUCCESS)
-      std::cout << "Buffer memory bound to buffer " << i
-		<< " successfully!" << std::endl;
-    else
-      std::cout << "Failed to bind buffer memory to buffer " << i
+  buffer_pool.for_each([](buffer_pool_t::handle h) {
+      std::cout << "Binding buffer memory to buffer " << h.index
 		<< "..." << std::endl;
-    locks[i].unlock();
-  }
+      res = vkBindBufferMemory(device,
+			       buffer_pool.get<BUFFER_HANDLE>(h),
+			       memory[RESOURCE_BUFFER],
+			       buffer_pool.get<BUFFER_OFFSET>(h));
+      if (res == VK_SUCCESS)
+	std::cout << "Buffer memory bound to buffer " << h.index
+		  << " successfully!" << std::endl;
+      else
+	std::cout << "Failed to bind buffer memory to buffer " << h.index
+		  << "..." << std::endl;
+    });
 }
 
 void bind_image_memory()
 {
-  std::vector<std::unique_lock<std::mutex>> locks;
-  for (auto& mut : resource_mutex[RESOURCE_IMAGE])
-    locks.emplace_back(mut, std::defer_lock);
-  VkDeviceSize offset = 0;
   for (unsigned int i = 0; i != IMAGE_COUNT; i++) {
+    if (!image_pool.alive(images[i]))
+      continue;
     std::cout << "Binding image memory to image "
 	      << i << "..." << std::endl;
-    locks[i].lock();
     res = vkBindImageMemory(device,
-			    images[i],
-			    memory[RESOURCE_IMAGE],
-			    offset);
-    offset += img_mem_requirements[i].size;
+			    image_at(i),
+			    memory[TRANSIENT_IMAGE(i) ?
+				   RESOURCE_TRANSIENT : RESOURCE_IMAGE],
+			    image_pool.get<IMAGE_OFFSET>(images[i]));
     if (res == VK_SUCCESS)
       std::cout << "Image memory bound for image " << i
 		<< " successfully!" << std::endl;
     else
       std::cout << "Failed to bind image memory for image "
 		<< i << "..." << std::endl;
-    locks[i].unlock();
   }
 }
 
 void create_buffer_views()
 {
-  buffer_views.resize(BUFFER_COUNT);
   for (unsigned int i = 0; i != BUFFER_COUNT; i++) {
+    if (!buffer_pool.alive(buffers[i]))
+      continue;
     VkBufferViewCreateInfo buf_view_create_info = {};
     buf_view_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO;
     buf_view_create_info.pNext = nullptr;
     buf_view_create_info.flags = 0;
-    buf_view_create_info.buffer = buffers[i];
+    buf_view_create_info.buffer = buffer_at(i);
     buf_view_create_info.format = BUFFER_FORMAT;
     buf_view_create_info.offset = 0;
     buf_view_create_info.range = VK_WHOLE_SIZE;
@@ -871,7 +1283,7 @@ void create_buffer_views()
     res = vkCreateBufferView(device,
 			     &buf_view_create_info,
 			     CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
-			     &buffer_views[i]);
+			     &buffer_pool.get<BUFFER_VIEW>(buffers[i]));
     if (res == VK_SUCCESS)
       std::cout << "Buffer view " << i << " created successfully!"
 		<< std::endl;
@@ -883,13 +1295,14 @@ void create_buffer_views()
 
 void create_image_views()
 {
-  image_views.resize(IMAGE_COUNT);
   for (unsigned int i = 0; i != IMAGE_COUNT; i++) {
+    if (!image_pool.alive(images[i]))
+      continue;
     VkImageViewCreateInfo img_view_create_info = {};
     img_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     img_view_create_info.pNext = nullptr;
     img_view_create_info.flags = 0;
-    img_view_create_info.image = images[i];
+    img_view_create_info.image = image_at(i);
     img_view_create_info.viewType =
       i == DEPTH_STENCIL_IMAGE ? VK_IMAGE_VIEW_TYPE_2D : VK_IMAGE_VIEW_TYPE_3D;
     img_view_create_info.format =
@@ -914,7 +1327,7 @@ void create_image_views()
     res = vkCreateImageView(device,
 			    &img_view_create_info,
 			    CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
-			    &image_views[i]);
+			    &image_pool.get<IMAGE_VIEW>(images[i]));
     if (res == VK_SUCCESS)
       std::cout << "Image view " << i << " created successfully!"
 		<< std::endl;
@@ -933,18 +1346,27 @@ void create_image_views()
   }
 }
 
+// The main family comes first, so its queues keep indices
+// 0..queue_family_queue_count-1
 void get_queues()
 {
-  queues.resize(queue_family_queue_count);
-  for (unsigned int queue_idx = 0;
-       queue_idx != queue_family_queue_count;
-       queue_idx++) {
-    std::cout << "Obtaining device queue " << (queue_idx+1)
-	      << "/" << queue_family_queue_count << "..." << std::endl;
-    vkGetDeviceQueue(device,
-		     queue_family_idx,
-		     queue_idx,
-		     &queues[queue_idx]);
+  queues.clear();
+  queue_families.clear();
+  for (auto family : planned_queues.families) {
+    uint32_t count = queue_family_properties[family].queueCount;
+    for (unsigned int i = 0; i != count; i++) {
+      if (queues.size() == MAX_QUEUES) {
+	std::cout << "Not using more than " << MAX_QUEUES << " queues..."
+		  << std::endl;
+	return;
+      }
+      std::cout << "Obtaining device queue " << (i+1) << "/" << count
+		<< " of family " << family << "..." << std::endl;
+      VkQueue queue;
+      vkGetDeviceQueue(device, family, i, &queue);
+      queues.push_back(queue);
+      queue_families.push_back(family);
+    }
   }
 }
 
@@ -990,6 +1412,144 @@ void allocate_command_buffers()
     std::cout << "Failed to allocate command buffers..." << std::endl;
 }
 
+// Static command buffers live for the whole run, so they come from a pool
+// without the transient hint
+void create_static_command_buffers()
+{
+  std::lock_guard<std::mutex> lock(command_pool_mutex);
+  VkCommandPoolCreateInfo cmd_pool_create_info = {};
+  cmd_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  cmd_pool_create_info.pNext = nullptr;
+  cmd_pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  cmd_pool_create_info.queueFamilyIndex = queue_family_idx;
+  std::cout << "Creating static command pool..." << std::endl;
+  res = vkCreateCommandPool(device,
+			    &cmd_pool_create_info,
+			    CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+			    &static_command_pool);
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to create static command pool..." << std::endl;
+    return;
+  }
+
+  uint32_t count = static_cast<uint32_t>(swapchain_images.size());
+  VkCommandBufferAllocateInfo cmd_buf_alloc_info = {};
+  cmd_buf_alloc_info.sType =
+    VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  cmd_buf_alloc_info.pNext = nullptr;
+  cmd_buf_alloc_info.commandPool = static_command_pool;
+  cmd_buf_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  cmd_buf_alloc_info.commandBufferCount = count;
+  command_buffers.resize(COMMAND_BUFFER_STATIC + count);
+  std::cout << "Allocating static command buffers ("
+	    << count << ")..." << std::endl;
+  res = vkAllocateCommandBuffers(device,
+				 &cmd_buf_alloc_info,
+				 &command_buffers[COMMAND_BUFFER_STATIC]);
+  if (res == VK_SUCCESS)
+    std::cout << "Static command buffers allocated successfully!"
+	      << std::endl;
+  else
+    std::cout << "Failed to allocate static command buffers..."
+	      << std::endl;
+  static_draw none = { false, 0, 0 };
+  static_draws.assign(count, none);
+}
+
+// Must be called whenever something a static command buffer references
+// changes: descriptor set contents, pipelines or framebuffers
+void invalidate_static_command_buffers()
+{
+  for (auto& draw : static_draws)
+    draw.valid = false;
+}
+
+// Async passes are recorded into a command buffer of the compute family;
+// the prologue, on the main queue, hands their resources over to it
+void create_async_compute()
+{
+  if (!scheduler->concurrent(QUEUE_CLASS_COMPUTE)) {
+    std::cout << "No separate compute queue, compute passes stay on the "
+	      << "main queue..." << std::endl;
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(command_pool_mutex);
+  VkCommandPoolCreateInfo cmd_pool_create_info = {};
+  cmd_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  cmd_pool_create_info.pNext = nullptr;
+  cmd_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+    VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  cmd_pool_create_info.queueFamilyIndex =
+    scheduler->family(QUEUE_CLASS_COMPUTE);
+  std::cout << "Creating async compute command pool (family "
+	    << cmd_pool_create_info.queueFamilyIndex << ")..." << std::endl;
+  res = vkCreateCommandPool(device,
+			    &cmd_pool_create_info,
+			    CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+			    &async_command_pool);
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to create async compute command pool..."
+	      << std::endl;
+    return;
+  }
+
+  VkCommandBufferAllocateInfo cmd_buf_alloc_info = {};
+  cmd_buf_alloc_info.sType =
+    VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  cmd_buf_alloc_info.pNext = nullptr;
+  cmd_buf_alloc_info.commandPool = async_command_pool;
+  cmd_buf_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  cmd_buf_alloc_info.commandBufferCount = 1;
+  res = vkAllocateCommandBuffers(device,
+				 &cmd_buf_alloc_info,
+				 &async_command_buffer);
+  if (res == VK_SUCCESS) {
+    cmd_buf_alloc_info.commandPool = command_pool;
+    res = vkAllocateCommandBuffers(device,
+				   &cmd_buf_alloc_info,
+				   &prologue_command_buffer);
+  }
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to allocate async compute command buffers..."
+	      << std::endl;
+    vkDestroyCommandPool(device,
+			 async_command_pool,
+			 CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+    return;
+  }
+
+  // Only the main queue is profiled, so a pass keeps the timing that sent
+  // it to the compute queue
+  frame_graph.set_async_queue(queue_family_idx,
+			      scheduler->family(QUEUE_CLASS_COMPUTE),
+			      ASYNC_COMPUTE_MIN_MS,
+			      [](const std::string& name, double& ms) {
+				gpu_scope_stats stats;
+				if (!profiler->stats(name, stats))
+				  return false;
+				ms = stats.avg_ms;
+				return true;
+			      });
+  async_compute = true;
+  std::cout << "Async compute command buffers allocated successfully!"
+	    << std::endl;
+}
+
+void destroy_async_compute()
+{
+  if (!async_compute)
+    return;
+  std::lock_guard<std::mutex> lock(command_pool_mutex);
+  std::cout << "Destroying async compute command pool..." << std::endl;
+  vkFreeCommandBuffers(device, command_pool, 1, &prologue_command_buffer);
+  vkDestroyCommandPool(device,
+		       async_command_pool,
+		       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+  async_compute = false;
+}
+
+#ifndef HEADLESS
 void create_surface()
 {
   std::cout << "Creating " << platform << " surface..." << std::endl;
@@ -1209,47 +1769,229 @@ void get_swapchain_images()
     std::cout << "Failed to get swapchain image count..." << std::endl;
 }
 
-void create_swapchain_image_views()
+#endif
+
+#ifdef HEADLESS
+uint32_t find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags flags)
 {
-  swapchain_image_views.resize(swapchain_images.size());
-  
-  VkImageSubresourceRange range = {};
-  range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  range.baseMipLevel = 0;
-  range.levelCount = 1;
-  range.baseArrayLayer = 0;
-  range.layerCount = 1;
+  for (uint32_t i = 0; i != physical_device_mem_props.memoryTypeCount; i++)
+    if ((type_bits & (1u << i)) != 0
+	&& (physical_device_mem_props.memoryTypes[i].propertyFlags & flags)
+	== flags)
+      return i;
+  return UINT32_MAX;
+}
 
-  for (unsigned int i = 0; i != swapchain_image_views.size(); i++) {
-    VkImageViewCreateInfo create_info = {};
-    create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    create_info.pNext = nullptr;
-    create_info.flags = 0;
-    create_info.image = swapchain_images[i];
-    create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    create_info.format = SWAPCHAIN_IMAGE_FORMAT;
-    create_info.components = {
-      VK_COMPONENT_SWIZZLE_R,
-      VK_COMPONENT_SWIZZLE_G,
-      VK_COMPONENT_SWIZZLE_B,
-      VK_COMPONENT_SWIZZLE_A
-    };
-    create_info.subresourceRange = range;
-    
-    std::cout << "Creating swapchain image view: " << (i+1) << "/"
-	      << swapchain_image_views.size()
-	      << "..." << std::endl;
-    res = vkCreateImageView(device,
-			    &create_info,
-			    CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
-			    &swapchain_image_views[i]);
-    if (res == VK_SUCCESS)
-      std::cout << "Created swapchain image view " << (i+1) << "/"
-		<< swapchain_image_views.size() << " sucessfully!"
-		<< std::endl;
-    else
-      std::cout << "Failed to create swapchain image view " << (i+1)
-		<< "/" << swapchain_image_views.size() << "..."
+void create_offscreen_images()
+{
+  surface_capabilities.currentExtent.width = PREFERRED_WIDTH;
+  surface_capabilities.currentExtent.height = PREFERRED_HEIGHT;
+
+  VkImageCreateInfo create_info = {};
+  create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  create_info.pNext = nullptr;
+  create_info.flags = 0;
+  create_info.imageType = VK_IMAGE_TYPE_2D;
+  create_info.format = SWAPCHAIN_IMAGE_FORMAT;
+  create_info.extent.width = PREFERRED_WIDTH;
+  create_info.extent.height = PREFERRED_HEIGHT;
+  create_info.extent.depth = 1;
+  create_info.mipLevels = 1;
+  create_info.arrayLayers = 1;
+  create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+    | VK_IMAGE_USAGE_TRANSFER_DST_BIT
+    | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  create_info.queueFamilyIndexCount = 0;
+  create_info.pQueueFamilyIndices = nullptr;
+  create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  std::lock_guard<std::mutex> lock(swapchain_mutex);
+  swapchain_images.resize(HEADLESS_IMAGE_COUNT);
+  std::vector<VkDeviceSize> offsets(HEADLESS_IMAGE_COUNT);
+  VkDeviceSize size = 0;
+  uint32_t type_bits = UINT32_MAX;
+  for (unsigned int i = 0; i != HEADLESS_IMAGE_COUNT; i++) {
+    std::cout << "Creating offscreen image " << (i+1) << "/"
+	      << HEADLESS_IMAGE_COUNT << "..." << std::endl;
+    res = vkCreateImage(device,
+			&create_info,
+			CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+			&swapchain_images[i]);
+    if (res != VK_SUCCESS) {
+      std::cout << "Failed to create offscreen image " << i << "..."
+		<< std::endl;
+      return;
+    }
+
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(device, swapchain_images[i], &reqs);
+    offsets[i] = (size + reqs.alignment - 1) / reqs.alignment * reqs.alignment;
+    size = offsets[i] + reqs.size;
+    type_bits &= reqs.memoryTypeBits;
+  }
+
+  uint32_t type = find_memory_type(type_bits,
+				   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  if (type == UINT32_MAX)
+    type = find_memory_type(type_bits, 0);
+
+  VkMemoryAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.pNext = nullptr;
+  alloc_info.allocationSize = size;
+  alloc_info.memoryTypeIndex = type;
+
+  std::cout << "Allocating offscreen image memory (" << size
+	    << " bytes, type " << type << ")..." << std::endl;
+  res = vkAllocateMemory(device,
+			 &alloc_info,
+			 CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+			 &offscreen_memory);
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to allocate offscreen image memory..." << std::endl;
+    return;
+  }
+
+  for (unsigned int i = 0; i != HEADLESS_IMAGE_COUNT; i++)
+    vkBindImageMemory(device, swapchain_images[i], offscreen_memory, offsets[i]);
+  std::cout << "Offscreen images created successfully!" << std::endl;
+}
+
+void create_readback_buffer()
+{
+  readback_size = (VkDeviceSize) PREFERRED_WIDTH * PREFERRED_HEIGHT * 4;
+
+  VkBufferCreateInfo create_info = {};
+  create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  create_info.pNext = nullptr;
+  create_info.flags = 0;
+  create_info.size = readback_size;
+  create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  create_info.queueFamilyIndexCount = 0;
+  create_info.pQueueFamilyIndices = nullptr;
+
+  std::cout << "Creating readback buffer (" << readback_size
+	    << " bytes)..." << std::endl;
+  res = vkCreateBuffer(device,
+		       &create_info,
+		       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+		       &readback_buffer);
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to create readback buffer..." << std::endl;
+    return;
+  }
+
+  VkMemoryRequirements reqs;
+  vkGetBufferMemoryRequirements(device, readback_buffer, &reqs);
+
+  // Cached memory makes the CPU side checksum much faster
+  uint32_t type = find_memory_type(reqs.memoryTypeBits,
+				   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+				   | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+  if (type == UINT32_MAX)
+    type = find_memory_type(reqs.memoryTypeBits,
+			    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  readback_coherent = type != UINT32_MAX
+    && HOST_COHERENT(physical_device_mem_props.memoryTypes[type].propertyFlags);
+
+  VkMemoryAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.pNext = nullptr;
+  alloc_info.allocationSize = reqs.size;
+  alloc_info.memoryTypeIndex = type;
+
+  res = vkAllocateMemory(device,
+			 &alloc_info,
+			 CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+			 &readback_memory);
+  if (res == VK_SUCCESS)
+    res = vkBindBufferMemory(device, readback_buffer, readback_memory, 0);
+  if (res == VK_SUCCESS)
+    res = vkMapMemory(device,
+		      readback_memory,
+		      0,
+		      VK_WHOLE_SIZE,
+		      0,
+		      (void**) &readback_data);
+  if (res == VK_SUCCESS)
+    std::cout << "Readback buffer created successfully!" << std::endl;
+  else
+    std::cout << "Failed to set up readback buffer memory..." << std::endl;
+}
+
+void destroy_readback_buffer()
+{
+  std::cout << "Destroying readback buffer..." << std::endl;
+  vkUnmapMemory(device, readback_memory);
+  vkDestroyBuffer(device,
+		  readback_buffer,
+		  CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+  vkFreeMemory(device,
+	       readback_memory,
+	       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+}
+
+void destroy_offscreen_images()
+{
+  std::lock_guard<std::mutex> lock(swapchain_mutex);
+  for (unsigned int i = 0; i != swapchain_images.size(); i++) {
+    std::cout << "Destroying offscreen image " << (i+1) << "/"
+	      << swapchain_images.size() << "..." << std::endl;
+    vkDestroyImage(device,
+		   swapchain_images[i],
+		   CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+  }
+  vkFreeMemory(device,
+	       offscreen_memory,
+	       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+}
+#endif
+
+void create_swapchain_image_views()
+{
+  swapchain_image_views.resize(swapchain_images.size());
+  
+  VkImageSubresourceRange range = {};
+  range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  range.baseMipLevel = 0;
+  range.levelCount = 1;
+  range.baseArrayLayer = 0;
+  range.layerCount = 1;
+
+  for (unsigned int i = 0; i != swapchain_image_views.size(); i++) {
+    VkImageViewCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.image = swapchain_images[i];
+    create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    create_info.format = SWAPCHAIN_IMAGE_FORMAT;
+    create_info.components = {
+      VK_COMPONENT_SWIZZLE_R,
+      VK_COMPONENT_SWIZZLE_G,
+      VK_COMPONENT_SWIZZLE_B,
+      VK_COMPONENT_SWIZZLE_A
+    };
+    create_info.subresourceRange = range;
+    
+    std::cout << "Creating swapchain image view: " << (i+1) << "/"
+	      << swapchain_image_views.size()
+	      << "..." << std::endl;
+    res = vkCreateImageView(device,
+			    &create_info,
+			    CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+			    &swapchain_image_views[i]);
+    if (res == VK_SUCCESS)
+      std::cout << "Created swapchain image view " << (i+1) << "/"
+		<< swapchain_image_views.size() << " sucessfully!"
+		<< std::endl;
+    else
+      std::cout << "Failed to create swapchain image view " << (i+1)
+		<< "/" << swapchain_image_views.size() << "..."
 		<< std::endl;
   }
 }
@@ -1261,22 +2003,21 @@ void begin_recording()
   cmd_buf_begin_info.pNext = nullptr;
   cmd_buf_begin_info.flags = 0;
   cmd_buf_begin_info.pInheritanceInfo = nullptr;
-  std::cout << "Beginning command buffers (" << COMMAND_BUFFER_COUNT
-	    << ")..." << std::endl;
+  LOG_DEBUG("Beginning command buffers (" << COMMAND_BUFFER_COUNT
+	    << ")...");
   std::lock_guard<std::mutex> lock(command_pool_mutex);
   std::vector<std::unique_lock<std::mutex>> locks;
   for (auto& mut : command_buffer_mutex)
     locks.emplace_back(mut, std::defer_lock);
   for (unsigned int i = 0; i != COMMAND_BUFFER_COUNT; i++) {
     locks[i].lock();
-    res = vkBeginCommandBuffer(command_buffers[i],
-			       &cmd_buf_begin_info);
+    res = vkd.vkBeginCommandBuffer(command_buffers[i],
+				   &cmd_buf_begin_info);
+    recorders[i].reset(command_buffers[i]);
     if (res == VK_SUCCESS)
-      std::cout << "Command buffer " << i << " is now recording."
-		<< std::endl;
+      LOG_DEBUG("Command buffer " << i << " is now recording.");
     else
-      std::cout << "Failed to begin command buffer " << i << "..."
-		<< std::endl;      
+      LOG_ERROR("Failed to begin command buffer " << i << "...");      
     locks[i].unlock();
   }
 }
@@ -1288,19 +2029,19 @@ void begin_recording(uint32_t command_buf_idx)
   cmd_buf_begin_info.pNext = nullptr;
   cmd_buf_begin_info.flags = 0;
   cmd_buf_begin_info.pInheritanceInfo = nullptr;
-  std::cout << "Beginning command buffer "
-	    << command_buf_idx << "..." << std::endl;
+  LOG_DEBUG("Beginning command buffer "
+	    << command_buf_idx << "...");
   std::lock_guard<std::mutex> pool_lock(command_pool_mutex);
   std::lock_guard<std::mutex> buf_lock(command_buffer_mutex[command_buf_idx]);
-  res = vkBeginCommandBuffer(command_buffers[command_buf_idx],
-			     &cmd_buf_begin_info);
+  res = vkd.vkBeginCommandBuffer(command_buffers[command_buf_idx],
+				 &cmd_buf_begin_info);
+  recorders[command_buf_idx].reset(command_buffers[command_buf_idx]);
   if (res == VK_SUCCESS)
-    std::cout << "Command buffer " << command_buf_idx
-	      << " is now recording." << std::endl;
+    LOG_DEBUG("Command buffer " << command_buf_idx
+	      << " is now recording.");
   else
-    std::cout << "Failed to begin command buffer "
-	      << command_buf_idx << "..."
-	      << std::endl;   
+    LOG_ERROR("Failed to begin command buffer "
+	      << command_buf_idx << "...");   
 }
 
 void record_copy_buffer_commands()
@@ -1310,21 +2051,21 @@ void record_copy_buffer_commands()
   for (auto& mut : command_buffer_mutex)
     locks.emplace_back(mut, std::defer_lock);
   for (unsigned int i = 0; i != COMMAND_BUFFER_COUNT; i++) {
-    std::cout << "Adding vkCmdCopyBuffer from buffer " << 2*i
+    LOG_DEBUG("Adding vkCmdCopyBuffer from buffer " << 2*i
 	      << " to buffer " << 2*i+1 << " to command buffer " << i
-	      << "..." << std::endl;
+	      << "...");
     locks[i].lock();
-    VkBuffer src_buf = buffers[2*i];
-    VkBuffer dst_buf = buffers[2*i+1];
+    VkBuffer src_buf = buffer_at(2*i);
+    VkBuffer dst_buf = buffer_at(2*i+1);
     std::vector<VkBufferCopy> copies(1);
     copies[0].srcOffset = 0;
     copies[0].dstOffset = 0;
     copies[0].size = 128;
-    vkCmdCopyBuffer(command_buffers[i],
-		    src_buf,
-		    dst_buf,
-		    static_cast<uint32_t>(copies.size()),
-		    copies.data());
+    vkd.vkCmdCopyBuffer(command_buffers[i],
+			src_buf,
+			dst_buf,
+			static_cast<uint32_t>(copies.size()),
+			copies.data());
     locks[i].unlock();
   }
 }
@@ -1337,129 +2078,266 @@ void record_fill_buffer_commands()
     locks.emplace_back(mut, std::defer_lock);
   uint32_t data = make_data("ABCD");
   if (data == VT_BAD_DATA) {
-    std::cout << "Failed record_fill_buffer_commands(): bad data"
-	      << std::endl;
+    LOG_ERROR("Failed record_fill_buffer_commands(): bad data");
     return;
   }
   
   for (unsigned int i = 0; i != COMMAND_BUFFER_COUNT; i++) {
-    std::cout << "Adding vkCmdFillBuffer to buffer "
+    LOG_DEBUG("Adding vkCmdFillBuffer to buffer "
 	      << i << " to command buffer " << i
-	      << "..." << std::endl;
+	      << "...");
     locks[i].lock();
-    vkCmdFillBuffer(command_buffers[i],
-		    buffers[i],
-		    0,
-		    64,
-		    data);
+    vkd.vkCmdFillBuffer(command_buffers[i],
+			buffer_at(i),
+			0,
+			64,
+			data);
     locks[i].unlock();
   }
 }
 
 void end_recording()
 {
-  std::cout << "Ending command buffers (" << COMMAND_BUFFER_COUNT
-	    << ")..." << std::endl;
+  LOG_DEBUG("Ending command buffers (" << COMMAND_BUFFER_COUNT
+	    << ")...");
   std::lock_guard<std::mutex> lock(command_pool_mutex);
   std::vector<std::unique_lock<std::mutex>> locks;
   for (auto& mut : command_buffer_mutex)
     locks.emplace_back(mut, std::defer_lock);
   for (unsigned int i = 0; i != COMMAND_BUFFER_COUNT; i++) {
     locks[i].lock();
-    res = vkEndCommandBuffer(command_buffers[i]);
+    res = vkd.vkEndCommandBuffer(command_buffers[i]);
     if (res == VK_SUCCESS)
-      std::cout << "Command buffer " << i << " is no longer recording."
-		<< std::endl;
+      LOG_DEBUG("Command buffer " << i << " is no longer recording.");
     else
-      std::cout << "Failed to end command buffer " << i << "..."
-		<< std::endl;      
+      LOG_ERROR("Failed to end command buffer " << i << "...");      
     locks[i].unlock();
   }
 }
 
 void end_recording(uint32_t command_buf_idx)
 {
-  std::cout << "Ending command buffer " << command_buf_idx 
-	    << "..." << std::endl;
+  LOG_DEBUG("Ending command buffer " << command_buf_idx 
+	    << "...");
   std::lock_guard<std::mutex> pool_lock(command_pool_mutex);
   std::lock_guard<std::mutex> buf_lock(command_buffer_mutex[command_buf_idx]);
-  res = vkEndCommandBuffer(command_buffers[command_buf_idx]);
+  res = vkd.vkEndCommandBuffer(command_buffers[command_buf_idx]);
   if (res == VK_SUCCESS)
-    std::cout << "Command buffer " << command_buf_idx
-	      << " is no longer recording." << std::endl;
+    LOG_DEBUG("Command buffer " << command_buf_idx
+	      << " is no longer recording.");
   else
-    std::cout << "Failed to end command buffer " << command_buf_idx
-	      << "..." << std::endl;      
+    LOG_ERROR("Failed to end command buffer " << command_buf_idx
+	      << "...");      
 }
 
 void submit_all_to_queue(uint32_t queue_idx)
 {
-  std::vector<VkSubmitInfo> submit_infos(1);
-  submit_infos[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submit_infos[0].pNext = nullptr;
-  submit_infos[0].waitSemaphoreCount = 0;
-  submit_infos[0].pWaitSemaphores = nullptr;
-  submit_infos[0].pWaitDstStageMask = nullptr;
-  submit_infos[0].commandBufferCount =
-    static_cast<uint32_t>(command_buffers.size());
-  submit_infos[0].pCommandBuffers = command_buffers.data();
-  submit_infos[0].signalSemaphoreCount = 0;
-  submit_infos[0].pSignalSemaphores = nullptr;
-  std::cout << "Submitting command buffers to queue "
-	    << queue_idx << "..." << std::endl;
-  std::lock_guard<std::mutex> lock(queue_mutex[queue_idx]);
-  res = vkQueueSubmit(queues[queue_idx],
-		      static_cast<uint32_t>(submit_infos.size()),
-		      submit_infos.data(),
-		      VK_NULL_HANDLE);
-  if (res == VK_SUCCESS)
-    std::cout << "Command buffers submitted to queue " << queue_idx
-	      << " successfully!" << std::endl;
+  LOG_DEBUG("Queueing command buffers for queue "
+	    << queue_idx << "...");
+  flush_buffer_memory();
+  if (timeline)
+    timeline->submit(queue_idx,
+		     command_buffers.data(), COMMAND_BUFFER_COUNT,
+		     nullptr, nullptr, 0);
   else
-    std::cout << "Failed to submit command buffers to queue "
-	      << queue_idx << "..." << std::endl;
+    submit_batches[queue_idx]->enqueue(command_buffers.data(),
+				       COMMAND_BUFFER_COUNT,
+				       nullptr, nullptr, 0,
+				       nullptr, 0);
+}
+
+uint32_t queue_index(const scheduled_queue& q)
+{
+  for (uint32_t i = 0; i != submit_batches.size(); i++)
+    if (submit_batches[i].get() == q.batch)
+      return i;
+  return 0;
+}
+
+// The same three submissions as a task graph on the timeline; the frame
+// waits for a value of the compute queue rather than a binary semaphore
+void submit_split_frame_tasks(uint32_t command_buf_idx, uint32_t queue_idx)
+{
+  gpu_task_graph graph;
+  gpu_task_graph::task prologue = 0;
+  if (frame_split.prologue)
+    prologue = graph.add_task(queue_idx, &prologue_command_buffer, 1);
+  gpu_task_graph::task async =
+    graph.add_task(queue_index(scheduler->pick(QUEUE_CLASS_COMPUTE)),
+		   &async_command_buffer, 1);
+  if (frame_split.prologue)
+    graph.depend(async, prologue, frame_split.async_wait_stages);
+  gpu_task_graph::task frame =
+    graph.add_task(queue_idx, &command_buffers[command_buf_idx], 1);
+  graph.depend(frame, async, frame_split.main_wait_stages);
+  graph.submit(*timeline);
+}
+
+// Prologue, async work and the frame itself, chained with semaphores.
+// The scheduler keeps queue 0 for its main class, the queue frames go to.
+void submit_split_frame(uint32_t command_buf_idx)
+{
+  LOG_DEBUG("Queueing async compute for command buffer "
+	    << command_buf_idx << "...");
+  queue_ticket prologue = {nullptr, VK_NULL_HANDLE};
+  if (frame_split.prologue)
+    prologue = scheduler->submit(QUEUE_CLASS_MAIN,
+				 &prologue_command_buffer, 1,
+				 nullptr, nullptr, 0,
+				 true);
+  queue_ticket async = scheduler->submit(QUEUE_CLASS_COMPUTE,
+					 &async_command_buffer, 1,
+					 &prologue,
+					 &frame_split.async_wait_stages, 1,
+					 true);
+  scheduler->submit(QUEUE_CLASS_MAIN,
+		    &command_buffers[command_buf_idx], 1,
+		    &async, &frame_split.main_wait_stages, 1,
+		    false);
 }
 
 void submit_to_queue(uint32_t command_buf_idx, uint32_t queue_idx)
 {
-  std::vector<VkSubmitInfo> submit_infos(1);
-  submit_infos[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submit_infos[0].pNext = nullptr;
-  submit_infos[0].waitSemaphoreCount = 0;
-  submit_infos[0].pWaitSemaphores = nullptr;
-  submit_infos[0].pWaitDstStageMask = nullptr;
-  submit_infos[0].commandBufferCount = 1;
-  submit_infos[0].pCommandBuffers = &command_buffers[command_buf_idx];
-  submit_infos[0].signalSemaphoreCount = 0;
-  submit_infos[0].pSignalSemaphores = nullptr;
-  std::cout << "Submitting command buffer " << command_buf_idx
-	    << " to queue " << queue_idx << "..." << std::endl;
-  std::lock_guard<std::mutex> lock(queue_mutex[queue_idx]);
-  res = vkQueueSubmit(queues[queue_idx],
-		      static_cast<uint32_t>(submit_infos.size()),
-		      submit_infos.data(),
-		      VK_NULL_HANDLE);
-  if (res == VK_SUCCESS)
-    std::cout << "Command buffer " << command_buf_idx
-	      << " submitted to queue " << queue_idx
-	      << " successfully!" << std::endl;
+  TRACE_SCOPE("submit");
+  LOG_DEBUG("Queueing command buffer " << command_buf_idx
+	    << " for queue " << queue_idx << "...");
+  flush_buffer_memory();
+  if (frame_split.async && timeline)
+    submit_split_frame_tasks(command_buf_idx, queue_idx);
+  else if (frame_split.async)
+    submit_split_frame(command_buf_idx);
+  else if (timeline)
+    timeline->submit(queue_idx, &command_buffers[command_buf_idx], 1,
+		     nullptr, nullptr, 0);
   else
-    std::cout << "Failed to submit command buffer "
-	      << command_buf_idx << " to queue "
-	      << queue_idx << "..." << std::endl;
+    submit_batches[queue_idx]->enqueue(command_buffers[command_buf_idx]);
+  frame_split = {};
+  frames_submitted++;
 }
 
-void wait_for_queue(uint32_t queue_idx)
+void create_submit_batches()
 {
-  std::cout << "Waiting for queue " << queue_idx
-	    << " to idle..." << std::endl;
-  res = vkQueueWaitIdle(queues[queue_idx]);
-  if (res == VK_SUCCESS)
-    std::cout << "Queue " << queue_idx << " idled successfully!"
+  std::cout << "Creating submit batches (" << queues.size()
+	    << ")..." << std::endl;
+  for (unsigned int i = 0; i != queues.size(); i++)
+    submit_batches.emplace_back(new submit_batch(queues[i], queue_mutex[i]));
+}
+
+void create_queue_scheduler()
+{
+  std::vector<scheduled_queue> scheduled;
+  for (unsigned int i = 0; i != queues.size(); i++) {
+    scheduled_queue q = {queue_families[i], queues[i], &queue_mutex[i],
+			 submit_batches[i].get()};
+    scheduled.push_back(q);
+  }
+  scheduler.reset(new queue_scheduler(device,
+				      planned_queues,
+				      scheduled,
+				      CUSTOM_ALLOCATOR ? &alloc_callbacks
+				      : nullptr));
+  std::cout << "Created queue scheduler ("
+	    << scheduler->queue_count(QUEUE_CLASS_COMPUTE) << " compute queues"
+	    << (scheduler->concurrent(QUEUE_CLASS_COMPUTE) ?
+		", async compute" : "")
+	    << ")..." << std::endl;
+}
+
+void destroy_queue_scheduler()
+{
+  std::cout << "Destroying queue scheduler..." << std::endl;
+  scheduler.reset();
+}
+
+void create_timeline()
+{
+  if (!timeline_semaphores) {
+    std::cout << "No timeline semaphores, waiting for whole queues..."
 	      << std::endl;
+    return;
+  }
+  std::vector<submit_batch*> batches;
+  for (auto& batch : submit_batches)
+    batches.push_back(batch.get());
+  std::cout << "Creating timeline semaphores (" << batches.size()
+	    << ")..." << std::endl;
+  timeline.reset(new gpu_timeline(device,
+				  batches,
+				  CUSTOM_ALLOCATOR ? &alloc_callbacks
+				  : nullptr));
+  if (timeline->supported())
+    std::cout << "Timeline semaphores created successfully!" << std::endl;
+  else {
+    std::cout << "Failed to create timeline semaphores..." << std::endl;
+    timeline.reset();
+  }
+}
+
+void destroy_timeline()
+{
+  if (!timeline)
+    return;
+  std::cout << "Destroying timeline semaphores..." << std::endl;
+  timeline.reset();
+}
+
+// Sends everything queued for the queue in as few vkQueueSubmit calls as
+// the fences allow, normally one
+void flush_queue(uint32_t queue_idx)
+{
+  if (submit_batches[queue_idx]->empty())
+    return;
+  LOG_DEBUG("Flushing submissions to queue " << queue_idx << "...");
+  res = submit_batches[queue_idx]->flush();
+  if (res == VK_SUCCESS)
+    LOG_DEBUG("Submissions flushed to queue " << queue_idx
+	      << " successfully!");
   else
-    std::cout << "Failed to wait for queue " << queue_idx
-	      << "...";
+    LOG_ERROR("Failed to flush submissions to queue "
+	      << queue_idx << "...");
+}
+
+void destroy_submit_batches()
+{
+  uint64_t submits = 0;
+  uint64_t entries = 0;
+  for (auto& batch : submit_batches) {
+    submits += batch->submit_count();
+    entries += batch->entry_count();
+  }
+  std::cout << "Destroying submit batches (" << entries
+	    << " submissions in " << submits << " vkQueueSubmit calls)..."
+	    << std::endl;
+  submit_batches.clear();
+}
+
+// With timelines, waits for the queue's last submission only; anything
+// it waited for, such as async work, completed before it
+void wait_for_queue(uint32_t queue_idx)
+{
+  TRACE_SCOPE("wait for queue");
+  flush_queue(queue_idx);
+  if (timeline) {
+    gpu_point last = timeline->last(queue_idx);
+    LOG_DEBUG("Waiting for queue " << queue_idx
+	      << " to reach " << last.value << "...");
+    res = timeline->wait(last);
+  } else {
+    LOG_DEBUG("Waiting for queue " << queue_idx
+	      << " to idle...");
+    res = vkd.vkQueueWaitIdle(queues[queue_idx]);
+  }
+  if (res == VK_SUCCESS) {
+    LOG_DEBUG("Queue " << queue_idx << " idled successfully!");
+    // Everything submitted so far has completed; async work did before
+    // the main queue's wait on it
+    frames_completed = frames_submitted;
+    if (deletions)
+      deletions->retire(frames_completed);
+    if (scheduler)
+      scheduler->end_frame();
+  } else
+    LOG_ERROR("Failed to wait for queue " << queue_idx << "...");
 }
 
 void reset_command_buffers()
@@ -1468,15 +2346,13 @@ void reset_command_buffers()
   for (auto& mut : command_buffer_mutex)
     locks.emplace_back(mut, std::defer_lock);
   for (unsigned int i = 0; i != COMMAND_BUFFER_COUNT; i++) {
-    std::cout << "Resetting command buffer " << i << "..." << std::endl;
+    LOG_DEBUG("Resetting command buffer " << i << "...");
     locks[i].lock();
-    res = vkResetCommandBuffer(command_buffers[i], 0);
+    res = vkd.vkResetCommandBuffer(command_buffers[i], 0);
     if (res == VK_SUCCESS)
-      std::cout << "Command buffer " << i << " reset successfully!"
-		<< std::endl;
+      LOG_DEBUG("Command buffer " << i << " reset successfully!");
     else
-      std::cout << "Failed to reset command buffer " << i << "..."
-		<< std::endl;
+      LOG_ERROR("Failed to reset command buffer " << i << "...");
     locks[i].unlock();
   }
 }
@@ -1484,15 +2360,14 @@ void reset_command_buffers()
 void reset_command_buffer(uint32_t command_buf_idx)
 {
   std::lock_guard<std::mutex> lock(command_buffer_mutex[command_buf_idx]);
-  std::cout << "Resetting command buffer " << command_buf_idx << "..."
-	    << std::endl;
-  res = vkResetCommandBuffer(command_buffers[command_buf_idx], 0);
+  LOG_DEBUG("Resetting command buffer " << command_buf_idx << "...");
+  res = vkd.vkResetCommandBuffer(command_buffers[command_buf_idx], 0);
   if (res == VK_SUCCESS)
-    std::cout << "Command buffer " << command_buf_idx
-	      << " reset successfully!" << std::endl;
+    LOG_DEBUG("Command buffer " << command_buf_idx
+	      << " reset successfully!");
   else
-    std::cout << "Failed to reset command buffer " << command_buf_idx
-	      << "..." << std::endl;
+    LOG_ERROR("Failed to reset command buffer " << command_buf_idx
+	      << "...");
 }
 
 void create_semaphore()
@@ -1596,14 +2471,21 @@ void create_descriptor_set_layouts()
     create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     create_info.pNext = nullptr;
     create_info.flags = 0;
-    VkDescriptorSetLayoutBinding layout_binding = {};
-    layout_binding.binding = i;
-    layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    layout_binding.descriptorCount = 1;
-    layout_binding.stageFlags = VK_SHADER_STAGE_ALL;
-    layout_binding.pImmutableSamplers = nullptr;
-    create_info.bindingCount = 1;
-    create_info.pBindings = &layout_binding;
+    VkDescriptorSetLayoutBinding layout_bindings[2] = {};
+    layout_bindings[0].binding = i;
+    layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layout_bindings[0].descriptorCount = 1;
+    layout_bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+    layout_bindings[0].pImmutableSamplers = nullptr;
+    // The streamed texture the draw samples
+    layout_bindings[1].binding = 1;
+    layout_bindings[1].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layout_bindings[1].descriptorCount = 1;
+    layout_bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    layout_bindings[1].pImmutableSamplers = nullptr;
+    create_info.bindingCount = i == DESCRIPTOR_SET_GRAPHICS ? 2 : 1;
+    create_info.pBindings = layout_bindings;
 
     std::cout << "Creating descriptor set layout " << (i+1)
 	      << "/" << DESCRIPTOR_SET_COUNT << "..." << std::endl;
@@ -1627,12 +2509,19 @@ void create_descriptor_pool()
   create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
   create_info.pNext = nullptr;
   create_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-  create_info.maxSets = static_cast<uint32_t>(DESCRIPTOR_SET_COUNT);
-  std::vector<VkDescriptorPoolSize> pool_sizes(DESCRIPTOR_SET_COUNT);
+  // Plus the culling pass's set
+  create_info.maxSets = static_cast<uint32_t>(DESCRIPTOR_SET_COUNT + 1);
+  std::vector<VkDescriptorPoolSize> pool_sizes(DESCRIPTOR_SET_COUNT + 2);
   for (unsigned int i = 0; i != DESCRIPTOR_SET_COUNT; i++) {
     pool_sizes[i].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     pool_sizes[i].descriptorCount = 1;
   }
+  pool_sizes[DESCRIPTOR_SET_COUNT].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_sizes[DESCRIPTOR_SET_COUNT].descriptorCount = 1;
+  // The graphics set's texture
+  pool_sizes[DESCRIPTOR_SET_COUNT+1].type =
+    VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  pool_sizes[DESCRIPTOR_SET_COUNT+1].descriptorCount = 1;
   create_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
   create_info.pPoolSizes = pool_sizes.data();
 
@@ -1662,9 +2551,9 @@ void allocate_descriptor_sets()
 	    << (DESCRIPTOR_SET_COUNT != 1 ? "s" : "") << "..."
 	    << std::endl;  
   descriptor_sets.resize(DESCRIPTOR_SET_COUNT);
-  res = vkAllocateDescriptorSets(device,
-				 &alloc_info,
-				 descriptor_sets.data());
+  res = vkd.vkAllocateDescriptorSets(device,
+				     &alloc_info,
+				     descriptor_sets.data());
   if (res == VK_SUCCESS)
     std::cout << "Allocated " << DESCRIPTOR_SET_COUNT << " descriptor set"
 	      << (DESCRIPTOR_SET_COUNT != 1 ? "s" : "") << " successfully!"
@@ -1681,9 +2570,9 @@ void create_image_sampler()
   create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
   create_info.pNext = nullptr;
   create_info.flags = 0;
-  create_info.magFilter = VK_FILTER_NEAREST;
-  create_info.minFilter = VK_FILTER_NEAREST;
-  create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  create_info.magFilter = VK_FILTER_LINEAR;
+  create_info.minFilter = VK_FILTER_LINEAR;
+  create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
   create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
   create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
   create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
@@ -1692,7 +2581,7 @@ void create_image_sampler()
   create_info.compareEnable = VK_FALSE;
   create_info.compareOp = VK_COMPARE_OP_NEVER;
   create_info.minLod = 0.0;
-  create_info.maxLod = 0.25;
+  create_info.maxLod = VK_LOD_CLAMP_NONE;
   create_info.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
   create_info.unnormalizedCoordinates = VK_FALSE;
 
@@ -1716,7 +2605,7 @@ void update_descriptor_sets()
   }
   
   VkDescriptorBufferInfo uniform_buffer_info = {};
-  uniform_buffer_info.buffer = buffers[UNIFORM_BUFFER];
+  uniform_buffer_info.buffer = buffer_at(UNIFORM_BUFFER);
   uniform_buffer_info.offset = 0;
   uniform_buffer_info.range = sizeof(uniform_data);
 
@@ -1734,14 +2623,43 @@ void update_descriptor_sets()
     writes[i].pTexelBufferView = nullptr;
   }
 
-  std::cout << "Updating " << DESCRIPTOR_SET_COUNT
+  // The sampled texture, or the fallback until it is resident
+  uint32_t tex_idx = sampled_texture;
+  if (tex_idx == TEXTURE_NONE
+      || tex_streamer->view(tex_idx) == VK_NULL_HANDLE)
+    tex_idx = fallback_texture;
+  VkDescriptorImageInfo texture_info = {};
+  texture_info.sampler = image_sampler;
+  texture_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  if (tex_idx != TEXTURE_NONE) {
+    texture_info.imageView = tex_streamer->view(tex_idx);
+    bound_texture = tex_idx;
+    bound_texture_version = tex_streamer->version(tex_idx);
+  }
+  if (texture_info.imageView != VK_NULL_HANDLE) {
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = descriptor_sets[DESCRIPTOR_SET_GRAPHICS];
+    write.dstBinding = 1;
+    write.dstArrayElement = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &texture_info;
+    write.pBufferInfo = nullptr;
+    write.pTexelBufferView = nullptr;
+    writes.push_back(write);
+  } else
+    LOG_ERROR("No texture is resident to sample...");
+
+  LOG_DEBUG("Updating " << DESCRIPTOR_SET_COUNT
 	    << " descriptor set"
-	    << (DESCRIPTOR_SET_COUNT != 1 ? "s..." : "...")
-	    << std::endl;
-  vkUpdateDescriptorSets(device,
-			 static_cast<uint32_t>(writes.size()),
-			 writes.data(),
-			 0, nullptr);
+	    << (DESCRIPTOR_SET_COUNT != 1 ? "s..." : "..."));
+  vkd.vkUpdateDescriptorSets(device,
+			     static_cast<uint32_t>(writes.size()),
+			     writes.data(),
+			     0, nullptr);
+  invalidate_static_command_buffers();
 
   for (unsigned int i = 0; i != DESCRIPTOR_SET_COUNT; i++)
     locks[i].unlock();
@@ -1752,17 +2670,14 @@ void record_bind_descriptor_set(uint32_t descriptor_set_idx,
 {
   std::lock_guard<std::mutex> buf_lock(command_buffer_mutex[command_buf_idx]);
   std::lock_guard<std::mutex> pool_lock(command_pool_mutex);
-  std::cout << "Recording bind descriptor set " << descriptor_set_idx
-	    << " to command buffer " << command_buf_idx << "..."
-	    << std::endl;
-  vkCmdBindDescriptorSets(command_buffers[command_buf_idx],
-			  VK_PIPELINE_BIND_POINT_GRAPHICS,
-			  graphics_pipeline_layout,
-			  0,
-			  1,
-			  &descriptor_sets[descriptor_set_idx],
-			  0,
-			  nullptr);
+  LOG_DEBUG("Recording bind descriptor set " << descriptor_set_idx
+	    << " to command buffer " << command_buf_idx << "...");
+  command_recorder& rec = recorders[command_buf_idx];
+  rec.bind_descriptor_sets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+			   graphics_pipeline_layout,
+			   0,
+			   1,
+			   &descriptor_sets[descriptor_set_idx]);
 }
 
 void create_renderpass()
@@ -1846,7 +2761,8 @@ void create_framebuffers()
   for (unsigned int i = 0; i != swapchain_image_views.size(); i++) {
     std::vector<VkImageView> attachments;
     attachments.push_back(swapchain_image_views[i]);
-    attachments.push_back(image_views[DEPTH_STENCIL_IMAGE]);
+    attachments.push_back(
+      image_pool.get<IMAGE_VIEW>(images[DEPTH_STENCIL_IMAGE]));
     
     VkFramebufferCreateInfo create_info = {};
     create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -1875,6 +2791,7 @@ void create_framebuffers()
 		<< (i+1) << "/" << swapchain_image_views.size()
 		<< "..." << std::endl;
   }
+  invalidate_static_command_buffers();
 }
 
 void create_graphics_pipeline_layout()
@@ -2121,71 +3038,214 @@ void create_graphics_pipelines()
     std::cout << "Failed to create graphics pipeline"
 	      << (GRAPHICS_PIPELINE_COUNT != 1 ? "s..." : "...")
 	      << std::endl;
+  invalidate_static_command_buffers();
 }
 
-void record_bind_graphics_pipeline(uint32_t pipeline_idx,
-				   uint32_t command_buf_idx)
+void create_cull_shader(const std::string& filename)
 {
-  std::cout << "Recording bind graphics pipeline to command buffer "
-	    << command_buf_idx << "..." << std::endl;
-  vkCmdBindPipeline(command_buffers[command_buf_idx],
-		    VK_PIPELINE_BIND_POINT_GRAPHICS,
-		    graphics_pipelines[pipeline_idx]);
+  std::cout << "Reading culling shader file: " << filename
+	    << "..." << std::endl;
+  std::ifstream is(filename,
+		   std::ios::binary | std::ios::in | std::ios::ate);
+  if (is.is_open()) {
+    auto size = is.tellg();
+    is.seekg(0, std::ios::beg);
+    char* code = new char[size];
+    is.read(code, size);
+    is.close();
+
+    VkShaderModuleCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.codeSize = size;
+    create_info.pCode = (uint32_t*) code;
+
+    std::cout << "Creating culling shader module..." << std::endl;
+    res = vkCreateShaderModule(device,
+			       &create_info,
+			       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+			       &cull_shader);
+    if (res == VK_SUCCESS)
+      std::cout << "Culling shader module created successfully!"
+		<< std::endl;
+    else
+      std::cout << "Failed to create culling shader module..." << std::endl;
+    
+    delete[](code);
+  } else
+    std::cout << "Failed to read culling shader file: " << filename << "..."
+	      << std::endl;
 }
 
-void next_swapchain_image()
+// Set 0 is the graphics set for the uniforms, set 1 holds the indirect
+// draw the pass writes
+void create_cull_pipeline_layout()
 {
-  std::cout << "Acquiring next swapchain image..." << std::endl;
-  res = vkAcquireNextImageKHR(device,
-			      swapchain,
-			      NEXT_IMAGE_TIMEOUT,
-			      semaphore,
-			      VK_NULL_HANDLE,
-			      &cur_swapchain_img);
+  VkDescriptorSetLayoutBinding layout_binding = {};
+  layout_binding.binding = 0;
+  layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  layout_binding.descriptorCount = 1;
+  layout_binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  layout_binding.pImmutableSamplers = nullptr;
+
+  VkDescriptorSetLayoutCreateInfo set_create_info = {};
+  set_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_create_info.pNext = nullptr;
+  set_create_info.flags = 0;
+  set_create_info.bindingCount = 1;
+  set_create_info.pBindings = &layout_binding;
+
+  std::cout << "Creating culling descriptor set layout..." << std::endl;
+  res = vkCreateDescriptorSetLayout(device,
+				    &set_create_info,
+				    CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+				    &cull_descriptor_set_layout);
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to create culling descriptor set layout..."
+	      << std::endl;
+    return;
+  }
+
+  VkDescriptorSetLayout set_layouts[2] = {
+    descriptor_set_layouts[DESCRIPTOR_SET_GRAPHICS],
+    cull_descriptor_set_layout
+  };
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = 2 * sizeof(uint32_t);
+
+  VkPipelineLayoutCreateInfo create_info = {};
+  create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  create_info.pNext = nullptr;
+  create_info.flags = 0;
+  create_info.setLayoutCount = 2;
+  create_info.pSetLayouts = set_layouts;
+  create_info.pushConstantRangeCount = 1;
+  create_info.pPushConstantRanges = &push_constant_range;
+
+  std::cout << "Creating culling pipeline layout..." << std::endl;
+  res = vkCreatePipelineLayout(device,
+			       &create_info,
+			       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+			       &cull_pipeline_layout);
   if (res == VK_SUCCESS)
-    std::cout << "Successfully got next swapchain image: "
-	      << cur_swapchain_img << "!" << std::endl;
+    std::cout << "Culling pipeline layout created successfully!"
+	      << std::endl;
   else
-    std::cout << "Failed to get next swapchain image..." << std::endl;
+    std::cout << "Failed to create culling pipeline layout..."
+	      << std::endl;
 }
 
-void record_image_barrier(uint32_t img_idx,
-			  uint32_t command_buf_idx,
-			  VkImageLayout old_layout,
-			  VkAccessFlags old_flags,
-			  VkImageLayout new_layout,
-			  VkAccessFlags new_flags)
+void allocate_cull_descriptor_set()
 {
-  VkImageSubresourceRange range = {};
-  range.aspectMask = img_idx == DEPTH_STENCIL_IMAGE ?
-    (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT) :
-    VK_IMAGE_ASPECT_COLOR_BIT;
-  range.baseMipLevel = 0;
-  range.levelCount = 1;
-  range.baseArrayLayer = 0;
-  range.layerCount = 1;
-  
-  VkImageMemoryBarrier barrier = {};
-  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  barrier.pNext = nullptr;
-  barrier.srcAccessMask = old_flags;
-  barrier.dstAccessMask = new_flags;
-  barrier.oldLayout = old_layout;
-  barrier.newLayout = new_layout;
-  barrier.srcQueueFamilyIndex = queue_family_idx;
-  barrier.dstQueueFamilyIndex = queue_family_idx;
-  barrier.image = images[img_idx];
-  barrier.subresourceRange = range;
-
-  std::cout << "Recording image pipeline barrier..." << std::endl;
-  vkCmdPipelineBarrier(command_buffers[command_buf_idx],
-		       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-		       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-		       0,
-		       0, nullptr,
-		       0, nullptr,
-		       1, &barrier);
+  std::lock_guard<std::mutex> lock(descriptor_pool_mutex);
+  VkDescriptorSetAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.pNext = nullptr;
+  alloc_info.descriptorPool = descriptor_pool;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &cull_descriptor_set_layout;
+
+  std::cout << "Allocating culling descriptor set..." << std::endl;
+  res = vkd.vkAllocateDescriptorSets(device,
+				     &alloc_info,
+				     &cull_descriptor_set);
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to allocate culling descriptor set..."
+	      << std::endl;
+    return;
+  }
+
+  VkDescriptorBufferInfo draw_buffer_info = {};
+  draw_buffer_info.buffer = buffer_at(DRAW_BUFFER);
+  draw_buffer_info.offset = 0;
+  draw_buffer_info.range = sizeof(VkDrawIndexedIndirectCommand);
+
+  VkWriteDescriptorSet write = {};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.pNext = nullptr;
+  write.dstSet = cull_descriptor_set;
+  write.dstBinding = 0;
+  write.dstArrayElement = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  write.pImageInfo = nullptr;
+  write.pBufferInfo = &draw_buffer_info;
+  write.pTexelBufferView = nullptr;
+  vkd.vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  std::cout << "Culling descriptor set allocated successfully!" << std::endl;
+}
+
+void create_cull_pipeline()
+{
+  VkPipelineShaderStageCreateInfo stage_info = {};
+  stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stage_info.pNext = nullptr;
+  stage_info.flags = 0;
+  stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  stage_info.module = cull_shader;
+  stage_info.pName = "main";
+  stage_info.pSpecializationInfo = nullptr;
+
+  VkComputePipelineCreateInfo create_info = {};
+  create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  create_info.pNext = nullptr;
+  create_info.flags = 0;
+  create_info.stage = stage_info;
+  create_info.layout = cull_pipeline_layout;
+  create_info.basePipelineHandle = VK_NULL_HANDLE;
+  create_info.basePipelineIndex = -1;
+
+  std::cout << "Creating culling pipeline..." << std::endl;
+  res = vkCreateComputePipelines(device,
+				 VK_NULL_HANDLE,
+				 1,
+				 &create_info,
+				 CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr,
+				 &cull_pipeline);
+  if (res == VK_SUCCESS)
+    std::cout << "Culling pipeline created successfully!" << std::endl;
+  else
+    std::cout << "Failed to create culling pipeline..." << std::endl;
+  invalidate_static_command_buffers();
+}
+
+void record_bind_graphics_pipeline(uint32_t pipeline_idx,
+				   uint32_t command_buf_idx)
+{
+  LOG_DEBUG("Recording bind graphics pipeline to command buffer "
+	    << command_buf_idx << "...");
+  recorders[command_buf_idx].bind_pipeline(VK_PIPELINE_BIND_POINT_GRAPHICS,
+					   graphics_pipelines[pipeline_idx]);
+}
+
+#ifdef HEADLESS
+void next_swapchain_image()
+{
+  TRACE_SCOPE("acquire");
+  cur_swapchain_img = (cur_swapchain_img + 1) % swapchain_images.size();
+  LOG_DEBUG("Using offscreen image " << cur_swapchain_img << "...");
+}
+#else
+void next_swapchain_image()
+{
+  TRACE_SCOPE("acquire");
+  LOG_DEBUG("Acquiring next swapchain image...");
+  res = vkd.vkAcquireNextImageKHR(device,
+				  swapchain,
+				  NEXT_IMAGE_TIMEOUT,
+				  semaphore,
+				  VK_NULL_HANDLE,
+				  &cur_swapchain_img);
+  if (res == VK_SUCCESS)
+    LOG_DEBUG("Successfully got next swapchain image: "
+	      << cur_swapchain_img << "!");
+  else
+    LOG_ERROR("Failed to get next swapchain image...");
 }
+#endif
 
 void record_clear_swapchain_image(uint32_t command_buf_idx)
 {
@@ -2198,53 +3258,50 @@ void record_clear_swapchain_image(uint32_t command_buf_idx)
   range.baseArrayLayer = 0;
   range.layerCount = 1;
   
-  std::cout << "Recording clear current swapchain image..." << std::endl;
-  vkCmdClearColorImage(command_buffers[command_buf_idx],
-		       swapchain_images[cur_swapchain_img],
-		       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		       &clear_color,
-		       1,
-		       &range);		       
+  LOG_DEBUG("Recording clear current swapchain image...");
+  vkd.vkCmdClearColorImage(command_buffers[command_buf_idx],
+			   swapchain_images[cur_swapchain_img],
+			   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			   &clear_color,
+			   1,
+			   &range);		       
 
 }
 
-void record_swapchain_image_barrier(uint32_t command_buf_idx,
-				    VkImageLayout old_layout,
-				    VkAccessFlags old_flags,
-				    VkImageLayout new_layout,
-				    VkAccessFlags new_flags)
+#ifdef HEADLESS
+// Stands in for presentation: checksums the frame the readback pass copied
+// out, which is complete once the caller has waited for the queue
+void present_current_swapchain_image(uint32_t /* queue_idx */)
 {
-  VkImageSubresourceRange range = {};
-  range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  range.baseMipLevel = 0;
-  range.levelCount = 1;
-  range.baseArrayLayer = 0;
-  range.layerCount = 1;
-  
-  VkImageMemoryBarrier barrier = {};
-  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  barrier.pNext = nullptr;
-  barrier.srcAccessMask = old_flags;
-  barrier.dstAccessMask = new_flags;
-  barrier.oldLayout = old_layout;
-  barrier.newLayout = new_layout;
-  barrier.srcQueueFamilyIndex = queue_family_idx;
-  barrier.dstQueueFamilyIndex = queue_family_idx;
-  barrier.image = swapchain_images[cur_swapchain_img];
-  barrier.subresourceRange = range;
-
-  std::cout << "Recording swapchain image pipeline barrier..." << std::endl;
-  vkCmdPipelineBarrier(command_buffers[command_buf_idx],
-		       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-		       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-		       0,
-		       0, nullptr,
-		       0, nullptr,
-		       1, &barrier);
-}
+  TRACE_SCOPE("present");
+  if (!readback_pending)
+    return;
+  readback_pending = false;
+
+  if (!readback_coherent) {
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.pNext = nullptr;
+    range.memory = readback_memory;
+    range.offset = 0;
+    range.size = VK_WHOLE_SIZE;
+    vkd.vkInvalidateMappedMemoryRanges(device, 1, &range);
+  }
 
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (VkDeviceSize i = 0; i != readback_size; i++) {
+    hash ^= readback_data[i];
+    hash *= 1099511628211ULL;
+  }
+  frame_checksum = hash;
+  LOG_INFO("Offscreen image " << cur_swapchain_img << " checksum: "
+	   << std::hex << hash << std::dec);
+}
+#else
 void present_current_swapchain_image(uint32_t queue_idx)
 {
+  TRACE_SCOPE("present");
   VkPresentInfoKHR present_info = {};
   present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
   present_info.pNext = nullptr;
@@ -2255,16 +3312,15 @@ void present_current_swapchain_image(uint32_t queue_idx)
   present_info.pImageIndices = &cur_swapchain_img;
   present_info.pResults = nullptr;
 
-  std::cout << "Presenting current swapchain image..." << std::endl;
-  res = vkQueuePresentKHR(queues[queue_idx],
-			  &present_info);
+  LOG_DEBUG("Presenting current swapchain image...");
+  res = vkd.vkQueuePresentKHR(queues[queue_idx],
+			      &present_info);
   if (res == VK_SUCCESS)
-    std::cout << "Presented current swapchain image successfully!"
-	      << std::endl;
+    LOG_DEBUG("Presented current swapchain image successfully!");
   else
-    std::cout << "Failed to present current swapchain image..."
-	      << std::endl;
+    LOG_ERROR("Failed to present current swapchain image...");
 }
+#endif
 
 void record_clear_color_image(uint32_t img_idx, uint32_t command_buf_idx)
 {
@@ -2277,13 +3333,13 @@ void record_clear_color_image(uint32_t img_idx, uint32_t command_buf_idx)
   range.baseArrayLayer = 0;
   range.layerCount = 1;
   
-  std::cout << "Recording clear image " << img_idx << "..." << std::endl;
-  vkCmdClearColorImage(command_buffers[command_buf_idx],
-		       images[img_idx],
-		       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		       &clear_color,
-		       1,
-		       &range);		       
+  LOG_DEBUG("Recording clear image " << img_idx << "...");
+  vkd.vkCmdClearColorImage(command_buffers[command_buf_idx],
+			   image_at(img_idx),
+			   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			   &clear_color,
+			   1,
+			   &range);		       
 }
 
 void update_vertex_buffer()
@@ -2298,128 +3354,112 @@ void update_vertex_buffer()
     {0.7f, 0.7f, 0.0f, 1.0f},
     {0.0f, 1.0f, 0.0f, 1.0f},
     {0.0f, 0.0f, 0.0f},
-    {0.0f, 0.0f}
+    {1.0f, 0.0f}
   };
   vertices[2] = {
     {0.0f, -0.7f, 0.0f, 1.0f},
     {0.0f, 0.0f, 1.0f, 1.0f},
     {0.0f, 0.0f, 0.0f},
-    {0.0f, 0.0f}
+    {0.5f, 1.0f}
   };
   
-  void* buf_data;
+  LOG_DEBUG("Updating vertex buffer...");
   std::lock_guard<std::mutex> lock(memory_mutex[RESOURCE_BUFFER]);
-  res = vkMapMemory(device,
-		    memory[RESOURCE_BUFFER],
-		    0,
-		    buf_mem_requirements[VERTEX_BUFFER].size,
-		    0,
-		    &buf_data);
-  if (res == VK_SUCCESS)
-    std::cout << "Updating vertex buffer..." << std::endl;
-  else
-    std::cout << "Failed to update vertex buffer..." << std::endl;
-
-  memcpy(buf_data, vertices, sizeof(vertex)*VERTEX_COUNT);
-
-  vkUnmapMemory(device,
-		memory[RESOURCE_BUFFER]);
+  buffer_mapping->write(buffer_pool.get<BUFFER_OFFSET>(buffers[VERTEX_BUFFER]),
+			vertices,
+			sizeof(vertex)*VERTEX_COUNT);
 }
 
 void update_index_buffer()
 {
   uint32_t indices[INDEX_COUNT] = {0, 1, 2};
   
-  void* buf_data;
+  LOG_DEBUG("Updating index buffer...");
   std::lock_guard<std::mutex> lock(memory_mutex[RESOURCE_BUFFER]);
-  res = vkMapMemory(device,
-		    memory[RESOURCE_BUFFER],
-		    buf_mem_requirements[VERTEX_BUFFER].size,
-		    buf_mem_requirements[INDEX_BUFFER].size,
-		    0,
-		    &buf_data);
-  if (res == VK_SUCCESS)
-    std::cout << "Updating index buffer..." << std::endl;
-  else
-    std::cout << "Failed to update index buffer..." << std::endl;
-
-  memcpy(buf_data, indices, sizeof(uint32_t)*INDEX_COUNT);
+  buffer_mapping->write(buffer_pool.get<BUFFER_OFFSET>(buffers[INDEX_BUFFER]),
+			indices,
+			sizeof(uint32_t)*INDEX_COUNT);
+}
 
-  vkUnmapMemory(device,
-		memory[RESOURCE_BUFFER]);
+// Stores value in the field of uniform_data and the uniform buffer, if it
+// differs from what was written last
+void write_uniform(void* field, const void* value, size_t size)
+{
+  if (uniforms_uploaded && memcmp(field, value, size) == 0)
+    return;
+  memcpy(field, value, size);
+  VkDeviceSize offset = static_cast<char*>(field)
+    - reinterpret_cast<char*>(&uniform_data);
+  offset += buffer_pool.get<BUFFER_OFFSET>(buffers[UNIFORM_BUFFER]);
+  buffer_mapping->write(offset, value, size);
 }
 
+// Only the matrices that changed are written, normally just the rotating
+// model matrices; the projection and view follow the extent and camera
 void update_uniform_buffer()
 {
-  uniform_data.projection_matrix =
+  TRACE_SCOPE("update uniforms");
+  glm::mat4 projection_matrix =
     glm::perspective(glm::radians(60.0f),
 		     (float) surface_capabilities.currentExtent.width /
 		     (float) surface_capabilities.currentExtent.height,
-		     0.1f,
-		     256.0f);
+		     Z_NEAR,
+		     Z_FAR);
   
-  uniform_data.view_matrix = glm::translate(glm::mat4(),
-					    glm::vec3(0.0f, 0.0f, -2.5f));
+  glm::mat4 view_matrix = glm::translate(glm::mat4(),
+					 glm::vec3(0.0f, 0.0f, -2.5f));
 
+  glm::mat4 model_matrix[INSTANCE_COUNT];
   for (unsigned int i = 0; i != INSTANCE_COUNT; i++) {
-    uniform_data.model_matrix[i] = glm::mat4();
+    model_matrix[i] = glm::mat4();
 
-    uniform_data.model_matrix[i] = glm::translate(uniform_data.model_matrix[i],
-						  glm::vec3(-0.8f+1.5f*(float)i,
-							    0.0f,
-							    0.0f));
+    model_matrix[i] = glm::translate(model_matrix[i],
+				     glm::vec3(-0.8f+1.5f*(float)i,
+					       0.0f,
+					       0.0f));
     
-    uniform_data.model_matrix[i] = glm::rotate(uniform_data.model_matrix[i],
-					       glm::radians(rotation[i].x),
-					       glm::vec3(1.0f, 0.0f, 0.0f));
-    uniform_data.model_matrix[i] = glm::rotate(uniform_data.model_matrix[i],
-					       glm::radians(rotation[i].y),
-					       glm::vec3(0.0f, 1.0f, 0.0f));
-    uniform_data.model_matrix[i] = glm::rotate(uniform_data.model_matrix[i],
-					       glm::radians(rotation[i].z),
-					       glm::vec3(0.0f, 0.0f, 1.0f));
-  }
-
-  void* buf_data;
-  std::lock_guard<std::mutex> lock(memory_mutex[RESOURCE_BUFFER]);
-  res = vkMapMemory(device,
-		    memory[RESOURCE_BUFFER],
-		    buf_mem_requirements[VERTEX_BUFFER].size
-		    +buf_mem_requirements[INDEX_BUFFER].size,
-		    buf_mem_requirements[UNIFORM_BUFFER].size,
-		    0,
-		    &buf_data);
-  if (res == VK_SUCCESS)
-    std::cout << "Updating uniform buffer..." << std::endl;
-  else
-    std::cout << "Failed to update uniform buffer..." << std::endl;
-
-  memcpy(buf_data, &uniform_data, sizeof(uniform_data));
+    model_matrix[i] = glm::rotate(model_matrix[i],
+				  glm::radians(rotation[i].x),
+				  glm::vec3(1.0f, 0.0f, 0.0f));
+    model_matrix[i] = glm::rotate(model_matrix[i],
+				  glm::radians(rotation[i].y),
+				  glm::vec3(0.0f, 1.0f, 0.0f));
+    model_matrix[i] = glm::rotate(model_matrix[i],
+				  glm::radians(rotation[i].z),
+				  glm::vec3(0.0f, 0.0f, 1.0f));
+  }
 
-  vkUnmapMemory(device,
-		memory[RESOURCE_BUFFER]);
+  LOG_DEBUG("Updating uniform buffer...");
+  std::lock_guard<std::mutex> lock(memory_mutex[RESOURCE_BUFFER]);
+  write_uniform(&uniform_data.projection_matrix,
+		&projection_matrix,
+		sizeof(projection_matrix));
+  for (unsigned int i = 0; i != INSTANCE_COUNT; i++)
+    write_uniform(&uniform_data.model_matrix[i],
+		  &model_matrix[i],
+		  sizeof(model_matrix[i]));
+  write_uniform(&uniform_data.view_matrix,
+		&view_matrix,
+		sizeof(view_matrix));
+  uniforms_uploaded = true;
 }
 
 void record_bind_vertex_buffer(uint32_t command_buf_idx)
 {
-  std::cout << "Recording bind vertex buffer to command buffer "
-	    << command_buf_idx << "..." << std::endl;
+  LOG_DEBUG("Recording bind vertex buffer to command buffer "
+	    << command_buf_idx << "...");
+  VkBuffer buf = buffer_at(VERTEX_BUFFER);
   VkDeviceSize offset = 0;
-  vkCmdBindVertexBuffers(command_buffers[command_buf_idx],
-			 0,
-			 1,
-			 &buffers[VERTEX_BUFFER],
-			 &offset);
+  recorders[command_buf_idx].bind_vertex_buffers(0, 1, &buf, &offset);
 }
 
 void record_bind_index_buffer(uint32_t command_buf_idx)
 {
-  std::cout << "Recording bind index buffer to command buffer "
-	    << command_buf_idx << "..." << std::endl;
-  vkCmdBindIndexBuffer(command_buffers[command_buf_idx],
-		       buffers[INDEX_BUFFER],
-		       0,
-		       VK_INDEX_TYPE_UINT32);
+  LOG_DEBUG("Recording bind index buffer to command buffer "
+	    << command_buf_idx << "...");
+  recorders[command_buf_idx].bind_index_buffer(buffer_at(INDEX_BUFFER),
+					       0,
+					       VK_INDEX_TYPE_UINT32);
 }
 
 void record_begin_renderpass(uint32_t command_buf_idx)
@@ -2439,27 +3479,534 @@ void record_begin_renderpass(uint32_t command_buf_idx)
   info.renderArea.extent.height = surface_capabilities.currentExtent.height;
   info.clearValueCount = 2;
   info.pClearValues = clear_values;
-  std::cout << "Recording begin renderpass..." << std::endl;
-  vkCmdBeginRenderPass(command_buffers[command_buf_idx],
-		       &info,
-		       VK_SUBPASS_CONTENTS_INLINE);  
+  LOG_DEBUG("Recording begin renderpass...");
+  vkd.vkCmdBeginRenderPass(command_buffers[command_buf_idx],
+			   &info,
+			   VK_SUBPASS_CONTENTS_INLINE);  
+}
+
+void record_draw_indexed_indirect(uint32_t command_buf_idx)
+{
+  LOG_DEBUG("Recording draw indexed indirect...");
+  command_recorder& rec = recorders[command_buf_idx];
+  rec.draw_indexed_indirect(buffer_at(DRAW_BUFFER),
+			    0,
+			    1,
+			    sizeof(VkDrawIndexedIndirectCommand));
 }
 
-void record_draw_indexed(uint32_t command_buf_idx, uint32_t num_instances)
+command_recorder& recorder_for(VkCommandBuffer cmd)
 {
-  std::cout << "Recording draw indexed vertices..." << std::endl;
-  vkCmdDrawIndexed(command_buffers[command_buf_idx],
-  		   INDEX_COUNT,
-   		   num_instances,
-   		   0,
-   		   0,
-   		   0);
+  if (async_compute && cmd == async_command_buffer)
+    return async_recorder;
+  for (uint32_t i = 0; i != command_buffers.size(); i++)
+    if (command_buffers[i] == cmd)
+      return recorders[i];
+  LOG_ERROR("Recording into an unknown command buffer...");
+  async_recorder.reset(cmd);
+  return async_recorder;
+}
+
+// Zeroes the indirect draw, then has the shader fill it in. Takes the
+// command buffer from the graph, as it may be the async one.
+void record_cull(VkCommandBuffer cmd, uint32_t num_instances)
+{
+  LOG_DEBUG("Recording instance culling...");
+  vkd.vkCmdFillBuffer(cmd,
+		      buffer_at(DRAW_BUFFER),
+		      0,
+		      sizeof(VkDrawIndexedIndirectCommand),
+		      0);
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+    | VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = buffer_at(DRAW_BUFFER);
+  barrier.offset = 0;
+  barrier.size = sizeof(VkDrawIndexedIndirectCommand);
+  vkd.vkCmdPipelineBarrier(cmd,
+			   VK_PIPELINE_STAGE_TRANSFER_BIT,
+			   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			   0,
+			   0, nullptr,
+			   1, &barrier,
+			   0, nullptr);
+
+  VkDescriptorSet sets[2] = {
+    descriptor_sets[DESCRIPTOR_SET_GRAPHICS],
+    cull_descriptor_set
+  };
+  uint32_t constants[2] = {INDEX_COUNT, num_instances};
+  command_recorder& rec = recorder_for(cmd);
+  rec.bind_pipeline(VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+  rec.bind_descriptor_sets(VK_PIPELINE_BIND_POINT_COMPUTE,
+			   cull_pipeline_layout,
+			   0,
+			   2,
+			   sets);
+  rec.push_constants(cull_pipeline_layout,
+		     VK_SHADER_STAGE_COMPUTE_BIT,
+		     0,
+		     sizeof(constants),
+		     constants);
+  rec.dispatch((num_instances + 63) / 64, 1, 1);
 }
 
 void record_end_renderpass(uint32_t command_buf_idx)
 {
-  std::cout << "Recording end renderpass..." << std::endl;
-  vkCmdEndRenderPass(command_buffers[command_buf_idx]);
+  LOG_DEBUG("Recording end renderpass...");
+  vkd.vkCmdEndRenderPass(command_buffers[command_buf_idx]);
+}
+
+void create_render_graph()
+{
+  std::cout << "Creating render graph..." << std::endl;
+  for (unsigned int i = 0; i != images.size(); i++)
+    graph_images.push_back(frame_graph.add_image(image_at(i),
+						 i == DEPTH_STENCIL_IMAGE ?
+						 (VK_IMAGE_ASPECT_DEPTH_BIT
+						  | VK_IMAGE_ASPECT_STENCIL_BIT) :
+						 VK_IMAGE_ASPECT_COLOR_BIT));
+  for (unsigned int i = 0; i != buffers.size(); i++)
+    graph_buffers.push_back(frame_graph.add_buffer(buffer_at(i)));
+
+#ifdef HEADLESS
+  // Offscreen images stay with the graph; the readback pass consumes them
+  for (unsigned int i = 0; i != swapchain_images.size(); i++)
+    graph_swapchain_images.push_back(frame_graph.add_image(swapchain_images[i],
+							   VK_IMAGE_ASPECT_COLOR_BIT));
+  graph_readback_buffer = frame_graph.add_buffer(readback_buffer);
+#else
+  // Swapchain images leave the graph for presentation at the end of every
+  // frame and come back with undefined contents
+  for (unsigned int i = 0; i != swapchain_images.size(); i++) {
+    graph_swapchain_images.push_back(frame_graph.add_image(swapchain_images[i],
+							   VK_IMAGE_ASPECT_COLOR_BIT));
+    frame_graph.export_image(graph_swapchain_images[i],
+			     VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			     VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			     0);
+  }
+#endif
+}
+
+void add_clear_image_pass(uint32_t img_idx, uint32_t command_buf_idx)
+{
+  uint32_t pass = frame_graph.add_pass("clear image",
+				       [=](VkCommandBuffer cmd) {
+					 gpu_scope scope(*profiler, cmd,
+							 "clear image");
+					 record_clear_color_image(img_idx,
+								  command_buf_idx);
+				       });
+  frame_graph.write(pass, graph_images[img_idx], RG_TRANSFER_WRITE);
+  // Nothing reads the cleared image yet, keep the pass anyway
+  frame_graph.set_side_effect(pass);
+}
+
+void add_clear_swapchain_pass(uint32_t command_buf_idx)
+{
+  uint32_t pass = frame_graph.add_pass("clear swapchain image",
+				       [=](VkCommandBuffer cmd) {
+					 gpu_scope scope(*profiler, cmd,
+							 "clear swapchain image");
+					 record_clear_swapchain_image(command_buf_idx);
+				       });
+  frame_graph.write(pass,
+		    graph_swapchain_images[cur_swapchain_img],
+		    RG_TRANSFER_WRITE);
+  frame_uses_swapchain = true;
+}
+
+// Draws keyed by pipeline, descriptor set and depth and replayed in key
+// order, so the binds the draws share are made once
+void record_draw_list(uint32_t pipeline_idx,
+		      uint32_t command_buf_idx,
+		      uint32_t num_instances)
+{
+  frame_draws.clear();
+  if (GPU_CULLING)
+    frame_draws.add(draw_key(PASS_RENDER,
+			     pipeline_idx,
+			     DESCRIPTOR_SET_GRAPHICS,
+			     0,
+			     0),
+		    DRAW_INDIRECT);
+  else
+    frame_draws.build(draw_jobs.get(), num_instances, DRAW_BUILD_GRAIN,
+		      [=](uint64_t begin, uint64_t end,
+			  std::vector<draw_command>& out) {
+			for (uint64_t i = begin; i != end; i++) {
+			  glm::vec4 center = uniform_data.view_matrix
+			    * uniform_data.model_matrix[i][3];
+			  uint32_t depth = draw_depth(-center.z, Z_NEAR, Z_FAR);
+			  out.push_back({draw_key(PASS_RENDER,
+						  pipeline_idx,
+						  DESCRIPTOR_SET_GRAPHICS,
+						  0,
+						  depth),
+					 static_cast<uint32_t>(i)});
+			}
+		      });
+  frame_draws.sort();
+  LOG_DEBUG("Recording " << frame_draws.size() << " sorted draws...");
+  frame_draws.replay(recorders[command_buf_idx],
+		     [=](command_recorder& rec, const draw_command& draw) {
+		       record_bind_graphics_pipeline(draw_key_pipeline(draw.key),
+						     command_buf_idx);
+		       record_bind_descriptor_set(draw_key_material(draw.key),
+						  command_buf_idx);
+		       record_bind_vertex_buffer(command_buf_idx);
+		       record_bind_index_buffer(command_buf_idx);
+		       if (draw.payload == DRAW_INDIRECT)
+			 record_draw_indexed_indirect(command_buf_idx);
+		       else
+			 // The shader indexes the model matrices by instance
+			 rec.draw_indexed(INDEX_COUNT, 1, 0, 0, draw.payload);
+		     });
+}
+
+// May run on the compute queue, where it goes untimed since the profiler
+// only sees the main command buffer
+void add_cull_pass(uint32_t num_instances)
+{
+  uint32_t pass = frame_graph.add_pass("cull",
+				       [=](VkCommandBuffer cmd) {
+					 bool timed = !async_compute
+					   || cmd != async_command_buffer;
+					 uint32_t scope = timed
+					   ? profiler->begin_scope(cmd, "cull")
+					   : GPU_PROFILER_NO_SCOPE;
+					 record_cull(cmd, num_instances);
+					 profiler->end_scope(cmd, scope);
+				       });
+  frame_graph.read(pass,
+		   graph_buffers[UNIFORM_BUFFER],
+		   RG_COMPUTE_UNIFORM_BUFFER_READ);
+  frame_graph.write(pass, graph_buffers[DRAW_BUFFER], RG_TRANSFER_WRITE);
+  frame_graph.write(pass,
+		    graph_buffers[DRAW_BUFFER],
+		    RG_COMPUTE_SHADER_WRITE);
+  frame_graph.set_async(pass);
+}
+
+void add_draw_pass(uint32_t pipeline_idx,
+		   uint32_t command_buf_idx,
+		   uint32_t num_instances)
+{
+  if (GPU_CULLING)
+    add_cull_pass(num_instances);
+  uint32_t pass = frame_graph.add_pass("draw",
+				       [=](VkCommandBuffer cmd) {
+					 gpu_scope scope(*profiler, cmd, "draw");
+					 record_begin_renderpass(command_buf_idx);
+					 record_draw_list(pipeline_idx,
+							  command_buf_idx,
+							  num_instances);
+					 record_end_renderpass(command_buf_idx);
+				       });
+  if (GPU_CULLING)
+    frame_graph.read(pass,
+		     graph_buffers[DRAW_BUFFER],
+		     RG_INDIRECT_BUFFER_READ);
+  frame_graph.read(pass, graph_buffers[VERTEX_BUFFER], RG_VERTEX_BUFFER_READ);
+  frame_graph.read(pass, graph_buffers[INDEX_BUFFER], RG_INDEX_BUFFER_READ);
+  frame_graph.read(pass, graph_buffers[UNIFORM_BUFFER], RG_UNIFORM_BUFFER_READ);
+  frame_graph.write(pass,
+		    graph_swapchain_images[cur_swapchain_img],
+		    RG_COLOR_ATTACHMENT_WRITE);
+  frame_graph.write(pass,
+		    graph_images[DEPTH_STENCIL_IMAGE],
+		    RG_DEPTH_STENCIL_ATTACHMENT_WRITE);
+  frame_uses_swapchain = true;
+}
+
+#ifdef HEADLESS
+void add_readback_pass(uint32_t command_buf_idx)
+{
+  uint32_t pass = frame_graph.add_pass("readback",
+				       [=](VkCommandBuffer cmd) {
+					 gpu_scope scope(*profiler, cmd,
+							 "readback");
+					 VkBufferImageCopy region = {};
+					 region.imageSubresource.aspectMask =
+					   VK_IMAGE_ASPECT_COLOR_BIT;
+					 region.imageSubresource.layerCount = 1;
+					 region.imageExtent.width = PREFERRED_WIDTH;
+					 region.imageExtent.height = PREFERRED_HEIGHT;
+					 region.imageExtent.depth = 1;
+					 vkd.vkCmdCopyImageToBuffer(command_buffers[command_buf_idx],
+								    swapchain_images[cur_swapchain_img],
+								    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+								    readback_buffer,
+								    1,
+								    &region);
+				       });
+  frame_graph.read(pass,
+		   graph_swapchain_images[cur_swapchain_img],
+		   RG_TRANSFER_READ);
+  frame_graph.write(pass, graph_readback_buffer, RG_TRANSFER_WRITE);
+
+  // Records nothing; makes the copy visible to the host
+  uint32_t host = frame_graph.add_pass("host read", [](VkCommandBuffer) {});
+  frame_graph.read(host, graph_readback_buffer, RG_HOST_READ);
+  frame_graph.set_side_effect(host);
+  readback_pending = true;
+}
+#endif
+
+// Records async passes and the hand-overs around them next to the frame;
+// submit_to_queue() sends whatever got used
+void record_split_render_graph(uint32_t command_buf_idx)
+{
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  begin_info.pInheritanceInfo = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(command_pool_mutex);
+    res = vkd.vkBeginCommandBuffer(prologue_command_buffer, &begin_info);
+    if (res == VK_SUCCESS)
+      res = vkd.vkBeginCommandBuffer(async_command_buffer, &begin_info);
+    async_recorder.reset(async_command_buffer);
+  }
+  if (res != VK_SUCCESS) {
+    LOG_ERROR("Failed to begin async compute command buffers...");
+    return;
+  }
+
+  frame_graph.execute(prologue_command_buffer,
+		      command_buffers[command_buf_idx],
+		      async_command_buffer,
+		      frame_split);
+  LOG_DEBUG("Recorded " << frame_graph.async_pass_count()
+	    << " async passes" << (frame_split.prologue ?
+				  " with a prologue" : "") << "...");
+
+  std::lock_guard<std::mutex> lock(command_pool_mutex);
+  res = vkd.vkEndCommandBuffer(prologue_command_buffer);
+  if (res == VK_SUCCESS)
+    res = vkd.vkEndCommandBuffer(async_command_buffer);
+  if (res != VK_SUCCESS)
+    LOG_ERROR("Failed to end async compute command buffers...");
+}
+
+void record_render_graph(uint32_t command_buf_idx)
+{
+  TRACE_SCOPE("record");
+#ifdef HEADLESS
+  if (frame_uses_swapchain)
+    add_readback_pass(command_buf_idx);
+#endif
+  frame_uses_swapchain = false;
+  frame_graph.compile();
+  LOG_DEBUG("Recording render graph (" << frame_graph.pass_count()
+	    << " passes, " << frame_graph.culled_pass_count()
+	    << " culled)...");
+  // Replayed command buffers would rewrite queries the profiler has
+  // already moved past, so they are left unprofiled
+  if (command_buf_idx >= COMMAND_BUFFER_STATIC)
+    profiler->skip_frame();
+  else
+    profiler->begin_frame(command_buffers[command_buf_idx]);
+  if (async_compute)
+    record_split_render_graph(command_buf_idx);
+  else
+    frame_graph.execute(command_buffers[command_buf_idx]);
+  frame_graph.clear_passes();
+}
+
+// Hands back the current swapchain image's static command buffer, recording
+// the draw into it only if it is missing or stale. Uniforms are rewritten in
+// place between frames, so resubmitting it as is picks them up.
+uint32_t record_static_draw(uint32_t pipeline_idx, uint32_t num_instances)
+{
+  uint32_t command_buf_idx = COMMAND_BUFFER_STATIC + cur_swapchain_img;
+  static_draw& draw = static_draws[cur_swapchain_img];
+  if (!draw.valid || draw.pipeline_idx != pipeline_idx
+      || draw.num_instances != num_instances) {
+    LOG_DEBUG("Recording static draw for swapchain image "
+	      << cur_swapchain_img << "...");
+    begin_recording(command_buf_idx);
+    add_draw_pass(pipeline_idx, command_buf_idx, num_instances);
+    record_render_graph(command_buf_idx);
+    end_recording(command_buf_idx);
+    draw.valid = true;
+    draw.pipeline_idx = pipeline_idx;
+    draw.num_instances = num_instances;
+  }
+#ifdef HEADLESS
+  // The recorded frame includes the readback pass
+  readback_pending = true;
+#endif
+  return command_buf_idx;
+}
+
+void create_gpu_profiler()
+{
+  std::cout << "Creating GPU profiler..." << std::endl;
+  profiler.reset(new gpu_profiler(physical_devices[phys_device_idx],
+				  device,
+				  queue_family_idx,
+				  PROFILER_FRAMES_IN_FLIGHT,
+				  CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr));
+  if (!profiler->supported())
+    std::cout << "GPU timestamps are not supported, "
+	      << "pass timings will be unavailable" << std::endl;
+}
+
+void create_draw_jobs()
+{
+  draw_jobs.reset(new job_system());
+  std::cout << "Created draw job system (" << draw_jobs->thread_count()
+	    << " threads)..." << std::endl;
+}
+
+// Builds a list of DRAW_CHECK_COUNT scrambled keys across the draw jobs
+// and checks that sorting leaves every draw once, in key order, with
+// equal keys in the order they were built
+void check_draw_list()
+{
+  draw_list draws;
+  draws.build(draw_jobs.get(), DRAW_CHECK_COUNT, DRAW_BUILD_GRAIN,
+	      [](uint64_t begin, uint64_t end,
+		 std::vector<draw_command>& out) {
+		for (uint64_t i = begin; i != end; i++) {
+		  uint32_t h = static_cast<uint32_t>(i) * 2654435761u;
+		  out.push_back({draw_key(h % 3, (h >> 8) % 5, 0, 0, h >> 28),
+				 static_cast<uint32_t>(i)});
+		}
+	      });
+  draws.sort();
+
+  unsigned int errors = 0;
+  std::vector<bool> seen(DRAW_CHECK_COUNT, false);
+  const std::vector<draw_command>& sorted = draws.commands();
+  for (size_t i = 0; i != sorted.size(); i++) {
+    if (sorted[i].payload >= DRAW_CHECK_COUNT || seen[sorted[i].payload])
+      errors++;
+    else
+      seen[sorted[i].payload] = true;
+    if (i != 0 && (sorted[i - 1].key > sorted[i].key
+		   || (sorted[i - 1].key == sorted[i].key
+		       && sorted[i - 1].payload > sorted[i].payload)))
+      errors++;
+  }
+  if (sorted.size() != DRAW_CHECK_COUNT)
+    errors++;
+  std::cout << "Draw list check: " << errors << " errors in "
+	    << sorted.size() << " sorted draws" << std::endl;
+}
+
+void destroy_draw_jobs()
+{
+  std::cout << "Destroying draw job system..." << std::endl;
+  draw_jobs.reset();
+}
+
+void destroy_gpu_profiler()
+{
+  profiler->collect();
+  profiler->print_stats(std::cout);
+  if (profiler->write_trace(PROFILER_TRACE_FILE))
+    std::cout << "Wrote GPU trace to " << PROFILER_TRACE_FILE << "!"
+	      << std::endl;
+  else
+    std::cout << "Failed to write GPU trace..." << std::endl;
+
+  std::cout << "Destroying GPU profiler..." << std::endl;
+  profiler.reset();
+}
+
+void create_deletion_queue()
+{
+  std::cout << "Creating deletion queue..." << std::endl;
+  deletions.reset(new deletion_queue(device,
+				     CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr));
+}
+
+void destroy_deletion_queue()
+{
+  std::cout << "Destroying deletion queue ("
+	    << deletions->pending() << " pending)..." << std::endl;
+  deletions.reset();
+}
+
+void create_texture_streamer(uint32_t queue_idx)
+{
+  std::cout << "Creating texture streamer (budget="
+	    << TEXTURE_VRAM_BUDGET << ", staging="
+	    << TEXTURE_STAGING_SIZE << ")..." << std::endl;
+  tex_loader.reset(new texture_loader());
+  tex_streamer.reset(new texture_streamer(physical_devices[phys_device_idx],
+					  device,
+					  queue_family_idx,
+					  queues[queue_idx],
+					  queue_mutex[queue_idx],
+					  TEXTURE_VRAM_BUDGET,
+					  TEXTURE_STAGING_SIZE,
+					  *deletions,
+					  CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr));
+
+  // A single level is its own mip tail, so it is never evicted
+  texture_data white;
+  white.name = "fallback";
+  white.mips.push_back({1, 1, std::vector<unsigned char>(TEXTURE_TEXEL_SIZE,
+							 255)});
+  fallback_texture = tex_streamer->add(white);
+  tex_streamer->update(0);
+}
+
+void load_textures(int count, const char* filenames[])
+{
+  for (int i = 0; i != count; i++) {
+    std::cout << "Requesting texture " << filenames[i] << "..." << std::endl;
+    tex_loader->request(filenames[i]);
+  }
+}
+
+void stream_textures(uint64_t frame)
+{
+  TRACE_SCOPE("stream textures");
+  texture_data tex;
+  while (tex_loader->poll(tex)) {
+    LOG_DEBUG("Streaming texture " << tex.name << "...");
+    streamed_textures.push_back(tex_streamer->add(tex));
+  }
+
+  // Only the texture this frame samples counts as used
+  sampled_texture = streamed_textures.empty() ? TEXTURE_NONE
+    : streamed_textures[(frame / TEXTURE_SWITCH_FRAMES)
+			% streamed_textures.size()];
+  if (sampled_texture != TEXTURE_NONE)
+    tex_streamer->touch(sampled_texture, frame);
+  tex_streamer->update(frame);
+
+  // Streaming recreates images, so the descriptor follows the version.
+  // The previous frame has been waited for, so the set is not in use.
+  uint32_t tex_idx = sampled_texture;
+  if (tex_idx == TEXTURE_NONE
+      || tex_streamer->view(tex_idx) == VK_NULL_HANDLE)
+    tex_idx = fallback_texture;
+  if (tex_idx != bound_texture
+      || tex_streamer->version(tex_idx) != bound_texture_version)
+    update_descriptor_sets();
+}
+
+void destroy_texture_streamer()
+{
+  std::cout << "Destroying texture streamer..." << std::endl;
+  tex_streamer.reset();
+  tex_loader.reset();
+  streamed_textures.clear();
+  fallback_texture = TEXTURE_NONE;
+  sampled_texture = TEXTURE_NONE;
+  bound_texture = TEXTURE_NONE;
 }
 
 void destroy_framebuffers()
@@ -2521,6 +4068,9 @@ void free_descriptor_sets()
 	      << (DESCRIPTOR_SET_COUNT != 1 ? "s" : "") << "..."
 	      << std::endl;
   
+  std::cout << "Freeing culling descriptor set..." << std::endl;
+  vkFreeDescriptorSets(device, descriptor_pool, 1, &cull_descriptor_set);
+  
   for (auto& lck : locks)
     lck.unlock();
 }
@@ -2551,6 +4101,33 @@ void destroy_graphics_pipelines()
   }
 }
 
+void destroy_cull_pipeline()
+{
+  std::cout << "Destroying culling pipeline..." << std::endl;
+  vkDestroyPipeline(device,
+		    cull_pipeline,
+		    CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+}
+
+void destroy_cull_pipeline_layout()
+{
+  std::cout << "Destroying culling pipeline layout..." << std::endl;
+  vkDestroyPipelineLayout(device,
+			  cull_pipeline_layout,
+			  CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+  vkDestroyDescriptorSetLayout(device,
+			       cull_descriptor_set_layout,
+			       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+}
+
+void destroy_cull_shader()
+{
+  std::cout << "Destroying culling shader module..." << std::endl;
+  vkDestroyShaderModule(device,
+			cull_shader,
+			CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+}
+
 void destroy_graphics_pipeline_layout()
 {
   std::lock_guard<std::mutex> lock(graphics_pipeline_layout_mutex);
@@ -2621,6 +4198,7 @@ void destroy_swapchain_image_views()
   }
 }
 
+#ifndef HEADLESS
 void destroy_swapchain()
 {
   std::lock_guard<std::mutex> lock(swapchain_mutex);
@@ -2638,6 +4216,7 @@ void destroy_surface()
 		      surface,
 		      CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
 }
+#endif
 
 void free_command_buffers()
 {
@@ -2656,6 +4235,18 @@ void free_command_buffers()
     lck.unlock();
 }
 
+void destroy_static_command_buffers()
+{
+  std::lock_guard<std::mutex> lock(command_pool_mutex);
+  std::cout << "Destroying static command pool..." << std::endl;
+  // Frees the static command buffers with it
+  vkDestroyCommandPool(device,
+		       static_command_pool,
+		       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+  command_buffers.resize(COMMAND_BUFFER_STATIC);
+  static_draws.clear();
+}
+
 void destroy_command_pool()
 {
   std::lock_guard<std::mutex> lock(command_pool_mutex);
@@ -2667,37 +4258,37 @@ void destroy_command_pool()
 
 void destroy_buffer_views()
 {
-  std::vector<std::unique_lock<std::mutex>> locks;
-  for (auto& mut : view_mutex[RESOURCE_BUFFER])
-    locks.emplace_back(mut, std::defer_lock);
-  for (unsigned i = 0; i != BUFFER_COUNT; i++) {
-    locks[i].lock();
-    std::cout << "Destroying buffer view " << i << "..." << std::endl;
-    vkDestroyBufferView(device,
-			buffer_views[i],
-			CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
-    locks[i].unlock();
-  }
+  buffer_pool.for_each([](buffer_pool_t::handle h) {
+      std::cout << "Destroying buffer view " << h.index << "..." << std::endl;
+      VkBufferView& view = buffer_pool.get<BUFFER_VIEW>(h);
+      vkDestroyBufferView(device,
+			  view,
+			  CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+      view = VK_NULL_HANDLE;
+    });
 }
 
 void destroy_image_views()
 {
-  std::vector<std::unique_lock<std::mutex>> locks;
-  for (auto& mut : view_mutex[RESOURCE_IMAGE])
-    locks.emplace_back(mut, std::defer_lock);
-  for (unsigned i = 0; i != IMAGE_COUNT; i++) {
-    locks[i].lock();
-    std::cout << "Destroying image view " << i << "..." << std::endl;
-    vkDestroyImageView(device,
-		       image_views[i],
-		       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
-    locks[i].unlock();
-  }
+  image_pool.for_each([](image_pool_t::handle h) {
+      std::cout << "Destroying image view " << h.index << "..." << std::endl;
+      VkImageView& view = image_pool.get<IMAGE_VIEW>(h);
+      vkDestroyImageView(device,
+			 view,
+			 CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+      view = VK_NULL_HANDLE;
+    });
 }
 
 void free_buffer_memory()
 {
   std::lock_guard<std::mutex> lock(memory_mutex[RESOURCE_BUFFER]);
+  if (buffer_mapping) {
+    std::cout << "Unmapping buffer memory (" << buffer_mapping->flushed_bytes()
+	      << " bytes flushed in " << buffer_mapping->flush_count()
+	      << " calls)..." << std::endl;
+    buffer_mapping.reset();
+  }
   std::cout << "Freeing buffer memory..." << std::endl;
   vkFreeMemory(device,
 	       memory[RESOURCE_BUFFER],
@@ -2713,34 +4304,42 @@ void free_image_memory()
 	       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
 }
 
+void free_transient_memory()
+{
+  std::lock_guard<std::mutex> lock(memory_mutex[RESOURCE_TRANSIENT]);
+  std::cout << "Freeing transient attachment memory..." << std::endl;
+  vkFreeMemory(device,
+	       memory[RESOURCE_TRANSIENT],
+	       CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
+}
+
+// Handles still held after this (e.g. by the render graph) fail lookups
 void destroy_buffers()
 {
-  std::vector<std::unique_lock<std::mutex>> locks;
-  for (auto& mut : resource_mutex[RESOURCE_BUFFER])
-    locks.emplace_back(mut, std::defer_lock);
-  for (int i = 0; i != BUFFER_COUNT; i++) {
-    locks[i].lock();
-    std::cout << "Destroying buffer " << i << "..." << std::endl;
+  for (auto h : buffers) {
+    if (!buffer_pool.alive(h))
+      continue;
+    std::cout << "Destroying buffer " << h.index << "..." << std::endl;
     vkDestroyBuffer(device,
-		    buffers[i],
+		    buffer_pool.get<BUFFER_HANDLE>(h),
 		    CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
-    locks[i].unlock();
+    buffer_pool.destroy(h);
   }
+  buffers.clear();
 }
 
 void destroy_images()
 {
-  std::vector<std::unique_lock<std::mutex>> locks;
-  for (auto& mut : resource_mutex[RESOURCE_IMAGE])
-    locks.emplace_back(mut, std::defer_lock);
-  for (unsigned int i = 0; i != IMAGE_COUNT; i++) {
-    locks[i].lock();
-    std::cout << "Destroying image " << i << "..." << std::endl;
+  for (auto h : images) {
+    if (!image_pool.alive(h))
+      continue;
+    std::cout << "Destroying image " << h.index << "..." << std::endl;
     vkDestroyImage(device,
-		   images[i],
+		   image_pool.get<IMAGE_HANDLE>(h),
 		   CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
-    locks[i].unlock();
+    image_pool.destroy(h);
   }
+  images.clear();
 }
 
 void wait_for_device()
@@ -2786,6 +4385,7 @@ void destroy_instance()
 		    CUSTOM_ALLOCATOR ? &alloc_callbacks : nullptr);
 }
 
+#ifndef HEADLESS
 void destroy_window()
 {
 #ifdef VK_USE_PLATFORM_WIN32_KHR
@@ -2798,6 +4398,7 @@ void destroy_window()
   XCloseDisplay(display);
 #endif 
 }
+#endif
 
 #ifdef VK_USE_PLATFORM_WIN32_KHR
 int APIENTRY WinMain(HINSTANCE hInstance,  
@@ -2808,10 +4409,15 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 int main(int argc, const char* argv[])
 #endif
 {
-  std::ofstream lfile;
-  std::streambuf* lsbuf = std::cout.rdbuf();
-  lfile.open(logfile);
-  std::cout.rdbuf(lfile.rdbuf());
+  // Everything written to std::cout goes through the log writer thread
+  if (!log_start(logfile))
+    std::cerr << "Failed to open " << logfile << "..." << std::endl;
+  std::streambuf* lsbuf = std::cout.rdbuf(log_stream_buffer());
+
+  if (!trace_start(TRACE_FILE))
+    std::cout << "Failed to start tracing to " << TRACE_FILE << "..."
+	      << std::endl;
+  trace_thread_name("main");
 
 #if ENABLE_STANDARD_VALIDATION
   std::ofstream efile;
@@ -2821,8 +4427,10 @@ int main(int argc, const char* argv[])
 #endif
 
   get_platform();
-    
+
+#ifndef HEADLESS
   create_window();
+#endif
   
   if (SHOW_INSTANCE_LAYERS) {
     uint32_t inst_layer_count;
@@ -2914,6 +4522,7 @@ int main(int argc, const char* argv[])
   queue_family_queue_count =
     queue_family_properties[queue_family_idx].queueCount;
 
+  plan_device_queues();
   create_device();
 
   if (ENABLE_STANDARD_VALIDATION)
@@ -2925,22 +4534,28 @@ int main(int argc, const char* argv[])
 
   get_subresource_layouts();
 
-  for (unsigned int i = 0; i != IMAGE_COUNT; i++)
-    std::cout << "Subresource " << i << ": off="
-	      << subresource_layouts[i].offset << ", size="
-	      << subresource_layouts[i].size << ", rowpitch="
-	      << subresource_layouts[i].rowPitch << ", arraypitch="
-	      << subresource_layouts[i].arrayPitch << ", depthpitch="
-	      << subresource_layouts[i].depthPitch << std::endl;
+  image_pool.for_each([](image_pool_t::handle h) {
+      const VkSubresourceLayout& layout = image_pool.get<IMAGE_LAYOUT>(h);
+      std::cout << "Subresource " << h.index << ": off="
+		<< layout.offset << ", size="
+		<< layout.size << ", rowpitch="
+		<< layout.rowPitch << ", arraypitch="
+		<< layout.arrayPitch << ", depthpitch="
+		<< layout.depthPitch << std::endl;
+    });
 
   get_buffer_memory_requirements();
   
   get_image_memory_requirements();
 
+  plan_image_memory();
+
   std::cout << "Buffer memory size: "
 	    << mem_size[RESOURCE_BUFFER] << std::endl;
   std::cout << "Image memory size: "
 	    << mem_size[RESOURCE_IMAGE] << std::endl;
+  std::cout << "Transient attachment memory size: "
+	    << mem_size[RESOURCE_TRANSIENT] << std::endl;
   
   find_memory_types();
 
@@ -2958,8 +4573,19 @@ int main(int argc, const char* argv[])
     std::cout << "Could not find a suitable memory type for images..."
 	      << std::endl;
 
+  if (mem_types[RESOURCE_TRANSIENT] != UINT32_MAX)
+    std::cout << "Found suitable memory type for transient attachments: "
+	      << mem_types[RESOURCE_TRANSIENT]
+	      << (LAZILY_ALLOCATED(physical_device_mem_props.memoryTypes[mem_types[RESOURCE_TRANSIENT]].propertyFlags) ?
+		  " (lazily allocated)" : "")
+	      << std::endl;
+  else
+    std::cout << "Could not find a suitable memory type for transient "
+	      << "attachments..." << std::endl;
+
   allocate_buffer_memory();
   allocate_image_memory();
+  allocate_transient_memory();
 
   write_buffer_memory();
 
@@ -2970,11 +4596,18 @@ int main(int argc, const char* argv[])
   create_image_views();
 
   get_queues();
+  create_submit_batches();
+  create_queue_scheduler();
+  create_timeline();
   
   create_command_pool();
 
   allocate_command_buffers();
 
+#ifdef HEADLESS
+  create_offscreen_images();
+  create_readback_buffer();
+#else
   create_surface();
 
   get_surface_capabilities();
@@ -2984,7 +4617,9 @@ int main(int argc, const char* argv[])
   
   create_swapchain();  
   get_swapchain_images();
+#endif
   create_swapchain_image_views();
+  create_static_command_buffers();
 
   begin_recording();
   record_copy_buffer_commands();
@@ -2993,18 +4628,12 @@ int main(int argc, const char* argv[])
   std::cout << "Before submit:" << std::endl;
   std::cout << "Buffer 0 (offset=" << READ_OFFSET << ", len="
 	    << READ_LENGTH << "): ";
-  print_mem(device,
-	    memory[RESOURCE_BUFFER],
-	    memory_mutex[RESOURCE_BUFFER],
-	    READ_OFFSET,
-	    READ_LENGTH);
+  print_buffer_memory(READ_OFFSET, READ_LENGTH);
   std::cout << "Buffer 1 (offset=" << READ_OFFSET << ", len="
 	    << READ_LENGTH << "): ";
-  print_mem(device,
-	    memory[RESOURCE_BUFFER],
-	    memory_mutex[RESOURCE_BUFFER],
-	    READ_OFFSET + buf_mem_requirements[0].size,
-	    READ_LENGTH);
+  print_buffer_memory(READ_OFFSET
+		      + buffer_pool.get<BUFFER_OFFSET>(buffers[1]),
+		      READ_LENGTH);
 
   uint32_t submit_queue_idx = 0;
   submit_all_to_queue(submit_queue_idx);
@@ -3013,18 +4642,12 @@ int main(int argc, const char* argv[])
   std::cout << "After submit:" << std::endl;
   std::cout << "Buffer 0 (offset=" << READ_OFFSET << ", len="
 	    << READ_LENGTH << "): ";
-  print_mem(device,
-	    memory[RESOURCE_BUFFER],
-	    memory_mutex[RESOURCE_BUFFER],
-	    READ_OFFSET,
-	    READ_LENGTH);
+  print_buffer_memory(READ_OFFSET, READ_LENGTH);
   std::cout << "Buffer 1 (offset=" << READ_OFFSET << ", len="
 	    << READ_LENGTH << "): ";
-  print_mem(device,
-	    memory[RESOURCE_BUFFER],
-	    memory_mutex[RESOURCE_BUFFER],
-	    READ_OFFSET + buf_mem_requirements[0].size,
-	    READ_LENGTH);
+  print_buffer_memory(READ_OFFSET
+		      + buffer_pool.get<BUFFER_OFFSET>(buffers[1]),
+		      READ_LENGTH);
 
   reset_command_buffers();
 
@@ -3035,11 +4658,7 @@ int main(int argc, const char* argv[])
   std::cout << "Before submit:" << std::endl;
   std::cout << "Buffer 0 (offset=" << READ_OFFSET << ", len="
 	    << READ_LENGTH << "): ";
-  print_mem(device,
-	    memory[RESOURCE_BUFFER],
-	    memory_mutex[RESOURCE_BUFFER],
-	    READ_OFFSET,
-	    READ_LENGTH);
+  print_buffer_memory(READ_OFFSET, READ_LENGTH);
 
   submit_all_to_queue(submit_queue_idx);
   wait_for_queue(submit_queue_idx);
@@ -3047,14 +4666,16 @@ int main(int argc, const char* argv[])
   std::cout << "After submit:" << std::endl;
   std::cout << "Buffer 0 (offset=" << READ_OFFSET << ", len="
 	    << READ_LENGTH << "): ";
-  print_mem(device,
-	    memory[RESOURCE_BUFFER],
-	    memory_mutex[RESOURCE_BUFFER],
-	    READ_OFFSET,
-	    READ_LENGTH);
+  print_buffer_memory(READ_OFFSET, READ_LENGTH);
 
   reset_command_buffers();
 
+  create_deletion_queue();
+  create_texture_streamer(submit_queue_idx);
+#ifndef VK_USE_PLATFORM_WIN32_KHR
+  load_textures(argc-1, argv+1);
+#endif
+
   create_semaphore();
 
   create_descriptor_set_layouts();
@@ -3071,8 +4692,17 @@ int main(int argc, const char* argv[])
   create_fragment_shader("shaders/simple.frag.spv");
   create_renderpass();
   create_framebuffers();
+  create_render_graph();
+  create_gpu_profiler();
+  create_draw_jobs();
+  check_draw_list();
   create_graphics_pipeline_layout();
   create_graphics_pipelines();
+  create_cull_shader("shaders/cull.comp.spv");
+  create_cull_pipeline_layout();
+  allocate_cull_descriptor_set();
+  create_cull_pipeline();
+  create_async_compute();
   
   update_vertex_buffer();
   update_index_buffer();
@@ -3080,20 +4710,8 @@ int main(int argc, const char* argv[])
   update_descriptor_sets();
 
   begin_recording(COMMAND_BUFFER_GRAPHICS);
-  record_image_barrier(CLEAR_IMAGE,
-		       COMMAND_BUFFER_GRAPHICS,
-		       VK_IMAGE_LAYOUT_UNDEFINED,
-		       0,
-		       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		       VK_ACCESS_TRANSFER_WRITE_BIT);
-  record_image_barrier(DEPTH_STENCIL_IMAGE,
-		       COMMAND_BUFFER_GRAPHICS,
-		       VK_IMAGE_LAYOUT_UNDEFINED,
-		       0,
-		       VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-		       (VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
-			| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT));
-  record_clear_color_image(CLEAR_IMAGE, COMMAND_BUFFER_GRAPHICS);
+  add_clear_image_pass(CLEAR_IMAGE, COMMAND_BUFFER_GRAPHICS);
+  record_render_graph(COMMAND_BUFFER_GRAPHICS);
   end_recording(COMMAND_BUFFER_GRAPHICS);
   submit_to_queue(COMMAND_BUFFER_GRAPHICS, submit_queue_idx);
   wait_for_queue(submit_queue_idx);
@@ -3101,109 +4719,113 @@ int main(int argc, const char* argv[])
 
   next_swapchain_image();
   begin_recording(COMMAND_BUFFER_GRAPHICS);
-  record_swapchain_image_barrier(COMMAND_BUFFER_GRAPHICS,
-				 VK_IMAGE_LAYOUT_UNDEFINED,
-				 0,
-				 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				 VK_ACCESS_TRANSFER_WRITE_BIT);
-  record_clear_swapchain_image(COMMAND_BUFFER_GRAPHICS);
-  record_swapchain_image_barrier(COMMAND_BUFFER_GRAPHICS,
-				 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				 VK_ACCESS_TRANSFER_WRITE_BIT,
-				 VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-				 VK_ACCESS_MEMORY_READ_BIT);
+  add_clear_swapchain_pass(COMMAND_BUFFER_GRAPHICS);
+  record_render_graph(COMMAND_BUFFER_GRAPHICS);
   end_recording(COMMAND_BUFFER_GRAPHICS);
   submit_to_queue(COMMAND_BUFFER_GRAPHICS, submit_queue_idx);
   wait_for_queue(submit_queue_idx);
   reset_command_buffer(COMMAND_BUFFER_GRAPHICS);
   present_current_swapchain_image(submit_queue_idx);
 
+#ifndef HEADLESS
   std::this_thread::sleep_for(std::chrono::milliseconds(5000));
+#endif
   
   uint32_t graphics_pipeline_idx = 0;
   next_swapchain_image();
   begin_recording(COMMAND_BUFFER_GRAPHICS);
-  record_begin_renderpass(COMMAND_BUFFER_GRAPHICS);
-  record_bind_graphics_pipeline(graphics_pipeline_idx,
-				COMMAND_BUFFER_GRAPHICS);
-  record_bind_descriptor_set(DESCRIPTOR_SET_GRAPHICS,
-  			     COMMAND_BUFFER_GRAPHICS);
-  record_bind_vertex_buffer(COMMAND_BUFFER_GRAPHICS);
-  record_bind_index_buffer(COMMAND_BUFFER_GRAPHICS);
-  record_draw_indexed(COMMAND_BUFFER_GRAPHICS, 1);
-  record_end_renderpass(COMMAND_BUFFER_GRAPHICS);
-  record_swapchain_image_barrier(COMMAND_BUFFER_GRAPHICS,
-				 VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-				 VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-				 VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-				 VK_ACCESS_MEMORY_READ_BIT);
+  add_draw_pass(graphics_pipeline_idx, COMMAND_BUFFER_GRAPHICS, 1);
+  record_render_graph(COMMAND_BUFFER_GRAPHICS);
   end_recording(COMMAND_BUFFER_GRAPHICS);
   submit_to_queue(COMMAND_BUFFER_GRAPHICS, submit_queue_idx);
   wait_for_queue(submit_queue_idx);
   present_current_swapchain_image(submit_queue_idx);
   reset_command_buffer(COMMAND_BUFFER_GRAPHICS);
 
+#ifndef HEADLESS
   std::this_thread::sleep_for(std::chrono::milliseconds(5000));
+#endif
 
   next_swapchain_image();
   begin_recording(COMMAND_BUFFER_GRAPHICS);
-  record_begin_renderpass(COMMAND_BUFFER_GRAPHICS);
-  record_bind_graphics_pipeline(graphics_pipeline_idx,
-				COMMAND_BUFFER_GRAPHICS);
-  record_bind_descriptor_set(DESCRIPTOR_SET_GRAPHICS,
-  			     COMMAND_BUFFER_GRAPHICS);
-  record_bind_vertex_buffer(COMMAND_BUFFER_GRAPHICS);
-  record_bind_index_buffer(COMMAND_BUFFER_GRAPHICS);
-  record_draw_indexed(COMMAND_BUFFER_GRAPHICS, 2);
-  record_end_renderpass(COMMAND_BUFFER_GRAPHICS);
-  record_swapchain_image_barrier(COMMAND_BUFFER_GRAPHICS,
-				 VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-				 VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-				 VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-				 VK_ACCESS_MEMORY_READ_BIT);
+  add_draw_pass(graphics_pipeline_idx, COMMAND_BUFFER_GRAPHICS, 2);
+  record_render_graph(COMMAND_BUFFER_GRAPHICS);
   end_recording(COMMAND_BUFFER_GRAPHICS);
   submit_to_queue(COMMAND_BUFFER_GRAPHICS, submit_queue_idx);
   wait_for_queue(submit_queue_idx);
   present_current_swapchain_image(submit_queue_idx);
   reset_command_buffer(COMMAND_BUFFER_GRAPHICS);
 
+#ifndef HEADLESS
   std::this_thread::sleep_for(std::chrono::milliseconds(5000));
+#endif
 
+  auto loop_start = std::chrono::steady_clock::now();
   for (unsigned int i = 0; i != 500; i++) {
+    TRACE_SCOPE("frame");
     rotation[0].z += 0.25f;
     rotation[1].y += 0.25f;
     update_uniform_buffer();
+    // Tag streamed resources with the frame about to be submitted
+    stream_textures(frames_submitted + 1);
     
     next_swapchain_image();
-    begin_recording(COMMAND_BUFFER_GRAPHICS);
-    record_begin_renderpass(COMMAND_BUFFER_GRAPHICS);
-    record_bind_graphics_pipeline(graphics_pipeline_idx,
-				  COMMAND_BUFFER_GRAPHICS);
-    record_bind_descriptor_set(DESCRIPTOR_SET_GRAPHICS,
-			       COMMAND_BUFFER_GRAPHICS);
-    record_bind_vertex_buffer(COMMAND_BUFFER_GRAPHICS);
-    record_bind_index_buffer(COMMAND_BUFFER_GRAPHICS);
-    record_draw_indexed(COMMAND_BUFFER_GRAPHICS, 2);
-    record_end_renderpass(COMMAND_BUFFER_GRAPHICS);
-    record_swapchain_image_barrier(COMMAND_BUFFER_GRAPHICS,
-				   VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-				   VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-				   VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-				   VK_ACCESS_MEMORY_READ_BIT);
-    end_recording(COMMAND_BUFFER_GRAPHICS);
-    submit_to_queue(COMMAND_BUFFER_GRAPHICS, submit_queue_idx);
-    wait_for_queue(submit_queue_idx);
-    present_current_swapchain_image(submit_queue_idx);
-    reset_command_buffer(COMMAND_BUFFER_GRAPHICS);
+    // Frames split over two queues are recorded every frame, as the split
+    // follows the passes' timings
+    if (STATIC_COMMAND_BUFFERS && !async_compute) {
+      uint32_t static_idx = record_static_draw(graphics_pipeline_idx, 2);
+      submit_to_queue(static_idx, submit_queue_idx);
+      wait_for_queue(submit_queue_idx);
+      present_current_swapchain_image(submit_queue_idx);
+    } else {
+      begin_recording(COMMAND_BUFFER_GRAPHICS);
+      add_draw_pass(graphics_pipeline_idx, COMMAND_BUFFER_GRAPHICS, 2);
+      record_render_graph(COMMAND_BUFFER_GRAPHICS);
+      end_recording(COMMAND_BUFFER_GRAPHICS);
+      submit_to_queue(COMMAND_BUFFER_GRAPHICS, submit_queue_idx);
+      wait_for_queue(submit_queue_idx);
+      present_current_swapchain_image(submit_queue_idx);
+      reset_command_buffer(COMMAND_BUFFER_GRAPHICS);
+    }
 
+#ifndef HEADLESS
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
+#endif
   }
+  std::chrono::duration<double, std::milli> loop_time =
+    std::chrono::steady_clock::now() - loop_start;
+  std::cout << "Average frame time: " << loop_time.count() / 500 << " ms"
+	    << std::endl;
+  uint64_t binds_requested = async_recorder.requested_count();
+  uint64_t binds_recorded = async_recorder.recorded_count();
+  for (auto& rec : recorders) {
+    binds_requested += rec.requested_count();
+    binds_recorded += rec.recorded_count();
+  }
+  std::cout << "Binds and state changes: " << binds_recorded
+	    << " recorded of " << binds_requested << std::endl;
+#ifdef HEADLESS
+  std::cout << "Last frame checksum: " << std::hex << frame_checksum
+	    << std::dec << std::endl;
+#endif
 
   // Cleanup
   wait_for_device();
+  destroy_draw_jobs();
+  destroy_gpu_profiler();
+  destroy_texture_streamer();
+  destroy_deletion_queue();
   destroy_swapchain_image_views();
+#ifdef HEADLESS
+  destroy_readback_buffer();
+  destroy_offscreen_images();
+#else
   destroy_swapchain();
+#endif
 
+  destroy_cull_pipeline();
+  destroy_cull_pipeline_layout();
+  destroy_cull_shader();
   destroy_graphics_pipelines();
   destroy_graphics_pipeline_layout();
   destroy_framebuffers();
@@ -3220,10 +4842,14 @@ int main(int argc, const char* argv[])
   destroy_descriptor_set_layouts();
 
   destroy_semaphore();
-  
+
+#ifndef HEADLESS
   destroy_surface();
+#endif
   
+  destroy_async_compute();
   free_command_buffers();
+  destroy_static_command_buffers();
   
   destroy_command_pool();
   
@@ -3235,6 +4861,8 @@ int main(int argc, const char* argv[])
 
   free_image_memory();
 
+  free_transient_memory();
+
   destroy_buffers();
 
   destroy_images();
@@ -3242,15 +4870,22 @@ int main(int argc, const char* argv[])
   if (ENABLE_STANDARD_VALIDATION)
     destroy_debug_report_callback();
 
+  destroy_timeline();
+  destroy_queue_scheduler();
+  destroy_submit_batches();
   wait_for_device();
   destroy_device();
   
   destroy_instance();
 
+#ifndef HEADLESS
   destroy_window();
+#endif
+
+  trace_stop();
 
   std::cout.rdbuf(lsbuf);
-  lfile.close();
+  log_stop();
 
 #if ENABLE_STANDARD_VALIDATION
   std::cerr.rdbuf(esbuf);
@@ -0,0 +1,104 @@
+#include "job_system.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+
+job_system::job_system(unsigned int workers)
+  : generation(0),
+    busy(0),
+    stopping(false),
+    fn(nullptr),
+    count(0),
+    grain(1),
+    next(0)
+{
+  if (workers == 0) {
+    unsigned int hw = std::thread::hardware_concurrency();
+    workers = hw > 1 ? hw - 1 : 0;
+  }
+  for (unsigned int i = 0; i != workers; i++)
+    threads.emplace_back(&job_system::run, this);
+}
+
+job_system::~job_system()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  start.notify_all();
+  for (auto& t : threads)
+    t.join();
+}
+
+unsigned int job_system::thread_count() const
+{
+  return static_cast<unsigned int>(threads.size()) + 1;
+}
+
+// Takes ranges until the loop is exhausted. A worker waking after its
+// loop has finished finds next past count and never touches fn; the loop
+// is not replaced while any worker is busy.
+void job_system::work()
+{
+  for (;;) {
+    uint64_t begin = next.fetch_add(grain);
+    if (begin >= count)
+      return;
+    (*fn)(begin, std::min(begin + grain, count));
+  }
+}
+
+void job_system::run()
+{
+  trace_thread_name("job worker");
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    start.wait(lock, [&] { return stopping || generation != seen; });
+    if (stopping)
+      return;
+    seen = generation;
+    busy++;
+    lock.unlock();
+
+    work();
+
+    lock.lock();
+    if (--busy == 0)
+      finished.notify_all();
+  }
+}
+
+void job_system::parallel_for(uint64_t count, uint64_t grain,
+			      const range_fn& fn)
+{
+  if (count == 0)
+    return;
+  grain = std::max<uint64_t>(grain, 1);
+
+  // Not worth waking anyone for a single range
+  if (threads.empty() || count <= grain) {
+    for (uint64_t begin = 0; begin < count; begin += grain)
+      fn(begin, std::min(begin + grain, count));
+    return;
+  }
+
+  std::lock_guard<std::mutex> loop_lock(loop_mutex);
+  {
+    // A worker that woke late for the previous loop may still be leaving
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return busy == 0; });
+    this->fn = &fn;
+    this->count = count;
+    this->grain = grain;
+    next = 0;
+    generation++;
+  }
+  start.notify_all();
+
+  work();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [this] { return busy == 0; });
+}
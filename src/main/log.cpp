@@ -0,0 +1,213 @@
+#include "log.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct log_message {
+  int level;
+  uint64_t time_ns;
+  std::string text;
+};
+
+// Single producer (the owning thread), single consumer (the writer)
+struct log_queue {
+  std::atomic<uint64_t> head;
+  std::atomic<uint64_t> tail;
+  uint32_t tid;
+  log_message messages[LOG_QUEUE_SIZE];
+};
+
+class log_buffer : public std::streambuf {
+protected:
+  int_type overflow(int_type c) override;
+  std::streamsize xsputn(const char* s, std::streamsize n) override;
+  int sync() override;
+};
+
+static std::atomic<bool> active(false);
+static std::atomic<uint64_t> dropped(0);
+static uint64_t epoch = 0;
+
+// Guards the queue list only; never taken when logging
+static std::mutex queues_mutex;
+static std::vector<std::unique_ptr<log_queue>> queues;
+static thread_local log_queue* local_queue = nullptr;
+
+// Partial line written through the stream buffer by this thread
+static thread_local std::string pending_line;
+static log_buffer stream_buffer;
+
+static std::thread writer;
+static std::mutex writer_mutex;
+static std::condition_variable writer_cond;
+static bool stopping = false;
+static std::ofstream file;
+
+static const char* level_names[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+static uint64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static log_queue* get_queue()
+{
+  if (local_queue == nullptr) {
+    std::lock_guard<std::mutex> lock(queues_mutex);
+    queues.emplace_back(new log_queue());
+    local_queue = queues.back().get();
+    local_queue->head = 0;
+    local_queue->tail = 0;
+    local_queue->tid = queues.size();
+  }
+  return local_queue;
+}
+
+// Writer thread only. Formats every queued message into one buffer so a
+// batch costs a single write.
+static void drain()
+{
+  std::vector<log_queue*> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(queues_mutex);
+    for (auto& queue : queues)
+      snapshot.push_back(queue.get());
+  }
+
+  std::string batch;
+  char prefix[64];
+  for (auto queue : snapshot) {
+    uint64_t tail = queue->tail.load(std::memory_order_relaxed);
+    uint64_t head = queue->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+      log_message& msg = queue->messages[tail % LOG_QUEUE_SIZE];
+      snprintf(prefix, sizeof(prefix), "[%12.6f] %s %2u ",
+	       (msg.time_ns - epoch) / 1e9, level_names[msg.level],
+	       queue->tid);
+      batch += prefix;
+      batch += msg.text;
+      batch += '\n';
+      std::string().swap(msg.text);
+    }
+    queue->tail.store(tail, std::memory_order_release);
+  }
+
+  if (!batch.empty()) {
+    file.write(batch.data(), batch.size());
+    file.flush();
+  }
+}
+
+static void run()
+{
+  std::unique_lock<std::mutex> lock(writer_mutex);
+  while (!stopping) {
+    writer_cond.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_MS));
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+}
+
+bool log_start(const std::string& filename)
+{
+  if (active)
+    return false;
+
+  file.open(filename);
+  if (!file.is_open())
+    return false;
+
+  epoch = now_ns();
+  dropped = 0;
+  stopping = false;
+  writer = std::thread(run);
+  active = true;
+  return true;
+}
+
+void log_stop()
+{
+  if (!active)
+    return;
+
+  active = false;
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    stopping = true;
+  }
+  writer_cond.notify_one();
+  writer.join();
+
+  drain();
+  if (dropped != 0)
+    file << "Log dropped " << dropped.load() << " message"
+	 << (dropped != 1 ? "s" : "") << std::endl;
+  file.close();
+}
+
+void log_write(int level, std::string&& message)
+{
+  if (!active)
+    return;
+
+  log_queue* queue = get_queue();
+  uint64_t head = queue->head.load(std::memory_order_relaxed);
+  if (head - queue->tail.load(std::memory_order_acquire) == LOG_QUEUE_SIZE) {
+    dropped++;
+    writer_cond.notify_one();
+    return;
+  }
+
+  log_message& msg = queue->messages[head % LOG_QUEUE_SIZE];
+  msg.level = level;
+  msg.time_ns = now_ns();
+  msg.text = std::move(message);
+  queue->head.store(head + 1, std::memory_order_release);
+}
+
+static void emit_line()
+{
+  log_write(LOG_LEVEL_INFO, std::move(pending_line));
+  pending_line.clear();
+}
+
+std::streambuf* log_stream_buffer()
+{
+  return &stream_buffer;
+}
+
+log_buffer::int_type log_buffer::overflow(int_type c)
+{
+  if (c != traits_type::eof()) {
+    if (c == '\n')
+      emit_line();
+    else
+      pending_line += traits_type::to_char_type(c);
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize log_buffer::xsputn(const char* s, std::streamsize n)
+{
+  for (std::streamsize i = 0; i != n; i++)
+    if (s[i] == '\n')
+      emit_line();
+    else
+      pending_line += s[i];
+  return n;
+}
+
+int log_buffer::sync()
+{
+  // Lines are sent when complete, so flushing has nothing left to do
+  return 0;
+}
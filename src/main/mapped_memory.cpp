@@ -0,0 +1,137 @@
+#include "mapped_memory.hpp"
+#include "dispatch.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+mapped_memory::mapped_memory(VkPhysicalDevice physical_device,
+			     VkDevice device,
+			     VkDeviceMemory memory,
+			     uint32_t memory_type,
+			     VkDeviceSize size)
+  : device(device),
+    memory(memory),
+    size(size),
+    atom_size(1),
+    is_coherent(true),
+    mapped(nullptr),
+    flushed(0),
+    flushes(0)
+{
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physical_device, &props);
+  atom_size = std::max<VkDeviceSize>(props.limits.nonCoherentAtomSize, 1);
+
+  VkPhysicalDeviceMemoryProperties mem_props;
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
+  if (memory_type < mem_props.memoryTypeCount)
+    is_coherent = (mem_props.memoryTypes[memory_type].propertyFlags
+		   & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+  void* data = nullptr;
+  if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data)
+      == VK_SUCCESS)
+    mapped = static_cast<char*>(data);
+}
+
+mapped_memory::~mapped_memory()
+{
+  if (mapped != nullptr)
+    vkUnmapMemory(device, memory);
+}
+
+bool mapped_memory::valid() const
+{
+  return mapped != nullptr;
+}
+
+bool mapped_memory::coherent() const
+{
+  return is_coherent;
+}
+
+char* mapped_memory::data()
+{
+  return mapped;
+}
+
+void mapped_memory::write(VkDeviceSize offset,
+			  const void* src,
+			  VkDeviceSize length)
+{
+  memcpy(mapped + offset, src, length);
+  mark_dirty(offset, length);
+}
+
+void mapped_memory::mark_dirty(VkDeviceSize offset, VkDeviceSize length)
+{
+  if (is_coherent || length == 0)
+    return;
+  range r = {offset / atom_size,
+	     (offset + length + atom_size - 1) / atom_size};
+
+  // Absorb every range r overlaps or touches, then insert it in order
+  auto first = std::lower_bound(dirty.begin(), dirty.end(), r.begin,
+				[](const range& other, VkDeviceSize begin) {
+				  return other.end < begin;
+				});
+  auto last = first;
+  for (; last != dirty.end() && last->begin <= r.end; last++) {
+    r.begin = std::min(r.begin, last->begin);
+    r.end = std::max(r.end, last->end);
+  }
+  first = dirty.erase(first, last);
+  dirty.insert(first, r);
+}
+
+// The last atom may run past the allocation when its size is not a whole
+// number of atoms; VK_WHOLE_SIZE covers it exactly
+VkMappedMemoryRange mapped_memory::mapped_range(const range& r) const
+{
+  VkMappedMemoryRange mapped_range = {};
+  mapped_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  mapped_range.pNext = nullptr;
+  mapped_range.memory = memory;
+  mapped_range.offset = r.begin * atom_size;
+  mapped_range.size = r.end * atom_size >= size ? VK_WHOLE_SIZE
+    : (r.end - r.begin) * atom_size;
+  return mapped_range;
+}
+
+VkResult mapped_memory::flush()
+{
+  if (dirty.empty())
+    return VK_SUCCESS;
+  ranges.clear();
+  for (auto& r : dirty) {
+    ranges.push_back(mapped_range(r));
+    flushed += std::min(r.end * atom_size, size) - r.begin * atom_size;
+  }
+  dirty.clear();
+  flushes++;
+  return vkd.vkFlushMappedMemoryRanges(device,
+				       static_cast<uint32_t>(ranges.size()),
+				       ranges.data());
+}
+
+const char* mapped_memory::read(VkDeviceSize offset, VkDeviceSize length)
+{
+  if (!is_coherent && length != 0) {
+    flush();
+    range r = {offset / atom_size,
+	       (offset + length + atom_size - 1) / atom_size};
+    VkMappedMemoryRange invalidate = mapped_range(r);
+    vkd.vkInvalidateMappedMemoryRanges(device, 1, &invalidate);
+  }
+  return mapped + offset;
+}
+
+VkDeviceSize mapped_memory::flushed_bytes() const
+{
+  return flushed;
+}
+
+uint64_t mapped_memory::flush_count() const
+{
+  return flushes;
+}
@@ -0,0 +1,195 @@
+#include "primitives.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+static uint32_t div_up(uint32_t x, uint32_t y)
+{
+  return (x + y - 1) / y;
+}
+
+static bool supports_subgroups(VkPhysicalDevice physical_device,
+			       uint32_t instance_api_version)
+{
+#ifdef VK_VERSION_1_1
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physical_device, &props);
+  if (instance_api_version < VK_API_VERSION_1_1
+      || props.apiVersion < VK_API_VERSION_1_1)
+    return false;
+
+  VkPhysicalDeviceSubgroupProperties subgroup_props = {};
+  subgroup_props.sType =
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+  subgroup_props.pNext = nullptr;
+
+  VkPhysicalDeviceProperties2 props2 = {};
+  props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  props2.pNext = &subgroup_props;
+  vkGetPhysicalDeviceProperties2(physical_device, &props2);
+
+  VkSubgroupFeatureFlags needed = VK_SUBGROUP_FEATURE_BASIC_BIT
+    | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+  return (subgroup_props.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0
+    && (subgroup_props.supportedOperations & needed) == needed;
+#else
+  return false;
+#endif
+}
+
+gpu_primitives::gpu_primitives(compute_engine& engine,
+			       VkPhysicalDevice physical_device,
+			       uint32_t instance_api_version,
+			       const std::string& shader_dir,
+			       uint32_t max_elements)
+  : engine(engine),
+    use_subgroups(supports_subgroups(physical_device,
+				     instance_api_version)),
+    max_elements(std::max(max_elements, 1u))
+{
+  std::string suffix = use_subgroups ? ".subgroup.comp.spv" : ".comp.spv";
+  reduce_kernel = engine.load_kernel(shader_dir + "/prim_reduce" + suffix,
+				     2, 16);
+  scan_kernel = engine.load_kernel(shader_dir + "/prim_scan" + suffix,
+				   3, 16);
+  scan_add_kernel = engine.load_kernel(shader_dir + "/prim_scan_add"
+				       + suffix, 2, 16);
+  compact_kernel = engine.load_kernel(shader_dir + "/prim_compact" + suffix,
+				      5, 16);
+  radix_count_kernel = engine.load_kernel(shader_dir + "/prim_radix_count"
+					  + suffix, 2, 16);
+  radix_scatter_kernel = engine.load_kernel(shader_dir
+					    + "/prim_radix_scatter" + suffix,
+					    5, 16);
+
+  // The sort scans its digit counts, which can outnumber tiny inputs
+  uint32_t count_size = PRIMITIVES_RADIX
+    * div_up(this->max_elements, PRIMITIVES_WG_SIZE);
+  uint32_t level_size = std::max(this->max_elements, count_size);
+  do {
+    level_size = div_up(level_size, PRIMITIVES_BLOCK);
+    block_sums.push_back(engine.add_buffer(level_size * sizeof(uint32_t),
+					   false));
+  } while (level_size > 1);
+
+  positions = engine.add_buffer(this->max_elements * sizeof(uint32_t), false);
+  sort_keys = engine.add_buffer(2 * this->max_elements * sizeof(uint32_t),
+				false);
+  sort_values = engine.add_buffer(this->max_elements * sizeof(uint32_t),
+				  false);
+  digit_counts = engine.add_buffer(count_size * sizeof(uint32_t), false);
+}
+
+bool gpu_primitives::valid() const
+{
+  uint32_t kernels[] = {reduce_kernel, scan_kernel, scan_add_kernel,
+			compact_kernel, radix_count_kernel,
+			radix_scatter_kernel};
+  for (auto kernel : kernels)
+    if (kernel == COMPUTE_NO_KERNEL)
+      return false;
+
+  for (auto buf : block_sums)
+    if (buf == COMPUTE_NO_BUFFER)
+      return false;
+  return positions != COMPUTE_NO_BUFFER
+    && sort_keys != COMPUTE_NO_BUFFER
+    && sort_values != COMPUTE_NO_BUFFER
+    && digit_counts != COMPUTE_NO_BUFFER;
+}
+
+bool gpu_primitives::subgroups() const
+{
+  return use_subgroups;
+}
+
+void gpu_primitives::dispatch(uint32_t kernel,
+			      const std::vector<uint32_t>& buffers,
+			      uint32_t invocations,
+			      uint32_t n,
+			      uint32_t a,
+			      uint32_t b)
+{
+  uint32_t constants[4] = {n, a, b, 0};
+  engine.dispatch(kernel, buffers, constants, invocations);
+}
+
+void gpu_primitives::reduce(uint32_t in, uint32_t n, uint32_t out)
+{
+  if (n == 0 || n > max_elements)
+    return;
+
+  // Each pass leaves one partial sum per block until a single one is left
+  uint32_t src = in;
+  for (uint32_t level = 0;; level++) {
+    uint32_t blocks = div_up(n, PRIMITIVES_BLOCK);
+    uint32_t dst = blocks == 1 ? out : block_sums[level];
+    dispatch(reduce_kernel, {src, dst}, blocks * PRIMITIVES_WG_SIZE, n);
+    if (blocks == 1)
+      break;
+    src = dst;
+    n = blocks;
+  }
+}
+
+void gpu_primitives::scan_level(uint32_t in,
+				uint32_t out,
+				uint32_t n,
+				bool inclusive,
+				bool flags,
+				uint32_t level)
+{
+  uint32_t blocks = div_up(n, PRIMITIVES_BLOCK);
+  dispatch(scan_kernel, {in, out, block_sums[level]},
+	   blocks * PRIMITIVES_WG_SIZE, n, inclusive ? 1 : 0, flags ? 1 : 0);
+  if (blocks == 1)
+    return;
+
+  // Scan the block totals, then offset every block by its prefix
+  scan_level(block_sums[level], block_sums[level], blocks, false, false,
+	     level + 1);
+  dispatch(scan_add_kernel, {out, block_sums[level]},
+	   blocks * PRIMITIVES_WG_SIZE, n);
+}
+
+void gpu_primitives::scan(uint32_t in, uint32_t out, uint32_t n,
+			  bool inclusive)
+{
+  if (n == 0 || n > max_elements)
+    return;
+  scan_level(in, out, n, inclusive, false, 0);
+}
+
+void gpu_primitives::compact(uint32_t values, uint32_t flags, uint32_t n,
+			     uint32_t out, uint32_t count)
+{
+  if (n == 0 || n > max_elements)
+    return;
+  scan_level(flags, positions, n, false, true, 0);
+  dispatch(compact_kernel, {values, flags, positions, out, count}, n, n);
+}
+
+void gpu_primitives::sort(uint32_t keys, uint32_t values, uint32_t n,
+			  uint32_t key_bits)
+{
+  if (n == 0 || n > max_elements || (key_bits != 32 && key_bits != 64))
+    return;
+
+  uint32_t words = key_bits / 32;
+  uint32_t blocks = div_up(n, PRIMITIVES_WG_SIZE);
+  uint32_t src_keys = keys, src_values = values;
+  uint32_t dst_keys = sort_keys, dst_values = sort_values;
+
+  // An even number of passes leaves the result back in keys and values
+  for (uint32_t shift = 0; shift != key_bits; shift += 4) {
+    dispatch(radix_count_kernel, {src_keys, digit_counts},
+	     blocks * PRIMITIVES_WG_SIZE, n, shift, words);
+    scan_level(digit_counts, digit_counts, PRIMITIVES_RADIX * blocks,
+	       false, false, 0);
+    dispatch(radix_scatter_kernel,
+	     {src_keys, src_values, digit_counts, dst_keys, dst_values},
+	     blocks * PRIMITIVES_WG_SIZE, n, shift, words);
+    std::swap(src_keys, dst_keys);
+    std::swap(src_values, dst_values);
+  }
+}
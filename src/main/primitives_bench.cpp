@@ -0,0 +1,377 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <mutex>
+#include <string>
+#include <chrono>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+#include <vulkan/vulkan.h>
+
+#include "compute_engine.hpp"
+#include "dispatch.hpp"
+#include "primitives.hpp"
+
+#define APP_SHORT_NAME     "VulturePrimitivesBench"
+#define ENGINE_SHORT_NAME  "Vulture"
+
+#define SHADER_DIR         "shaders"
+
+// Element counts benchmarked unless given on the command line
+#define DEFAULT_SIZES      {1 << 16, 1 << 20, 1 << 22}
+#define ITERATIONS         10
+
+VkResult res;
+VkInstance inst;
+uint32_t api_version = VK_API_VERSION_1_0;
+VkPhysicalDevice physical_device;
+uint32_t queue_family_idx = UINT32_MAX;
+VkDevice device;
+VkQueue queue;
+std::mutex queue_mutex;
+std::unique_ptr<compute_engine> engine;
+std::unique_ptr<gpu_primitives> primitives;
+
+// Host visible staging and device local working buffers, sized for the
+// largest run
+uint32_t upload, upload_values, download;
+uint32_t keys, values, flags, out, result;
+
+void create_instance()
+{
+  // vkEnumerateInstanceVersion only exists from Vulkan 1.1 on
+  PFN_vkEnumerateInstanceVersion enumerate_version =
+    (PFN_vkEnumerateInstanceVersion)
+    vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+  if (enumerate_version != nullptr)
+    enumerate_version(&api_version);
+#ifdef VK_API_VERSION_1_1
+  api_version = std::min<uint32_t>(api_version, VK_API_VERSION_1_1);
+#else
+  api_version = VK_API_VERSION_1_0;
+#endif
+
+  VkApplicationInfo app_info = {};
+  app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  app_info.pNext = nullptr;
+  app_info.pApplicationName = APP_SHORT_NAME;
+  app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+  app_info.pEngineName = ENGINE_SHORT_NAME;
+  app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+  app_info.apiVersion = api_version;
+
+  VkInstanceCreateInfo inst_info = {};
+  inst_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  inst_info.pNext = nullptr;
+  inst_info.flags = 0;
+  inst_info.pApplicationInfo = &app_info;
+  inst_info.enabledLayerCount = 0;
+  inst_info.ppEnabledLayerNames = nullptr;
+  inst_info.enabledExtensionCount = 0;
+  inst_info.ppEnabledExtensionNames = nullptr;
+
+  res = vkCreateInstance(&inst_info, nullptr, &inst);
+  if (res != VK_SUCCESS)
+    std::cout << "Instance creation failed..." << std::endl;
+  else
+    load_instance_dispatch(inst);
+}
+
+void create_device()
+{
+  uint32_t count = 1;
+  res = vkEnumeratePhysicalDevices(inst, &count, &physical_device);
+  if ((res != VK_SUCCESS && res != VK_INCOMPLETE) || count == 0) {
+    std::cout << "Failed to find a physical device..." << std::endl;
+    res = VK_ERROR_INITIALIZATION_FAILED;
+    return;
+  }
+
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physical_device, &props);
+  std::cout << "Physical Device: " << props.deviceName << std::endl;
+
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(count);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count,
+					   families.data());
+  for (uint32_t i = 0; i != count && queue_family_idx == UINT32_MAX; i++)
+    if ((families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0)
+      queue_family_idx = i;
+
+  float priority = 1.0f;
+  VkDeviceQueueCreateInfo queue_info = {};
+  queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+  queue_info.pNext = nullptr;
+  queue_info.flags = 0;
+  queue_info.queueFamilyIndex = queue_family_idx;
+  queue_info.queueCount = 1;
+  queue_info.pQueuePriorities = &priority;
+
+  VkDeviceCreateInfo device_info = {};
+  device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  device_info.pNext = nullptr;
+  device_info.flags = 0;
+  device_info.queueCreateInfoCount = 1;
+  device_info.pQueueCreateInfos = &queue_info;
+  device_info.enabledLayerCount = 0;
+  device_info.ppEnabledLayerNames = nullptr;
+  device_info.enabledExtensionCount = 0;
+  device_info.ppEnabledExtensionNames = nullptr;
+  device_info.pEnabledFeatures = nullptr;
+
+  res = vkCreateDevice(physical_device, &device_info, nullptr, &device);
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to create device..." << std::endl;
+    return;
+  }
+  load_device_dispatch(device);
+  vkGetDeviceQueue(device, queue_family_idx, 0, &queue);
+}
+
+void create_buffers(uint32_t max_elements)
+{
+  VkDeviceSize words = 2 * static_cast<VkDeviceSize>(max_elements)
+    * sizeof(uint32_t);
+  upload = engine->add_buffer(words, true);
+  upload_values = engine->add_buffer(words / 2, true);
+  download = engine->add_buffer(words, true);
+  keys = engine->add_buffer(words, false);
+  values = engine->add_buffer(words / 2, false);
+  flags = engine->add_buffer(words / 2, false);
+  out = engine->add_buffer(words / 2, false);
+  result = engine->add_buffer(sizeof(uint32_t), false);
+}
+
+uint32_t* host(uint32_t buf)
+{
+  return static_cast<uint32_t*>(engine->data(buf));
+}
+
+void copy_and_wait(uint32_t src, uint32_t dst, uint32_t words)
+{
+  engine->copy(src, dst, words * sizeof(uint32_t));
+  engine->submit();
+  engine->wait();
+}
+
+double time_ms(const std::function<void()>& work)
+{
+  auto start = std::chrono::steady_clock::now();
+  work();
+  std::chrono::duration<double, std::milli> time =
+    std::chrono::steady_clock::now() - start;
+  return time.count();
+}
+
+// Runs the recorded GPU work ITERATIONS times in one batch
+double time_gpu(const std::function<void()>& record)
+{
+  return time_ms([&]() {
+      for (unsigned int i = 0; i != ITERATIONS; i++)
+	record();
+      engine->submit();
+      engine->wait();
+    });
+}
+
+void report(const char* name, uint32_t n, double gpu_ms, double cpu_ms,
+	    bool ok)
+{
+  double elements = static_cast<double>(n) * ITERATIONS;
+  std::cout << std::left << std::setw(14) << name << std::right
+	    << std::setw(10) << n
+	    << std::fixed << std::setprecision(1)
+	    << std::setw(12) << elements / gpu_ms / 1e3
+	    << std::setw(12) << elements / cpu_ms / 1e3
+	    << std::setw(9) << cpu_ms / gpu_ms << "x"
+	    << (ok ? "" : "  WRONG") << std::endl;
+}
+
+void bench_reduce(uint32_t n, std::mt19937& rng)
+{
+  std::vector<uint32_t> data(n);
+  for (auto& x : data)
+    x = rng() % 1024;
+  std::copy(data.begin(), data.end(), host(upload));
+  copy_and_wait(upload, keys, n);
+
+  double gpu = time_gpu([&]() { primitives->reduce(keys, n, result); });
+  copy_and_wait(result, download, 1);
+
+  uint32_t sum = 0;
+  double cpu = time_ms([&]() {
+      for (unsigned int i = 0; i != ITERATIONS; i++)
+	sum = std::accumulate(data.begin(), data.end(), 0u);
+    });
+  report("reduce", n, gpu, cpu, host(download)[0] == sum);
+}
+
+void bench_scan(uint32_t n, std::mt19937& rng, bool inclusive)
+{
+  std::vector<uint32_t> data(n), expected(n);
+  for (auto& x : data)
+    x = rng() % 1024;
+  std::copy(data.begin(), data.end(), host(upload));
+  copy_and_wait(upload, keys, n);
+
+  double gpu = time_gpu([&]() {
+      primitives->scan(keys, out, n, inclusive);
+    });
+  copy_and_wait(out, download, n);
+
+  double cpu = time_ms([&]() {
+      for (unsigned int i = 0; i != ITERATIONS; i++) {
+	uint32_t sum = 0;
+	for (uint32_t j = 0; j != n; j++) {
+	  expected[j] = inclusive ? sum + data[j] : sum;
+	  sum += data[j];
+	}
+      }
+    });
+  report(inclusive ? "scan (incl)" : "scan (excl)", n, gpu, cpu,
+	 std::equal(expected.begin(), expected.end(), host(download)));
+}
+
+void bench_compact(uint32_t n, std::mt19937& rng)
+{
+  std::vector<uint32_t> data(n), keep(n), expected;
+  for (uint32_t i = 0; i != n; i++) {
+    data[i] = rng();
+    keep[i] = rng() % 4 == 0 ? 1 : 0;
+  }
+  std::copy(data.begin(), data.end(), host(upload));
+  copy_and_wait(upload, values, n);
+  std::copy(keep.begin(), keep.end(), host(upload));
+  copy_and_wait(upload, flags, n);
+
+  double gpu = time_gpu([&]() {
+      primitives->compact(values, flags, n, out, result);
+    });
+  copy_and_wait(result, download, 1);
+  uint32_t count = host(download)[0];
+  copy_and_wait(out, download, n);
+
+  double cpu = time_ms([&]() {
+      for (unsigned int i = 0; i != ITERATIONS; i++) {
+	expected.clear();
+	for (uint32_t j = 0; j != n; j++)
+	  if (keep[j] != 0)
+	    expected.push_back(data[j]);
+      }
+    });
+  report("compact", n, gpu, cpu, count == expected.size()
+	 && std::equal(expected.begin(), expected.end(), host(download)));
+}
+
+void bench_sort(uint32_t n, std::mt19937& rng, uint32_t key_bits)
+{
+  uint32_t words = key_bits / 32;
+  std::vector<std::pair<uint64_t, uint32_t>> pairs(n), expected;
+  for (uint32_t i = 0; i != n; i++) {
+    uint64_t key = rng();
+    if (words == 2)
+      key |= static_cast<uint64_t>(rng()) << 32;
+    pairs[i] = std::make_pair(key, i);
+    for (uint32_t w = 0; w != words; w++)
+      host(upload)[i * words + w] = static_cast<uint32_t>(key >> (32 * w));
+    host(upload_values)[i] = i;
+  }
+
+  // Each sort starts from the same unsorted input; restoring it is not timed
+  double gpu = 0.0;
+  for (unsigned int i = 0; i != ITERATIONS; i++) {
+    engine->copy(upload, keys, n * words * sizeof(uint32_t));
+    engine->copy(upload_values, values, n * sizeof(uint32_t));
+    engine->submit();
+    engine->wait();
+    gpu += time_ms([&]() {
+	primitives->sort(keys, values, n, key_bits);
+	engine->submit();
+	engine->wait();
+      });
+  }
+  copy_and_wait(keys, download, n * words);
+  std::vector<uint32_t> sorted_keys(host(download),
+				    host(download) + n * words);
+  copy_and_wait(values, download, n);
+
+  double cpu = time_ms([&]() {
+      for (unsigned int i = 0; i != ITERATIONS; i++) {
+	expected = pairs;
+	std::stable_sort(expected.begin(), expected.end(),
+			 [](const std::pair<uint64_t, uint32_t>& a,
+			    const std::pair<uint64_t, uint32_t>& b) {
+			   return a.first < b.first;
+			 });
+      }
+    });
+
+  bool ok = true;
+  for (uint32_t i = 0; i != n && ok; i++) {
+    uint64_t key = 0;
+    for (uint32_t w = 0; w != words; w++)
+      key |= static_cast<uint64_t>(sorted_keys[i * words + w]) << (32 * w);
+    ok = key == expected[i].first && host(download)[i] == expected[i].second;
+  }
+  report(key_bits == 32 ? "sort (32 bit)" : "sort (64 bit)", n, gpu, cpu,
+	 ok);
+}
+
+int main(int argc, const char* argv[])
+{
+  std::vector<uint32_t> sizes = DEFAULT_SIZES;
+  if (argc > 1) {
+    sizes.clear();
+    for (int i = 1; i != argc; i++)
+      sizes.push_back(static_cast<uint32_t>(std::stoul(argv[i])));
+  }
+  uint32_t max_elements = *std::max_element(sizes.begin(), sizes.end());
+
+  create_instance();
+  if (res != VK_SUCCESS)
+    return 1;
+  create_device();
+  if (res != VK_SUCCESS)
+    return 1;
+
+  engine.reset(new compute_engine(physical_device, device, queue_family_idx,
+				  queue, queue_mutex, nullptr));
+  primitives.reset(new gpu_primitives(*engine, physical_device, api_version,
+				      SHADER_DIR, max_elements));
+  create_buffers(max_elements);
+  if (!primitives->valid()) {
+    std::cout << "Failed to set up primitives (missing shaders in "
+	      << SHADER_DIR << "?)..." << std::endl;
+    return 1;
+  }
+
+  std::cout << "Subgroup kernels: " << (primitives->subgroups() ? "yes" : "no")
+	    << ", " << ITERATIONS << " iterations" << std::endl;
+  std::cout << std::left << std::setw(14) << "Primitive" << std::right
+	    << std::setw(10) << "Elements" << std::setw(12) << "GPU Me/s"
+	    << std::setw(12) << "CPU Me/s" << std::setw(10) << "Speedup"
+	    << std::endl;
+
+  std::mt19937 rng(1234);
+  for (auto n : sizes) {
+    if (n == 0)
+      continue;
+    bench_reduce(n, rng);
+    bench_scan(n, rng, false);
+    bench_scan(n, rng, true);
+    bench_compact(n, rng);
+    bench_sort(n, rng, 32);
+    bench_sort(n, rng, 64);
+  }
+
+  primitives.reset();
+  engine.reset();
+  vkDestroyDevice(device, nullptr);
+  vkDestroyInstance(inst, nullptr);
+  return 0;
+}
@@ -0,0 +1,209 @@
+#include "queue_scheduler.hpp"
+#include "dispatch.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#define FLAGS_GRAPHICS_COMPUTE (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)
+
+queue_plan plan_queues(const std::vector<VkQueueFamilyProperties>& families,
+		       uint32_t main_family)
+{
+  queue_plan plan;
+  for (uint32_t c = 0; c != QUEUE_CLASS_COUNT; c++)
+    plan.family[c] = main_family;
+
+  for (uint32_t i = 0; i != families.size(); i++) {
+    VkQueueFlags flags = families[i].queueFlags;
+    if (i == main_family || families[i].queueCount == 0)
+      continue;
+    if ((flags & FLAGS_GRAPHICS_COMPUTE) == VK_QUEUE_COMPUTE_BIT
+	&& plan.family[QUEUE_CLASS_COMPUTE] == main_family)
+      plan.family[QUEUE_CLASS_COMPUTE] = i;
+    if ((flags & FLAGS_GRAPHICS_COMPUTE) == 0
+	&& (flags & VK_QUEUE_TRANSFER_BIT) != 0
+	&& plan.family[QUEUE_CLASS_TRANSFER] == main_family)
+      plan.family[QUEUE_CLASS_TRANSFER] = i;
+  }
+
+  for (uint32_t c = 0; c != QUEUE_CLASS_COUNT; c++)
+    if (std::find(plan.families.begin(), plan.families.end(),
+		  plan.family[c]) == plan.families.end())
+      plan.families.push_back(plan.family[c]);
+  return plan;
+}
+
+void queue_create_infos(const queue_plan& plan,
+			const std::vector<VkQueueFamilyProperties>& families,
+			std::vector<float>& priorities,
+			std::vector<VkDeviceQueueCreateInfo>& infos)
+{
+  uint32_t max_count = 0;
+  for (auto family : plan.families)
+    max_count = std::max(max_count, families[family].queueCount);
+  priorities.assign(max_count, 0.0f);
+
+  infos.clear();
+  for (auto family : plan.families) {
+    VkDeviceQueueCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    info.pNext = nullptr;
+    info.flags = 0;
+    info.queueFamilyIndex = family;
+    info.queueCount = families[family].queueCount;
+    info.pQueuePriorities = priorities.data();
+    infos.push_back(info);
+  }
+}
+
+queue_scheduler::queue_scheduler(VkDevice device,
+				 const queue_plan& plan,
+				 const std::vector<scheduled_queue>& queues,
+				 const VkAllocationCallbacks* alloc_callbacks)
+  : device(device),
+    alloc_callbacks(alloc_callbacks),
+    plan(plan),
+    lanes(queues)
+{
+  for (auto& cls : classes)
+    cls.next.store(0, std::memory_order_relaxed);
+
+  uint32_t main_lane = UINT32_MAX;
+  for (uint32_t i = 0; i != lanes.size(); i++)
+    if (lanes[i].family == plan.family[QUEUE_CLASS_MAIN]) {
+      main_lane = i;
+      break;
+    }
+  if (main_lane == UINT32_MAX) {
+    std::cout << "Queue scheduler has no queue of the main family..."
+	      << std::endl;
+    return;
+  }
+  classes[QUEUE_CLASS_MAIN].lanes.push_back(main_lane);
+
+  for (uint32_t c = QUEUE_CLASS_MAIN + 1; c != QUEUE_CLASS_COUNT; c++) {
+    for (uint32_t i = 0; i != lanes.size(); i++)
+      if (i != main_lane && lanes[i].family == plan.family[c])
+	classes[c].lanes.push_back(i);
+    // Sharing a main family that has a single queue
+    if (classes[c].lanes.empty())
+      classes[c].lanes.push_back(main_lane);
+  }
+}
+
+queue_scheduler::~queue_scheduler()
+{
+  for (auto semaphore : free_semaphores)
+    vkDestroySemaphore(device, semaphore, alloc_callbacks);
+  for (auto semaphore : used_semaphores)
+    vkDestroySemaphore(device, semaphore, alloc_callbacks);
+}
+
+uint32_t queue_scheduler::family(queue_class c) const
+{
+  return plan.family[c];
+}
+
+uint32_t queue_scheduler::queue_count(queue_class c) const
+{
+  return static_cast<uint32_t>(classes[c].lanes.size());
+}
+
+bool queue_scheduler::concurrent(queue_class c) const
+{
+  return c != QUEUE_CLASS_MAIN
+    && classes[c].lanes[0] != classes[QUEUE_CLASS_MAIN].lanes[0];
+}
+
+const scheduled_queue& queue_scheduler::pick(queue_class c)
+{
+  lane_set& cls = classes[c];
+  uint32_t n = cls.next.fetch_add(1, std::memory_order_relaxed);
+  return lanes[cls.lanes[n % cls.lanes.size()]];
+}
+
+VkSemaphore queue_scheduler::acquire_semaphore()
+{
+  std::lock_guard<std::mutex> lock(semaphore_mutex);
+  VkSemaphore semaphore = VK_NULL_HANDLE;
+  if (!free_semaphores.empty()) {
+    semaphore = free_semaphores.back();
+    free_semaphores.pop_back();
+  } else {
+    VkSemaphoreCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    info.pNext = nullptr;
+    info.flags = 0;
+    if (vkCreateSemaphore(device, &info, alloc_callbacks, &semaphore)
+	!= VK_SUCCESS) {
+      std::cout << "Failed to create scheduler semaphore..." << std::endl;
+      return VK_NULL_HANDLE;
+    }
+  }
+  used_semaphores.push_back(semaphore);
+  return semaphore;
+}
+
+queue_ticket queue_scheduler::submit(queue_class c,
+				     const VkCommandBuffer* command_buffers,
+				     uint32_t command_buffer_count,
+				     const queue_ticket* waits,
+				     const VkPipelineStageFlags* wait_stages,
+				     uint32_t wait_count,
+				     bool signal,
+				     VkFence fence)
+{
+  const scheduled_queue& q = pick(c);
+  std::vector<VkSemaphore> wait_semaphores;
+  std::vector<VkPipelineStageFlags> stages;
+  for (uint32_t i = 0; i != wait_count; i++) {
+    if (waits[i].semaphore == VK_NULL_HANDLE)
+      continue;
+    if (waits[i].batch != q.batch)
+      waits[i].batch->flush();
+    wait_semaphores.push_back(waits[i].semaphore);
+    stages.push_back(wait_stages[i]);
+  }
+
+  queue_ticket ticket = {q.batch, VK_NULL_HANDLE};
+  if (signal)
+    ticket.semaphore = acquire_semaphore();
+  q.batch->enqueue(command_buffers, command_buffer_count,
+		   wait_semaphores.data(), stages.data(),
+		   static_cast<uint32_t>(wait_semaphores.size()),
+		   &ticket.semaphore,
+		   ticket.semaphore != VK_NULL_HANDLE ? 1 : 0,
+		   fence);
+  return ticket;
+}
+
+VkResult queue_scheduler::flush()
+{
+  VkResult first = VK_SUCCESS;
+  for (auto& lane : lanes) {
+    VkResult res = lane.batch->flush();
+    if (first == VK_SUCCESS)
+      first = res;
+  }
+  return first;
+}
+
+VkResult queue_scheduler::wait_idle()
+{
+  VkResult first = flush();
+  for (auto& lane : lanes) {
+    std::lock_guard<std::mutex> lock(*lane.mutex);
+    VkResult res = vkd.vkQueueWaitIdle(lane.queue);
+    if (first == VK_SUCCESS)
+      first = res;
+  }
+  return first;
+}
+
+void queue_scheduler::end_frame()
+{
+  std::lock_guard<std::mutex> lock(semaphore_mutex);
+  free_semaphores.insert(free_semaphores.end(),
+			 used_semaphores.begin(), used_semaphores.end());
+  used_semaphores.clear();
+}
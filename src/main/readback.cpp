@@ -0,0 +1,344 @@
+#include "readback.hpp"
+#include "dispatch.hpp"
+
+#include <algorithm>
+#include <memory>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static readback_callback fulfil(
+  std::shared_ptr<std::promise<std::vector<char>>> promise)
+{
+  return [promise](const char* data, VkDeviceSize size) {
+    promise->set_value(std::vector<char>(data, data + size));
+  };
+}
+
+readback_ring::readback_ring(VkPhysicalDevice physical_device,
+			     VkDevice device,
+			     VkDeviceSize size,
+			     uint32_t frames_in_flight,
+			     const VkAllocationCallbacks* alloc_callbacks)
+  : device(device),
+    alloc_callbacks(alloc_callbacks),
+    buffer(VK_NULL_HANDLE),
+    memory(VK_NULL_HANDLE),
+    data(nullptr),
+    coherent(false),
+    head(0),
+    tail(0),
+    next_frame(0)
+{
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
+
+  // Image copies need 4 byte aligned offsets, invalidation whole atoms
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physical_device, &props);
+  atom_size = std::max<VkDeviceSize>(props.limits.nonCoherentAtomSize, 16);
+  this->size = align_up(std::max<VkDeviceSize>(size, atom_size), atom_size);
+
+  frames.resize(std::max(frames_in_flight, 1u));
+  VkFenceCreateInfo fence_info = {};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fence_info.pNext = nullptr;
+  fence_info.flags = 0;
+  for (auto& f : frames) {
+    f.fence = VK_NULL_HANDLE;
+    f.end = 0;
+    f.pending = false;
+    vkCreateFence(device, &fence_info, alloc_callbacks, &f.fence);
+  }
+
+  VkBufferCreateInfo buf_info = {};
+  buf_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buf_info.pNext = nullptr;
+  buf_info.flags = 0;
+  buf_info.size = this->size;
+  buf_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buf_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  buf_info.queueFamilyIndexCount = 0;
+  buf_info.pQueueFamilyIndices = nullptr;
+  if (vkCreateBuffer(device, &buf_info, alloc_callbacks, &buffer)
+      != VK_SUCCESS)
+    return;
+
+  VkMemoryRequirements reqs;
+  vkGetBufferMemoryRequirements(device, buffer, &reqs);
+
+  // Cached memory makes reading the results on the CPU much cheaper
+  uint32_t type = find_memory_type(reqs.memoryTypeBits,
+				   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				   VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+  if (type == UINT32_MAX)
+    type = find_memory_type(reqs.memoryTypeBits,
+			    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  if (type == UINT32_MAX)
+    return;
+  coherent = (mem_props.memoryTypes[type].propertyFlags
+	      & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+  VkMemoryAllocateInfo mem_info = {};
+  mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  mem_info.pNext = nullptr;
+  mem_info.allocationSize = reqs.size;
+  mem_info.memoryTypeIndex = type;
+  if (vkAllocateMemory(device, &mem_info, alloc_callbacks, &memory)
+      != VK_SUCCESS)
+    return;
+  if (vkBindBufferMemory(device, buffer, memory, 0) != VK_SUCCESS)
+    return;
+
+  // The ring stays mapped for its lifetime
+  void* mapped;
+  if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped)
+      != VK_SUCCESS)
+    return;
+  data = static_cast<char*>(mapped);
+}
+
+readback_ring::~readback_ring()
+{
+  // Results still in flight are dropped; their futures see broken promises
+  for (auto& f : frames) {
+    if (f.pending)
+      vkd.vkWaitForFences(device, 1, &f.fence, VK_TRUE, UINT64_MAX);
+    if (f.fence != VK_NULL_HANDLE)
+      vkDestroyFence(device, f.fence, alloc_callbacks);
+  }
+
+  if (data != nullptr)
+    vkUnmapMemory(device, memory);
+  vkDestroyBuffer(device, buffer, alloc_callbacks);
+  vkFreeMemory(device, memory, alloc_callbacks);
+}
+
+bool readback_ring::valid() const
+{
+  return data != nullptr;
+}
+
+uint32_t readback_ring::find_memory_type(uint32_t type_bits,
+					 VkMemoryPropertyFlags flags) const
+{
+  for (uint32_t i = 0; i != mem_props.memoryTypeCount; i++)
+    if ((type_bits & (1u << i)) != 0 &&
+	(mem_props.memoryTypes[i].propertyFlags & flags) == flags)
+      return i;
+  return UINT32_MAX;
+}
+
+bool readback_ring::read_buffer(VkBuffer buffer,
+				VkDeviceSize offset,
+				VkDeviceSize size,
+				readback_callback callback)
+{
+  if (!valid() || size == 0 || align_up(size, atom_size) > this->size)
+    return false;
+
+  request req = {};
+  req.buffer = buffer;
+  req.image = VK_NULL_HANDLE;
+  req.buffer_copy.srcOffset = offset;
+  req.buffer_copy.size = size;
+  req.size = size;
+  req.callback = std::move(callback);
+  requests.push_back(std::move(req));
+  return true;
+}
+
+std::future<std::vector<char>> readback_ring::read_buffer(VkBuffer buffer,
+							  VkDeviceSize offset,
+							  VkDeviceSize size)
+{
+  std::shared_ptr<std::promise<std::vector<char>>> promise(
+    new std::promise<std::vector<char>>());
+  std::future<std::vector<char>> result = promise->get_future();
+  read_buffer(buffer, offset, size, fulfil(promise));
+  return result;
+}
+
+bool readback_ring::read_image(VkImage image,
+			       VkImageLayout layout,
+			       const VkBufferImageCopy& region,
+			       VkDeviceSize size,
+			       readback_callback callback)
+{
+  if (!valid() || size == 0 || align_up(size, atom_size) > this->size)
+    return false;
+
+  request req = {};
+  req.buffer = VK_NULL_HANDLE;
+  req.image = image;
+  req.layout = layout;
+  req.image_copy = region;
+  req.image_copy.bufferRowLength = 0;
+  req.image_copy.bufferImageHeight = 0;
+  req.size = size;
+  req.callback = std::move(callback);
+  requests.push_back(std::move(req));
+  return true;
+}
+
+std::future<std::vector<char>> readback_ring::read_image(
+  VkImage image,
+  VkImageLayout layout,
+  const VkBufferImageCopy& region,
+  VkDeviceSize size)
+{
+  std::shared_ptr<std::promise<std::vector<char>>> promise(
+    new std::promise<std::vector<char>>());
+  std::future<std::vector<char>> result = promise->get_future();
+  read_image(image, layout, region, size, fulfil(promise));
+  return result;
+}
+
+bool readback_ring::allocate(VkDeviceSize size, VkDeviceSize& ring_offset)
+{
+  VkDeviceSize needed = align_up(size, atom_size);
+  VkDeviceSize pos = head % this->size;
+
+  // Never split a copy across the end; skip the remainder instead
+  VkDeviceSize padding = pos + needed > this->size ? this->size - pos : 0;
+  if (head + padding + needed - tail > this->size)
+    return false;
+
+  ring_offset = (pos + padding) % this->size;
+  head += padding + needed;
+  return true;
+}
+
+VkFence readback_ring::record(VkCommandBuffer command_buffer)
+{
+  poll();
+
+  frame& f = frames[next_frame];
+  if (requests.empty() || f.pending)
+    return VK_NULL_HANDLE;
+
+  f.requests.clear();
+  while (!requests.empty()) {
+    request& req = requests.front();
+    if (!allocate(req.size, req.ring_offset))
+      break;
+    f.requests.push_back(std::move(req));
+    requests.pop_front();
+  }
+  if (f.requests.empty())
+    return VK_NULL_HANDLE;
+
+  // Whatever produced the data must finish before the copies read it
+  VkMemoryBarrier before = {};
+  before.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  before.pNext = nullptr;
+  before.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  before.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkd.vkCmdPipelineBarrier(command_buffer,
+			   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			   VK_PIPELINE_STAGE_TRANSFER_BIT,
+			   0,
+			   1, &before,
+			   0, nullptr,
+			   0, nullptr);
+
+  for (auto& req : f.requests) {
+    if (req.image == VK_NULL_HANDLE) {
+      req.buffer_copy.dstOffset = req.ring_offset;
+      vkd.vkCmdCopyBuffer(command_buffer, req.buffer, buffer, 1,
+			  &req.buffer_copy);
+    } else {
+      req.image_copy.bufferOffset = req.ring_offset;
+      vkd.vkCmdCopyImageToBuffer(command_buffer, req.image, req.layout, buffer,
+				 1, &req.image_copy);
+    }
+  }
+
+  VkBufferMemoryBarrier after = {};
+  after.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  after.pNext = nullptr;
+  after.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  after.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  after.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  after.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  after.buffer = buffer;
+  after.offset = 0;
+  after.size = VK_WHOLE_SIZE;
+  vkd.vkCmdPipelineBarrier(command_buffer,
+			   VK_PIPELINE_STAGE_TRANSFER_BIT,
+			   VK_PIPELINE_STAGE_HOST_BIT,
+			   0,
+			   0, nullptr,
+			   1, &after,
+			   0, nullptr);
+
+  vkd.vkResetFences(device, 1, &f.fence);
+  f.end = head;
+  f.pending = true;
+  next_frame = (next_frame + 1) % frames.size();
+  return f.fence;
+}
+
+void readback_ring::deliver(frame& f)
+{
+  if (!coherent) {
+    std::vector<VkMappedMemoryRange> ranges(f.requests.size());
+    for (unsigned int i = 0; i != ranges.size(); i++) {
+      ranges[i].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+      ranges[i].pNext = nullptr;
+      ranges[i].memory = memory;
+      ranges[i].offset = f.requests[i].ring_offset;
+      ranges[i].size = align_up(f.requests[i].size, atom_size);
+    }
+    vkd.vkInvalidateMappedMemoryRanges(device,
+				       static_cast<uint32_t>(ranges.size()),
+				       ranges.data());
+  }
+
+  for (auto& req : f.requests)
+    if (req.callback)
+      req.callback(data + req.ring_offset, req.size);
+
+  f.requests.clear();
+  f.pending = false;
+  tail = f.end;
+}
+
+void readback_ring::poll()
+{
+  // Frames finish in submission order, which starts at the next slot
+  for (uint32_t i = 0; i != frames.size(); i++) {
+    frame& f = frames[(next_frame + i) % frames.size()];
+    if (!f.pending)
+      continue;
+    if (vkd.vkGetFenceStatus(device, f.fence) != VK_SUCCESS)
+      break;
+    deliver(f);
+  }
+}
+
+void readback_ring::flush()
+{
+  for (uint32_t i = 0; i != frames.size(); i++) {
+    frame& f = frames[(next_frame + i) % frames.size()];
+    if (!f.pending)
+      continue;
+    vkd.vkWaitForFences(device, 1, &f.fence, VK_TRUE, UINT64_MAX);
+    deliver(f);
+  }
+}
+
+uint32_t readback_ring::queued() const
+{
+  return static_cast<uint32_t>(requests.size());
+}
+
+uint32_t readback_ring::in_flight() const
+{
+  uint32_t count = 0;
+  for (auto& f : frames)
+    if (f.pending)
+      count++;
+  return count;
+}
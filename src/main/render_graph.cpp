@@ -0,0 +1,582 @@
+#include "render_graph.hpp"
+#include "dispatch.hpp"
+
+static const rg_access_info access_infos[] = {
+  // RG_TRANSFER_READ
+  {VK_PIPELINE_STAGE_TRANSFER_BIT,
+   VK_ACCESS_TRANSFER_READ_BIT,
+   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false},
+  // RG_TRANSFER_WRITE
+  {VK_PIPELINE_STAGE_TRANSFER_BIT,
+   VK_ACCESS_TRANSFER_WRITE_BIT,
+   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true},
+  // RG_COLOR_ATTACHMENT_WRITE
+  {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+   VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+   VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true},
+  // RG_DEPTH_STENCIL_ATTACHMENT_WRITE
+  {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+   | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+   VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+   | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+   VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true},
+  // RG_FRAGMENT_SHADER_READ
+  {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+   VK_ACCESS_SHADER_READ_BIT,
+   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false},
+  // RG_COMPUTE_SHADER_READ
+  {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+   VK_ACCESS_SHADER_READ_BIT,
+   VK_IMAGE_LAYOUT_GENERAL, false},
+  // RG_COMPUTE_SHADER_WRITE
+  {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+   VK_ACCESS_SHADER_WRITE_BIT,
+   VK_IMAGE_LAYOUT_GENERAL, true},
+  // RG_VERTEX_BUFFER_READ
+  {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+   VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+   VK_IMAGE_LAYOUT_UNDEFINED, false},
+  // RG_INDEX_BUFFER_READ
+  {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+   VK_ACCESS_INDEX_READ_BIT,
+   VK_IMAGE_LAYOUT_UNDEFINED, false},
+  // RG_INDIRECT_BUFFER_READ
+  {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+   VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+   VK_IMAGE_LAYOUT_UNDEFINED, false},
+  // RG_UNIFORM_BUFFER_READ
+  {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+   | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+   VK_ACCESS_UNIFORM_READ_BIT,
+   VK_IMAGE_LAYOUT_UNDEFINED, false},
+  // RG_COMPUTE_UNIFORM_BUFFER_READ
+  {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+   VK_ACCESS_UNIFORM_READ_BIT,
+   VK_IMAGE_LAYOUT_UNDEFINED, false},
+  // RG_HOST_READ
+  {VK_PIPELINE_STAGE_HOST_BIT,
+   VK_ACCESS_HOST_READ_BIT,
+   VK_IMAGE_LAYOUT_GENERAL, false},
+  // RG_HOST_WRITE
+  {VK_PIPELINE_STAGE_HOST_BIT,
+   VK_ACCESS_HOST_WRITE_BIT,
+   VK_IMAGE_LAYOUT_GENERAL, true}
+};
+
+const rg_access_info& get_access_info(rg_access access)
+{
+  return access_infos[access];
+}
+
+render_graph::render_graph()
+  : culled(0),
+    barriers(0),
+    async_enabled(false),
+    main_family(VK_QUEUE_FAMILY_IGNORED),
+    async_family(VK_QUEUE_FAMILY_IGNORED),
+    async_min_ms(0.0),
+    async_passes(0)
+{
+}
+
+uint32_t render_graph::add_image(VkImage image,
+				 VkImageAspectFlags aspect,
+				 VkImageLayout initial_layout,
+				 VkPipelineStageFlags initial_stages)
+{
+  resource_state res = {};
+  res.is_image = true;
+  res.image = image;
+  res.aspect = aspect;
+  res.initial_layout = initial_layout;
+  res.initial_stages = initial_stages;
+  reset_state(res);
+  resources.push_back(res);
+  return resources.size() - 1;
+}
+
+uint32_t render_graph::add_buffer(VkBuffer buffer)
+{
+  resource_state res = {};
+  res.is_image = false;
+  res.buffer = buffer;
+  res.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  res.initial_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  reset_state(res);
+  resources.push_back(res);
+  return resources.size() - 1;
+}
+
+void render_graph::export_image(uint32_t resource,
+				VkImageLayout layout,
+				VkPipelineStageFlags stages,
+				VkAccessFlags access)
+{
+  resource_state& res = resources[resource];
+  res.exported = true;
+  res.export_layout = layout;
+  res.export_stages = stages;
+  res.export_access = access;
+}
+
+uint32_t render_graph::add_pass(const std::string& name,
+				std::function<void(VkCommandBuffer)> record)
+{
+  pass p;
+  p.name = name;
+  p.record = record;
+  p.side_effect = false;
+  p.culled = false;
+  p.async = false;
+  p.on_async = false;
+  passes.push_back(p);
+  return passes.size() - 1;
+}
+
+void render_graph::read(uint32_t pass, uint32_t resource, rg_access access)
+{
+  add_use(passes[pass], resource, get_access_info(access), true);
+}
+
+void render_graph::write(uint32_t pass, uint32_t resource, rg_access access)
+{
+  rg_access_info info = get_access_info(access);
+  info.write = true;
+  add_use(passes[pass], resource, info, false);
+}
+
+void render_graph::set_side_effect(uint32_t pass)
+{
+  passes[pass].side_effect = true;
+}
+
+void render_graph::set_async_queue(uint32_t main_family,
+				   uint32_t async_family,
+				   double min_ms,
+				   std::function<bool(const std::string&,
+						      double&)> timing)
+{
+  async_enabled = true;
+  this->main_family = main_family;
+  this->async_family = async_family;
+  async_min_ms = min_ms;
+  async_timing = timing;
+}
+
+void render_graph::set_async(uint32_t pass)
+{
+  passes[pass].async = true;
+}
+
+void render_graph::add_use(pass& p,
+			   uint32_t resource,
+			   const rg_access_info& info,
+			   bool is_read)
+{
+  // One entry per resource and pass, so a read-modify-write pass gets a
+  // single barrier covering both accesses
+  for (auto& use : p.uses)
+    if (use.resource == resource) {
+      if (use.info.layout != info.layout)
+	use.info.layout = VK_IMAGE_LAYOUT_GENERAL;
+      use.info.stages |= info.stages;
+      use.info.access |= info.access;
+      use.info.write = use.info.write || info.write;
+      use.read = use.read || is_read;
+      return;
+    }
+
+  resource_use use;
+  use.resource = resource;
+  use.info = info;
+  use.read = is_read;
+  p.uses.push_back(use);
+}
+
+void render_graph::compile()
+{
+  // Walk backwards from the exported resources and side effects. A pass
+  // survives if something later consumes what it writes; a surviving
+  // pass that overwrites a resource without reading it ends the interest
+  // in earlier writers of that resource.
+  std::vector<bool> needed(resources.size(), false);
+  for (size_t i = 0; i != resources.size(); i++)
+    needed[i] = resources[i].exported;
+
+  culled = 0;
+  for (size_t i = passes.size(); i-- != 0;) {
+    pass& p = passes[i];
+    bool live = p.side_effect;
+    for (auto& use : p.uses)
+      if (use.info.write && needed[use.resource])
+	live = true;
+
+    p.culled = !live;
+    if (!live) {
+      culled++;
+      continue;
+    }
+
+    for (auto& use : p.uses)
+      if (use.info.write && !use.read)
+	needed[use.resource] = false;
+    for (auto& use : p.uses)
+      if (use.read)
+	needed[use.resource] = true;
+  }
+
+  // A pass goes async only if no main pass before it touches its
+  // resources this frame. Main passes after it wait for the async queue,
+  // so resources move over at most once and back at most once per frame.
+  // Async passes are not timed, so the measurement that moved a pass
+  // stays the one it is judged by.
+  async_passes = 0;
+  std::vector<bool> main_touched(resources.size(), false);
+  for (auto& p : passes) {
+    p.on_async = false;
+    if (p.culled)
+      continue;
+
+    if (async_enabled && p.async && async_timing) {
+      double ms = 0.0;
+      bool go = async_timing(p.name, ms) && ms >= async_min_ms;
+      for (auto& use : p.uses)
+	if (main_touched[use.resource] || resources[use.resource].exported)
+	  go = false;
+      p.on_async = go;
+    }
+
+    if (p.on_async)
+      async_passes++;
+    else
+      for (auto& use : p.uses)
+	main_touched[use.resource] = true;
+  }
+}
+
+void render_graph::execute(VkCommandBuffer command_buffer)
+{
+  for (auto& p : passes) {
+    if (p.culled)
+      continue;
+
+    barrier_batch batch = {};
+    for (auto& use : p.uses) {
+      transition(resources[use.resource], use.info, batch);
+      resources[use.resource].used = true;
+    }
+    flush(command_buffer, batch);
+
+    p.record(command_buffer);
+  }
+
+  export_resources(command_buffer);
+}
+
+void render_graph::execute(VkCommandBuffer prologue_command_buffer,
+			   VkCommandBuffer command_buffer,
+			   VkCommandBuffer async_command_buffer,
+			   rg_async_split& split)
+{
+  split = {};
+
+  // Async passes first, taking over what they use from the main family
+  barrier_batch releases = {};
+  for (auto& p : passes) {
+    if (p.culled || !p.on_async)
+      continue;
+
+    barrier_batch batch = {};
+    for (auto& use : p.uses) {
+      resource_state& res = resources[use.resource];
+      if (!res.async_owned) {
+	if (hand_over(res, use, main_family, async_family, releases, batch))
+	  split.async_wait_stages |= use.info.stages;
+	res.async_owned = true;
+      } else
+	transition(res, use.info, batch);
+      res.used = true;
+    }
+    flush(async_command_buffer, batch);
+
+    p.record(async_command_buffer);
+    split.async = true;
+  }
+  split.prologue = releases.src_stages != 0;
+  flush(prologue_command_buffer, releases);
+
+  // Main passes take back what async passes of this or earlier frames
+  // left on the async family
+  releases = {};
+  for (auto& p : passes) {
+    if (p.culled || p.on_async)
+      continue;
+
+    barrier_batch batch = {};
+    for (auto& use : p.uses) {
+      resource_state& res = resources[use.resource];
+      if (res.async_owned) {
+	hand_over(res, use, async_family, main_family, releases, batch);
+	split.main_wait_stages |= use.info.stages;
+	res.async_owned = false;
+      } else
+	transition(res, use.info, batch);
+      res.used = true;
+    }
+    flush(command_buffer, batch);
+
+    p.record(command_buffer);
+  }
+  if (releases.src_stages != 0) {
+    flush(async_command_buffer, releases);
+    split.async = true;
+  }
+  // Nothing on the main queue consumes the async work, but the frame is
+  // not done before it is
+  if (split.async && split.main_wait_stages == 0)
+    split.main_wait_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+  export_resources(command_buffer);
+}
+
+void render_graph::export_resources(VkCommandBuffer command_buffer)
+{
+  // Hand exported images over in one final batch. Untouched ones may
+  // still belong to the presentation engine, so leave them alone.
+  barrier_batch batch = {};
+  for (auto& res : resources) {
+    if (!res.exported || !res.used)
+      continue;
+
+    rg_access_info info = {res.export_stages,
+			   res.export_access,
+			   res.export_layout,
+			   false};
+    transition(res, info, batch);
+    reset_state(res);
+  }
+  flush(command_buffer, batch);
+}
+
+void render_graph::clear_passes()
+{
+  passes.clear();
+  culled = 0;
+}
+
+uint32_t render_graph::pass_count() const
+{
+  return passes.size();
+}
+
+uint32_t render_graph::culled_pass_count() const
+{
+  return culled;
+}
+
+uint32_t render_graph::async_pass_count() const
+{
+  return async_passes;
+}
+
+uint32_t render_graph::barrier_count() const
+{
+  return barriers;
+}
+
+void render_graph::reset_state(resource_state& res)
+{
+  res.layout = res.initial_layout;
+  // Top of pipe means there is nothing to wait for
+  res.write_stages = res.initial_stages == VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+    ? 0 : res.initial_stages;
+  res.write_access = 0;
+  res.read_stages = 0;
+  res.visible_stages = 0;
+  res.visible_access = 0;
+  res.used = false;
+}
+
+void render_graph::transition(resource_state& res,
+			      const rg_access_info& info,
+			      barrier_batch& batch)
+{
+  VkImageLayout layout = res.is_image ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+  bool layout_change = res.is_image && layout != res.layout;
+
+  if (info.write || layout_change) {
+    // Writes and layout transitions wait for every earlier access, but
+    // only earlier writes need to be made available
+    VkPipelineStageFlags src_stages = res.write_stages | res.read_stages;
+    if (src_stages != 0 || layout_change) {
+      batch.src_stages |= src_stages != 0
+	? src_stages
+	: static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+      batch.dst_stages |= info.stages;
+      if (res.is_image)
+	add_image_barrier(res, res.write_access, info.access, layout, batch);
+      else {
+	batch.src_memory_access |= res.write_access;
+	batch.dst_memory_access |= info.access;
+      }
+    }
+
+    res.layout = layout;
+    // A layout transition is itself a write that later readers in other
+    // stages have to wait for
+    res.write_stages = info.stages;
+    res.write_access = info.write ? info.access : 0;
+    res.read_stages = info.write ? 0 : info.stages;
+    res.visible_stages = info.stages;
+    res.visible_access = info.access;
+    return;
+  }
+
+  // Reads in the same layout only need a barrier the first time a stage or
+  // access type sees the last write
+  if (res.write_stages != 0
+      && ((info.stages & ~res.visible_stages) != 0
+	  || (info.access & ~res.visible_access) != 0)) {
+    batch.src_stages |= res.write_stages;
+    batch.dst_stages |= info.stages;
+    if (res.is_image)
+      add_image_barrier(res, res.write_access, info.access, layout, batch);
+    else {
+      batch.src_memory_access |= res.write_access;
+      batch.dst_memory_access |= info.access;
+    }
+    res.visible_stages |= info.stages;
+    res.visible_access |= info.access;
+  }
+  res.read_stages |= info.stages;
+}
+
+// Moves a resource between queue families: a release on the queue that
+// owns it and a matching acquire where it is used next, ordered by the
+// semaphore between the two submissions. Returns whether a release was
+// needed. Contents that the use overwrites need not survive, and within
+// one family the semaphore alone makes earlier writes visible, so those
+// only keep a layout transition on the acquiring side.
+bool render_graph::hand_over(resource_state& res,
+			     const resource_use& use,
+			     uint32_t src_family,
+			     uint32_t dst_family,
+			     barrier_batch& releases,
+			     barrier_batch& acquires)
+{
+  const rg_access_info& info = use.info;
+  VkImageLayout layout = res.is_image ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+  bool discard = info.write && !use.read;
+  bool transfer = !discard && src_family != dst_family;
+  if (discard)
+    res.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  if (!transfer) {
+    src_family = VK_QUEUE_FAMILY_IGNORED;
+    dst_family = VK_QUEUE_FAMILY_IGNORED;
+  }
+
+  if (transfer) {
+    VkPipelineStageFlags src_stages = res.write_stages | res.read_stages;
+    releases.src_stages |= src_stages != 0
+      ? src_stages
+      : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    releases.dst_stages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    if (res.is_image)
+      add_image_barrier(res, res.write_access, 0, layout, releases,
+			src_family, dst_family);
+    else
+      add_buffer_barrier(res, res.write_access, 0, src_family, dst_family,
+			 releases);
+  }
+
+  if (transfer || (res.is_image && layout != res.layout)) {
+    acquires.src_stages |= VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    acquires.dst_stages |= info.stages;
+    if (res.is_image)
+      add_image_barrier(res, 0, info.access, layout, acquires,
+			src_family, dst_family);
+    else
+      add_buffer_barrier(res, 0, info.access, src_family, dst_family,
+			 acquires);
+  }
+
+  res.layout = layout;
+  res.write_stages = info.stages;
+  res.write_access = info.write ? info.access : 0;
+  res.read_stages = info.write ? 0 : info.stages;
+  res.visible_stages = info.stages;
+  res.visible_access = info.access;
+  return transfer;
+}
+
+void render_graph::add_image_barrier(resource_state& res,
+				     VkAccessFlags src_access,
+				     VkAccessFlags dst_access,
+				     VkImageLayout new_layout,
+				     barrier_batch& batch,
+				     uint32_t src_family,
+				     uint32_t dst_family)
+{
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+  barrier.oldLayout = res.layout;
+  barrier.newLayout = new_layout;
+  barrier.srcQueueFamilyIndex = src_family;
+  barrier.dstQueueFamilyIndex = dst_family;
+  barrier.image = res.image;
+  barrier.subresourceRange.aspectMask = res.aspect;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+  batch.image_barriers.push_back(barrier);
+}
+
+void render_graph::add_buffer_barrier(resource_state& res,
+				      VkAccessFlags src_access,
+				      VkAccessFlags dst_access,
+				      uint32_t src_family,
+				      uint32_t dst_family,
+				      barrier_batch& batch)
+{
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+  barrier.srcQueueFamilyIndex = src_family;
+  barrier.dstQueueFamilyIndex = dst_family;
+  barrier.buffer = res.buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  batch.buffer_barriers.push_back(barrier);
+}
+
+void render_graph::flush(VkCommandBuffer command_buffer, barrier_batch& batch)
+{
+  if (batch.src_stages == 0)
+    return;
+
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.pNext = nullptr;
+  memory_barrier.srcAccessMask = batch.src_memory_access;
+  memory_barrier.dstAccessMask = batch.dst_memory_access;
+  bool has_memory_barrier = batch.src_memory_access != 0
+    || batch.dst_memory_access != 0;
+
+  vkd.vkCmdPipelineBarrier(command_buffer,
+			   batch.src_stages,
+			   batch.dst_stages,
+			   0,
+			   has_memory_barrier ? 1 : 0,
+			   has_memory_barrier ? &memory_barrier : nullptr,
+			   batch.buffer_barriers.size(),
+			   batch.buffer_barriers.data(),
+			   batch.image_barriers.size(),
+			   batch.image_barriers.data());
+  barriers++;
+}
@@ -0,0 +1,666 @@
+#include "stream_compute.hpp"
+#include "compute_engine.hpp"
+#include "dispatch.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+stream_compute::stream_compute(VkPhysicalDevice physical_device,
+			       VkDevice device,
+			       const stream_queue& upload,
+			       const stream_queue& compute,
+			       const stream_queue& download,
+			       VkDeviceSize chunk_size,
+			       uint32_t depth,
+			       const VkAllocationCallbacks* alloc_callbacks)
+  : device(device),
+    upload_queue(upload),
+    compute_queue(compute),
+    download_queue(download),
+    alloc_callbacks(alloc_callbacks),
+    chunk_size(chunk_size),
+    ready(true),
+    upload_pool(VK_NULL_HANDLE),
+    compute_pool(VK_NULL_HANDLE),
+    download_pool(VK_NULL_HANDLE),
+    descriptor_pool(VK_NULL_HANDLE),
+    set_layout(VK_NULL_HANDLE),
+    module(VK_NULL_HANDLE),
+    layout(VK_NULL_HANDLE),
+    pipeline(VK_NULL_HANDLE),
+    in_element_size(0),
+    out_element_size(0),
+    chunks(0),
+    in_bytes(0),
+    out_bytes(0)
+{
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physical_device, &props);
+  limits = props.limits;
+  // A slot is only waited on when it comes round again, after the next
+  // chunk has started, so a single slot would be reused while in flight
+  depth = std::max(2u, std::min(depth,
+				static_cast<uint32_t>(STREAM_MAX_DEPTH)));
+
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  VkCommandPool* pools[3] = {&upload_pool, &compute_pool, &download_pool};
+  uint32_t families[3] = {upload.family, compute.family, download.family};
+  for (unsigned int i = 0; i != 3; i++) {
+    pool_info.queueFamilyIndex = families[i];
+    if (vkCreateCommandPool(device, &pool_info, alloc_callbacks, pools[i])
+	!= VK_SUCCESS) {
+      std::cout << "Failed to create stream command pool..." << std::endl;
+      ready = false;
+    }
+  }
+
+  VkDescriptorSetLayoutBinding bindings[2] = {};
+  for (uint32_t i = 0; i != 2; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[i].pImmutableSamplers = nullptr;
+  }
+  VkDescriptorSetLayoutCreateInfo set_layout_info = {};
+  set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_layout_info.pNext = nullptr;
+  set_layout_info.flags = 0;
+  set_layout_info.bindingCount = 2;
+  set_layout_info.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(device, &set_layout_info, alloc_callbacks,
+				  &set_layout) != VK_SUCCESS)
+    ready = false;
+
+  VkDescriptorPoolSize pool_size = {};
+  pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_size.descriptorCount = 2 * depth;
+  VkDescriptorPoolCreateInfo desc_pool_info = {};
+  desc_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  desc_pool_info.pNext = nullptr;
+  desc_pool_info.flags = 0;
+  desc_pool_info.maxSets = depth;
+  desc_pool_info.poolSizeCount = 1;
+  desc_pool_info.pPoolSizes = &pool_size;
+  if (vkCreateDescriptorPool(device, &desc_pool_info, alloc_callbacks,
+			     &descriptor_pool) != VK_SUCCESS)
+    ready = false;
+  if (!ready)
+    return;
+
+  slots.resize(depth);
+  for (auto& s : slots) {
+    std::memset(&s, 0, sizeof(s));
+
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.pNext = nullptr;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = 1;
+    VkCommandBuffer* cmds[3] = {&s.upload_cmd, &s.compute_cmd,
+				&s.download_cmd};
+    for (unsigned int i = 0; i != 3; i++) {
+      alloc_info.commandPool = *pools[i];
+      if (vkAllocateCommandBuffers(device, &alloc_info, cmds[i])
+	  != VK_SUCCESS)
+	ready = false;
+    }
+
+    VkDescriptorSetAllocateInfo set_info = {};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.pNext = nullptr;
+    set_info.descriptorPool = descriptor_pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &set_layout;
+    if (vkd.vkAllocateDescriptorSets(device, &set_info, &s.set) != VK_SUCCESS)
+      ready = false;
+
+    VkSemaphoreCreateInfo sem_info = {};
+    sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    sem_info.pNext = nullptr;
+    sem_info.flags = 0;
+    if (vkCreateSemaphore(device, &sem_info, alloc_callbacks, &s.uploaded)
+	!= VK_SUCCESS
+	|| vkCreateSemaphore(device, &sem_info, alloc_callbacks, &s.computed)
+	!= VK_SUCCESS)
+      ready = false;
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = 0;
+    if (vkCreateFence(device, &fence_info, alloc_callbacks, &s.done)
+	!= VK_SUCCESS)
+      ready = false;
+  }
+  if (!ready)
+    std::cout << "Failed to create stream slots..." << std::endl;
+}
+
+// Only downloads carry a fence; after a failed run uploads and kernels
+// may still be running without one, so the queues are drained instead
+void stream_compute::wait_idle()
+{
+  const stream_queue* queues[3] = {&upload_queue, &compute_queue,
+				   &download_queue};
+  for (unsigned int i = 0; i != 3; i++) {
+    if (queues[i]->queue == VK_NULL_HANDLE)
+      continue;
+    std::lock_guard<std::mutex> lock(*queues[i]->mutex);
+    vkd.vkQueueWaitIdle(queues[i]->queue);
+  }
+  for (auto& s : slots)
+    s.pending = false;
+}
+
+stream_compute::~stream_compute()
+{
+  wait_idle();
+  for (auto& s : slots) {
+    vkDestroyFence(device, s.done, alloc_callbacks);
+    vkDestroySemaphore(device, s.uploaded, alloc_callbacks);
+    vkDestroySemaphore(device, s.computed, alloc_callbacks);
+
+    VkBuffer bufs[4] = {s.in_staging, s.in, s.out, s.out_staging};
+    VkDeviceMemory mems[4] = {s.in_staging_memory, s.in_memory,
+			      s.out_memory, s.out_staging_memory};
+    for (unsigned int i = 0; i != 4; i++) {
+      vkDestroyBuffer(device, bufs[i], alloc_callbacks);
+      vkFreeMemory(device, mems[i], alloc_callbacks);
+    }
+  }
+
+  // Destroying the pools frees their command buffers and sets
+  vkDestroyCommandPool(device, upload_pool, alloc_callbacks);
+  vkDestroyCommandPool(device, compute_pool, alloc_callbacks);
+  vkDestroyCommandPool(device, download_pool, alloc_callbacks);
+  vkDestroyDescriptorPool(device, descriptor_pool, alloc_callbacks);
+
+  vkDestroyPipeline(device, pipeline, alloc_callbacks);
+  vkDestroyPipelineLayout(device, layout, alloc_callbacks);
+  vkDestroyDescriptorSetLayout(device, set_layout, alloc_callbacks);
+  vkDestroyShaderModule(device, module, alloc_callbacks);
+}
+
+uint32_t stream_compute::find_memory_type(uint32_t type_bits,
+					  VkMemoryPropertyFlags flags) const
+{
+  for (uint32_t i = 0; i != mem_props.memoryTypeCount; i++)
+    if ((type_bits & (1u << i)) != 0 &&
+	(mem_props.memoryTypes[i].propertyFlags & flags) == flags)
+      return i;
+  return UINT32_MAX;
+}
+
+// Buffers used by more than one queue family are shared concurrently so
+// no ownership transfers are needed between the stages
+bool stream_compute::create_buffer(VkDeviceSize size,
+				   VkBufferUsageFlags usage,
+				   VkMemoryPropertyFlags flags,
+				   const std::vector<uint32_t>& families,
+				   VkBuffer& buffer,
+				   VkDeviceMemory& memory,
+				   void** data)
+{
+  std::vector<uint32_t> unique(families);
+  std::sort(unique.begin(), unique.end());
+  unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+  VkBufferCreateInfo buf_info = {};
+  buf_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buf_info.pNext = nullptr;
+  buf_info.flags = 0;
+  buf_info.size = size;
+  buf_info.usage = usage;
+  if (unique.size() > 1) {
+    buf_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    buf_info.queueFamilyIndexCount = static_cast<uint32_t>(unique.size());
+    buf_info.pQueueFamilyIndices = unique.data();
+  } else {
+    buf_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buf_info.queueFamilyIndexCount = 0;
+    buf_info.pQueueFamilyIndices = nullptr;
+  }
+  if (vkCreateBuffer(device, &buf_info, alloc_callbacks, &buffer)
+      != VK_SUCCESS) {
+    std::cout << "Failed to create stream buffer (" << size << " bytes)..."
+	      << std::endl;
+    return false;
+  }
+
+  VkMemoryRequirements reqs;
+  vkGetBufferMemoryRequirements(device, buffer, &reqs);
+
+  VkMemoryAllocateInfo mem_info = {};
+  mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  mem_info.pNext = nullptr;
+  mem_info.allocationSize = reqs.size;
+  mem_info.memoryTypeIndex = find_memory_type(reqs.memoryTypeBits, flags);
+  // Cached readback memory is only a preference
+  if (mem_info.memoryTypeIndex == UINT32_MAX)
+    mem_info.memoryTypeIndex =
+      find_memory_type(reqs.memoryTypeBits,
+		       flags & ~VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+  if (mem_info.memoryTypeIndex == UINT32_MAX && data == nullptr)
+    mem_info.memoryTypeIndex = find_memory_type(reqs.memoryTypeBits, 0);
+  if (mem_info.memoryTypeIndex == UINT32_MAX
+      || vkAllocateMemory(device, &mem_info, alloc_callbacks, &memory)
+      != VK_SUCCESS) {
+    std::cout << "Failed to allocate stream buffer memory (" << size
+	      << " bytes)..." << std::endl;
+    return false;
+  }
+  vkBindBufferMemory(device, buffer, memory, 0);
+
+  if (data != nullptr
+      && vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, data)
+      != VK_SUCCESS) {
+    std::cout << "Failed to map stream buffer memory..." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool stream_compute::load_kernel(const std::string& filename,
+				 uint32_t in_element_size,
+				 uint32_t out_element_size,
+				 const void* push_constants,
+				 uint32_t push_constant_size)
+{
+  if (!ready || pipeline != VK_NULL_HANDLE || in_element_size == 0
+      || out_element_size == 0 || chunk_size < in_element_size)
+    return false;
+
+  std::ifstream is(filename,
+		   std::ios::binary | std::ios::in | std::ios::ate);
+  if (!is.is_open()) {
+    std::cout << "Failed to read stream kernel file: " << filename << "..."
+	      << std::endl;
+    return false;
+  }
+  auto size = is.tellg();
+  is.seekg(0, std::ios::beg);
+  std::vector<uint32_t> spirv(size / sizeof(uint32_t));
+  is.read(reinterpret_cast<char*>(spirv.data()),
+	  spirv.size() * sizeof(uint32_t));
+
+  if (!spirv_local_size(spirv, local_size)
+      || local_size[0] == 0
+      || local_size[0] > limits.maxComputeWorkGroupSize[0]
+      || local_size[1] != 1 || local_size[2] != 1) {
+    std::cout << "Stream kernels need a one dimensional local size..."
+	      << std::endl;
+    return false;
+  }
+  if (COMPUTE_HEADER_SIZE + push_constant_size > limits.maxPushConstantsSize) {
+    std::cout << "Stream kernel needs too many push constants..."
+	      << std::endl;
+    return false;
+  }
+
+  VkShaderModuleCreateInfo module_info = {};
+  module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  module_info.pNext = nullptr;
+  module_info.flags = 0;
+  module_info.codeSize = spirv.size() * sizeof(uint32_t);
+  module_info.pCode = spirv.data();
+  if (vkCreateShaderModule(device, &module_info, alloc_callbacks, &module)
+      != VK_SUCCESS) {
+    std::cout << "Failed to create stream kernel module..." << std::endl;
+    return false;
+  }
+
+  VkPushConstantRange range = {};
+  range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  range.offset = 0;
+  range.size = COMPUTE_HEADER_SIZE + push_constant_size;
+
+  VkPipelineLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_info.pNext = nullptr;
+  layout_info.flags = 0;
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &set_layout;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &range;
+  vkCreatePipelineLayout(device, &layout_info, alloc_callbacks, &layout);
+
+  VkComputePipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.pNext = nullptr;
+  pipeline_info.flags = 0;
+  pipeline_info.stage.sType =
+    VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipeline_info.stage.pNext = nullptr;
+  pipeline_info.stage.flags = 0;
+  pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipeline_info.stage.module = module;
+  pipeline_info.stage.pName = "main";
+  pipeline_info.stage.pSpecializationInfo = nullptr;
+  pipeline_info.layout = layout;
+  pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+  pipeline_info.basePipelineIndex = -1;
+  if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipeline_info,
+			       alloc_callbacks, &pipeline) != VK_SUCCESS) {
+    std::cout << "Failed to create stream kernel pipeline..." << std::endl;
+    pipeline = VK_NULL_HANDLE;
+    return false;
+  }
+
+  this->in_element_size = in_element_size;
+  this->out_element_size = out_element_size;
+  chunk_size = std::min<VkDeviceSize>(chunk_size,
+				      static_cast<VkDeviceSize>(UINT32_MAX)
+				      * in_element_size);
+  chunk_size -= chunk_size % in_element_size;
+  const char* bytes = static_cast<const char*>(push_constants);
+  constants.assign(bytes, bytes + push_constant_size);
+
+  // Each slot carries one chunk from staging through the kernel and back
+  VkDeviceSize out_size = chunk_size / in_element_size * out_element_size;
+  for (auto& s : slots) {
+    ready = ready
+      && create_buffer(chunk_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+		       | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		       {upload_queue.family},
+		       s.in_staging, s.in_staging_memory, &s.in_data)
+      && create_buffer(chunk_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		       | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		       {upload_queue.family, compute_queue.family},
+		       s.in, s.in_memory, nullptr)
+      && create_buffer(out_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+		       | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		       {compute_queue.family, download_queue.family},
+		       s.out, s.out_memory, nullptr)
+      && create_buffer(out_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+		       | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		       | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+		       {download_queue.family},
+		       s.out_staging, s.out_staging_memory, &s.out_data);
+    if (!ready)
+      return false;
+
+    VkDescriptorBufferInfo buf_infos[2] = {{s.in, 0, VK_WHOLE_SIZE},
+					   {s.out, 0, VK_WHOLE_SIZE}};
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = s.set;
+    write.dstBinding = 0;
+    write.dstArrayElement = 0;
+    write.descriptorCount = 2;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pImageInfo = nullptr;
+    write.pBufferInfo = buf_infos;
+    write.pTexelBufferView = nullptr;
+    vkd.vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+  return true;
+}
+
+bool stream_compute::valid() const
+{
+  return ready && pipeline != VK_NULL_HANDLE;
+}
+
+VkCommandBuffer stream_compute::begin(VkCommandBuffer cmd)
+{
+  vkd.vkResetCommandBuffer(cmd, 0);
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  begin_info.pInheritanceInfo = nullptr;
+  vkd.vkBeginCommandBuffer(cmd, &begin_info);
+  return cmd;
+}
+
+bool stream_compute::submit(const stream_queue& q,
+			    VkCommandBuffer cmd,
+			    VkSemaphore wait,
+			    VkPipelineStageFlags wait_stage,
+			    VkSemaphore signal,
+			    VkFence fence)
+{
+  vkd.vkEndCommandBuffer(cmd);
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = nullptr;
+  submit_info.waitSemaphoreCount = wait != VK_NULL_HANDLE ? 1 : 0;
+  submit_info.pWaitSemaphores = &wait;
+  submit_info.pWaitDstStageMask = &wait_stage;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &cmd;
+  submit_info.signalSemaphoreCount = signal != VK_NULL_HANDLE ? 1 : 0;
+  submit_info.pSignalSemaphores = &signal;
+
+  VkResult res;
+  {
+    std::lock_guard<std::mutex> lock(*q.mutex);
+    res = vkd.vkQueueSubmit(q.queue, 1, &submit_info, fence);
+  }
+  if (res != VK_SUCCESS)
+    std::cout << "Failed to submit stream chunk..." << std::endl;
+  return res == VK_SUCCESS;
+}
+
+// Uploads the chunk already in the slot's staging buffer and runs the
+// kernel over it
+bool stream_compute::start_chunk(slot& s, uint32_t elements, uint64_t first)
+{
+  VkBufferCopy region = {};
+  region.srcOffset = 0;
+  region.dstOffset = 0;
+  region.size = static_cast<VkDeviceSize>(elements) * in_element_size;
+  VkCommandBuffer cmd = begin(s.upload_cmd);
+  vkd.vkCmdCopyBuffer(cmd, s.in_staging, s.in, 1, &region);
+  if (!submit(upload_queue, cmd, VK_NULL_HANDLE, 0, s.uploaded,
+	      VK_NULL_HANDLE))
+    return false;
+
+  cmd = begin(s.compute_cmd);
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout,
+			      0, 1, &s.set, 0, nullptr);
+  if (!constants.empty())
+    vkd.vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT,
+			   COMPUTE_HEADER_SIZE,
+			   static_cast<uint32_t>(constants.size()),
+			   constants.data());
+
+  uint32_t groups = (elements + local_size[0] - 1) / local_size[0];
+  uint32_t max_groups = limits.maxComputeWorkGroupCount[0];
+  uint32_t header[8] = {0, 0, 0, static_cast<uint32_t>(first),
+			elements, 1, 1, static_cast<uint32_t>(first >> 32)};
+  for (uint32_t gx = 0; gx < groups; gx += max_groups) {
+    header[0] = gx * local_size[0];
+    vkd.vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT,
+			   0, COMPUTE_HEADER_SIZE, header);
+    vkd.vkCmdDispatch(cmd, std::min(max_groups, groups - gx), 1, 1);
+  }
+  if (!submit(compute_queue, cmd, s.uploaded,
+	      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, s.computed,
+	      VK_NULL_HANDLE))
+    return false;
+
+  s.elements = elements;
+  return true;
+}
+
+bool stream_compute::download_chunk(slot& s)
+{
+  VkBufferCopy region = {};
+  region.srcOffset = 0;
+  region.dstOffset = 0;
+  region.size = static_cast<VkDeviceSize>(s.elements) * out_element_size;
+  VkCommandBuffer cmd = begin(s.download_cmd);
+  vkd.vkCmdCopyBuffer(cmd, s.out, s.out_staging, 1, &region);
+
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkd.vkCmdPipelineBarrier(cmd,
+			   VK_PIPELINE_STAGE_TRANSFER_BIT,
+			   VK_PIPELINE_STAGE_HOST_BIT,
+			   0,
+			   1, &barrier,
+			   0, nullptr,
+			   0, nullptr);
+
+  vkd.vkResetFences(device, 1, &s.done);
+  if (!submit(download_queue, cmd, s.computed,
+	      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_NULL_HANDLE, s.done))
+    return false;
+  s.pending = true;
+  return true;
+}
+
+bool stream_compute::finish_chunk(slot& s, std::ostream& out)
+{
+  if (!s.pending)
+    return true;
+  vkd.vkWaitForFences(device, 1, &s.done, VK_TRUE, UINT64_MAX);
+  s.pending = false;
+
+  size_t size = static_cast<size_t>(s.elements) * out_element_size;
+  out.write(static_cast<const char*>(s.out_data), size);
+  out_bytes += size;
+  return out.good();
+}
+
+// Each chunk's readback is submitted after the next chunk's upload, so a
+// shared transfer queue is not left waiting on the kernel while it could
+// be uploading
+bool stream_compute::stream(const reader& read, std::ostream& out)
+{
+  if (!valid())
+    return false;
+
+  bool ok = true;
+  uint64_t first = 0;
+  size_t cur = 0;
+  slot* waiting = nullptr;
+  for (;;) {
+    slot& s = slots[cur];
+    ok = ok && finish_chunk(s, out);
+    if (!ok)
+      break;
+
+    size_t size = read(s.in_data, static_cast<size_t>(chunk_size));
+    if (size == 0)
+      break;
+    uint32_t elements = static_cast<uint32_t>(
+      (size + in_element_size - 1) / in_element_size);
+    std::memset(static_cast<char*>(s.in_data) + size, 0,
+		static_cast<size_t>(elements) * in_element_size - size);
+
+    ok = start_chunk(s, elements, first);
+    if (waiting != nullptr)
+      ok = download_chunk(*waiting) && ok;
+    waiting = &s;
+    if (!ok)
+      break;
+
+    in_bytes += size;
+    first += elements;
+    chunks++;
+    cur = (cur + 1) % slots.size();
+  }
+
+  if (ok && waiting != nullptr)
+    ok = download_chunk(*waiting);
+  for (size_t i = 0; i != slots.size(); i++)
+    ok = finish_chunk(slots[(cur + i) % slots.size()], out) && ok;
+
+  // A failed submission can leave a slot's semaphores signalled with no
+  // wait to come, so the slots cannot be trusted for another run
+  if (!ok) {
+    wait_idle();
+    ready = false;
+  }
+  return ok;
+}
+
+bool stream_compute::run(const void* data, size_t size, std::ostream& out)
+{
+  const char* src = static_cast<const char*>(data);
+  return stream([&](void* dst, size_t max) {
+      size_t n = std::min(max, size);
+      std::memcpy(dst, src, n);
+      src += n;
+      size -= n;
+      return n;
+    }, out);
+}
+
+bool stream_compute::run(std::istream& in, std::ostream& out)
+{
+  return stream([&](void* dst, size_t max) {
+      in.read(static_cast<char*>(dst), max);
+      return static_cast<size_t>(in.gcount());
+    }, out);
+}
+
+bool stream_compute::run_file(const std::string& filename, std::ostream& out)
+{
+#if !defined(_WIN32)
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+		      MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+      bool ok = run(data, static_cast<size_t>(st.st_size), out);
+      munmap(data, static_cast<size_t>(st.st_size));
+      close(fd);
+      return ok;
+    }
+  }
+  if (fd >= 0)
+    close(fd);
+#endif
+
+  std::ifstream in(filename, std::ios::binary | std::ios::in);
+  if (!in.is_open()) {
+    std::cout << "Failed to open stream input: " << filename << "..."
+	      << std::endl;
+    return false;
+  }
+  return run(in, out);
+}
+
+uint64_t stream_compute::chunk_count() const
+{
+  return chunks;
+}
+
+uint64_t stream_compute::bytes_in() const
+{
+  return in_bytes;
+}
+
+uint64_t stream_compute::bytes_out() const
+{
+  return out_bytes;
+}
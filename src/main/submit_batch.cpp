@@ -0,0 +1,207 @@
+#include "submit_batch.hpp"
+#include "dispatch.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+
+thread_local submit_batch::entry_cache submit_batch::cache = {nullptr};
+
+void submit_batch::delete_entries(entry* e)
+{
+  while (e != nullptr) {
+    entry* next = e->next;
+    delete e;
+    e = next;
+  }
+}
+
+submit_batch::entry_cache::~entry_cache()
+{
+  delete_entries(free);
+}
+
+submit_batch::submit_batch(VkQueue queue, std::mutex& queue_mutex)
+  : queue(queue),
+    queue_mutex(queue_mutex),
+    head(nullptr),
+    free_head(nullptr),
+    submits(0),
+    entries(0)
+{
+}
+
+submit_batch::~submit_batch()
+{
+  delete_entries(head.exchange(nullptr, std::memory_order_acquire));
+  delete_entries(free_head.exchange(nullptr, std::memory_order_acquire));
+}
+
+void submit_batch::enqueue(VkCommandBuffer command_buffer, VkFence fence)
+{
+  enqueue(&command_buffer, 1, nullptr, nullptr, 0, nullptr, 0, fence);
+}
+
+void submit_batch::enqueue(const VkCommandBuffer* command_buffers,
+			   uint32_t command_buffer_count,
+			   const VkSemaphore* wait_semaphores,
+			   const VkPipelineStageFlags* wait_stages,
+			   uint32_t wait_count,
+			   const VkSemaphore* signal_semaphores,
+			   uint32_t signal_count,
+			   VkFence fence)
+{
+  enqueue(command_buffers, command_buffer_count,
+	  wait_semaphores, nullptr, wait_stages, wait_count,
+	  signal_semaphores, nullptr, signal_count,
+	  fence);
+}
+
+void submit_batch::enqueue(const VkCommandBuffer* command_buffers,
+			   uint32_t command_buffer_count,
+			   const VkSemaphore* wait_semaphores,
+			   const uint64_t* wait_values,
+			   const VkPipelineStageFlags* wait_stages,
+			   uint32_t wait_count,
+			   const VkSemaphore* signal_semaphores,
+			   const uint64_t* signal_values,
+			   uint32_t signal_count,
+			   VkFence fence)
+{
+  entry* e = allocate();
+  e->command_buffers.assign(command_buffers,
+			    command_buffers + command_buffer_count);
+  e->wait_semaphores.assign(wait_semaphores, wait_semaphores + wait_count);
+  e->wait_stages.assign(wait_stages, wait_stages + wait_count);
+  e->signal_semaphores.assign(signal_semaphores,
+			      signal_semaphores + signal_count);
+  if (wait_values != nullptr)
+    e->wait_values.assign(wait_values, wait_values + wait_count);
+  else
+    e->wait_values.clear();
+  if (signal_values != nullptr)
+    e->signal_values.assign(signal_values, signal_values + signal_count);
+  else
+    e->signal_values.clear();
+  e->fence = fence;
+  push(e);
+}
+
+// Taking the whole free list by exchange cannot suffer ABA the way
+// popping its head by compare and swap would
+submit_batch::entry* submit_batch::allocate()
+{
+  if (cache.free == nullptr)
+    cache.free = free_head.exchange(nullptr, std::memory_order_acquire);
+  if (cache.free == nullptr)
+    return new entry;
+  entry* e = cache.free;
+  cache.free = e->next;
+  return e;
+}
+
+void submit_batch::push(entry* e)
+{
+  e->next = head.load(std::memory_order_relaxed);
+  while (!head.compare_exchange_weak(e->next, e,
+				     std::memory_order_release,
+				     std::memory_order_relaxed))
+    ;
+}
+
+VkResult submit_batch::flush()
+{
+  TRACE_SCOPE("flush submits");
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  entry* e = head.exchange(nullptr, std::memory_order_acquire);
+  if (e == nullptr)
+    return VK_SUCCESS;
+
+  // The list is newest first
+  pending.clear();
+  for (; e != nullptr; e = e->next)
+    pending.push_back(e);
+  std::reverse(pending.begin(), pending.end());
+
+  VkResult res = VK_SUCCESS;
+  size_t first = 0;
+  while (first != pending.size() && res == VK_SUCCESS) {
+    infos.clear();
+#ifdef VK_KHR_timeline_semaphore
+    // Chained from infos, so must not reallocate while filling
+    timeline_infos.clear();
+    timeline_infos.reserve(pending.size() - first);
+#endif
+    VkFence fence = VK_NULL_HANDLE;
+    size_t last = first;
+    for (; last != pending.size() && fence == VK_NULL_HANDLE; last++) {
+      const entry& p = *pending[last];
+      VkSubmitInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      info.pNext = nullptr;
+      info.waitSemaphoreCount =
+	static_cast<uint32_t>(p.wait_semaphores.size());
+      info.pWaitSemaphores = p.wait_semaphores.data();
+      info.pWaitDstStageMask = p.wait_stages.data();
+      info.commandBufferCount =
+	static_cast<uint32_t>(p.command_buffers.size());
+      info.pCommandBuffers = p.command_buffers.data();
+      info.signalSemaphoreCount =
+	static_cast<uint32_t>(p.signal_semaphores.size());
+      info.pSignalSemaphores = p.signal_semaphores.data();
+#ifdef VK_KHR_timeline_semaphore
+      if (!p.wait_values.empty() || !p.signal_values.empty()) {
+	VkTimelineSemaphoreSubmitInfoKHR timeline_info = {};
+	timeline_info.sType =
+	  VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	timeline_info.pNext = nullptr;
+	timeline_info.waitSemaphoreValueCount =
+	  static_cast<uint32_t>(p.wait_values.size());
+	timeline_info.pWaitSemaphoreValues = p.wait_values.data();
+	timeline_info.signalSemaphoreValueCount =
+	  static_cast<uint32_t>(p.signal_values.size());
+	timeline_info.pSignalSemaphoreValues = p.signal_values.data();
+	timeline_infos.push_back(timeline_info);
+	info.pNext = &timeline_infos.back();
+      }
+#endif
+      infos.push_back(info);
+      fence = p.fence;
+    }
+    res = vkd.vkQueueSubmit(queue,
+			    static_cast<uint32_t>(infos.size()),
+			    infos.data(),
+			    fence);
+    submits++;
+    entries += infos.size();
+    first = last;
+  }
+
+  // Back to the free list as one chain; the entries' vectors keep their
+  // capacity for the next enqueue
+  for (size_t i = 0; i + 1 < pending.size(); i++)
+    pending[i]->next = pending[i+1];
+  entry* first_free = pending.front();
+  entry* last_free = pending.back();
+  last_free->next = free_head.load(std::memory_order_relaxed);
+  while (!free_head.compare_exchange_weak(last_free->next, first_free,
+					  std::memory_order_release,
+					  std::memory_order_relaxed))
+    ;
+  pending.clear();
+  return res;
+}
+
+bool submit_batch::empty() const
+{
+  return head.load(std::memory_order_acquire) == nullptr;
+}
+
+uint64_t submit_batch::submit_count() const
+{
+  return submits;
+}
+
+uint64_t submit_batch::entry_count() const
+{
+  return entries;
+}
@@ -0,0 +1,814 @@
+#include "texture.hpp"
+#include "dispatch.hpp"
+#include "trace.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define STAGING_ALIGNMENT 16
+
+// Textures not touched for this many frames are no longer upgraded.
+#define TEXTURE_IDLE_FRAMES 60
+
+static bool read_ppm_token(std::istream& is, std::string& token)
+{
+  token.clear();
+  int c = is.get();
+  while (is.good()) {
+    if (c == '#') {
+      while (is.good() && c != '\n')
+	c = is.get();
+    } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      if (!token.empty())
+	return true;
+    } else
+      token.push_back(static_cast<char>(c));
+    c = is.get();
+  }
+  return !token.empty();
+}
+
+// Header numbers are plain decimal; at most nine digits always fit, so a
+// malformed or oversized one fails here rather than throwing in the loader
+static bool parse_ppm_number(const std::string& token, uint32_t& value)
+{
+  if (token.empty() || token.size() > 9 ||
+      token.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  value = static_cast<uint32_t>(std::stoul(token));
+  return true;
+}
+
+bool load_ppm(const std::string& filename, texture_data& tex)
+{
+  std::ifstream is(filename, std::ios::binary | std::ios::in);
+  if (!is.is_open()) {
+    std::cout << "Failed to open texture file: " << filename << "..."
+	      << std::endl;
+    return false;
+  }
+
+  texture_mip base = {};
+  std::string magic, width, height, max_value;
+  uint32_t maxval;
+  if (!read_ppm_token(is, magic) || magic != "P6" ||
+      !read_ppm_token(is, width) ||
+      !read_ppm_token(is, height) ||
+      !read_ppm_token(is, max_value) ||
+      !parse_ppm_number(width, base.width) ||
+      !parse_ppm_number(height, base.height) ||
+      !parse_ppm_number(max_value, maxval) ||
+      maxval == 0 || maxval > 255) {
+    std::cout << "Failed to load texture " << filename
+	      << ": only binary 8-bit PPM (P6) files are supported..."
+	      << std::endl;
+    return false;
+  }
+
+  if (base.width == 0 || base.height == 0) {
+    std::cout << "Failed to load texture " << filename
+	      << ": empty image..." << std::endl;
+    return false;
+  }
+
+  size_t texel_count = static_cast<size_t>(base.width) * base.height;
+  std::vector<unsigned char> rgb(texel_count * 3);
+  is.read(reinterpret_cast<char*>(rgb.data()), rgb.size());
+  if (static_cast<size_t>(is.gcount()) != rgb.size()) {
+    std::cout << "Failed to load texture " << filename
+	      << ": truncated pixel data..." << std::endl;
+    return false;
+  }
+
+  base.texels.resize(texel_count * TEXTURE_TEXEL_SIZE);
+  for (size_t i = 0; i != texel_count; i++) {
+    base.texels[4*i] = rgb[3*i];
+    base.texels[4*i+1] = rgb[3*i+1];
+    base.texels[4*i+2] = rgb[3*i+2];
+    base.texels[4*i+3] = 255;
+  }
+
+  tex.name = filename;
+  tex.mips.clear();
+  tex.mips.push_back(std::move(base));
+  return true;
+}
+
+static void downsample(const texture_mip& src, texture_mip& dst)
+{
+  dst.width = std::max(1u, src.width / 2);
+  dst.height = std::max(1u, src.height / 2);
+  dst.texels.resize(static_cast<size_t>(dst.width) * dst.height
+		    * TEXTURE_TEXEL_SIZE);
+
+  for (uint32_t y = 0; y != dst.height; y++) {
+    const unsigned char* row0 =
+      &src.texels[static_cast<size_t>(std::min(2*y, src.height-1))
+		  * src.width * TEXTURE_TEXEL_SIZE];
+    const unsigned char* row1 =
+      &src.texels[static_cast<size_t>(std::min(2*y+1, src.height-1))
+		  * src.width * TEXTURE_TEXEL_SIZE];
+    unsigned char* out =
+      &dst.texels[static_cast<size_t>(y) * dst.width * TEXTURE_TEXEL_SIZE];
+
+    uint32_t x = 0;
+#ifdef TEXTURE_USE_SSE2
+    // Four destination texels per iteration. Sums are taken in 16 bits
+    // and rounded once, like the scalar loop, so both give the same value
+    // for a texel.
+    if (src.width >= 2) {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i two = _mm_set1_epi16(2);
+      for (; x + 4 <= dst.width; x += 4) {
+	const unsigned char* a = row0 + 2*x*TEXTURE_TEXEL_SIZE;
+	const unsigned char* b = row1 + 2*x*TEXTURE_TEXEL_SIZE;
+	__m128i halves[2];
+	for (unsigned int h = 0; h != 2; h++) {
+	  __m128i va =
+	    _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 16*h));
+	  __m128i vb =
+	    _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 16*h));
+	  // Source texels 0,1 and 2,3 of this half, rows added
+	  __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(va, zero),
+				     _mm_unpacklo_epi8(vb, zero));
+	  __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(va, zero),
+				     _mm_unpackhi_epi8(vb, zero));
+	  // Then each texel added to its neighbour in the low four lanes
+	  lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+	  hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+	  __m128i sum = _mm_unpacklo_epi64(lo, hi);
+	  halves[h] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x*TEXTURE_TEXEL_SIZE),
+			 _mm_packus_epi16(halves[0], halves[1]));
+      }
+    }
+#endif
+    for (; x != dst.width; x++) {
+      uint32_t x0 = std::min(2*x, src.width-1) * TEXTURE_TEXEL_SIZE;
+      uint32_t x1 = std::min(2*x+1, src.width-1) * TEXTURE_TEXEL_SIZE;
+      for (uint32_t c = 0; c != TEXTURE_TEXEL_SIZE; c++)
+	out[x*TEXTURE_TEXEL_SIZE+c] =
+	  static_cast<unsigned char>((row0[x0+c] + row0[x1+c]
+				      + row1[x0+c] + row1[x1+c] + 2) / 4);
+    }
+  }
+}
+
+void generate_mips(texture_data& tex)
+{
+  if (tex.mips.empty())
+    return;
+
+  tex.mips.resize(1);
+  while (tex.mips.back().width > 1 || tex.mips.back().height > 1) {
+    texture_mip next;
+    downsample(tex.mips.back(), next);
+    tex.mips.push_back(std::move(next));
+  }
+}
+
+texture_loader::texture_loader()
+  : in_flight(0),
+    stopping(false)
+{
+  worker = std::thread(&texture_loader::run, this);
+}
+
+texture_loader::~texture_loader()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cond.notify_all();
+  worker.join();
+}
+
+void texture_loader::request(const std::string& filename)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(filename);
+  }
+  cond.notify_one();
+}
+
+bool texture_loader::poll(texture_data& tex)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (finished.empty())
+    return false;
+  tex = std::move(finished.front());
+  finished.pop_front();
+  return true;
+}
+
+bool texture_loader::idle()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return pending.empty() && finished.empty() && in_flight == 0;
+}
+
+void texture_loader::run()
+{
+  trace_thread_name("texture loader");
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    cond.wait(lock, [this] { return stopping || !pending.empty(); });
+    if (stopping)
+      return;
+
+    std::string filename = pending.front();
+    pending.pop_front();
+    in_flight++;
+    lock.unlock();
+
+    texture_data tex;
+    bool loaded;
+    {
+      TRACE_SCOPE("load texture");
+      loaded = load_ppm(filename, tex);
+      if (loaded)
+	generate_mips(tex);
+    }
+    if (loaded) {
+      std::cout << "Loaded texture " << filename << " ("
+		<< tex.mips[0].width << "x" << tex.mips[0].height << ", "
+		<< tex.mips.size() << " levels)" << std::endl;
+    }
+
+    lock.lock();
+    if (loaded)
+      finished.push_back(std::move(tex));
+    in_flight--;
+  }
+}
+
+texture_streamer::texture_streamer(VkPhysicalDevice physical_device,
+				   VkDevice device,
+				   uint32_t queue_family_idx,
+				   VkQueue queue,
+				   std::mutex& queue_mutex,
+				   VkDeviceSize vram_budget,
+				   VkDeviceSize staging_size,
+				   deletion_queue& deletions,
+				   const VkAllocationCallbacks* alloc_callbacks)
+  : physical_device(physical_device),
+    device(device),
+    queue_family_idx(queue_family_idx),
+    queue(queue),
+    queue_mutex(queue_mutex),
+    deletions(deletions),
+    alloc_callbacks(alloc_callbacks),
+    vram_budget(vram_budget),
+    resident(0),
+    staging_buffer(VK_NULL_HANDLE),
+    staging_memory(VK_NULL_HANDLE),
+    staging_size(staging_size),
+    staging_used(0),
+    staging_data(nullptr),
+    command_pool(VK_NULL_HANDLE),
+    command_buffer(VK_NULL_HANDLE),
+    fence(VK_NULL_HANDLE),
+    recording(false),
+    submitted(false),
+    current_frame(0)
+{
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
+
+  if (!create_staging())
+    std::cout << "Failed to create texture staging buffer..." << std::endl;
+
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+    VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  pool_info.queueFamilyIndex = queue_family_idx;
+  VkResult res = vkCreateCommandPool(device, &pool_info, alloc_callbacks,
+				     &command_pool);
+  if (res != VK_SUCCESS)
+    std::cout << "Failed to create texture command pool..." << std::endl;
+
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.pNext = nullptr;
+  alloc_info.commandPool = command_pool;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandBufferCount = 1;
+  res = vkAllocateCommandBuffers(device, &alloc_info, &command_buffer);
+  if (res != VK_SUCCESS)
+    std::cout << "Failed to allocate texture command buffer..." << std::endl;
+
+  VkFenceCreateInfo fence_info = {};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fence_info.pNext = nullptr;
+  fence_info.flags = 0;
+  res = vkCreateFence(device, &fence_info, alloc_callbacks, &fence);
+  if (res != VK_SUCCESS)
+    std::cout << "Failed to create texture fence..." << std::endl;
+}
+
+texture_streamer::~texture_streamer()
+{
+  if (submitted)
+    vkd.vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+
+  for (auto& tex : textures) {
+    if (tex.view != VK_NULL_HANDLE)
+      vkDestroyImageView(device, tex.view, alloc_callbacks);
+    if (tex.image != VK_NULL_HANDLE)
+      vkDestroyImage(device, tex.image, alloc_callbacks);
+    if (tex.memory != VK_NULL_HANDLE)
+      vkFreeMemory(device, tex.memory, alloc_callbacks);
+  }
+
+  vkDestroyFence(device, fence, alloc_callbacks);
+  vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
+  vkDestroyCommandPool(device, command_pool, alloc_callbacks);
+
+  if (staging_data != nullptr)
+    vkUnmapMemory(device, staging_memory);
+  vkDestroyBuffer(device, staging_buffer, alloc_callbacks);
+  vkFreeMemory(device, staging_memory, alloc_callbacks);
+}
+
+uint32_t texture_streamer::find_memory_type(uint32_t type_bits,
+					    VkMemoryPropertyFlags flags) const
+{
+  for (uint32_t i = 0; i != mem_props.memoryTypeCount; i++)
+    if ((type_bits & (1u << i)) != 0 &&
+	(mem_props.memoryTypes[i].propertyFlags & flags) == flags)
+      return i;
+  return UINT32_MAX;
+}
+
+bool texture_streamer::create_staging()
+{
+  VkBufferCreateInfo buf_info = {};
+  buf_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buf_info.pNext = nullptr;
+  buf_info.flags = 0;
+  buf_info.size = staging_size;
+  buf_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  buf_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  buf_info.queueFamilyIndexCount = 0;
+  buf_info.pQueueFamilyIndices = nullptr;
+  if (vkCreateBuffer(device, &buf_info, alloc_callbacks,
+		     &staging_buffer) != VK_SUCCESS)
+    return false;
+
+  VkMemoryRequirements reqs;
+  vkGetBufferMemoryRequirements(device, staging_buffer, &reqs);
+
+  VkMemoryAllocateInfo mem_info = {};
+  mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  mem_info.pNext = nullptr;
+  mem_info.allocationSize = reqs.size;
+  mem_info.memoryTypeIndex =
+    find_memory_type(reqs.memoryTypeBits,
+		     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  if (mem_info.memoryTypeIndex == UINT32_MAX)
+    return false;
+  if (vkAllocateMemory(device, &mem_info, alloc_callbacks,
+		       &staging_memory) != VK_SUCCESS)
+    return false;
+  if (vkBindBufferMemory(device, staging_buffer, staging_memory, 0)
+      != VK_SUCCESS)
+    return false;
+
+  // The staging buffer stays mapped for the streamer's lifetime
+  void* data;
+  if (vkMapMemory(device, staging_memory, 0, VK_WHOLE_SIZE, 0, &data)
+      != VK_SUCCESS)
+    return false;
+  staging_data = static_cast<unsigned char*>(data);
+  return true;
+}
+
+uint32_t texture_streamer::add(texture_data& tex)
+{
+  entry new_tex = {};
+  new_tex.data = std::move(tex);
+  new_tex.tail_level = static_cast<uint32_t>(new_tex.data.mips.size()) - 1;
+  for (uint32_t i = 0; i != new_tex.data.mips.size(); i++) {
+    const texture_mip& mip = new_tex.data.mips[i];
+    if (std::max(mip.width, mip.height) <= TEXTURE_MIP_TAIL_EXTENT) {
+      new_tex.tail_level = i;
+      break;
+    }
+  }
+  new_tex.top_level = TEXTURE_NOT_RESIDENT;
+  new_tex.last_used = 0;
+  new_tex.version = 0;
+  new_tex.image = VK_NULL_HANDLE;
+  new_tex.view = VK_NULL_HANDLE;
+  new_tex.memory = VK_NULL_HANDLE;
+  new_tex.size = 0;
+  textures.push_back(std::move(new_tex));
+  return static_cast<uint32_t>(textures.size() - 1);
+}
+
+void texture_streamer::touch(uint32_t tex_idx, uint64_t frame)
+{
+  textures[tex_idx].last_used = frame;
+}
+
+VkImageView texture_streamer::view(uint32_t tex_idx) const
+{
+  return textures[tex_idx].view;
+}
+
+uint32_t texture_streamer::version(uint32_t tex_idx) const
+{
+  return textures[tex_idx].version;
+}
+
+uint32_t texture_streamer::resident_level(uint32_t tex_idx) const
+{
+  return textures[tex_idx].top_level;
+}
+
+uint32_t texture_streamer::level_count(uint32_t tex_idx) const
+{
+  return static_cast<uint32_t>(textures[tex_idx].data.mips.size());
+}
+
+VkDeviceSize texture_streamer::resident_bytes() const
+{
+  return resident;
+}
+
+bool texture_streamer::create_image(entry& tex, uint32_t top_level,
+				    VkImage& image, VkImageView& view,
+				    VkDeviceMemory& memory, VkDeviceSize& size)
+{
+  const texture_mip& top = tex.data.mips[top_level];
+  uint32_t levels = static_cast<uint32_t>(tex.data.mips.size()) - top_level;
+
+  VkImageCreateInfo img_info = {};
+  img_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  img_info.pNext = nullptr;
+  img_info.flags = 0;
+  img_info.imageType = VK_IMAGE_TYPE_2D;
+  img_info.format = TEXTURE_FORMAT;
+  img_info.extent.width = top.width;
+  img_info.extent.height = top.height;
+  img_info.extent.depth = 1;
+  img_info.mipLevels = levels;
+  img_info.arrayLayers = 1;
+  img_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  img_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  img_info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+    | VK_IMAGE_USAGE_TRANSFER_DST_BIT
+    | VK_IMAGE_USAGE_SAMPLED_BIT;
+  img_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  img_info.queueFamilyIndexCount = 0;
+  img_info.pQueueFamilyIndices = nullptr;
+  img_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  if (vkCreateImage(device, &img_info, alloc_callbacks, &image)
+      != VK_SUCCESS) {
+    std::cout << "Failed to create image for texture " << tex.data.name
+	      << "..." << std::endl;
+    return false;
+  }
+
+  VkMemoryRequirements reqs;
+  vkGetImageMemoryRequirements(device, image, &reqs);
+
+  VkMemoryAllocateInfo mem_info = {};
+  mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  mem_info.pNext = nullptr;
+  mem_info.allocationSize = reqs.size;
+  mem_info.memoryTypeIndex =
+    find_memory_type(reqs.memoryTypeBits,
+		     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  if (mem_info.memoryTypeIndex == UINT32_MAX)
+    mem_info.memoryTypeIndex = find_memory_type(reqs.memoryTypeBits, 0);
+  if (vkAllocateMemory(device, &mem_info, alloc_callbacks, &memory)
+      != VK_SUCCESS) {
+    std::cout << "Failed to allocate memory for texture " << tex.data.name
+	      << "..." << std::endl;
+    vkDestroyImage(device, image, alloc_callbacks);
+    return false;
+  }
+  vkBindImageMemory(device, image, memory, 0);
+  size = reqs.size;
+
+  VkImageViewCreateInfo view_info = {};
+  view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  view_info.pNext = nullptr;
+  view_info.flags = 0;
+  view_info.image = image;
+  view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  view_info.format = TEXTURE_FORMAT;
+  view_info.components = {
+    VK_COMPONENT_SWIZZLE_IDENTITY,
+    VK_COMPONENT_SWIZZLE_IDENTITY,
+    VK_COMPONENT_SWIZZLE_IDENTITY,
+    VK_COMPONENT_SWIZZLE_IDENTITY
+  };
+  view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  view_info.subresourceRange.baseMipLevel = 0;
+  view_info.subresourceRange.levelCount = levels;
+  view_info.subresourceRange.baseArrayLayer = 0;
+  view_info.subresourceRange.layerCount = 1;
+  if (vkCreateImageView(device, &view_info, alloc_callbacks, &view)
+      != VK_SUCCESS) {
+    std::cout << "Failed to create view for texture " << tex.data.name
+	      << "..." << std::endl;
+    vkDestroyImage(device, image, alloc_callbacks);
+    vkFreeMemory(device, memory, alloc_callbacks);
+    return false;
+  }
+  return true;
+}
+
+bool texture_streamer::stage_levels(const entry& tex,
+				    uint32_t first, uint32_t last,
+				    std::vector<VkBufferImageCopy>& copies)
+{
+  VkDeviceSize offset = staging_used;
+  for (uint32_t level = first; level <= last; level++) {
+    offset = (offset + STAGING_ALIGNMENT - 1) & ~(VkDeviceSize)(STAGING_ALIGNMENT - 1);
+    offset += tex.data.mips[level].texels.size();
+  }
+  if (staging_data == nullptr || offset > staging_size)
+    return false;
+
+  for (uint32_t level = first; level <= last; level++) {
+    const texture_mip& mip = tex.data.mips[level];
+    staging_used = (staging_used + STAGING_ALIGNMENT - 1)
+      & ~(VkDeviceSize)(STAGING_ALIGNMENT - 1);
+    memcpy(staging_data + staging_used, mip.texels.data(), mip.texels.size());
+
+    VkBufferImageCopy copy = {};
+    copy.bufferOffset = staging_used;
+    copy.bufferRowLength = 0;
+    copy.bufferImageHeight = 0;
+    copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy.imageSubresource.mipLevel = level;
+    copy.imageSubresource.baseArrayLayer = 0;
+    copy.imageSubresource.layerCount = 1;
+    copy.imageOffset = {0, 0, 0};
+    copy.imageExtent = {mip.width, mip.height, 1};
+    copies.push_back(copy);
+
+    staging_used += mip.texels.size();
+  }
+  return true;
+}
+
+// Recreates tex with levels [top_level, last] resident. Levels both images
+// share are copied on the device; levels only the new image has are staged
+// from the CPU copy when upload is set.
+bool texture_streamer::restream(entry& tex, uint32_t top_level, bool upload)
+{
+  uint32_t last_level = static_cast<uint32_t>(tex.data.mips.size()) - 1;
+  uint32_t old_top = tex.top_level;
+  uint32_t copy_from = std::max(top_level, old_top == TEXTURE_NOT_RESIDENT ?
+				last_level + 1 : old_top);
+
+  std::vector<VkBufferImageCopy> uploads;
+  if (upload && top_level < copy_from &&
+      !stage_levels(tex, top_level, copy_from - 1, uploads))
+    return false;
+  for (auto& copy : uploads)
+    copy.imageSubresource.mipLevel -= top_level;
+
+  VkImage image;
+  VkImageView view;
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  if (!create_image(tex, top_level, image, view, memory, size))
+    return false;
+
+  if (!recording) {
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+    vkd.vkBeginCommandBuffer(command_buffer, &begin_info);
+    recording = true;
+  }
+
+  VkImageMemoryBarrier barriers[2] = {};
+  uint32_t barrier_count = 1;
+  barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[0].pNext = nullptr;
+  barriers[0].srcAccessMask = 0;
+  barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].image = image;
+  barriers[0].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barriers[0].subresourceRange.baseMipLevel = 0;
+  barriers[0].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+  barriers[0].subresourceRange.baseArrayLayer = 0;
+  barriers[0].subresourceRange.layerCount = 1;
+  if (old_top != TEXTURE_NOT_RESIDENT) {
+    barriers[1] = barriers[0];
+    barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
+      | VK_ACCESS_SHADER_READ_BIT;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[1].image = tex.image;
+    barrier_count = 2;
+  }
+  vkd.vkCmdPipelineBarrier(command_buffer,
+			   VK_PIPELINE_STAGE_TRANSFER_BIT
+			   | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			   VK_PIPELINE_STAGE_TRANSFER_BIT,
+			   0,
+			   0, nullptr,
+			   0, nullptr,
+			   barrier_count, barriers);
+
+  if (old_top != TEXTURE_NOT_RESIDENT) {
+    std::vector<VkImageCopy> copies;
+    for (uint32_t level = copy_from; level <= last_level; level++) {
+      VkImageCopy copy = {};
+      copy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      copy.srcSubresource.mipLevel = level - old_top;
+      copy.srcSubresource.baseArrayLayer = 0;
+      copy.srcSubresource.layerCount = 1;
+      copy.srcOffset = {0, 0, 0};
+      copy.dstSubresource = copy.srcSubresource;
+      copy.dstSubresource.mipLevel = level - top_level;
+      copy.dstOffset = {0, 0, 0};
+      copy.extent = {tex.data.mips[level].width,
+		     tex.data.mips[level].height, 1};
+      copies.push_back(copy);
+    }
+    vkd.vkCmdCopyImage(command_buffer,
+		       tex.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		       image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		       static_cast<uint32_t>(copies.size()), copies.data());
+  }
+
+  if (!uploads.empty())
+    vkd.vkCmdCopyBufferToImage(command_buffer,
+			       staging_buffer,
+			       image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			       static_cast<uint32_t>(uploads.size()),
+			       uploads.data());
+
+  barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkd.vkCmdPipelineBarrier(command_buffer,
+			   VK_PIPELINE_STAGE_TRANSFER_BIT,
+			   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			   0,
+			   0, nullptr,
+			   0, nullptr,
+			   1, barriers);
+
+  retire(tex);
+  tex.image = image;
+  tex.view = view;
+  tex.memory = memory;
+  tex.size = size;
+  tex.top_level = top_level;
+  tex.version++;
+  resident += size;
+  return true;
+}
+
+// The old image is read by this update's copies and by the frame being
+// streamed for, which is submitted after them on the same queue, so it is
+// handed to the deletion queue tagged with that frame.
+void texture_streamer::retire(entry& tex)
+{
+  if (tex.image == VK_NULL_HANDLE)
+    return;
+  deletions.destroy_image_view(tex.view, current_frame);
+  deletions.destroy_image(tex.image, current_frame);
+  deletions.free_memory(tex.memory, current_frame);
+  resident -= tex.size;
+  tex.image = VK_NULL_HANDLE;
+  tex.view = VK_NULL_HANDLE;
+  tex.memory = VK_NULL_HANDLE;
+  tex.size = 0;
+}
+
+void texture_streamer::update(uint64_t frame)
+{
+  TRACE_SCOPE("texture streaming");
+  current_frame = frame;
+  // Never block the frame on the previous batch; just skip streaming
+  if (submitted) {
+    if (vkd.vkGetFenceStatus(device, fence) != VK_SUCCESS)
+      return;
+    vkd.vkResetFences(device, 1, &fence);
+    vkd.vkResetCommandBuffer(command_buffer, 0);
+    staging_used = 0;
+    submitted = false;
+  }
+
+  // Mip tails first, in the order textures were added. A texture that
+  // cannot be streamed now (a level larger than the staging buffer, or
+  // staging already full) is skipped, so it never holds up the others.
+  for (auto& tex : textures)
+    if (tex.top_level == TEXTURE_NOT_RESIDENT)
+      restream(tex, tex.tail_level, true);
+
+  // Then one more level for each recently used texture, most recent first.
+  // Room is only made by evicting textures used less recently than the
+  // one being upgraded, so two textures never trade the same level back
+  // and forth.
+  std::vector<uint32_t> order;
+  for (uint32_t i = 0; i != textures.size(); i++)
+    if (textures[i].top_level != TEXTURE_NOT_RESIDENT &&
+	textures[i].top_level > 0 &&
+	textures[i].last_used + TEXTURE_IDLE_FRAMES >= frame)
+      order.push_back(i);
+  std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+      return textures[a].last_used > textures[b].last_used;
+    });
+
+  std::vector<bool> evicted(textures.size(), false);
+  for (auto idx : order) {
+    entry& tex = textures[idx];
+    if (evicted[idx])
+      continue;
+
+    // Evicting for a level that cannot be staged this update only churns
+    VkDeviceSize needed = tex.data.mips[tex.top_level-1].texels.size();
+    VkDeviceSize staged = (staging_used + STAGING_ALIGNMENT - 1)
+      & ~(VkDeviceSize)(STAGING_ALIGNMENT - 1);
+    if (staged + needed > staging_size)
+      continue;
+
+    bool room = true;
+    while (resident + needed > vram_budget) {
+      entry* victim = nullptr;
+      uint32_t victim_idx = 0;
+      for (uint32_t i = 0; i != textures.size(); i++) {
+	entry& cand = textures[i];
+	if (cand.top_level < cand.tail_level &&
+	    cand.last_used < tex.last_used &&
+	    (victim == nullptr || cand.last_used < victim->last_used)) {
+	  victim = &cand;
+	  victim_idx = i;
+	}
+      }
+      if (victim == nullptr || !restream(*victim, victim->top_level+1, false)) {
+	room = false;
+	break;
+      }
+      evicted[victim_idx] = true;
+    }
+    if (room)
+      restream(tex, tex.top_level-1, true);
+  }
+
+  // Tails alone may exceed the budget; trim the least recently used
+  while (resident > vram_budget) {
+    entry* victim = nullptr;
+    for (auto& cand : textures)
+      if (cand.top_level < cand.tail_level &&
+	  (victim == nullptr || cand.last_used < victim->last_used))
+	victim = &cand;
+    if (victim == nullptr || !restream(*victim, victim->top_level+1, false))
+      break;
+  }
+
+  if (!recording)
+    return;
+
+  vkd.vkEndCommandBuffer(command_buffer);
+  recording = false;
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = nullptr;
+  submit_info.waitSemaphoreCount = 0;
+  submit_info.pWaitSemaphores = nullptr;
+  submit_info.pWaitDstStageMask = nullptr;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &command_buffer;
+  submit_info.signalSemaphoreCount = 0;
+  submit_info.pSignalSemaphores = nullptr;
+
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  VkResult res = vkd.vkQueueSubmit(queue, 1, &submit_info, fence);
+  if (res == VK_SUCCESS)
+    submitted = true;
+  else
+    std::cout << "Failed to submit texture uploads..." << std::endl;
+}
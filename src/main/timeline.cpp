@@ -0,0 +1,241 @@
+#include "timeline.hpp"
+#include "dispatch.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+gpu_timeline::gpu_timeline(VkDevice device,
+			   const std::vector<submit_batch*>& batches,
+			   const VkAllocationCallbacks* alloc_callbacks)
+  : device(device),
+    alloc_callbacks(alloc_callbacks),
+    ready(false)
+{
+#ifdef VK_KHR_timeline_semaphore
+  wait_semaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>
+    (vki.vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR"));
+  get_counter_value = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>
+    (vki.vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR"));
+  if (wait_semaphores == nullptr || get_counter_value == nullptr) {
+    std::cout << "Timeline semaphores are not enabled..." << std::endl;
+    return;
+  }
+
+  VkSemaphoreTypeCreateInfoKHR type_info = {};
+  type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+  type_info.pNext = nullptr;
+  type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+  type_info.initialValue = 0;
+
+  VkSemaphoreCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  info.pNext = &type_info;
+  info.flags = 0;
+
+  for (auto batch : batches) {
+    std::unique_ptr<lane> l(new lane);
+    l->batch = batch;
+    l->semaphore = VK_NULL_HANDLE;
+    l->value = 0;
+    if (vkCreateSemaphore(device, &info, alloc_callbacks, &l->semaphore)
+	!= VK_SUCCESS) {
+      std::cout << "Failed to create timeline semaphore..." << std::endl;
+      return;
+    }
+    lanes.push_back(std::move(l));
+  }
+  ready = true;
+#else
+  (void)batches;
+  std::cout << "Built without timeline semaphores..." << std::endl;
+#endif
+}
+
+gpu_timeline::~gpu_timeline()
+{
+  for (auto& l : lanes)
+    vkDestroySemaphore(device, l->semaphore, alloc_callbacks);
+}
+
+bool gpu_timeline::supported() const
+{
+  return ready;
+}
+
+uint32_t gpu_timeline::queue_count() const
+{
+  return static_cast<uint32_t>(lanes.size());
+}
+
+gpu_point gpu_timeline::submit(uint32_t queue,
+			       const VkCommandBuffer* command_buffers,
+			       uint32_t command_buffer_count,
+			       const gpu_point* waits,
+			       const VkPipelineStageFlags* wait_stages,
+			       uint32_t wait_count,
+			       VkFence fence)
+{
+  // One wait per queue is enough: its latest point covers the earlier ones
+  std::vector<VkSemaphore> semaphores;
+  std::vector<uint64_t> values;
+  std::vector<VkPipelineStageFlags> stages;
+  std::vector<uint32_t> wait_queues;
+  for (uint32_t i = 0; i != wait_count; i++) {
+    if (waits[i].value == 0)
+      continue;
+    auto pos = std::find(wait_queues.begin(), wait_queues.end(),
+			 waits[i].queue);
+    if (pos != wait_queues.end()) {
+      size_t j = pos - wait_queues.begin();
+      values[j] = std::max(values[j], waits[i].value);
+      stages[j] |= wait_stages[i];
+      continue;
+    }
+    if (waits[i].queue != queue)
+      lanes[waits[i].queue]->batch->flush();
+    wait_queues.push_back(waits[i].queue);
+    semaphores.push_back(lanes[waits[i].queue]->semaphore);
+    values.push_back(waits[i].value);
+    stages.push_back(wait_stages[i]);
+  }
+
+  lane& l = *lanes[queue];
+  std::lock_guard<std::mutex> lock(l.mutex);
+  gpu_point point = {queue, ++l.value};
+  l.batch->enqueue(command_buffers, command_buffer_count,
+		   semaphores.data(), values.data(), stages.data(),
+		   static_cast<uint32_t>(semaphores.size()),
+		   &l.semaphore, &point.value, 1,
+		   fence);
+  return point;
+}
+
+gpu_point gpu_timeline::last(uint32_t queue) const
+{
+  lane& l = *lanes[queue];
+  std::lock_guard<std::mutex> lock(l.mutex);
+  return {queue, l.value};
+}
+
+uint64_t gpu_timeline::completed(uint32_t queue) const
+{
+  uint64_t value = 0;
+#ifdef VK_KHR_timeline_semaphore
+  get_counter_value(device, lanes[queue]->semaphore, &value);
+#else
+  (void)queue;
+#endif
+  return value;
+}
+
+bool gpu_timeline::reached(gpu_point point) const
+{
+  return point.value == 0 || completed(point.queue) >= point.value;
+}
+
+VkResult gpu_timeline::wait(gpu_point point, uint64_t timeout)
+{
+  return wait(&point, 1, false, timeout);
+}
+
+VkResult gpu_timeline::wait(const gpu_point* points,
+			    uint32_t point_count,
+			    bool any,
+			    uint64_t timeout)
+{
+  std::vector<VkSemaphore> semaphores;
+  std::vector<uint64_t> values;
+  for (uint32_t i = 0; i != point_count; i++) {
+    // Reached from the start; waiting for any is then already satisfied
+    if (points[i].value == 0) {
+      if (any)
+	return VK_SUCCESS;
+      continue;
+    }
+    lanes[points[i].queue]->batch->flush();
+    semaphores.push_back(lanes[points[i].queue]->semaphore);
+    values.push_back(points[i].value);
+  }
+  if (semaphores.empty())
+    return VK_SUCCESS;
+
+#ifdef VK_KHR_timeline_semaphore
+  VkSemaphoreWaitInfoKHR info = {};
+  info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+  info.pNext = nullptr;
+  info.flags = any ? VK_SEMAPHORE_WAIT_ANY_BIT_KHR : 0;
+  info.semaphoreCount = static_cast<uint32_t>(semaphores.size());
+  info.pSemaphores = semaphores.data();
+  info.pValues = values.data();
+  return wait_semaphores(device, &info, timeout);
+#else
+  (void)timeout;
+  return VK_ERROR_FEATURE_NOT_PRESENT;
+#endif
+}
+
+gpu_task_graph::task gpu_task_graph::add_task(uint32_t queue,
+					      const VkCommandBuffer*
+					      command_buffers,
+					      uint32_t command_buffer_count,
+					      VkFence fence)
+{
+  node n;
+  n.queue = queue;
+  n.command_buffers.assign(command_buffers,
+			   command_buffers + command_buffer_count);
+  n.fence = fence;
+  n.point = {queue, 0};
+  nodes.push_back(std::move(n));
+  return static_cast<task>(nodes.size() - 1);
+}
+
+void gpu_task_graph::depend(task t, task on, VkPipelineStageFlags stages)
+{
+  if (on >= t) {
+    std::cout << "Task " << t << " cannot depend on later task " << on
+	      << "..." << std::endl;
+    return;
+  }
+  nodes[t].dependencies.push_back({on, {0, 0}, stages});
+}
+
+void gpu_task_graph::depend(task t, gpu_point on, VkPipelineStageFlags stages)
+{
+  nodes[t].dependencies.push_back({EXTERNAL, on, stages});
+}
+
+void gpu_task_graph::submit(gpu_timeline& timeline)
+{
+  std::vector<gpu_point> waits;
+  std::vector<VkPipelineStageFlags> stages;
+  for (auto& n : nodes) {
+    waits.clear();
+    stages.clear();
+    for (auto& d : n.dependencies) {
+      waits.push_back(d.on == EXTERNAL ? d.point : nodes[d.on].point);
+      stages.push_back(d.stages);
+    }
+    n.point = timeline.submit(n.queue,
+			      n.command_buffers.data(),
+			      static_cast<uint32_t>(n.command_buffers.size()),
+			      waits.data(), stages.data(),
+			      static_cast<uint32_t>(waits.size()),
+			      n.fence);
+  }
+}
+
+gpu_point gpu_task_graph::point(task t) const
+{
+  return nodes[t].point;
+}
+
+void gpu_task_graph::clear()
+{
+  nodes.clear();
+}
+
+size_t gpu_task_graph::size() const
+{
+  return nodes.size();
+}
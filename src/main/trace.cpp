@@ -0,0 +1,242 @@
+#include "trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct trace_record {
+  const char* name;
+  uint64_t begin;
+  uint64_t end;
+};
+
+// Single producer (the owning thread), single consumer (the writer)
+struct trace_ring {
+  std::atomic<uint64_t> head;
+  std::atomic<uint64_t> tail;
+  uint32_t tid;
+  std::string thread_name;
+  trace_record records[TRACE_RING_SIZE];
+};
+
+struct gpu_record {
+  std::string name;
+  uint64_t begin;
+  uint64_t end;
+};
+
+static std::atomic<bool> active(false);
+static std::atomic<uint64_t> dropped(0);
+static uint64_t epoch = 0;
+
+// Guards the ring list and thread names; never taken when recording
+static std::mutex rings_mutex;
+static std::vector<std::unique_ptr<trace_ring>> rings;
+static thread_local trace_ring* local_ring = nullptr;
+
+static std::mutex gpu_mutex;
+static std::vector<gpu_record> gpu_records;
+
+static std::thread writer;
+static std::mutex writer_mutex;
+static std::condition_variable writer_cond;
+static bool stopping = false;
+static std::ofstream file;
+static bool first_event = true;
+
+static trace_ring* get_ring()
+{
+  if (local_ring == nullptr) {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    rings.emplace_back(new trace_ring());
+    local_ring = rings.back().get();
+    local_ring->head = 0;
+    local_ring->tail = 0;
+    local_ring->tid = rings.size();
+  }
+  return local_ring;
+}
+
+// Quotes, backslashes and control characters escaped for a JSON string
+static void write_string(const char* str)
+{
+  for (const char* c = str; *c != '\0'; c++) {
+    unsigned char ch = *c;
+    if (ch == '"' || ch == '\\')
+      file << '\\' << *c;
+    else if (ch < 0x20)
+      file << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+	   << (unsigned int)ch << std::dec << std::setfill(' ');
+    else
+      file << *c;
+  }
+}
+
+static void write_event(const char* name,
+			uint32_t tid,
+			uint64_t begin,
+			uint64_t end)
+{
+  file << (first_event ? "" : ",\n");
+  first_event = false;
+
+  file << "{\"name\":\"";
+  write_string(name);
+  file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+       << std::fixed << std::setprecision(3)
+       << ",\"ts\":" << (begin - epoch) / 1000.0
+       << ",\"dur\":" << (end - begin) / 1000.0 << "}";
+}
+
+static void write_thread_name(uint32_t tid, const std::string& name)
+{
+  file << (first_event ? "" : ",\n");
+  first_event = false;
+  file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+       << ",\"args\":{\"name\":\"";
+  write_string(name.c_str());
+  file << "\"}}";
+}
+
+// Writer thread only
+static void drain()
+{
+  std::vector<trace_ring*> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (auto& ring : rings)
+      snapshot.push_back(ring.get());
+  }
+
+  for (auto ring : snapshot) {
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+      const trace_record& rec = ring->records[tail % TRACE_RING_SIZE];
+      write_event(rec.name, ring->tid, rec.begin, rec.end);
+    }
+    ring->tail.store(tail, std::memory_order_release);
+  }
+
+  std::vector<gpu_record> gpu;
+  {
+    std::lock_guard<std::mutex> lock(gpu_mutex);
+    gpu.swap(gpu_records);
+  }
+  for (auto& rec : gpu)
+    write_event(rec.name.c_str(), 0, rec.begin, rec.end);
+}
+
+static void run()
+{
+  std::unique_lock<std::mutex> lock(writer_mutex);
+  while (!stopping) {
+    writer_cond.wait_for(lock, std::chrono::milliseconds(TRACE_FLUSH_MS));
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+}
+
+uint64_t trace_now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool trace_start(const std::string& filename)
+{
+  if (active)
+    return false;
+
+  file.open(filename);
+  if (!file.is_open())
+    return false;
+
+  file << "{\"traceEvents\":[\n";
+  first_event = true;
+  epoch = trace_now_ns();
+  dropped = 0;
+  stopping = false;
+  writer = std::thread(run);
+  active = true;
+  return true;
+}
+
+void trace_stop()
+{
+  if (!active)
+    return;
+
+  active = false;
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    stopping = true;
+  }
+  writer_cond.notify_one();
+  writer.join();
+
+  // Zones that were open when tracing stopped may still land; take them
+  drain();
+
+  write_thread_name(0, "GPU");
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (auto& ring : rings)
+      write_thread_name(ring->tid, ring->thread_name.empty() ?
+			"thread " + std::to_string(ring->tid) :
+			ring->thread_name);
+  }
+  file << "\n],\"otherData\":{\"dropped\":" << dropped.load() << "}}\n";
+  file.close();
+}
+
+void trace_thread_name(const char* name)
+{
+  trace_ring* ring = get_ring();
+  std::lock_guard<std::mutex> lock(rings_mutex);
+  ring->thread_name = name;
+}
+
+void trace_gpu_zone(const std::string& name,
+		    uint64_t begin_ns,
+		    uint64_t end_ns)
+{
+  if (!active || begin_ns < epoch || end_ns < begin_ns)
+    return;
+
+  std::lock_guard<std::mutex> lock(gpu_mutex);
+  gpu_records.push_back({name, begin_ns, end_ns});
+}
+
+trace_zone::trace_zone(const char* name)
+  : name(name),
+    begin(active.load(std::memory_order_relaxed) ? trace_now_ns() : 0)
+{
+}
+
+trace_zone::~trace_zone()
+{
+  if (begin == 0 || !active.load(std::memory_order_relaxed))
+    return;
+
+  uint64_t end = trace_now_ns();
+  trace_ring* ring = get_ring();
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->tail.load(std::memory_order_acquire) == TRACE_RING_SIZE) {
+    dropped++;
+    return;
+  }
+
+  trace_record& rec = ring->records[head % TRACE_RING_SIZE];
+  rec.name = name;
+  rec.begin = begin;
+  rec.end = end;
+  ring->head.store(head + 1, std::memory_order_release);
+}
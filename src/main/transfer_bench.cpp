@@ -0,0 +1,712 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+#include <vulkan/vulkan.h>
+
+#include "dispatch.hpp"
+
+#define APP_SHORT_NAME     "VultureTransferBench"
+#define ENGINE_SHORT_NAME  "Vulture"
+
+#define RESULT_FILE        "transfer_bench.json"
+
+// Sizes swept, multiplied by SIZE_STEP each time
+#define MIN_SIZE           (4ull << 10)
+#define MAX_SIZE           (1ull << 30)
+#define SIZE_STEP          4
+
+// Each measurement repeats the operation until about this many bytes
+// have moved (at least once, at most MAX_REPEATS times)
+#define TARGET_BYTES       (64ull << 20)
+#define MAX_REPEATS        64
+
+#define IMAGE_WIDTH        4096
+#define IMAGE_FORMAT       VK_FORMAT_R8G8B8A8_UNORM
+#define FILL_VALUE         0xdeadbeef
+
+#define HOST_VISIBLE(X)  ((X & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0)
+#define HOST_CACHED(X)   ((X & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0)
+#define DEVICE_LOCAL(X)  ((X & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0)
+#define LAZILY_ALLOCATED(X) \
+  ((X & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0)
+
+struct bench_queue {
+  uint32_t family;
+  VkQueueFlags flags;
+  VkQueue queue;
+  VkCommandPool command_pool;
+  VkCommandBuffer command_buffer;
+  VkQueryPool query_pool;
+  uint32_t timestamp_bits;
+  VkExtent3D granularity;
+};
+
+struct bench_buffer {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+};
+
+VkResult res;
+VkInstance inst;
+VkPhysicalDevice physical_device;
+VkPhysicalDeviceProperties device_props;
+VkPhysicalDeviceMemoryProperties mem_props;
+VkDevice device;
+VkFence fence;
+std::vector<bench_queue> queues;
+// Resets the query pools of queues that cannot (transfer only)
+bench_queue* reset_queue = nullptr;
+// Lets transfer-only queues fill buffers on a 1.0 device
+bool maintenance1 = false;
+std::ofstream results;
+bool first_result = true;
+
+void create_instance()
+{
+  VkApplicationInfo app_info = {};
+  app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  app_info.pNext = nullptr;
+  app_info.pApplicationName = APP_SHORT_NAME;
+  app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+  app_info.pEngineName = ENGINE_SHORT_NAME;
+  app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+  app_info.apiVersion = VK_API_VERSION_1_0;
+
+  VkInstanceCreateInfo inst_info = {};
+  inst_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  inst_info.pNext = nullptr;
+  inst_info.flags = 0;
+  inst_info.pApplicationInfo = &app_info;
+  inst_info.enabledLayerCount = 0;
+  inst_info.ppEnabledLayerNames = nullptr;
+  inst_info.enabledExtensionCount = 0;
+  inst_info.ppEnabledExtensionNames = nullptr;
+
+  res = vkCreateInstance(&inst_info, nullptr, &inst);
+  if (res != VK_SUCCESS)
+    std::cout << "Instance creation failed..." << std::endl;
+  else
+    load_instance_dispatch(inst);
+}
+
+// One queue from every family; all of them can transfer
+void create_device()
+{
+  uint32_t count = 1;
+  res = vkEnumeratePhysicalDevices(inst, &count, &physical_device);
+  if ((res != VK_SUCCESS && res != VK_INCOMPLETE) || count == 0) {
+    std::cout << "Failed to find a physical device..." << std::endl;
+    res = VK_ERROR_INITIALIZATION_FAILED;
+    return;
+  }
+  vkGetPhysicalDeviceProperties(physical_device, &device_props);
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
+  std::cout << "Physical Device: " << device_props.deviceName << std::endl;
+
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(count);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count,
+					   families.data());
+
+  float priority = 1.0f;
+  std::vector<VkDeviceQueueCreateInfo> queue_infos;
+  for (uint32_t i = 0; i != count; i++) {
+    if ((families[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT
+				   | VK_QUEUE_COMPUTE_BIT
+				   | VK_QUEUE_TRANSFER_BIT)) == 0)
+      continue;
+
+    VkDeviceQueueCreateInfo queue_info = {};
+    queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue_info.pNext = nullptr;
+    queue_info.flags = 0;
+    queue_info.queueFamilyIndex = i;
+    queue_info.queueCount = 1;
+    queue_info.pQueuePriorities = &priority;
+    queue_infos.push_back(queue_info);
+
+    bench_queue q = {};
+    q.family = i;
+    q.flags = families[i].queueFlags;
+    q.timestamp_bits = families[i].timestampValidBits;
+    q.granularity = families[i].minImageTransferGranularity;
+    queues.push_back(q);
+  }
+
+  std::vector<const char*> extensions;
+  uint32_t ext_count = 0;
+  vkEnumerateDeviceExtensionProperties(physical_device, nullptr,
+				       &ext_count, nullptr);
+  std::vector<VkExtensionProperties> ext_props(ext_count);
+  vkEnumerateDeviceExtensionProperties(physical_device, nullptr,
+				       &ext_count, ext_props.data());
+  for (auto& extension : ext_props)
+    if (strcmp(extension.extensionName, "VK_KHR_maintenance1") == 0) {
+      extensions.push_back("VK_KHR_maintenance1");
+      maintenance1 = true;
+    }
+
+  VkDeviceCreateInfo device_info = {};
+  device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  device_info.pNext = nullptr;
+  device_info.flags = 0;
+  device_info.queueCreateInfoCount = static_cast<uint32_t>(queue_infos.size());
+  device_info.pQueueCreateInfos = queue_infos.data();
+  device_info.enabledLayerCount = 0;
+  device_info.ppEnabledLayerNames = nullptr;
+  device_info.enabledExtensionCount =
+    static_cast<uint32_t>(extensions.size());
+  device_info.ppEnabledExtensionNames = extensions.data();
+  device_info.pEnabledFeatures = nullptr;
+
+  res = vkCreateDevice(physical_device, &device_info, nullptr, &device);
+  if (res != VK_SUCCESS)
+    std::cout << "Failed to create device..." << std::endl;
+  else
+    load_device_dispatch(device);
+}
+
+bool graphics_or_compute(const bench_queue& q)
+{
+  return (q.flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) != 0;
+}
+
+// vkCmdResetQueryPool is only valid on graphics and compute queues, so a
+// transfer-only queue's pool is reset by a submission to another queue,
+// finished before the pool is used
+bool reset_queries(const bench_queue& q)
+{
+  if (reset_queue == nullptr)
+    return false;
+  VkCommandBuffer cmd = reset_queue->command_buffer;
+  vkd.vkResetCommandBuffer(cmd, 0);
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  begin_info.pInheritanceInfo = nullptr;
+  vkd.vkBeginCommandBuffer(cmd, &begin_info);
+  vkd.vkCmdResetQueryPool(cmd, q.query_pool, 0, 2);
+  vkd.vkEndCommandBuffer(cmd);
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = nullptr;
+  submit_info.waitSemaphoreCount = 0;
+  submit_info.pWaitSemaphores = nullptr;
+  submit_info.pWaitDstStageMask = nullptr;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &cmd;
+  submit_info.signalSemaphoreCount = 0;
+  submit_info.pSignalSemaphores = nullptr;
+  vkd.vkResetFences(device, 1, &fence);
+  if (vkd.vkQueueSubmit(reset_queue->queue, 1, &submit_info, fence)
+      != VK_SUCCESS)
+    return false;
+  vkd.vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+  return true;
+}
+
+void create_queue_resources()
+{
+  VkFenceCreateInfo fence_info = {};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fence_info.pNext = nullptr;
+  fence_info.flags = 0;
+  vkCreateFence(device, &fence_info, nullptr, &fence);
+
+  for (auto& q : queues) {
+    vkGetDeviceQueue(device, q.family, 0, &q.queue);
+
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex = q.family;
+    vkCreateCommandPool(device, &pool_info, nullptr, &q.command_pool);
+
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.pNext = nullptr;
+    alloc_info.commandPool = q.command_pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = 1;
+    vkAllocateCommandBuffers(device, &alloc_info, &q.command_buffer);
+
+    q.query_pool = VK_NULL_HANDLE;
+    if (q.timestamp_bits == 0) {
+      std::cout << "Queue family " << q.family
+		<< " has no timestamps, skipping it..." << std::endl;
+      continue;
+    }
+    VkQueryPoolCreateInfo query_info = {};
+    query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_info.pNext = nullptr;
+    query_info.flags = 0;
+    query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_info.queryCount = 2;
+    query_info.pipelineStatistics = 0;
+    vkCreateQueryPool(device, &query_info, nullptr, &q.query_pool);
+  }
+
+  for (auto& q : queues)
+    if (graphics_or_compute(q)) {
+      reset_queue = &q;
+      break;
+    }
+}
+
+void destroy_queue_resources()
+{
+  for (auto& q : queues) {
+    if (q.query_pool != VK_NULL_HANDLE)
+      vkDestroyQueryPool(device, q.query_pool, nullptr);
+    vkFreeCommandBuffers(device, q.command_pool, 1, &q.command_buffer);
+    vkDestroyCommandPool(device, q.command_pool, nullptr);
+  }
+  vkDestroyFence(device, fence, nullptr);
+}
+
+bool create_bench_buffer(VkDeviceSize size, uint32_t type, bench_buffer& buf)
+{
+  buf.buffer = VK_NULL_HANDLE;
+  buf.memory = VK_NULL_HANDLE;
+
+  VkBufferCreateInfo buf_info = {};
+  buf_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buf_info.pNext = nullptr;
+  buf_info.flags = 0;
+  buf_info.size = size;
+  buf_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+    | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buf_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  buf_info.queueFamilyIndexCount = 0;
+  buf_info.pQueueFamilyIndices = nullptr;
+  if (vkCreateBuffer(device, &buf_info, nullptr, &buf.buffer) != VK_SUCCESS)
+    return false;
+
+  VkMemoryRequirements reqs;
+  vkGetBufferMemoryRequirements(device, buf.buffer, &reqs);
+  VkMemoryAllocateInfo mem_info = {};
+  mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  mem_info.pNext = nullptr;
+  mem_info.allocationSize = reqs.size;
+  mem_info.memoryTypeIndex = type;
+  if ((reqs.memoryTypeBits & (1u << type)) == 0
+      || vkAllocateMemory(device, &mem_info, nullptr, &buf.memory)
+      != VK_SUCCESS)
+    return false;
+  return vkBindBufferMemory(device, buf.buffer, buf.memory, 0) == VK_SUCCESS;
+}
+
+void destroy_bench_buffer(bench_buffer& buf)
+{
+  vkDestroyBuffer(device, buf.buffer, nullptr);
+  vkFreeMemory(device, buf.memory, nullptr);
+}
+
+uint32_t find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags flags,
+			  VkMemoryPropertyFlags avoid)
+{
+  for (uint32_t i = 0; i != mem_props.memoryTypeCount; i++) {
+    VkMemoryPropertyFlags props = mem_props.memoryTypes[i].propertyFlags;
+    if ((type_bits & (1u << i)) != 0 && (props & flags) == flags
+	&& (props & avoid) == 0)
+      return i;
+  }
+  return UINT32_MAX;
+}
+
+// Quotes, backslashes and control characters escaped for a JSON string
+std::string json_string(const char* str)
+{
+  std::ostringstream out;
+  for (const char* c = str; *c != '\0'; c++) {
+    unsigned char ch = *c;
+    if (ch == '"' || ch == '\\')
+      out << '\\' << *c;
+    else if (ch < 0x20)
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+	  << (unsigned int)ch << std::dec;
+    else
+      out << *c;
+  }
+  return out.str();
+}
+
+std::string memory_flags(uint32_t type)
+{
+  VkMemoryPropertyFlags props = mem_props.memoryTypes[type].propertyFlags;
+  std::string flags;
+  if (DEVICE_LOCAL(props))
+    flags += "device_local ";
+  if (HOST_VISIBLE(props))
+    flags += "host_visible ";
+  if ((props & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0)
+    flags += "host_coherent ";
+  if (HOST_CACHED(props))
+    flags += "host_cached ";
+  if (!flags.empty())
+    flags.pop_back();
+  return flags;
+}
+
+// Records work repeats times between two timestamps; returns GPU
+// milliseconds, or a negative value on failure. Every repeat writes the
+// same memory, so each waits for the transfer writes of the one before.
+double time_on_queue(bench_queue& q,
+		     uint32_t repeats,
+		     const std::function<void(VkCommandBuffer)>& prepare,
+		     const std::function<void(VkCommandBuffer)>& work)
+{
+  if (!graphics_or_compute(q) && !reset_queries(q))
+    return -1.0;
+
+  VkCommandBuffer cmd = q.command_buffer;
+  vkd.vkResetCommandBuffer(cmd, 0);
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  begin_info.pInheritanceInfo = nullptr;
+  vkd.vkBeginCommandBuffer(cmd, &begin_info);
+  if (graphics_or_compute(q))
+    vkd.vkCmdResetQueryPool(cmd, q.query_pool, 0, 2);
+  if (prepare)
+    prepare(cmd);
+  vkd.vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			  q.query_pool, 0);
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+    | VK_ACCESS_TRANSFER_WRITE_BIT;
+  for (uint32_t i = 0; i != repeats; i++) {
+    if (i != 0)
+      vkd.vkCmdPipelineBarrier(cmd,
+			       VK_PIPELINE_STAGE_TRANSFER_BIT,
+			       VK_PIPELINE_STAGE_TRANSFER_BIT,
+			       0,
+			       1, &barrier,
+			       0, nullptr,
+			       0, nullptr);
+    work(cmd);
+  }
+  vkd.vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			  q.query_pool, 1);
+  vkd.vkEndCommandBuffer(cmd);
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = nullptr;
+  submit_info.waitSemaphoreCount = 0;
+  submit_info.pWaitSemaphores = nullptr;
+  submit_info.pWaitDstStageMask = nullptr;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &cmd;
+  submit_info.signalSemaphoreCount = 0;
+  submit_info.pSignalSemaphores = nullptr;
+  vkd.vkResetFences(device, 1, &fence);
+  if (vkd.vkQueueSubmit(q.queue, 1, &submit_info, fence) != VK_SUCCESS)
+    return -1.0;
+  vkd.vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+
+  uint64_t stamps[2];
+  res = vkd.vkGetQueryPoolResults(device, q.query_pool, 0, 2, sizeof(stamps),
+				  stamps, sizeof(uint64_t),
+				  VK_QUERY_RESULT_64_BIT
+				  | VK_QUERY_RESULT_WAIT_BIT);
+  if (res != VK_SUCCESS)
+    return -1.0;
+
+  uint64_t mask = q.timestamp_bits >= 64 ? UINT64_MAX
+    : ((uint64_t)1 << q.timestamp_bits) - 1;
+  uint64_t ticks = ((stamps[1] & mask) - (stamps[0] & mask)) & mask;
+  return ticks * device_props.limits.timestampPeriod / 1e6;
+}
+
+void report(const char* op, const bench_queue& q, uint32_t src_type,
+	    uint32_t dst_type, VkDeviceSize size, uint32_t repeats,
+	    double ms)
+{
+  if (ms <= 0.0)
+    return;
+  double gbps = static_cast<double>(size) * repeats / (ms / 1e3) / 1e9;
+
+  std::cout << std::left << std::setw(10) << op << std::right
+	    << " family " << q.family << ", " << std::setw(2) << src_type
+	    << " -> " << std::setw(2) << dst_type << ", "
+	    << std::setw(11) << size << " bytes: "
+	    << std::fixed << std::setprecision(2) << gbps << " GB/s"
+	    << std::endl;
+
+  results << (first_result ? "" : ",\n")
+	  << "    {\"op\":\"" << op << "\",\"queue_family\":" << q.family
+	  << ",\"src_memory_type\":";
+  if (src_type == UINT32_MAX)
+    results << "null,\"src_memory\":\"\"";
+  else
+    results << src_type << ",\"src_memory\":\"" << memory_flags(src_type)
+	    << "\"";
+  results << ",\"dst_memory_type\":";
+  if (dst_type == UINT32_MAX)
+    results << "null,\"dst_memory\":\"image\"";
+  else
+    results << dst_type << ",\"dst_memory\":\"" << memory_flags(dst_type)
+	    << "\"";
+  results << ",\"bytes\":" << size << ",\"repeats\":" << repeats
+	  << std::setprecision(6) << ",\"ms\":" << ms
+	  << ",\"gbps\":" << gbps << "}";
+  first_result = false;
+}
+
+bool image_fits(const bench_queue& q, uint32_t width, uint32_t height)
+{
+  // Transfer-only queues may only copy whole granules
+  if (q.granularity.width == 0 || q.granularity.height == 0)
+    return false;
+  return width % q.granularity.width == 0
+    && height % q.granularity.height == 0
+    && width <= device_props.limits.maxImageDimension2D
+    && height <= device_props.limits.maxImageDimension2D;
+}
+
+void bench_image(bench_queue& q, uint32_t src_type, const bench_buffer& src,
+		 VkDeviceSize size, uint32_t repeats)
+{
+  uint32_t texels = static_cast<uint32_t>(size / 4);
+  uint32_t width = std::min<uint32_t>(texels, IMAGE_WIDTH);
+  uint32_t height = texels / width;
+  if (!image_fits(q, width, height))
+    return;
+
+  VkImageCreateInfo image_info = {};
+  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_info.pNext = nullptr;
+  image_info.flags = 0;
+  image_info.imageType = VK_IMAGE_TYPE_2D;
+  image_info.format = IMAGE_FORMAT;
+  image_info.extent = {width, height, 1};
+  image_info.mipLevels = 1;
+  image_info.arrayLayers = 1;
+  image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  image_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  image_info.queueFamilyIndexCount = 0;
+  image_info.pQueueFamilyIndices = nullptr;
+  image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VkImage image;
+  if (vkCreateImage(device, &image_info, nullptr, &image) != VK_SUCCESS)
+    return;
+
+  VkMemoryRequirements reqs;
+  vkGetImageMemoryRequirements(device, image, &reqs);
+  VkMemoryAllocateInfo mem_info = {};
+  mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  mem_info.pNext = nullptr;
+  mem_info.allocationSize = reqs.size;
+  mem_info.memoryTypeIndex =
+    find_memory_type(reqs.memoryTypeBits,
+		     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+  VkDeviceMemory memory;
+  if (mem_info.memoryTypeIndex == UINT32_MAX
+      || vkAllocateMemory(device, &mem_info, nullptr, &memory)
+      != VK_SUCCESS) {
+    vkDestroyImage(device, image, nullptr);
+    return;
+  }
+  vkBindImageMemory(device, image, memory, 0);
+
+  VkBufferImageCopy region = {};
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = {0, 0, 0};
+  region.imageExtent = {width, height, 1};
+
+  double ms = time_on_queue(q, repeats,
+			    [&](VkCommandBuffer cmd) {
+			      VkImageMemoryBarrier barrier = {};
+			      barrier.sType =
+				VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			      barrier.pNext = nullptr;
+			      barrier.srcAccessMask = 0;
+			      barrier.dstAccessMask =
+				VK_ACCESS_TRANSFER_WRITE_BIT;
+			      barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			      barrier.newLayout =
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			      barrier.srcQueueFamilyIndex =
+				VK_QUEUE_FAMILY_IGNORED;
+			      barrier.dstQueueFamilyIndex =
+				VK_QUEUE_FAMILY_IGNORED;
+			      barrier.image = image;
+			      barrier.subresourceRange = {
+				VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+			      vkd.vkCmdPipelineBarrier(cmd,
+						       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+						       VK_PIPELINE_STAGE_TRANSFER_BIT,
+						       0, 0, nullptr, 0, nullptr,
+						       1, &barrier);
+			    },
+			    [&](VkCommandBuffer cmd) {
+			      vkd.vkCmdCopyBufferToImage(cmd, src.buffer, image,
+							 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+							 1, &region);
+			    });
+  report("image", q, src_type, UINT32_MAX,
+	 static_cast<VkDeviceSize>(width) * height * 4, repeats, ms);
+
+  vkDestroyImage(device, image, nullptr);
+  vkFreeMemory(device, memory, nullptr);
+}
+
+// Every operation with memory of the given type at the given size
+void bench_memory_type(uint32_t type, VkDeviceSize size,
+		       uint32_t upload_type, uint32_t download_type)
+{
+  bench_buffer a, b;
+  bool ok = create_bench_buffer(size, type, a);
+  ok = create_bench_buffer(size, type, b) && ok;
+  if (!ok) {
+    std::cout << "Could not allocate 2 x " << size << " bytes of memory type "
+	      << type << ", skipping..." << std::endl;
+    destroy_bench_buffer(a);
+    destroy_bench_buffer(b);
+    return;
+  }
+
+  bench_buffer upload = {}, download = {};
+  bool have_upload = upload_type != UINT32_MAX && upload_type != type
+    && create_bench_buffer(size, upload_type, upload);
+  bool have_download = download_type != UINT32_MAX && download_type != type
+    && create_bench_buffer(size, download_type, download);
+
+  uint32_t repeats = static_cast<uint32_t>(
+    std::max<VkDeviceSize>(1, std::min<VkDeviceSize>(MAX_REPEATS,
+						     TARGET_BYTES / size)));
+  VkBufferCopy region = {0, 0, size};
+
+  for (auto& q : queues) {
+    if (q.query_pool == VK_NULL_HANDLE)
+      continue;
+
+    // Transfer-only queues can only fill with VK_KHR_maintenance1
+    if (graphics_or_compute(q) || maintenance1)
+      report("fill", q, UINT32_MAX, type, size, repeats,
+	     time_on_queue(q, repeats, nullptr, [&](VkCommandBuffer cmd) {
+		 vkd.vkCmdFillBuffer(cmd, a.buffer, 0, size, FILL_VALUE);
+	       }));
+    report("copy", q, type, type, size, repeats,
+	   time_on_queue(q, repeats, nullptr, [&](VkCommandBuffer cmd) {
+	       vkd.vkCmdCopyBuffer(cmd, a.buffer, b.buffer, 1, &region);
+	     }));
+    if (have_upload)
+      report("upload", q, upload_type, type, size, repeats,
+	     time_on_queue(q, repeats, nullptr, [&](VkCommandBuffer cmd) {
+		 vkd.vkCmdCopyBuffer(cmd, upload.buffer, a.buffer, 1, &region);
+	       }));
+    if (have_download)
+      report("download", q, type, download_type, size, repeats,
+	     time_on_queue(q, repeats, nullptr, [&](VkCommandBuffer cmd) {
+		 vkd.vkCmdCopyBuffer(cmd, a.buffer, download.buffer, 1, &region);
+	       }));
+    bench_image(q, type, a, size, repeats);
+  }
+
+  if (upload.buffer != VK_NULL_HANDLE)
+    destroy_bench_buffer(upload);
+  if (download.buffer != VK_NULL_HANDLE)
+    destroy_bench_buffer(download);
+  destroy_bench_buffer(a);
+  destroy_bench_buffer(b);
+}
+
+int main(int argc, const char* argv[])
+{
+  const char* filename = argc > 1 ? argv[1] : RESULT_FILE;
+
+  create_instance();
+  if (res != VK_SUCCESS)
+    return 1;
+  create_device();
+  if (res != VK_SUCCESS)
+    return 1;
+  create_queue_resources();
+
+  // Buffers of every type that can back a transfer buffer
+  bench_buffer probe;
+  uint32_t type_bits = 0;
+  create_bench_buffer(MIN_SIZE, 0, probe);
+  if (probe.buffer != VK_NULL_HANDLE) {
+    VkMemoryRequirements reqs;
+    vkGetBufferMemoryRequirements(device, probe.buffer, &reqs);
+    type_bits = reqs.memoryTypeBits;
+  }
+  destroy_bench_buffer(probe);
+
+  // Staging for uploads avoids device local (BAR) memory when possible;
+  // downloads want cached memory
+  uint32_t upload_type =
+    find_memory_type(type_bits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  if (upload_type == UINT32_MAX)
+    upload_type = find_memory_type(type_bits,
+				   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, 0);
+  uint32_t download_type =
+    find_memory_type(type_bits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+		     | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 0);
+  if (download_type == UINT32_MAX)
+    download_type = upload_type;
+
+  results.open(filename);
+  if (!results.is_open()) {
+    std::cout << "Failed to open " << filename << "..." << std::endl;
+    return 1;
+  }
+  results << "{\n  \"device\":\""
+	  << json_string(device_props.deviceName) << "\",\n"
+	  << "  \"upload_memory_type\":" << upload_type << ",\n"
+	  << "  \"download_memory_type\":" << download_type << ",\n"
+	  << "  \"results\":[\n";
+
+  for (uint32_t type = 0; type != mem_props.memoryTypeCount; type++) {
+    VkMemoryType& mem_type = mem_props.memoryTypes[type];
+    if ((type_bits & (1u << type)) == 0
+	|| LAZILY_ALLOCATED(mem_type.propertyFlags))
+      continue;
+
+    // Leave room for the second buffer, staging and everyone else
+    VkDeviceSize heap_size = mem_props.memoryHeaps[mem_type.heapIndex].size;
+    std::cout << "Memory type " << type << " (" << memory_flags(type)
+	      << ")..." << std::endl;
+    for (VkDeviceSize size = MIN_SIZE; size <= MAX_SIZE; size *= SIZE_STEP)
+      if (4 * size <= heap_size)
+	bench_memory_type(type, size, upload_type, download_type);
+  }
+
+  results << "\n  ]\n}\n";
+  results.close();
+  std::cout << "Wrote results to " << filename << "!" << std::endl;
+
+  vkDeviceWaitIdle(device);
+  destroy_queue_resources();
+  vkDestroyDevice(device, nullptr);
+  vkDestroyInstance(inst, nullptr);
+  return 0;
+}
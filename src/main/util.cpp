@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <cstring>
+#include <string>
 
 bool supported_surface_present_mode(VkPresentModeKHR mode,
 				    const std::vector<VkPresentModeKHR>& modes)
@@ -33,6 +34,12 @@ bool supports_mem_reqs(unsigned int memory_type_idx,
   return true;
 }
 
+// Prints up to the first NUL, as the buffers hold text
+static void print_str(const char* str, VkDeviceSize size)
+{
+  std::cout << std::string(str, strnlen(str, size)) << std::endl;
+}
+
 void print_mem(VkDevice device,
 	       VkDeviceMemory memory,
 	       std::mutex& mem_mutex,
@@ -44,36 +51,58 @@ void print_mem(VkDevice device,
   VkResult res = vkMapMemory(device,
 			     memory,
 			     offset,
-			     size+1,
+			     size,
 			     0,
 			     &data);
-  if (res != VK_SUCCESS)
+  if (res != VK_SUCCESS) {
     std::cout << "Failed to print memory (Offset=" << offset
 	      << ",Size=" << size << ")..." << std::endl;
-  char* str = static_cast<char*>(data);
-  str[size] = '\0';
-  std::cout << str << std::endl;
+    return;
+  }
+  print_str(static_cast<const char*>(data), size);
   vkUnmapMemory(device, memory);
 }
 
+void print_mem(const char* data, VkDeviceSize size)
+{
+  print_str(data, size);
+}
+
 void print_all_buffers(VkDevice device,
 		       VkDeviceMemory memory,
 		       std::mutex& mem_mutex,
 		       VkDeviceSize offset,
 		       VkDeviceSize length,
-		       const std::vector<VkMemoryRequirements>& buf_mem_reqs)
+		       const std::vector<VkDeviceSize>& buf_offsets)
 {
-  VkDeviceSize cur_offset = offset;
-  for (unsigned int i = 0; i != buf_mem_reqs.size(); i++) {
+  if (buf_offsets.empty())
+    return;
+
+  // One mapping covering every buffer's range rather than one per buffer
+  VkDeviceSize first_offset = buf_offsets.front() + offset;
+  VkDeviceSize last_offset = buf_offsets.back() + offset;
+
+  std::lock_guard<std::mutex> lock(mem_mutex);
+  void* data;
+  VkResult res = vkMapMemory(device,
+			     memory,
+			     first_offset,
+			     last_offset + length - first_offset,
+			     0,
+			     &data);
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to print buffers (Offset=" << offset
+	      << ",Size=" << length << ")..." << std::endl;
+    return;
+  }
+
+  const char* str = static_cast<const char*>(data);
+  for (unsigned int i = 0; i != buf_offsets.size(); i++) {
     std::cout << "Buffer " << i << " (offset=" << offset << ", len="
 	      << length << "): ";
-    print_mem(device,
-	      memory,
-	      mem_mutex,
-	      cur_offset,
-	      length);
-    cur_offset += buf_mem_reqs[i].size;
+    print_str(str + buf_offsets[i] - buf_offsets.front(), length);
   }
+  vkUnmapMemory(device, memory);
 }
 
 uint32_t make_data(const char* str)
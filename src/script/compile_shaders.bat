@@ -14,10 +14,19 @@ FOR %%F IN (*.comp) DO (
     COPY "%%F" "%%F.tmp"
     ECHO #version %GLSL_VERSION% core > "%%F"
     ECHO #define BUFFER_COUNT %BUF_COUNT% >> "%%F"
+    ECHO #define INSTANCE_COUNT %INST_COUNT% >> "%%F"
     TYPE "%%F.tmp" >> "%%F"
     %SHADER_COMPILER% -V "%%F" -o "%%F.spv"
     MOVE "%%F.tmp" "%%F"
 )
+FOR %%F IN (prim_*.comp) DO (
+    COPY "%%F" "%%F.tmp"
+    ECHO #version %GLSL_VERSION% core > "%%F"
+    ECHO #define BUFFER_COUNT %BUF_COUNT% >> "%%F"
+    TYPE "%%F.tmp" >> "%%F"
+    %SHADER_COMPILER% -V --target-env vulkan1.1 -DSUBGROUPS "%%F" -o "%%~nF.subgroup.comp.spv"
+    MOVE "%%F.tmp" "%%F"
+)
 FOR %%F IN (*.vert) DO (
     COPY "%%F" "%%F.tmp"
     ECHO #version %GLSL_VERSION% core > "%%F"
@@ -15,6 +15,7 @@ for filename in ${SHADER_SOURCE_DIR}/*.comp; do
     cp ${filename} ${TMP_FILE}
     echo "#version ${GLSL_VERSION} core" > ${filename}
     echo "#define BUFFER_COUNT ${BUF_COUNT}" >> ${filename}
+    echo "#define INSTANCE_COUNT ${INST_COUNT}" >> ${filename}
     cat ${TMP_FILE} >> ${filename}
 
     SPV_FILE="${filename}.spv"
@@ -22,6 +23,19 @@ for filename in ${SHADER_SOURCE_DIR}/*.comp; do
     mv ${TMP_FILE} ${filename}
 done
 
+# Parallel primitives get a second variant using subgroup operations
+for filename in ${SHADER_SOURCE_DIR}/prim_*.comp; do
+    TMP_FILE="${filename}.tmp"
+    cp ${filename} ${TMP_FILE}
+    echo "#version ${GLSL_VERSION} core" > ${filename}
+    echo "#define BUFFER_COUNT ${BUF_COUNT}" >> ${filename}
+    cat ${TMP_FILE} >> ${filename}
+
+    SPV_FILE="${filename%.comp}.subgroup.comp.spv"
+    $2 -V --target-env vulkan1.1 -DSUBGROUPS "${filename}" -o "${SPV_FILE}"
+    mv ${TMP_FILE} ${filename}
+done
+
 for filename in ${SHADER_SOURCE_DIR}/*.vert; do
     TMP_FILE="${filename}.tmp"
     cp ${filename} ${TMP_FILE}
@@ -0,0 +1,99 @@
+// Shared by the prim_*.comp kernels. The build compiles each of them twice:
+// plainly, and with SUBGROUPS defined against Vulkan 1.1.
+
+#ifdef SUBGROUPS
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+#endif
+
+#define WG_SIZE 256
+// Elements per invocation for scan and reduce
+#define ITEMS   4
+#define BLOCK   (WG_SIZE * ITEMS)
+
+layout (local_size_x = WG_SIZE) in;
+
+// Header written by compute_engine, then four kernel specific words
+layout (push_constant) uniform push_constants_t
+{
+	uvec4 offset;
+	uvec4 size;
+	uint n;
+	uint a;
+	uint b;
+	uint c;
+} pc;
+
+shared uint wg_scratch[2 * WG_SIZE];
+
+uint group_id()
+{
+	return gl_WorkGroupID.x + pc.offset.x / WG_SIZE;
+}
+
+// Exclusive prefix sum of v over the workgroup, total set to the sum of
+// all v. Every invocation of the workgroup must call it.
+uint workgroup_scan(uint v, out uint total)
+{
+#ifdef SUBGROUPS
+	uint incl = subgroupInclusiveAdd(v);
+	if (gl_SubgroupInvocationID == gl_SubgroupSize - 1)
+		wg_scratch[gl_SubgroupID] = incl;
+	barrier();
+
+	uint prefix = 0;
+	total = 0;
+	for (uint i = 0; i != gl_NumSubgroups; i++) {
+		if (i < gl_SubgroupID)
+			prefix += wg_scratch[i];
+		total += wg_scratch[i];
+	}
+	barrier();
+	return prefix + incl - v;
+#else
+	uint id = gl_LocalInvocationID.x;
+	uint src = 0;
+	wg_scratch[id] = v;
+	barrier();
+	for (uint off = 1; off < WG_SIZE; off <<= 1) {
+		uint x = wg_scratch[src * WG_SIZE + id];
+		if (id >= off)
+			x += wg_scratch[src * WG_SIZE + id - off];
+		wg_scratch[(1 - src) * WG_SIZE + id] = x;
+		src = 1 - src;
+		barrier();
+	}
+	total = wg_scratch[src * WG_SIZE + WG_SIZE - 1];
+	uint incl = wg_scratch[src * WG_SIZE + id];
+	barrier();
+	return incl - v;
+#endif
+}
+
+uint workgroup_reduce(uint v)
+{
+#ifdef SUBGROUPS
+	uint sum = subgroupAdd(v);
+	if (subgroupElect())
+		wg_scratch[gl_SubgroupID] = sum;
+	barrier();
+
+	uint total = 0;
+	for (uint i = 0; i != gl_NumSubgroups; i++)
+		total += wg_scratch[i];
+	barrier();
+	return total;
+#else
+	uint id = gl_LocalInvocationID.x;
+	wg_scratch[id] = v;
+	barrier();
+	for (uint half_size = WG_SIZE / 2; half_size != 0; half_size >>= 1) {
+		if (id < half_size)
+			wg_scratch[id] += wg_scratch[id + half_size];
+		barrier();
+	}
+	uint total = wg_scratch[0];
+	barrier();
+	return total;
+#endif
+}
@@ -2,10 +2,13 @@
 #extension GL_ARB_shading_language_420pack : enable
 
 layout (location = 0) in vec4 in_Color;
+layout (location = 1) in vec2 in_Texcoord;
+
+layout (binding = 1) uniform sampler2D tex;
 
 layout (location = 0) out vec4 out_Color;
 
 void main()
 {
-	out_Color = in_Color;
+	out_Color = in_Color * texture(tex, in_Texcoord);
 }
\ No newline at end of file
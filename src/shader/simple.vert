@@ -7,6 +7,7 @@ layout (location = 2) in vec3 normal;
 layout (location = 3) in vec2 texcoord;
 
 layout (location = 0) out vec4 out_color;
+layout (location = 1) out vec2 out_texcoord;
 
 layout (binding = 0) uniform UBO 
 {
@@ -23,6 +24,7 @@ out gl_PerVertex
 void main(void)
 {
 	out_color = in_color;
+	out_texcoord = texcoord;
 	gl_Position = ubo.projectionMatrix * ubo.viewMatrix * ubo.modelMatrix[gl_InstanceIndex] * position;
 }
 